@@ -0,0 +1,429 @@
+#include "khmer.hh"
+#include "alloc.hh"
+#include "chunkedgz.hh"		// for SavedFileError
+#include "thread_utils.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <new>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define HUGE_PAGE_BYTES (2 * 1024 * 1024)
+#define NODE_DIR "/sys/devices/system/node"
+#define MAX_NUMA_NODES 1024
+#define _MPOL_INTERLEAVE 3		// from linux/mempolicy.h
+
+using namespace std;
+using namespace khmer;
+
+static unsigned int _alloc_policy = 0;
+
+#define MAX_CLEAR_THREADS 8
+
+// marks map_table() mappings; not one of the ALLOC_* flags.
+#define _MAPPED_FILE (1 << 16)
+
+// what we mapped for each table, so free_table() can undo it.
+namespace khmer {
+  struct _TableMapping {
+    Byte * mapping;
+    size_t mapped_len;
+    size_t table_len;
+    unsigned int policy;
+  };
+}
+
+static Mutex _mappings_lock;
+static map<Byte *, _TableMapping> _mappings;
+
+static _TableMapping _find_mapping(Byte * table)
+{
+  ScopedLock lock(_mappings_lock);
+  map<Byte *, _TableMapping>::iterator it = _mappings.find(table);
+  assert(it != _mappings.end());
+
+  return it->second;
+}
+
+void khmer::set_alloc_policy(unsigned int policy)
+{
+  _alloc_policy = policy;
+}
+
+unsigned int khmer::get_alloc_policy()
+{
+  return _alloc_policy;
+}
+
+// read a sysfs list like "0-3,8,10-11".
+static vector<unsigned int> _read_id_list(const string &path)
+{
+  vector<unsigned int> ids;
+  ifstream infile(path.c_str());
+  string line;
+
+  if (!infile.is_open() || !getline(infile, line)) {
+    return ids;
+  }
+
+  const char * p = line.c_str();
+  while (*p) {
+    char * end;
+    unsigned long lo = strtoul(p, &end, 10), hi = lo;
+    if (end == p) {
+      break;
+    }
+    p = end;
+    if (*p == '-') {
+      hi = strtoul(p + 1, &end, 10);
+      p = end;
+    }
+    for (unsigned long i = lo; i <= hi; i++) {
+      ids.push_back(i);
+    }
+    if (*p != ',') {
+      break;
+    }
+    p++;
+  }
+
+  return ids;
+}
+
+static vector<unsigned int> _numa_nodes()
+{
+  return _read_id_list(NODE_DIR "/online");
+}
+
+//
+// _interleave: spread the (not yet faulted-in) pages across all nodes.
+//
+
+static void _interleave(void * table, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+  vector<unsigned int> nodes = _numa_nodes();
+  if (nodes.size() < 2) {
+    return;
+  }
+
+  unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof(mask));
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    if (nodes[i] < MAX_NUMA_NODES) {
+      mask[nodes[i] / (8 * sizeof(unsigned long))] |=
+	1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+    }
+  }
+
+  // best effort; without it we just get the default placement.
+  syscall(SYS_mbind, table, len, _MPOL_INTERLEAVE, mask,
+	  MAX_NUMA_NODES, 0);
+#endif
+}
+
+//
+// _first_touch: zero the table from one thread per node, each pinned to
+//     its node and touching every n_nodes'th huge page, so that the
+//     kernel's first-touch placement spreads it across nodes.
+//
+
+namespace khmer {
+  struct _TouchState {
+    Byte * table;
+    size_t len;
+    unsigned int node_index, n_nodes;
+    vector<unsigned int> cpus;
+  };
+}
+
+static void * _touch_pages(void * arg)
+{
+  _TouchState * state = (_TouchState *) arg;
+
+#ifdef __linux__
+  if (!state->cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (unsigned int i = 0; i < state->cpus.size(); i++) {
+      CPU_SET(state->cpus[i], &cpus);
+    }
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+#endif
+
+  const size_t stride = (size_t) HUGE_PAGE_BYTES * state->n_nodes;
+  for (size_t start = (size_t) HUGE_PAGE_BYTES * state->node_index;
+       start < state->len; start += stride) {
+    size_t n = state->len - start;
+    if (n > HUGE_PAGE_BYTES) {
+      n = HUGE_PAGE_BYTES;
+    }
+    memset(state->table + start, 0, n);
+  }
+
+  return NULL;
+}
+
+//
+// _parallel_zero: memset, split over a few threads.
+//
+
+namespace khmer {
+  struct _ZeroState {
+    Byte * start;
+    size_t len;
+  };
+}
+
+static void * _zero_pages(void * arg)
+{
+  _ZeroState * state = (_ZeroState *) arg;
+  memset(state->start, 0, state->len);
+  return NULL;
+}
+
+static void _parallel_zero(Byte * table, size_t len)
+{
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n_threads = n_cpus > 1 ? n_cpus : 1;
+  if (n_threads > MAX_CLEAR_THREADS) {
+    n_threads = MAX_CLEAR_THREADS;
+  }
+  if (len < (size_t) HUGE_PAGE_BYTES * n_threads) {
+    memset(table, 0, len);
+    return;
+  }
+
+  // split on huge page boundaries.
+  size_t chunk = (len / n_threads + HUGE_PAGE_BYTES - 1) /
+    HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+
+  vector<_ZeroState> states(n_threads);
+  vector<pthread_t> threads(n_threads);
+  unsigned int n_started = 0;
+
+  for (size_t start = 0; start < len; start += chunk) {
+    states[n_started].start = table + start;
+    states[n_started].len = len - start < chunk ? len - start : chunk;
+
+    int ret = pthread_create(&threads[n_started], NULL, _zero_pages,
+			     &states[n_started]);
+    assert(ret == 0);
+    n_started++;
+  }
+
+  for (unsigned int i = 0; i < n_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+static void _first_touch(Byte * table, size_t len)
+{
+  vector<unsigned int> nodes = _numa_nodes();
+  if (nodes.size() < 2) {
+    memset(table, 0, len);
+    return;
+  }
+
+  vector<_TouchState> states(nodes.size());
+  vector<pthread_t> threads(nodes.size());
+
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    char path[128];
+    snprintf(path, sizeof(path), NODE_DIR "/node%u/cpulist", nodes[i]);
+
+    states[i].table = table;
+    states[i].len = len;
+    states[i].node_index = i;
+    states[i].n_nodes = nodes.size();
+    states[i].cpus = _read_id_list(path);
+
+    int ret = pthread_create(&threads[i], NULL, _touch_pages, &states[i]);
+    assert(ret == 0);
+  }
+
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+Byte * khmer::allocate_table(HashIntoType n_bytes)
+{
+  const unsigned int policy = _alloc_policy;
+  const bool huge = policy & (ALLOC_HUGEPAGES | ALLOC_HUGETLB);
+
+  size_t len = n_bytes ? n_bytes : 1;
+  if (huge) {
+    len = (len + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  }
+
+  Byte * mapping = (Byte *) MAP_FAILED;
+  size_t mapped_len = len;
+  Byte * table = NULL;
+
+#ifdef MAP_HUGETLB
+  if (policy & ALLOC_HUGETLB) {
+    mapping = (Byte *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    table = mapping;
+  }
+#endif
+
+  if (mapping == MAP_FAILED) {
+    // over-allocate so that the table can start on a huge page
+    // boundary; the kernel only uses huge pages for aligned ranges.
+    if (huge) {
+      mapped_len = len + HUGE_PAGE_BYTES;
+    }
+
+    mapping = (Byte *) mmap(NULL, mapped_len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      throw std::bad_alloc();	// as new Byte[] would.
+    }
+
+    table = mapping;
+    if (huge) {
+      size_t offset = (HUGE_PAGE_BYTES -
+		       (size_t) mapping % HUGE_PAGE_BYTES) % HUGE_PAGE_BYTES;
+      table = mapping + offset;
+#ifdef MADV_HUGEPAGE
+      madvise(table, len, MADV_HUGEPAGE);
+#endif
+    }
+  }
+
+  if (policy & ALLOC_NUMA_INTERLEAVE) {
+    _interleave(table, len);
+  }
+
+  // fresh anonymous memory is already zero, so only touch it if that's
+  // how the pages are being placed.
+  if ((policy & ALLOC_NUMA_FIRST_TOUCH) && !(policy & ALLOC_NUMA_INTERLEAVE)) {
+    _first_touch(table, len);
+  }
+
+  _TableMapping m;
+  m.mapping = mapping;
+  m.mapped_len = mapped_len;
+  m.table_len = len;
+  m.policy = policy;
+
+  ScopedLock lock(_mappings_lock);
+  _mappings[table] = m;
+
+  return table;
+}
+
+Byte * khmer::map_table(int fd, HashIntoType offset, HashIntoType n_bytes)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw SavedFileError("can't stat a saved table's file");
+  }
+  if (offset + n_bytes > (HashIntoType) st.st_size) { // else SIGBUS later.
+    throw SavedFileError("a saved table runs past the end of its file");
+  }
+
+  const long page_bytes = sysconf(_SC_PAGESIZE);
+  if (n_bytes == 0 || offset % page_bytes != 0) {
+    Byte * table = allocate_table(n_bytes);
+
+    HashIntoType loaded = 0;
+    while (loaded != n_bytes) {
+      ssize_t n = pread(fd, table + loaded, n_bytes - loaded, offset + loaded);
+      if (n <= 0) {
+	free_table(table);
+	throw SavedFileError("can't read a saved table");
+      }
+      loaded += n;
+    }
+    return table;
+  }
+
+  Byte * table = (Byte *) mmap(NULL, n_bytes, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, fd, offset);
+  if (table == MAP_FAILED) {
+    throw SavedFileError("can't map a saved table");
+  }
+
+#ifdef MADV_RANDOM
+  // lookups are scattered all over the table; readahead is wasted.
+  madvise(table, n_bytes, MADV_RANDOM);
+#endif
+
+  _TableMapping m;
+  m.mapping = table;
+  m.mapped_len = n_bytes;
+  m.table_len = n_bytes;
+  m.policy = _MAPPED_FILE;
+
+  ScopedLock lock(_mappings_lock);
+  _mappings[table] = m;
+
+  return table;
+}
+
+void khmer::free_table(Byte * table)
+{
+  if (table == NULL) {
+    return;
+  }
+
+  _TableMapping m;
+  {
+    ScopedLock lock(_mappings_lock);
+    map<Byte *, _TableMapping>::iterator it = _mappings.find(table);
+    assert(it != _mappings.end());
+
+    m = it->second;
+    _mappings.erase(it);
+  }
+
+  munmap(m.mapping, m.mapped_len);
+}
+
+void khmer::clear_table(Byte * table)
+{
+  const _TableMapping m = _find_mapping(table);
+
+  // dropping the pages of a file mapping would bring the file back.
+  if (m.policy & _MAPPED_FILE) {
+    _parallel_zero(table, m.table_len);
+    return;
+  }
+
+  if ((m.policy & ALLOC_NUMA_FIRST_TOUCH) &&
+      !(m.policy & ALLOC_NUMA_INTERLEAVE)) {
+    _first_touch(table, m.table_len);
+    return;
+  }
+
+#if defined(__linux__) && defined(MADV_DONTNEED)
+  // private anonymous pages read back as zero after this.  It can fail
+  // on hugetlbfs pages with older kernels.
+  if (!(m.policy & ALLOC_HUGETLB) &&
+      madvise(m.mapping, m.mapped_len, MADV_DONTNEED) == 0) {
+    return;
+  }
+#endif
+
+  _parallel_zero(table, m.table_len);
+}
@@ -0,0 +1,50 @@
+#ifndef ALLOC_HH
+#define ALLOC_HH
+
+#include "khmer.hh"
+
+// how tables are allocated; or these together for set_alloc_policy().
+#define ALLOC_HUGEPAGES 1		// transparent huge pages (madvise).
+#define ALLOC_HUGETLB 2			// hugetlbfs pages, if any are reserved.
+#define ALLOC_NUMA_INTERLEAVE 4		// pages round-robin across NUMA nodes.
+#define ALLOC_NUMA_FIRST_TOUCH 8	// fault pages in up front, node by node.
+
+namespace khmer {
+  // the policy for tables allocated from now on.  The default, 0, is
+  // ordinary pages, faulted in by whichever thread first touches them.
+  void set_alloc_policy(unsigned int policy);
+  unsigned int get_alloc_policy();
+
+  //
+  // allocate_table: zeroed, page-aligned memory for a Hashbits or
+  // CountingHash table, mapped according to the current policy.  Falls
+  // back to ordinary pages if the kernel won't do what's asked; throws
+  // std::bad_alloc if there are none.  Free with free_table().
+  //
+  // Unless ALLOC_NUMA_FIRST_TOUCH is set, nothing is written: the
+  // mapping starts out as the kernel's zero page, so even a huge table
+  // costs nothing until it is used, and a load() writes it only once.
+  //
+
+  Byte * allocate_table(HashIntoType n_bytes);
+  void free_table(Byte * table);
+
+  //
+  // map_table: n_bytes of an open file, starting at offset, as a table.
+  // The mapping is private, so until the table is written its pages are
+  // the file's page cache, shared with every other process that maps
+  // the same file; a write copies just the page it lands on.  Offsets
+  // that aren't on a page boundary are read into an allocate_table()
+  // table instead.  Free with free_table().  Throws SavedFileError if
+  // the file can't be mapped or read.
+  //
+
+  Byte * map_table(int fd, HashIntoType offset, HashIntoType n_bytes);
+
+  // zero a table in place, keeping its mapping and policy.  Ordinary
+  // tables are handed back to the kernel (MADV_DONTNEED) to become zero
+  // pages again; otherwise the pages are zeroed by several threads.
+  void clear_table(Byte * table);
+};
+
+#endif // ALLOC_HH
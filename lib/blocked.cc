@@ -0,0 +1,302 @@
+#include "khmer.hh"
+#include "blocked.hh"
+#include "savedfile.hh"
+#include "zlib-1.2.3/zlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace khmer;
+
+HashIntoType BlockedHashbits::_count_blocks(const std::vector<HashIntoType> &tablesizes)
+{
+  HashIntoType n_bits = 0;
+  for (unsigned int i = 0; i < tablesizes.size(); i++) {
+    n_bits += tablesizes[i];
+  }
+  return n_bits / BLOCKED_BLOCK_BITS + 1;
+}
+
+void BlockedHashbits::_allocate_blocks()
+{
+  assert(_n_tables > 0 && _n_tables <= BLOCKED_BLOCK_BITS);
+
+  _n_blocks = _count_blocks(_tablesizes);
+
+  // page-aligned, so the blocks line up with cache lines.
+  _blocks = allocate_table(_n_blocks * BLOCKED_BLOCK_BYTES);
+}
+
+void BlockedHashbits::_free_blocks()
+{
+  free_table(_blocks);
+  _blocks = NULL;
+  _n_blocks = 0;
+}
+
+//
+// false_positive_rate: a k-mer not in the table lands in one block, so
+//     the rate is the average over blocks of (fill fraction)^n_tables.
+//     Uneven fill between blocks is what makes this worse than Hashbits.
+//
+
+double BlockedHashbits::false_positive_rate() const
+{
+  double total = 0;
+
+  for (HashIntoType i = 0; i < _n_blocks; i++) {
+    const Byte * block = _blocks + i * BLOCKED_BLOCK_BYTES;
+    unsigned int n_set = 0;
+
+    for (unsigned int j = 0; j < BLOCKED_BLOCK_BYTES; j++) {
+      n_set += __builtin_popcount(block[j]);
+    }
+
+    double p = 1.0;
+    for (unsigned int j = 0; j < _n_tables; j++) {
+      p *= double(n_set) / BLOCKED_BLOCK_BITS;
+    }
+    total += p;
+  }
+
+  return total / _n_blocks;
+}
+
+//
+// save/load: the sectioned format, as for Hashbits (see savedfile.hh),
+//     with the blocks as its one table.
+//
+
+void BlockedHashbits::save(std::string outfilename)
+{
+  assert(_blocks);
+
+  SectionedFileWriter outfile(outfilename, SAVED_BLOCKED_HASHBITS);
+
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ksize;
+  params.hash_family = _family.type();
+  params.n_tables = _n_tables;
+  outfile.write_params(params, _tablesizes, _unique_rc);
+
+  outfile.write_section(SECTION_TABLE, _blocks,
+			_n_blocks * BLOCKED_BLOCK_BYTES);
+
+  SavedStats stats;
+  stats.occupied_bins = _occupied_bins;
+  stats.n_unique_kmers = _n_unique_kmers;
+  stats.n_overlap_kmers = _n_overlap_kmers;
+  outfile.write_section(SECTION_STATS, &stats, sizeof(stats));
+
+  outfile.close();
+}
+
+void BlockedHashbits::_load(const std::string &infilename, bool use_mmap)
+{
+  SectionedFileReader infile(infilename, SAVED_BLOCKED_HASHBITS);
+
+  // the old blocks stay, if it can't be loaded.
+  SavedParams params;
+  std::vector<HashIntoType> tablesizes;
+  infile.read_params(params, tablesizes, _unique_rc);
+  if (params.hash_family != HASH_FAMILY_MIX || params.n_tables == 0 ||
+      params.n_tables > BLOCKED_BLOCK_BITS) {
+    throw SavedFileError(infilename + " is not a blocked Hashbits table");
+  }
+
+  SavedStats stats;
+  memset(&stats, 0, sizeof(stats));
+  const SavedSection * section = infile.find(SECTION_STATS);
+  if (section) {
+    infile.check_length(*section, sizeof(stats));
+    infile.read_section(*section, &stats);
+  }
+
+  const HashIntoType n_blocks = _count_blocks(tablesizes);
+
+  Byte * blocks;
+  std::vector<HashIntoType> table_bytes(1, n_blocks * BLOCKED_BLOCK_BYTES);
+  infile.read_tables(table_bytes, &blocks, use_mmap);
+
+  _free_blocks();
+  _blocks = blocks;
+  _n_blocks = n_blocks;
+  _tablesizes = tablesizes;
+
+  _ksize = (WordLength) params.ksize;
+  _n_tables = params.n_tables;
+  _init_bitstuff();
+
+  _occupied_bins = stats.occupied_bins;
+  _n_unique_kmers = stats.n_unique_kmers;
+  _n_overlap_kmers = stats.n_overlap_kmers;
+}
+
+//
+// BlockedCountingHash
+//
+
+HashIntoType BlockedCountingHash::_count_blocks(const std::vector<HashIntoType> &tablesizes)
+{
+  HashIntoType n_counters = 0;
+  for (unsigned int i = 0; i < tablesizes.size(); i++) {
+    n_counters += tablesizes[i];
+  }
+  return n_counters / BLOCKED_BLOCK_BYTES + 1;
+}
+
+void BlockedCountingHash::_allocate_blocks()
+{
+  assert(_n_tables > 0 && _n_tables <= BLOCKED_BLOCK_BYTES);
+
+  _n_blocks = _count_blocks(_tablesizes);
+  _blocks = allocate_table(_n_blocks * BLOCKED_BLOCK_BYTES);
+}
+
+void BlockedCountingHash::_free_blocks()
+{
+  free_table(_blocks);
+  _blocks = NULL;
+  _n_blocks = 0;
+}
+
+void BlockedCountingHash::count_concurrent(const HashIntoType * kmers,
+					   unsigned int n)
+{
+  for (unsigned int k = 0; k < n; k++) {
+    const HashIntoType khash = kmers[k];
+    unsigned int start, stride, n_full = 0;
+    Byte * block = _get_block(khash, start, stride);
+
+    for (unsigned int i = 0; i < _n_tables; i++) {
+      Byte * bin = &block[(start + i * stride) % BLOCKED_BLOCK_BYTES];
+      if (_increment_atomic(bin) >= MAX_COUNT) {
+	n_full++;
+      }
+    }
+
+    if (n_full == _n_tables && _use_bigcount) {
+      ScopedLock lock(_bigcount_locks[khash % N_BIGCOUNT_STRIPES]);
+      _increment_bigcount(khash);
+    }
+  }
+}
+
+//
+// save/load: the sectioned format, as for CountingHash (see
+//     savedfile.hh), with the blocks as its one table.  Files ending in
+//     .gz are written as chunked gzip.
+//
+
+static bool _is_gz_filename(const std::string &filename)
+{
+  size_t found = filename.find_last_of(".");
+  return found != std::string::npos && filename.substr(found + 1) == "gz";
+}
+
+void BlockedCountingHash::save(std::string outfilename)
+{
+  assert(_blocks);
+
+  SectionedFileWriter outfile(outfilename, SAVED_BLOCKED_COUNTING_HT,
+			      _is_gz_filename(outfilename));
+
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ksize;
+  params.hash_family = _family.type();
+  params.use_bigcount = _use_bigcount ? 1 : 0;
+  params.n_tables = _n_tables;
+  outfile.write_params(params, _tablesizes, _unique_rc);
+
+  outfile.write_section(SECTION_TABLE, _blocks,
+			_n_blocks * BLOCKED_BLOCK_BYTES);
+
+  // (kmer, count) pairs, packed as for CountingHash.
+  const unsigned int pair_bytes = sizeof(HashIntoType) +
+    sizeof(BoundedCounterType);
+  std::vector<char> buf;
+
+  outfile.begin_section(SECTION_BIGCOUNTS);
+  for (unsigned int i = 0; i < N_BIGCOUNT_STRIPES; i++) {
+    KmerCountMap::const_iterator it = _bigcounts[i].begin();
+
+    for (; it != _bigcounts[i].end(); it++) {
+      buf.resize(buf.size() + pair_bytes);
+      char * pair = &buf[buf.size() - pair_bytes];
+      memcpy(pair, &it->first, sizeof(it->first));
+      memcpy(pair + sizeof(it->first), &it->second, sizeof(it->second));
+
+      if (buf.size() >= SAVED_PAGE_BYTES * 256) {
+	outfile.write(&buf[0], buf.size());
+	buf.clear();
+      }
+    }
+  }
+  if (!buf.empty()) {
+    outfile.write(&buf[0], buf.size());
+  }
+  outfile.end_section();
+
+  outfile.close();
+}
+
+void BlockedCountingHash::_load(const std::string &infilename, bool use_mmap)
+{
+  SectionedFileReader infile(infilename, SAVED_BLOCKED_COUNTING_HT);
+
+  // the old blocks stay, if it can't be loaded.
+  SavedParams params;
+  std::vector<HashIntoType> tablesizes;
+  infile.read_params(params, tablesizes, _unique_rc);
+  if (params.hash_family != HASH_FAMILY_MIX || params.n_tables == 0 ||
+      params.n_tables > BLOCKED_BLOCK_BYTES) {
+    throw SavedFileError(infilename + " is not a blocked counting table");
+  }
+
+  // (kmer, count) pairs.
+  const unsigned int pair_bytes = sizeof(HashIntoType) +
+    sizeof(BoundedCounterType);
+  std::vector<char> buf;
+
+  const SavedSection * section = infile.find(SECTION_BIGCOUNTS);
+  if (section) {
+    if (section->length % pair_bytes) {
+      throw SavedFileError(infilename + " has a section of the wrong size");
+    }
+
+    buf.resize(section->length);
+    if (!buf.empty()) {
+      infile.read_section(*section, &buf[0]);
+    }
+  }
+
+  const HashIntoType n_blocks = _count_blocks(tablesizes);
+
+  Byte * blocks;
+  std::vector<HashIntoType> table_bytes(1, n_blocks * BLOCKED_BLOCK_BYTES);
+  infile.read_tables(table_bytes, &blocks, use_mmap);
+
+  _free_blocks();
+  _blocks = blocks;
+  _n_blocks = n_blocks;
+  _tablesizes = tablesizes;
+
+  _ksize = (WordLength) params.ksize;
+  _n_tables = params.n_tables;
+  _init_bitstuff();
+
+  _use_bigcount = params.use_bigcount;
+
+  _clear_bigcounts();
+
+  for (unsigned long long i = 0; i < buf.size(); i += pair_bytes) {
+    HashIntoType kmer;
+    BoundedCounterType count;
+
+    memcpy(&kmer, &buf[i], sizeof(kmer));
+    memcpy(&count, &buf[i + sizeof(kmer)], sizeof(count));
+    _bigcount_stripe(kmer)[kmer] = count;
+  }
+}
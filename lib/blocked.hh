@@ -0,0 +1,320 @@
+#ifndef BLOCKED_HH
+#define BLOCKED_HH
+
+#include "hashbits.hh"
+
+// one cache line.
+#define BLOCKED_BLOCK_BYTES 64
+#define BLOCKED_BLOCK_BITS (BLOCKED_BLOCK_BYTES * 8)
+
+namespace khmer {
+  // find the block for khash, and the start & stride of its slots in a
+  // block of n_slots (a power of two).  The stride is odd, so the first
+  // n_slots probes are all distinct.
+  inline HashIntoType _blocked_locate(HashIntoType khash,
+				      HashIntoType n_blocks,
+				      unsigned int n_slots,
+				      unsigned int &start,
+				      unsigned int &stride) {
+    HashIntoType h = mix_hash(khash);
+
+    start = h % n_slots;
+    stride = ((h >> 9) % n_slots) | 1;
+    return (h >> 18) % n_blocks;
+  }
+
+  //
+  // BlockedHashbits: a Bloom filter that keeps all of a k-mer's bits in
+  // one 64-byte block, so a lookup touches a single cache line instead
+  // of one per table.  It is sized from the same tablesizes as Hashbits
+  // (the total number of bits is their sum) and sets one bit per table.
+  //
+  // The price is a somewhat higher false positive rate at the same fill;
+  // see false_positive_rate().
+  //
+
+  class BlockedHashbits : public Hashbits {
+  protected:
+    HashIntoType _n_blocks;
+    Byte * _blocks;
+
+    // to hold tablesizes' bits.
+    static HashIntoType _count_blocks(const std::vector<HashIntoType> &tablesizes);
+    void _allocate_blocks();
+    void _free_blocks();
+
+    Byte * _get_block(HashIntoType khash, unsigned int &start,
+		      unsigned int &stride) const {
+      HashIntoType block = _blocked_locate(khash, _n_blocks,
+					   BLOCKED_BLOCK_BITS, start, stride);
+      return _blocks + block * BLOCKED_BLOCK_BYTES;
+    }
+
+    virtual unsigned int _set_bits_atomic(HashIntoType khash) {
+      unsigned int start, stride, n_new = 0;
+      Byte * block = _get_block(khash, start, stride);
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	unsigned int bit = (start + i * stride) % BLOCKED_BLOCK_BITS;
+	Byte mask = 1 << (bit % 8);
+	Byte old = __sync_fetch_and_or(&block[bit / 8], mask);
+	if (!(old & mask)) {
+	  n_new++;
+	}
+      }
+      return n_new;
+    }
+
+    void _load(const std::string &infilename, bool use_mmap);
+
+  public:
+    BlockedHashbits(WordLength ksize, std::vector<HashIntoType>& tablesizes)
+      : Hashbits(ksize, tablesizes, false), _blocks(NULL) {
+      _family = HashFamily(HASH_FAMILY_MIX); // always; see _blocked_locate.
+      _allocate_blocks();
+    }
+
+    ~BlockedHashbits() {
+      _free_blocks();
+    }
+
+    HashIntoType n_blocks() const { return _n_blocks; }
+
+    virtual void save(std::string);
+    virtual void load(std::string filename) { _load(filename, false); }
+    virtual void load_mmap(std::string filename) { _load(filename, true); }
+
+    virtual double false_positive_rate() const;
+
+    virtual void clear() {
+      clear_table(_blocks);
+      _occupied_bins = 0;
+      _n_unique_kmers = 0;
+      _n_overlap_kmers = 0;
+    }
+
+    // a k-mer's updates are already confined to one cache line.
+    virtual void count_staged(const HashIntoType * kmers, unsigned int n,
+			      StagingBuffer &buffer) {
+      count_concurrent(kmers, n);
+    }
+
+    virtual void count(const char * kmer) {
+      HashIntoType hash = hash_kmer(kmer);
+      count(hash);
+    }
+
+    virtual void count(HashIntoType khash) {
+      unsigned int start, stride;
+      Byte * block = _get_block(khash, start, stride);
+      bool is_new_kmer = false;
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	unsigned int bit = (start + i * stride) % BLOCKED_BLOCK_BITS;
+	if (!(block[bit / 8] & (1 << (bit % 8)))) {
+	  _occupied_bins += 1;
+	  is_new_kmer = true;
+	}
+	block[bit / 8] |= (1 << (bit % 8));
+      }
+      if (is_new_kmer) {
+	_n_unique_kmers += 1;
+      }
+    }
+
+    virtual void count_overlap(const char * kmer, Hashbits &ht2) {
+      HashIntoType hash = hash_kmer(kmer);
+      count_overlap(hash, ht2);
+    }
+
+    virtual void count_overlap(HashIntoType khash, Hashbits &ht2) {
+      HashIntoType n_unique = _n_unique_kmers;
+
+      count(khash);
+      if (_n_unique_kmers != n_unique && check_overlap(khash, ht2)) {
+	_n_overlap_kmers += 1;
+      }
+    }
+
+    virtual const BoundedCounterType get_count(const char * kmer) const {
+      HashIntoType hash = hash_kmer(kmer);
+      return get_count(hash);
+    }
+
+    virtual const BoundedCounterType get_count(HashIntoType khash) const {
+      unsigned int start, stride;
+      const Byte * block = _get_block(khash, start, stride);
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	unsigned int bit = (start + i * stride) % BLOCKED_BLOCK_BITS;
+	if (!(block[bit / 8] & (1 << (bit % 8)))) {
+	  return 0;
+	}
+      }
+      return 1;
+    }
+
+    virtual unsigned int count_kmers(const HashIntoType * kmers,
+				     unsigned int n,
+				     HashIntoType lower_bound = 0,
+				     HashIntoType upper_bound = 0) {
+      return _drive_count_kmers(*this, kmers, n, lower_bound, upper_bound);
+    }
+
+    virtual void get_counts(const HashIntoType * kmers, unsigned int n,
+			    BoundedCounterType * out) const {
+      _drive_get_counts(*this, kmers, n, out);
+    }
+
+    // start pulling khash's block in ahead of a count() or get_count().
+    void _prefetch(HashIntoType khash) const {
+      unsigned int start, stride;
+      __builtin_prefetch(_get_block(khash, start, stride));
+    }
+  };
+
+  //
+  // BlockedCountingHash: a count-min sketch with all of a k-mer's
+  // counters in one 64-byte block (64 one-byte counters), so get_count
+  // is one cache miss instead of one per table.  Sized like
+  // CountingHash; bigcounts work the same way.
+  //
+
+  class BlockedCountingHash : public CountingHash {
+  protected:
+    HashIntoType _n_blocks;
+    Byte * _blocks;
+
+    // to hold tablesizes' counters.
+    static HashIntoType _count_blocks(const std::vector<HashIntoType> &tablesizes);
+    void _allocate_blocks();
+    void _free_blocks();
+
+    Byte * _get_block(HashIntoType khash, unsigned int &start,
+		      unsigned int &stride) const {
+      HashIntoType block = _blocked_locate(khash, _n_blocks,
+					   BLOCKED_BLOCK_BYTES, start, stride);
+      return _blocks + block * BLOCKED_BLOCK_BYTES;
+    }
+
+    void _load(const std::string &infilename, bool use_mmap);
+
+  public:
+    BlockedCountingHash(WordLength ksize,
+			std::vector<HashIntoType>& tablesizes)
+      : CountingHash(ksize, tablesizes, false), _blocks(NULL) {
+      _family = HashFamily(HASH_FAMILY_MIX); // always; see _blocked_locate.
+      _allocate_blocks();
+    }
+
+    ~BlockedCountingHash() {
+      _free_blocks();
+    }
+
+    HashIntoType n_blocks() const { return _n_blocks; }
+
+    virtual void save(std::string);
+    virtual void load(std::string filename) { _load(filename, false); }
+    virtual void load_mmap(std::string filename) { _load(filename, true); }
+
+    virtual void clear() {
+      clear_table(_blocks);
+      _clear_bigcounts();
+    }
+
+    // counters in use over the whole table, scaled by the number of
+    // tables so it can be compared to CountingHash::n_occupied.
+    virtual const HashIntoType n_occupied(HashIntoType start=0,
+					  HashIntoType stop=0) const {
+      HashIntoType n = 0;
+      const HashIntoType n_slots = _n_blocks * BLOCKED_BLOCK_BYTES;
+      if (stop == 0 || stop > n_slots) { stop = n_slots; }
+      for (HashIntoType i = start; i < stop; i++) {
+	if (_blocks[i]) {
+	  n++;
+	}
+      }
+      return n / _n_tables;
+    }
+
+    virtual void count(const char * kmer) {
+      HashIntoType hash = hash_kmer(kmer);
+      count(hash);
+    }
+
+    virtual void count(HashIntoType khash) {
+      unsigned int start, stride, n_full = 0;
+      Byte * block = _get_block(khash, start, stride);
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	Byte &counter = block[(start + i * stride) % BLOCKED_BLOCK_BYTES];
+
+	if (counter < MAX_COUNT) {
+	  counter += 1;
+	} else {
+	  n_full++;
+	}
+      }
+
+      if (n_full == _n_tables && _use_bigcount) {
+	_increment_bigcount(khash);
+      }
+    }
+
+    virtual void count_concurrent(const HashIntoType * kmers,
+				  unsigned int n);
+
+    // a k-mer's updates are already confined to one cache line.
+    virtual void count_staged(const HashIntoType * kmers, unsigned int n,
+			      StagingBuffer &buffer) {
+      count_concurrent(kmers, n);
+    }
+
+    virtual const BoundedCounterType get_count(const char * kmer) const {
+      HashIntoType hash = hash_kmer(kmer);
+      return get_count(hash);
+    }
+
+    virtual const BoundedCounterType get_count(HashIntoType khash) const {
+      unsigned int start, stride;
+      const Byte * block = _get_block(khash, start, stride);
+
+      BoundedCounterType min_count = MAX_COUNT;
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	BoundedCounterType the_count =
+	  block[(start + i * stride) % BLOCKED_BLOCK_BYTES];
+	if (the_count < min_count) {
+	  min_count = the_count;
+	}
+      }
+      if (min_count == MAX_COUNT && _use_bigcount) {
+	const KmerCountMap &bigcounts = _bigcount_stripe(khash);
+	KmerCountMap::const_iterator it = bigcounts.find(khash);
+	if (it != bigcounts.end()) {
+	  min_count = it->second;
+	}
+      }
+      return min_count;
+    }
+
+    virtual unsigned int count_kmers(const HashIntoType * kmers,
+				     unsigned int n,
+				     HashIntoType lower_bound = 0,
+				     HashIntoType upper_bound = 0) {
+      return _drive_count_kmers(*this, kmers, n, lower_bound, upper_bound);
+    }
+
+    virtual void get_counts(const HashIntoType * kmers, unsigned int n,
+			    BoundedCounterType * out) const {
+      _drive_get_counts(*this, kmers, n, out);
+    }
+
+    // start pulling khash's block in ahead of a count() or get_count().
+    void _prefetch(HashIntoType khash) const {
+      unsigned int start, stride;
+      __builtin_prefetch(_get_block(khash, start, stride));
+    }
+  };
+};
+
+#endif // BLOCKED_HH
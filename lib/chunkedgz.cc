@@ -0,0 +1,627 @@
+#include "khmer.hh"
+#include "chunkedgz.hh"
+#include "thread_utils.hh"
+#include "zlib-1.2.3/zlib.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define GZ_HEADER_BYTES 12		// before the extra field.
+#define GZ_TRAILER_BYTES 8		// CRC32 and ISIZE.
+#define GZ_MAX_EXTRA 65535
+#define INDEX_ENTRY_BYTES 16
+#define INDEX_INFO_BYTES 24
+#define INDEX_INFO_MEMBER_BYTES (GZ_HEADER_BYTES + 4 + INDEX_INFO_BYTES + 2 + \
+				 GZ_TRAILER_BYTES)
+
+using namespace std;
+using namespace khmer;
+
+//
+// little-endian fields, as gzip wants them.
+//
+
+static void _put16(vector<Byte> &out, unsigned int x)
+{
+  out.push_back(x & 0xff);
+  out.push_back((x >> 8) & 0xff);
+}
+
+static void _put32(vector<Byte> &out, unsigned int x)
+{
+  _put16(out, x & 0xffff);
+  _put16(out, x >> 16);
+}
+
+static void _put64(vector<Byte> &out, unsigned long long x)
+{
+  _put32(out, x & 0xffffffffULL);
+  _put32(out, x >> 32);
+}
+
+static unsigned int _get16(const Byte * p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned int _get32(const Byte * p)
+{
+  return _get16(p) | (_get16(p + 2) << 16);
+}
+
+static unsigned long long _get64(const Byte * p)
+{
+  return _get32(p) | ((unsigned long long) _get32(p + 4) << 32);
+}
+
+static unsigned int _n_cpus()
+{
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n = n_cpus > 1 ? n_cpus : 1;
+  return n > MAX_GZ_THREADS ? MAX_GZ_THREADS : n;
+}
+
+// the gzip header, with one extra subfield of slen bytes to follow.
+static void _member_header(vector<Byte> &out, char si1, char si2,
+			   unsigned int slen)
+{
+  static const Byte fixed[] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff };
+
+  out.insert(out.end(), fixed, fixed + sizeof(fixed));
+  _put16(out, 4 + slen);
+  out.push_back(si1);
+  out.push_back(si2);
+  _put16(out, slen);
+}
+
+// an empty deflate stream, and its CRC and length.
+static void _empty_member_data(vector<Byte> &out)
+{
+  out.push_back(0x03);
+  out.push_back(0x00);
+  _put32(out, 0);
+  _put32(out, 0);
+}
+
+//
+// _deflate_member: one complete gzip member for n bytes of data.
+//
+
+static void _deflate_member(const Byte * data, unsigned long long n,
+			    int level, vector<Byte> &out)
+{
+  out.clear();
+  _member_header(out, 'K', 'C', 4);
+  const unsigned int bsize_at = out.size();
+  _put32(out, 0);			// filled in below.
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  int ret = deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+			 Z_DEFAULT_STRATEGY);
+  assert(ret == Z_OK);
+
+  const unsigned int start = out.size();
+  out.resize(start + deflateBound(&strm, n));
+
+  strm.next_in = (Bytef *) data;
+  strm.avail_in = n;
+  strm.next_out = &out[start];
+  strm.avail_out = out.size() - start;
+
+  ret = deflate(&strm, Z_FINISH);
+  assert(ret == Z_STREAM_END);
+  out.resize(start + strm.total_out);
+  deflateEnd(&strm);
+
+  _put32(out, crc32(crc32(0L, Z_NULL, 0), data, n));
+  _put32(out, n & 0xffffffffULL);
+
+  vector<Byte> bsize;
+  _put32(bsize, out.size() - 1);
+  memcpy(&out[bsize_at], &bsize[0], 4);
+}
+
+//
+// ChunkedGzWriter
+//
+
+namespace khmer {
+  struct _DeflateState {
+    const vector<Byte> * data;
+    int level;
+    vector<Byte> member;
+  };
+}
+
+static void * _deflate_chunk(void * arg)
+{
+  _DeflateState * state = (_DeflateState *) arg;
+  _deflate_member(&(*state->data)[0], state->data->size(), state->level,
+		  state->member);
+  return NULL;
+}
+
+ChunkedGzWriter::ChunkedGzWriter(const std::string &filename,
+				 unsigned long long head_bytes)
+  : _outfile(filename.c_str(), ios::binary), _head_bytes(head_bytes),
+    _written(0), _data_size(0), _flushed_data(0)
+{
+  if (!_outfile.is_open()) {
+    throw SavedFileError("can't open " + filename);
+  }
+  assert(head_bytes > 0 && head_bytes <= GZ_CHUNK_BYTES);
+
+  _n_threads = _n_cpus();
+}
+
+void ChunkedGzWriter::write(const void * data, unsigned long long n)
+{
+  const Byte * p = (const Byte *) data;
+
+  while (n) {
+    const bool first = _index.empty() && _chunks.empty();
+    const unsigned long long chunk_bytes = first ? _head_bytes : GZ_CHUNK_BYTES;
+
+    unsigned long long take = chunk_bytes - _chunk.size();
+    if (take > n) {
+      take = n;
+    }
+    _chunk.insert(_chunk.end(), p, p + take);
+    p += take;
+    n -= take;
+    _data_size += take;
+
+    if (_chunk.size() == chunk_bytes) {
+      _add_chunk();
+    }
+  }
+}
+
+void ChunkedGzWriter::_add_chunk()
+{
+  _chunks.push_back(vector<Byte>());
+  _chunks.back().swap(_chunk);
+  _chunk.reserve(GZ_CHUNK_BYTES);
+
+  if (_chunks.size() >= _n_threads) {
+    _flush_chunks();
+  }
+}
+
+// deflate the waiting chunks, one thread each, and write them in order.
+void ChunkedGzWriter::_flush_chunks()
+{
+  vector<_DeflateState> states(_chunks.size());
+  for (unsigned int i = 0; i < _chunks.size(); i++) {
+    states[i].data = &_chunks[i];
+    // the head is stored, so that it is always the same size.
+    states[i].level = _index.empty() && i == 0 ? 0 : Z_DEFAULT_COMPRESSION;
+  }
+
+  if (states.size() == 1) {
+    _deflate_chunk(&states[0]);
+  } else {
+    vector<pthread_t> threads(states.size());
+    for (unsigned int i = 0; i < states.size(); i++) {
+      int ret = pthread_create(&threads[i], NULL, _deflate_chunk, &states[i]);
+      assert(ret == 0);
+    }
+    for (unsigned int i = 0; i < states.size(); i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  for (unsigned int i = 0; i < states.size(); i++) {
+    ChunkedGzEntry entry;
+    entry.offset = _written;
+    entry.data_offset = _flushed_data;
+    _index.push_back(entry);
+
+    _outfile.write((const char *) &states[i].member[0],
+		   states[i].member.size());
+    _written += states[i].member.size();
+    _flushed_data += _chunks[i].size();
+  }
+  _chunks.clear();
+}
+
+void ChunkedGzWriter::close(const void * head)
+{
+  if (!_outfile.is_open()) {
+    return;
+  }
+
+  if (!_chunk.empty()) {
+    _add_chunk();
+  }
+  if (!_chunks.empty()) {
+    _flush_chunks();
+  }
+
+  // the index, as many members as it takes...
+  const unsigned long long index_offset = _written;
+  const unsigned int per_member = (GZ_MAX_EXTRA - 4) / INDEX_ENTRY_BYTES;
+
+  for (unsigned int start = 0; start < _index.size(); start += per_member) {
+    unsigned int n = _index.size() - start;
+    if (n > per_member) {
+      n = per_member;
+    }
+
+    vector<Byte> member;
+    _member_header(member, 'K', 'X', n * INDEX_ENTRY_BYTES);
+    for (unsigned int i = start; i < start + n; i++) {
+      _put64(member, _index[i].offset);
+      _put64(member, _index[i].data_offset);
+    }
+    _empty_member_data(member);
+
+    _outfile.write((const char *) &member[0], member.size());
+    _written += member.size();
+  }
+
+  // ...and where to find it.
+  vector<Byte> member;
+  _member_header(member, 'K', 'I', INDEX_INFO_BYTES);
+  _put64(member, index_offset);
+  _put64(member, _index.size());
+  _put64(member, _data_size);
+  _empty_member_data(member);
+  assert(member.size() == INDEX_INFO_MEMBER_BYTES);
+  _outfile.write((const char *) &member[0], member.size());
+
+  if (head) {
+    assert(_data_size >= _head_bytes);
+    const unsigned long long head_member_bytes =
+      _index.size() > 1 ? _index[1].offset : index_offset;
+
+    _deflate_member((const Byte *) head, _head_bytes, 0, member);
+    assert(member.size() == head_member_bytes);
+
+    _outfile.seekp(0);
+    _outfile.write((const char *) &member[0], member.size());
+  }
+
+  _outfile.close();
+}
+
+//
+// ChunkedGzReader
+//
+
+bool ChunkedGzReader::is_chunked(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool chunked = false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= INDEX_INFO_MEMBER_BYTES) {
+    Byte member[INDEX_INFO_MEMBER_BYTES];
+    if (pread(fd, member, sizeof(member), st.st_size - sizeof(member)) ==
+	sizeof(member)) {
+      chunked = member[0] == 0x1f && member[1] == 0x8b &&
+	(member[3] & 4) && _get16(member + 10) == 4 + INDEX_INFO_BYTES &&
+	member[12] == 'K' && member[13] == 'I' &&
+	_get16(member + 14) == INDEX_INFO_BYTES;
+    }
+  }
+
+  ::close(fd);
+  return chunked;
+}
+
+ChunkedGzReader::ChunkedGzReader(const std::string &filename)
+  : _filename(filename), _cached_chunk(-1)
+{
+  _fd = open(filename.c_str(), O_RDONLY);
+  if (_fd < 0) {
+    throw SavedFileError("can't open " + filename);
+  }
+
+  try {
+    _read_index();
+  } catch (...) {
+    ::close(_fd);
+    throw;
+  }
+}
+
+void ChunkedGzReader::_read_index()
+{
+  struct stat st;
+  int ret = fstat(_fd, &st);
+  assert(ret == 0);
+  const unsigned long long file_size = st.st_size;
+  if (file_size < INDEX_INFO_MEMBER_BYTES) {
+    throw SavedFileError(_filename + " is truncated");
+  }
+
+  Byte info[INDEX_INFO_MEMBER_BYTES];
+  _pread_fully(info, sizeof(info), file_size - sizeof(info));
+  if (info[12] != 'K' || info[13] != 'I') {
+    throw SavedFileError(_filename + " has no chunk index");
+  }
+
+  _index_offset = _get64(info + 16);
+  const unsigned long long n_chunks = _get64(info + 24);
+  _data_size = _get64(info + 32);
+
+  // every chunk takes at least a gzip header and trailer.
+  if (_index_offset > file_size - sizeof(info) ||
+      n_chunks > _index_offset / (GZ_HEADER_BYTES + GZ_TRAILER_BYTES)) {
+    throw SavedFileError(_filename + " has a corrupt chunk index");
+  }
+
+  unsigned long long pos = _index_offset;
+  while (_index.size() < n_chunks) {
+    Byte header[GZ_HEADER_BYTES + 4];
+    _pread_fully(header, sizeof(header), pos);
+
+    const unsigned int xlen = _get16(header + 10);
+    const unsigned int n = _get16(header + 14) / INDEX_ENTRY_BYTES;
+    if (header[12] != 'K' || header[13] != 'X' || n == 0) {
+      throw SavedFileError(_filename + " has a corrupt chunk index");
+    }
+
+    vector<Byte> entries(n * INDEX_ENTRY_BYTES);
+    _pread_fully(&entries[0], entries.size(), pos + sizeof(header));
+    for (unsigned int i = 0; i < n; i++) {
+      ChunkedGzEntry entry;
+      entry.offset = _get64(&entries[i * INDEX_ENTRY_BYTES]);
+      entry.data_offset = _get64(&entries[i * INDEX_ENTRY_BYTES + 8]);
+      _index.push_back(entry);
+    }
+
+    pos += GZ_HEADER_BYTES + xlen + 2 + GZ_TRAILER_BYTES;
+  }
+
+  // the members must tile the data, in order, no more than a chunk each.
+  for (unsigned int i = 0; i < _index.size(); i++) {
+    const bool last = i + 1 == _index.size();
+    const unsigned long long next_offset =
+      last ? _index_offset : _index[i + 1].offset;
+    const unsigned long long next_data =
+      last ? _data_size : _index[i + 1].data_offset;
+
+    if ((i == 0 && (_index[i].offset != 0 || _index[i].data_offset != 0)) ||
+	_index[i].offset >= next_offset ||
+	_index[i].data_offset >= next_data ||
+	next_data - _index[i].data_offset > GZ_CHUNK_BYTES) {
+      throw SavedFileError(_filename + " has a corrupt chunk index");
+    }
+  }
+  if (_index.size() != n_chunks || (_index.empty() && _data_size != 0)) {
+    throw SavedFileError(_filename + " has a corrupt chunk index");
+  }
+}
+
+ChunkedGzReader::~ChunkedGzReader()
+{
+  ::close(_fd);
+}
+
+void ChunkedGzReader::_pread_fully(void * buf, unsigned long long n,
+				   unsigned long long offset) const
+{
+  char * p = (char *) buf;
+  while (n) {
+    ssize_t got = pread(_fd, p, n, offset);
+    if (got <= 0) {
+      throw SavedFileError(_filename + " is truncated");
+    }
+    p += got;
+    n -= got;
+    offset += got;
+  }
+}
+
+unsigned int ChunkedGzReader::_find_chunk(unsigned long long offset) const
+{
+  unsigned int lo = 0, hi = _index.size();
+  while (hi - lo > 1) {
+    unsigned int mid = (lo + hi) / 2;
+    if (_index[mid].data_offset <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void ChunkedGzReader::inflate_chunk(unsigned int i, std::vector<Byte> &out)
+  const
+{
+  const bool last = i + 1 == _index.size();
+  const unsigned long long member_bytes =
+    (last ? _index_offset : _index[i + 1].offset) - _index[i].offset;
+  const unsigned long long data_bytes =
+    (last ? _data_size : _index[i + 1].data_offset) - _index[i].data_offset;
+
+  vector<Byte> member(member_bytes);
+  _pread_fully(&member[0], member_bytes, _index[i].offset);
+
+  const std::string corrupt = _filename + " has a corrupt gzip chunk";
+  if (member_bytes < GZ_HEADER_BYTES + GZ_TRAILER_BYTES ||
+      member[0] != 0x1f || member[1] != 0x8b || !(member[3] & 4)) {
+    throw SavedFileError(corrupt);
+  }
+
+  const unsigned int start = GZ_HEADER_BYTES + _get16(&member[10]);
+  if (start + GZ_TRAILER_BYTES > member_bytes) {
+    throw SavedFileError(corrupt);
+  }
+
+  out.resize(data_bytes);
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  int ret = inflateInit2(&strm, -MAX_WBITS);
+  assert(ret == Z_OK);
+
+  strm.next_in = &member[start];
+  strm.avail_in = member_bytes - start - GZ_TRAILER_BYTES;
+  strm.next_out = &out[0];
+  strm.avail_out = data_bytes;
+
+  ret = inflate(&strm, Z_FINISH);
+  const unsigned long long total_out = strm.total_out;
+  inflateEnd(&strm);
+  if (ret != Z_STREAM_END || total_out != data_bytes) {
+    throw SavedFileError(corrupt);
+  }
+
+  const Byte * trailer = &member[member_bytes - GZ_TRAILER_BYTES];
+  if (_get32(trailer) != crc32(crc32(0L, Z_NULL, 0), &out[0], data_bytes) ||
+      _get32(trailer + 4) != (data_bytes & 0xffffffffULL)) {
+    throw SavedFileError(_filename + " fails a gzip CRC check");
+  }
+}
+
+void ChunkedGzReader::read(unsigned long long offset, void * buf,
+			   unsigned long long n)
+{
+  if (offset + n > _data_size) {
+    throw SavedFileError(_filename + " is truncated");
+  }
+  Byte * p = (Byte *) buf;
+
+  while (n) {
+    const unsigned int i = _find_chunk(offset);
+    if (_cached_chunk != i) {
+      _cached_chunk = -1;		// until it's been inflated.
+      inflate_chunk(i, _cache);
+      _cached_chunk = i;
+    }
+
+    const unsigned long long at = offset - _index[i].data_offset;
+    unsigned long long take = _cache.size() - at;
+    if (take > n) {
+      take = n;
+    }
+    memcpy(p, &_cache[at], take);
+
+    p += take;
+    n -= take;
+    offset += take;
+  }
+}
+
+//
+// read_parallel: each thread takes the next chunk, inflates it, and
+//     copies whatever parts of it the extents want.
+//
+
+namespace khmer {
+  struct _InflateState {
+    const ChunkedGzReader * reader;
+    const std::vector<ChunkedGzExtent> * extents;
+    std::vector<unsigned int> chunks;
+    std::vector<unsigned long long> chunk_starts;
+    unsigned int next;
+
+    Mutex error_lock;
+    bool failed;		// the workers stop at the first failure...
+    std::string error;		// ...and read_parallel throws this.
+  };
+}
+
+static void * _inflate_chunks(void * arg)
+{
+  _InflateState * state = (_InflateState *) arg;
+  const vector<ChunkedGzExtent> &extents = *state->extents;
+  vector<Byte> data;
+
+  while (1) {
+    unsigned int i = __sync_fetch_and_add(&state->next, 1);
+    if (i >= state->chunks.size() || state->failed) {
+      break;
+    }
+
+    try {
+      state->reader->inflate_chunk(state->chunks[i], data);
+    } catch (SavedFileError &e) {
+      ScopedLock lock(state->error_lock);
+      if (!state->failed) {
+	state->error = e.get_message();
+	state->failed = true;
+      }
+      break;
+    }
+    const unsigned long long start = state->chunk_starts[i];
+    const unsigned long long end = start + data.size();
+
+    for (unsigned int j = 0; j < extents.size(); j++) {
+      const ChunkedGzExtent &e = extents[j];
+      unsigned long long lo = e.offset > start ? e.offset : start;
+      unsigned long long hi = e.offset + e.length < end ?
+	e.offset + e.length : end;
+
+      if (lo < hi) {
+	memcpy(e.dest + (lo - e.offset), &data[lo - start], hi - lo);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void ChunkedGzReader::read_parallel(const std::vector<ChunkedGzExtent> &extents)
+  const
+{
+  _InflateState state;
+  state.reader = this;
+  state.extents = &extents;
+  state.next = 0;
+  state.failed = false;
+
+  // every chunk that overlaps an extent, once.
+  vector<bool> wanted(_index.size(), false);
+  for (unsigned int j = 0; j < extents.size(); j++) {
+    if (extents[j].length == 0) {
+      continue;
+    }
+    if (extents[j].offset + extents[j].length > _data_size) {
+      throw SavedFileError(_filename + " is truncated");
+    }
+
+    unsigned int first = _find_chunk(extents[j].offset);
+    unsigned int last = _find_chunk(extents[j].offset + extents[j].length - 1);
+    for (unsigned int i = first; i <= last; i++) {
+      wanted[i] = true;
+    }
+  }
+  for (unsigned int i = 0; i < wanted.size(); i++) {
+    if (wanted[i]) {
+      state.chunks.push_back(i);
+      state.chunk_starts.push_back(_index[i].data_offset);
+    }
+  }
+
+  unsigned int n_threads = _n_cpus();
+  if (n_threads > state.chunks.size()) {
+    n_threads = state.chunks.size();
+  }
+  if (n_threads <= 1) {
+    _inflate_chunks(&state);
+  } else {
+    vector<pthread_t> threads(n_threads);
+    for (unsigned int i = 0; i < n_threads; i++) {
+      int ret = pthread_create(&threads[i], NULL, _inflate_chunks, &state);
+      assert(ret == 0);
+    }
+    for (unsigned int i = 0; i < n_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  if (state.failed) {
+    throw SavedFileError(state.error);
+  }
+}
@@ -0,0 +1,124 @@
+#ifndef CHUNKEDGZ_HH
+#define CHUNKEDGZ_HH
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "khmer.hh"
+
+#define GZ_CHUNK_BYTES (4 * 1024 * 1024)	// uncompressed, per member.
+#define MAX_GZ_THREADS 16
+
+namespace khmer {
+  // a file that can't be loaded as it stands: not what it says it is,
+  // truncated, or failing a CRC.
+  class SavedFileError {
+  private:
+    std::string _message;
+  public:
+    SavedFileError(const std::string &message) : _message(message) { }
+    const std::string &get_message() const { return _message; }
+  };
+
+  //
+  // Chunked gzip, much like BGZF: the data is cut into chunks, each
+  // deflated on its own into a complete gzip member, so that they can
+  // be compressed and decompressed in parallel.  Each member's extra
+  // field ("KC") holds its size, less one.  After the data come empty
+  // members whose extra fields ("KX") hold the chunk index -- the
+  // compressed and uncompressed offset of every member -- and last, a
+  // fixed-size member ("KI") saying where the index starts.
+  //
+  // It is still just a gzip file: gunzip (or gzread) gives back the
+  // data, and ignores the rest.
+  //
+  // The first chunk is head_bytes long and stored uncompressed, so
+  // that it can be rewritten in place when the writer is closed; the
+  // sectioned format uses it for its header page.
+  //
+
+  struct ChunkedGzEntry {
+    unsigned long long offset;		// of the member, in the file.
+    unsigned long long data_offset;	// of its data, uncompressed.
+  };
+
+  class ChunkedGzWriter {
+  protected:
+    std::ofstream _outfile;
+    const unsigned long long _head_bytes;
+    unsigned int _n_threads;
+
+    std::vector<ChunkedGzEntry> _index;
+    unsigned long long _written;	// compressed bytes written so far.
+    unsigned long long _data_size;	// uncompressed bytes so far.
+    unsigned long long _flushed_data;	// ...of which, written.
+
+    std::vector<std::vector<Byte> > _chunks; // full, waiting to be deflated.
+    std::vector<Byte> _chunk;		// being filled.
+
+    void _add_chunk();
+    void _flush_chunks();
+  public:
+    ChunkedGzWriter(const std::string &filename, unsigned long long head_bytes);
+    ~ChunkedGzWriter() { close(NULL); }
+
+    void write(const void * data, unsigned long long n);
+
+    // uncompressed bytes written so far.
+    unsigned long long tell() const { return _data_size; }
+
+    // write out the rest, then the index; if head isn't NULL, replace
+    // the first head_bytes of data with it.
+    void close(const void * head);
+  };
+
+  // where to put each piece of the data, for ChunkedGzReader::read_parallel.
+  struct ChunkedGzExtent {
+    unsigned long long offset;	// uncompressed.
+    unsigned long long length;
+    Byte * dest;
+  };
+
+  //
+  // ChunkedGzReader: throws SavedFileError if the file is truncated, or a
+  // chunk or the index is corrupt.
+  //
+
+  class ChunkedGzReader {
+  protected:
+    std::string _filename;
+    int _fd;
+    std::vector<ChunkedGzEntry> _index;
+    unsigned long long _index_offset;	// where the data members stop.
+    unsigned long long _data_size;
+
+    long long _cached_chunk;		// in _cache, for read().
+    std::vector<Byte> _cache;
+
+    unsigned int _find_chunk(unsigned long long offset) const;
+    void _pread_fully(void * buf, unsigned long long n,
+		      unsigned long long offset) const;
+    void _read_index();
+  public:
+    ChunkedGzReader(const std::string &filename);
+    ~ChunkedGzReader();
+
+    // does this file end with a chunk index?
+    static bool is_chunked(const std::string &filename);
+
+    unsigned long long size() const { return _data_size; }
+    unsigned int n_chunks() const { return _index.size(); }
+
+    // inflate chunk i into out, checking its CRC.
+    void inflate_chunk(unsigned int i, std::vector<Byte> &out) const;
+
+    // n bytes of data starting at offset, one chunk at a time.
+    void read(unsigned long long offset, void * buf, unsigned long long n);
+
+    // fill every extent, inflating the chunks they cover in parallel.
+    void read_parallel(const std::vector<ChunkedGzExtent> &extents) const;
+  };
+};
+
+#endif // CHUNKEDGZ_HH
@@ -2,9 +2,11 @@
 #include "counting.hh"
 #include "hashbits.hh"
 #include "parsers.hh"
+#include "savedfile.hh"
 
 #include "zlib-1.2.3/zlib.h"
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 
 using namespace std;
@@ -360,9 +362,15 @@ BoundedCounterType CountingHash::get_min_count(const std::string &s,
 					    HashIntoType lower_bound,
 					    HashIntoType upper_bound)
 {
-  KMerIterator kmers(s.c_str(), _ksize);
+  KmerExtractor kmers;
+  kmers.extract(s, _ksize, _unique_rc);
   HashIntoType kmer;
 
+  std::vector<BoundedCounterType> counts(kmers.size());
+  if (kmers.size()) {
+    get_counts(kmers.kmers(), kmers.size(), &counts[0]);
+  }
+
   BoundedCounterType min_count = MAX_COUNT, count;
 
   bool bounded = true;
@@ -370,11 +378,11 @@ BoundedCounterType CountingHash::get_min_count(const std::string &s,
     bounded = false;
   }
 
-  while(!kmers.done()) {
-    kmer = kmers.next();
+  for (unsigned int i = 0; i < kmers.size(); i++) {
+    kmer = kmers[i];
 
     if (!bounded || (kmer >= lower_bound && kmer < upper_bound)) {
-      count = this->get_count(kmer);
+      count = counts[i];
     
       if (count < min_count) {
 	min_count = count;
@@ -388,7 +396,13 @@ BoundedCounterType CountingHash::get_max_count(const std::string &s,
 					    HashIntoType lower_bound,
 					    HashIntoType upper_bound)
 {
-  KMerIterator kmers(s.c_str(), _ksize);
+  KmerExtractor kmers;
+  kmers.extract(s, _ksize, _unique_rc);
+
+  std::vector<BoundedCounterType> counts(kmers.size());
+  if (kmers.size()) {
+    get_counts(kmers.kmers(), kmers.size(), &counts[0]);
+  }
 
   BoundedCounterType max_count = 0, count;
 
@@ -398,11 +412,11 @@ BoundedCounterType CountingHash::get_max_count(const std::string &s,
   }
 
   HashIntoType kmer;
-  while(!kmers.done()) {
-    kmer = kmers.next();
+  for (unsigned int i = 0; i < kmers.size(); i++) {
+    kmer = kmers[i];
 
     if (!bounded || (kmer >= lower_bound && kmer < upper_bound)) {
-      count = this->get_count(kmer);
+      count = counts[i];
 
       if (count > max_count) {
 	max_count = count;
@@ -424,49 +438,49 @@ HashIntoType * CountingHash::abundance_distribution(std::string filename,
     dist[i] = 0;
   }
 
-  Read read;
+  ReadBatch batch;
+  KmerExtractor kmers;
+  std::vector<BoundedCounterType> counts;
   IParser* parser = IParser::get_parser(filename.c_str());
-  string name;
-  string seq;
   unsigned long long read_num = 0;
 
   // if not, could lead to overflow.
   assert(sizeof(BoundedCounterType) == 2);
 
-  while(!parser->is_complete()) {
-    read = parser->get_next_read();
-    seq = read.seq;
-
-    if (check_read(seq)) {
-      HashIntoType kmer;
-      KMerIterator kmers(seq.c_str(), _ksize);
+  while(parser->get_next_batch(batch)) {
+    for (unsigned int i = 0; i < batch.size(); i++) {
+      if (kmers.extract(batch.seq(i), batch.seq_len(i), _ksize, _unique_rc)) {
+	HashIntoType kmer;
 
-      while(!kmers.done()) {
-	kmer = kmers.next();
+	counts.resize(kmers.size());
+	get_counts(kmers.kmers(), kmers.size(), &counts[0]);
 
-	if (!tracking->get_count(kmer)) {
-	  tracking->count(kmer);
+	// tracking is updated as we go, so that a k-mer seen twice in
+	// this read is only counted once; look it up one at a time.
+	for (unsigned int j = 0; j < kmers.size(); j++) {
+	  kmer = kmers[j];
 
-	  BoundedCounterType n = get_count(kmer);
-	  dist[n]++;
+	  if (!tracking->get_count(kmer)) {
+	    tracking->count(kmer);
+	    dist[counts[j]]++;
+	  }
 	}
       }
 
-      name.clear();
-      seq.clear();
-    }
-
-    read_num += 1;
+      read_num += 1;
 
-    // run callback, if specified
-    if (read_num % CALLBACK_PERIOD == 0 && callback) {
-      try {
-        callback("abundance_distribution", callback_data, read_num, 0);
-      } catch (...) {
-        throw;
+      // run callback, if specified
+      if (read_num % CALLBACK_PERIOD == 0 && callback) {
+	try {
+	  callback("abundance_distribution", callback_data, read_num, 0);
+	} catch (...) {
+	  delete parser;
+	  throw;
+	}
       }
     }
   }
+  delete parser;
 
   return dist;
 }
@@ -592,6 +606,11 @@ void CountingHash::load(std::string infilename)
   CountingHashFile::load(infilename, *this);
 }
 
+void CountingHash::load_mmap(std::string infilename)
+{
+  CountingHashFile::load(infilename, *this, true);
+}
+
 // technically, get medioid count... our "median" is always a member of the
 // population.
 
@@ -600,14 +619,12 @@ void CountingHash::get_median_count(const std::string &s,
 				    float &average,
 				    float &stddev)
 {
-  BoundedCounterType count;
-  std::vector<BoundedCounterType> counts;
-  KMerIterator kmers(s.c_str(), _ksize);
+  KmerExtractor kmers;
+  kmers.extract(s, _ksize, _unique_rc);
 
-  while(!kmers.done()) {
-    HashIntoType kmer = kmers.next();
-    count = this->get_count(kmer);
-    counts.push_back(count);
+  std::vector<BoundedCounterType> counts(kmers.size());
+  if (kmers.size()) {
+    get_counts(kmers.kmers(), kmers.size(), &counts[0]);
   }
 
   assert(counts.size());
@@ -643,14 +660,12 @@ void CountingHash::get_kadian_count(const std::string &s,
 				    BoundedCounterType &kadian,
 				    unsigned int nk)
 {
-  BoundedCounterType count;
-  std::vector<BoundedCounterType> counts;
-  KMerIterator kmers(s.c_str(), _ksize);
+  KmerExtractor kmers;
+  kmers.extract(s, _ksize, _unique_rc);
 
-  while(!kmers.done()) {
-    HashIntoType kmer = kmers.next();
-    count = this->get_count(kmer);
-    counts.push_back(count);
+  std::vector<BoundedCounterType> counts(kmers.size());
+  if (kmers.size()) {
+    get_counts(kmers.kmers(), kmers.size(), &counts[0]);
   }
 
   assert(counts.size());
@@ -806,31 +821,26 @@ unsigned int CountingHash::trim_on_abundance(std::string seq,
 					     BoundedCounterType min_abund)
   const
 {
-  if (!check_read(seq)) {
+  KmerExtractor kmers;
+  if (!kmers.extract(seq, _ksize, _unique_rc)) { // also checks the read.
     return 0;
   }
 
-  KMerIterator kmers(seq.c_str(), _ksize);
-
-  SeenSet path;
-
-  HashIntoType kmer;
+  if (kmers.size() < 2) {
+    return 0;
+  }
 
-  if (kmers.done()) { return 0; }
-  kmer = kmers.next();
+  std::vector<BoundedCounterType> counts(kmers.size());
+  get_counts(kmers.kmers(), kmers.size(), &counts[0]);
 
-  if (kmers.done() || get_count(kmer) < min_abund) {
+  if (counts[0] < min_abund) {
     return 0;
   }
 
-  unsigned int i = _ksize;
-  while (!kmers.done()) {
-    kmer = kmers.next();
-
-    if (get_count(kmer) < min_abund) {
-      return i;
+  for (unsigned int i = 1; i < kmers.size(); i++) {
+    if (counts[i] < min_abund) {
+      return _ksize + i - 1;
     }
-    i++;
   }
 
   return seq.length();
@@ -841,45 +851,41 @@ unsigned int CountingHash::trim_below_abundance(std::string seq,
 						BoundedCounterType max_abund)
   const
 {
-  if (!check_read(seq)) {
+  KmerExtractor kmers;
+  if (!kmers.extract(seq, _ksize, _unique_rc)) { // also checks the read.
     return 0;
   }
 
-  KMerIterator kmers(seq.c_str(), _ksize);
-
-  SeenSet path;
-
-  HashIntoType kmer;
+  if (kmers.size() < 2) {
+    return 0;
+  }
 
-  if (kmers.done()) { return 0; }
-  kmer = kmers.next();
+  std::vector<BoundedCounterType> counts(kmers.size());
+  get_counts(kmers.kmers(), kmers.size(), &counts[0]);
 
-  if (kmers.done() || get_count(kmer) > max_abund) {
+  if (counts[0] > max_abund) {
     return 0;
   }
 
-  unsigned int i = _ksize;
-  while (!kmers.done()) {
-    kmer = kmers.next();
-
-    if (get_count(kmer) > max_abund) {
-      return i;
+  for (unsigned int i = 1; i < kmers.size(); i++) {
+    if (counts[i] > max_abund) {
+      return _ksize + i - 1;
     }
-    i++;
   }
 
   return seq.length();
 }
 
 
-void CountingHashFile::load(const std::string &infilename, CountingHash &ht)
+void CountingHashFile::load(const std::string &infilename, CountingHash &ht,
+			    bool use_mmap)
 {
    std::string filename(infilename);
    int found = filename.find_last_of(".");
    std::string type = filename.substr(found+1);
 
    if (type == "gz") { CountingHashGzFileReader(filename, ht); }
-   else { CountingHashFileReader(filename, ht); }
+   else { CountingHashFileReader(filename, ht, use_mmap); }
 }
 
 
@@ -894,28 +900,39 @@ void CountingHashFile::save(const std::string &outfilename, const CountingHash &
 }
 
 
-CountingHashFileReader::CountingHashFileReader(const std::string &infilename, CountingHash &ht)
+CountingHashFileReader::CountingHashFileReader(const std::string &infilename, CountingHash &ht,
+					       bool use_mmap)
 {
-  if (ht._counts) {
-    for (unsigned int i = 0; i < ht._n_tables; i++) {
-      delete ht._counts[i]; ht._counts[i] = NULL;
-    }
-    delete ht._counts; ht._counts = NULL;
+  if (SectionedFileReader::is_sectioned(infilename)) {
+    _load_sectioned(infilename, ht, use_mmap);
+    return;
   }
-  ht._tablesizes.clear();
-  
+
   unsigned int save_ksize = 0;
   unsigned char save_n_tables = 0;
   unsigned long long save_tablesize = 0;
-  unsigned char version, ht_type, use_bigcount;
+  unsigned char version = 0, ht_type = 0, use_bigcount;
 
   ifstream infile(infilename.c_str(), ios::binary);
-  assert(infile.is_open());
+  if (!infile.is_open()) {
+    throw SavedFileError("can't open " + infilename);
+  }
 
   infile.read((char *) &version, 1);
   infile.read((char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_COUNTING_HT);
+  if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_COUNTING_HT) {
+    throw SavedFileError(infilename + " is not a saved counting table");
+  }
+
+  if (ht._counts) {
+    for (unsigned int i = 0; i < ht._n_tables; i++) {
+      free_table(ht._counts[i]); ht._counts[i] = NULL;
+    }
+    delete[] ht._counts; ht._counts = NULL;
+  }
+  ht._tablesizes.clear();
+
+  ht._family = HashFamily(HASH_FAMILY_MODULO);
 
   infile.read((char *) &use_bigcount, 1);
   infile.read((char *) &save_ksize, sizeof(save_ksize));
@@ -936,11 +953,15 @@ CountingHashFileReader::CountingHashFileReader(const std::string &infilename, Co
     tablesize = (HashIntoType) save_tablesize;
     ht._tablesizes.push_back(tablesize);
 
-    ht._counts[i] = new Byte[tablesize];
+    ht._counts[i] = allocate_table(tablesize);
 
     unsigned long long loaded = 0;
     while (loaded != tablesize) {
       infile.read((char *) ht._counts[i], tablesize - loaded);
+      if (infile.gcount() == 0) {
+	ht._n_tables = i + 1;	// (so that the rest aren't freed.)
+	throw SavedFileError(infilename + " is truncated");
+      }
       loaded += infile.gcount();	// do I need to do this loop?
     }
   }
@@ -949,7 +970,7 @@ CountingHashFileReader::CountingHashFileReader(const std::string &infilename, Co
   infile.read((char *) &n_counts, sizeof(n_counts));
 
   if (n_counts) {
-    ht._bigcounts.clear();
+    ht._clear_bigcounts();
 
     HashIntoType kmer;
     BoundedCounterType count;
@@ -957,34 +978,110 @@ CountingHashFileReader::CountingHashFileReader(const std::string &infilename, Co
     for (HashIntoType n = 0; n < n_counts; n++) {
       infile.read((char *) &kmer, sizeof(kmer));
       infile.read((char *) &count, sizeof(count));
-      ht._bigcounts[kmer] = count;
+      ht._bigcount_stripe(kmer)[kmer] = count;
     }
   }
 
   infile.close();
 }
 
-CountingHashGzFileReader::CountingHashGzFileReader(const std::string &infilename, CountingHash &ht)
+void CountingHashFile::_load_sectioned(const std::string &infilename,
+					     CountingHash &ht, bool use_mmap)
 {
+  SectionedFileReader infile(infilename, SAVED_COUNTING_HT);
+
+  // the old tables stay, if it can't be loaded.
+  SavedParams params;
+  std::vector<HashIntoType> tablesizes;
+  infile.read_params(params, tablesizes, ht.unique_rc());
+
+  // (kmer, count) pairs.
+  const unsigned int pair_bytes = sizeof(HashIntoType) +
+    sizeof(BoundedCounterType);
+  std::vector<char> buf;
+
+  const SavedSection * section = infile.find(SECTION_BIGCOUNTS);
+  if (section) {
+    if (section->length % pair_bytes) {
+      throw SavedFileError(infilename + " has a section of the wrong size");
+    }
+
+    buf.resize(section->length);
+    if (!buf.empty()) {
+      infile.read_section(*section, &buf[0]);
+    }
+  }
+
+  Byte ** counts = new Byte*[params.n_tables];
+  try {
+    infile.read_tables(tablesizes, counts, use_mmap);
+  } catch (...) {
+    delete[] counts;
+    throw;
+  }
+
   if (ht._counts) {
     for (unsigned int i = 0; i < ht._n_tables; i++) {
-      delete ht._counts[i]; ht._counts[i] = NULL;
+      free_table(ht._counts[i]); ht._counts[i] = NULL;
     }
-    delete ht._counts; ht._counts = NULL;
+    delete[] ht._counts; ht._counts = NULL;
   }
-  ht._tablesizes.clear();
-  
+  ht._counts = counts;
+  ht._tablesizes = tablesizes;
+
+  ht._family = HashFamily(params.hash_family);
+  ht._ksize = (WordLength) params.ksize;
+  ht._n_tables = params.n_tables;
+  ht._init_bitstuff();
+
+  ht._use_bigcount = params.use_bigcount;
+
+  ht._clear_bigcounts();
+
+  for (unsigned long long i = 0; i < buf.size(); i += pair_bytes) {
+    HashIntoType kmer;
+    BoundedCounterType count;
+
+    memcpy(&kmer, &buf[i], sizeof(kmer));
+    memcpy(&count, &buf[i + sizeof(kmer)], sizeof(count));
+    ht._bigcount_stripe(kmer)[kmer] = count;
+  }
+}
+
+CountingHashGzFileReader::CountingHashGzFileReader(const std::string &infilename, CountingHash &ht)
+{
+  // a saved file, gzipped afterwards.
+  if (SectionedFileReader::is_sectioned(infilename)) {
+    _load_sectioned(infilename, ht, false);
+    return;
+  }
+
   unsigned int save_ksize = 0;
   unsigned char save_n_tables = 0;
   unsigned long long save_tablesize = 0;
-  unsigned char version, ht_type, use_bigcount;
+  unsigned char version = 0, ht_type = 0, use_bigcount;
 
   gzFile infile = gzopen(infilename.c_str(), "rb");
+  if (infile == NULL) {
+    throw SavedFileError("can't open " + infilename);
+  }
 
   gzread(infile, (char *) &version, 1);
   gzread(infile, (char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_COUNTING_HT);
+  if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_COUNTING_HT) {
+    gzclose(infile);
+    throw SavedFileError(infilename + " is not a saved counting table");
+  }
+
+  if (ht._counts) {
+    for (unsigned int i = 0; i < ht._n_tables; i++) {
+      free_table(ht._counts[i]); ht._counts[i] = NULL;
+    }
+    delete[] ht._counts; ht._counts = NULL;
+  }
+  ht._tablesizes.clear();
+
+  ht._family = HashFamily(HASH_FAMILY_MODULO);
 
   gzread(infile, (char *) &use_bigcount, 1);
   gzread(infile, (char *) &save_ksize, sizeof(save_ksize));
@@ -1005,11 +1102,17 @@ CountingHashGzFileReader::CountingHashGzFileReader(const std::string &infilename
     tablesize = (HashIntoType) save_tablesize;
     ht._tablesizes.push_back(tablesize);
 
-    ht._counts[i] = new Byte[tablesize];
+    ht._counts[i] = allocate_table(tablesize);
 
     unsigned long long loaded = 0;
     while (loaded != tablesize) {
-      loaded += gzread(infile, (char *) ht._counts[i], tablesize - loaded);
+      int got = gzread(infile, (char *) ht._counts[i], tablesize - loaded);
+      if (got <= 0) {
+	gzclose(infile);
+	ht._n_tables = i + 1;	// (so that the rest aren't freed.)
+	throw SavedFileError(infilename + " is truncated or corrupt");
+      }
+      loaded += got;
     }
   }
 
@@ -1017,7 +1120,7 @@ CountingHashGzFileReader::CountingHashGzFileReader(const std::string &infilename
   gzread(infile, (char *) &n_counts, sizeof(n_counts));
 
   if (n_counts) {
-    ht._bigcounts.clear();
+    ht._clear_bigcounts();
 
     HashIntoType kmer;
     BoundedCounterType count;
@@ -1025,105 +1128,75 @@ CountingHashGzFileReader::CountingHashGzFileReader(const std::string &infilename
     for (HashIntoType n = 0; n < n_counts; n++) {
       gzread(infile, (char *) &kmer, sizeof(kmer));
       gzread(infile, (char *) &count, sizeof(count));
-      ht._bigcounts[kmer] = count;
+      ht._bigcount_stripe(kmer)[kmer] = count;
     }
   }
 
   gzclose(infile);
 }
 
-CountingHashFileWriter::CountingHashFileWriter(const std::string &outfilename, const CountingHash &ht)
+//
+// _save_sectioned: the same file either way; compressed, it is written as
+//    chunked gzip, deflated in parallel.
+//
+
+void CountingHashFile::_save_sectioned(const std::string &outfilename,
+				       const CountingHash &ht,
+				       bool compressed)
 {
   assert(ht._counts[0]);
 
-  unsigned int save_ksize = ht._ksize;
-  unsigned char save_n_tables = ht._n_tables;
-  unsigned long long save_tablesize;
+  SectionedFileWriter outfile(outfilename, SAVED_COUNTING_HT, compressed);
 
-  ofstream outfile(outfilename.c_str(), ios::binary);
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = ht._ksize;
+  params.hash_family = ht._family.type();
+  params.use_bigcount = ht._use_bigcount ? 1 : 0;
+  params.n_tables = ht._n_tables;
+  outfile.write_params(params, ht._tablesizes, ht.unique_rc());
 
-  unsigned char version = SAVED_FORMAT_VERSION;
-  outfile.write((const char *) &version, 1);
-
-  unsigned char ht_type = SAVED_COUNTING_HT;
-  outfile.write((const char *) &ht_type, 1);
-
-  unsigned char use_bigcount = 0;
-  if (ht._use_bigcount) {
-    use_bigcount = 1;
+  for (unsigned int i = 0; i < ht._n_tables; i++) {
+    outfile.write_section(SECTION_TABLE, ht._counts[i], ht._tablesizes[i]);
   }
-  outfile.write((const char *) &use_bigcount, 1);
 
-  outfile.write((const char *) &save_ksize, sizeof(save_ksize));
-  outfile.write((const char *) &save_n_tables, sizeof(save_n_tables));
+  // (kmer, count) pairs, packed as in the older format.
+  const unsigned int pair_bytes = sizeof(HashIntoType) +
+    sizeof(BoundedCounterType);
+  std::vector<char> buf;
 
-  for (unsigned int i = 0; i < save_n_tables; i++) {
-    save_tablesize = ht._tablesizes[i];
+  outfile.begin_section(SECTION_BIGCOUNTS);
+  for (unsigned int i = 0; i < N_BIGCOUNT_STRIPES; i++) {
+    KmerCountMap::const_iterator it = ht._bigcounts[i].begin();
 
-    outfile.write((const char *) &save_tablesize, sizeof(save_tablesize));
-    outfile.write((const char *) ht._counts[i], save_tablesize);
-  }
-
-  HashIntoType n_counts = ht._bigcounts.size();
-  outfile.write((const char *) &n_counts, sizeof(n_counts));
+    for (; it != ht._bigcounts[i].end(); it++) {
+      buf.resize(buf.size() + pair_bytes);
+      char * pair = &buf[buf.size() - pair_bytes];
+      memcpy(pair, &it->first, sizeof(it->first));
+      memcpy(pair + sizeof(it->first), &it->second, sizeof(it->second));
 
-  if (n_counts) {
-    KmerCountMap::const_iterator it = ht._bigcounts.begin();
-    
-    for (; it != ht._bigcounts.end(); it++) {
-      outfile.write((const char *) &it->first, sizeof(it->first));
-      outfile.write((const char *) &it->second, sizeof(it->second));
+      if (buf.size() >= SAVED_PAGE_BYTES * 256) {
+	outfile.write(&buf[0], buf.size());
+	buf.clear();
+      }
     }
   }
+  if (!buf.empty()) {
+    outfile.write(&buf[0], buf.size());
+  }
+  outfile.end_section();
 
   outfile.close();
 }
 
-CountingHashGzFileWriter::CountingHashGzFileWriter(const std::string &outfilename, const CountingHash &ht)
+CountingHashFileWriter::CountingHashFileWriter(const std::string &outfilename, const CountingHash &ht)
 {
-  assert(ht._counts[0]);
-
-  unsigned int save_ksize = ht._ksize;
-  unsigned char save_n_tables = ht._n_tables;
-  unsigned long long save_tablesize;
-
-  gzFile outfile = gzopen(outfilename.c_str(), "wb");
-
-  unsigned char version = SAVED_FORMAT_VERSION;
-  gzwrite(outfile, (const char *) &version, 1);
-
-  unsigned char ht_type = SAVED_COUNTING_HT;
-  gzwrite(outfile, (const char *) &ht_type, 1);
-
-  unsigned char use_bigcount = 0;
-  if (ht._use_bigcount) {
-    use_bigcount = 1;
-  }
-  gzwrite(outfile, (const char *) &use_bigcount, 1);
-
-  gzwrite(outfile, (const char *) &save_ksize, sizeof(save_ksize));
-  gzwrite(outfile, (const char *) &save_n_tables, sizeof(save_n_tables));
-
-  for (unsigned int i = 0; i < save_n_tables; i++) {
-    save_tablesize = ht._tablesizes[i];
-
-    gzwrite(outfile, (const char *) &save_tablesize, sizeof(save_tablesize));
-    gzwrite(outfile, (const char *) ht._counts[i], save_tablesize);
-  }
-
-  HashIntoType n_counts = ht._bigcounts.size();
-  gzwrite(outfile, (const char *) &n_counts, sizeof(n_counts));
-
-  if (n_counts) {
-    KmerCountMap::const_iterator it = ht._bigcounts.begin();
-    
-    for (; it != ht._bigcounts.end(); it++) {
-      gzwrite(outfile, (const char *) &it->first, sizeof(it->first));
-      gzwrite(outfile, (const char *) &it->second, sizeof(it->second));
-    }
-  }
+  _save_sectioned(outfilename, ht, false);
+}
 
-  gzclose(outfile);
+CountingHashGzFileWriter::CountingHashGzFileWriter(const std::string &outfilename, const CountingHash &ht)
+{
+  _save_sectioned(outfilename, ht, true);
 }
 
 void CountingHash::collect_high_abundance_kmers(const std::string &filename,
@@ -1154,7 +1227,7 @@ void CountingHash::collect_high_abundance_kmers(const std::string &filename,
     if (check_read(currSeq)) {
       const char * sp = currSeq.c_str();
 
-      KMerIterator kmers(sp, _ksize);
+      KMerIterator kmers(sp, _ksize, _unique_rc);
       HashIntoType kmer;
 
       while(!kmers.done()) {
@@ -1195,7 +1268,7 @@ void CountingHash::collect_high_abundance_kmers(const std::string &filename,
     if (check_read(currSeq)) {
       const char * sp = currSeq.c_str();
 
-      KMerIterator kmers(sp, _ksize);
+      KMerIterator kmers(sp, _ksize, _unique_rc);
       HashIntoType kmer;
 
       while(!kmers.done()) {
@@ -1216,3 +1289,83 @@ void CountingHash::collect_high_abundance_kmers(const std::string &filename,
   }
   delete parser; parser = NULL;
 }
+
+//
+// count_concurrent: see counting.hh.
+//
+
+void CountingHash::count_concurrent(const HashIntoType * kmers,
+				    unsigned int n)
+{
+  for (unsigned int k = 0; k < n; k++) {
+    const HashIntoType khash = kmers[k];
+    const HashIntoType h = _family.prepare(khash);
+    unsigned int n_full = 0;
+
+    for (unsigned int i = 0; i < _n_tables; i++) {
+      Byte * bin = &_counts[i][_family.bin(h, i, _tablesizes[i])];
+      if (_increment_atomic(bin) >= MAX_COUNT) {
+	n_full++;
+      }
+    }
+
+    if (n_full == _n_tables && _use_bigcount) {
+      ScopedLock lock(_bigcount_locks[khash % N_BIGCOUNT_STRIPES]);
+      _increment_bigcount(khash);
+    }
+  }
+}
+
+//
+// count_staged: stage the counters, then bump them a region at a time.
+//     Updates to a counter stay in k-mer order, so which k-mers found
+//     all their counters full -- and so the bigcounts -- come out as
+//     they would from count().
+//
+
+void CountingHash::count_staged(const HashIntoType * kmers, unsigned int n,
+				StagingBuffer &buffer)
+{
+  std::vector<unsigned int> first_region(_n_tables);
+  unsigned int n_regions = 0;
+  for (unsigned int i = 0; i < _n_tables; i++) {
+    first_region[i] = n_regions;
+    n_regions += (_tablesizes[i] >> STAGING_REGION_SHIFT) + 1;
+  }
+
+  for (unsigned int start = 0; start < n; start += STAGING_MAX_KMERS) {
+    const unsigned int n_chunk = min(n - start, (unsigned int) STAGING_MAX_KMERS);
+
+    buffer.bins.clear();
+    for (unsigned int k = 0; k < n_chunk; k++) {
+      const HashIntoType h = _family.prepare(kmers[start + k]);
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
+	buffer.add(&_counts[i][bin],
+		   first_region[i] + (bin >> STAGING_REGION_SHIFT), k);
+      }
+    }
+    buffer.sort(n_regions);
+
+    // count the full counters for each k-mer.
+    buffer.kmer_flags.assign(n_chunk, 0);
+
+    for (unsigned int j = 0; j < buffer.sorted.size(); j++) {
+      const StagedBin &b = buffer.sorted[j];
+      if (_increment_atomic(b.byte) >= MAX_COUNT) {
+	buffer.kmer_flags[b.kmer_bit >> 3]++;
+      }
+    }
+
+    if (_use_bigcount) {
+      for (unsigned int k = 0; k < n_chunk; k++) {
+	if (buffer.kmer_flags[k] == _n_tables) {
+	  const HashIntoType khash = kmers[start + k];
+	  ScopedLock lock(_bigcount_locks[khash % N_BIGCOUNT_STRIPES]);
+	  _increment_bigcount(khash);
+	}
+      }
+    }
+  }
+}
@@ -5,9 +5,27 @@
 #include "hashtable.hh"
 #include "hashbits.hh"
 
+#define N_BIGCOUNT_STRIPES 64
+
 namespace khmer {
   typedef std::map<HashIntoType, BoundedCounterType> KmerCountMap;
 
+  // saturating increment of a count shared between threads; returns
+  // the old value.
+  inline Byte _increment_atomic(Byte * bin)
+  {
+    Byte old = *bin;
+
+    while (old < MAX_COUNT) {
+      Byte seen = __sync_val_compare_and_swap(bin, old, old + 1);
+      if (seen == old) {
+	break;
+      }
+      old = seen;
+    }
+    return old;
+  }
+
   class CountingHashIntersect;
   class CountingHashFile;
   class CountingHashFileReader;
@@ -35,12 +53,49 @@ namespace khmer {
 
       _counts = new Byte*[_n_tables];
       for (unsigned int i = 0; i < _n_tables; i++) {
-	_counts[i] = new Byte[_tablesizes[i]];
-	memset(_counts[i], 0, _tablesizes[i]);
+	_counts[i] = allocate_table(_tablesizes[i]);
+      }
+    }
+
+    // one lock per _bigcounts stripe, for count_concurrent().
+    Mutex _bigcount_locks[N_BIGCOUNT_STRIPES];
+
+    KmerCountMap& _bigcount_stripe(HashIntoType khash) {
+      return _bigcounts[khash % N_BIGCOUNT_STRIPES];
+    }
+    const KmerCountMap& _bigcount_stripe(HashIntoType khash) const {
+      return _bigcounts[khash % N_BIGCOUNT_STRIPES];
+    }
+
+    HashIntoType _n_bigcounts() const {
+      HashIntoType n = 0;
+      for (unsigned int i = 0; i < N_BIGCOUNT_STRIPES; i++) {
+	n += _bigcounts[i].size();
+      }
+      return n;
+    }
+
+    void _clear_bigcounts() {
+      for (unsigned int i = 0; i < N_BIGCOUNT_STRIPES; i++) {
+	_bigcounts[i].clear();
+      }
+    }
+
+    // for subclasses that lay out their own counters; leaves _counts NULL.
+    CountingHash(WordLength ksize, std::vector<HashIntoType>& tablesizes,
+		 bool allocate) :
+      khmer::Hashtable(ksize), _use_bigcount(false), _tablesizes(tablesizes) {
+      _n_tables = _tablesizes.size();
+      _counts = NULL;
+
+      if (allocate) {
+	_allocate_counters();
       }
     }
   public:
-    KmerCountMap _bigcounts;
+    // counts above MAX_COUNT, split by k-mer into stripes so that
+    // concurrent updates only contend within a stripe.
+    KmerCountMap _bigcounts[N_BIGCOUNT_STRIPES];
 
     CountingHash(WordLength ksize, HashIntoType single_tablesize) :
       khmer::Hashtable(ksize), _use_bigcount(false) {
@@ -58,7 +113,7 @@ namespace khmer {
     virtual ~CountingHash() {
       if (_counts) {
 	for (unsigned int i = 0; i < _n_tables; i++) {
-	  delete _counts[i];
+	  free_table(_counts[i]);
 	  _counts[i] = NULL;
 	}
 
@@ -78,6 +133,14 @@ namespace khmer {
 
     virtual void save(std::string);
     virtual void load(std::string);
+    virtual void load_mmap(std::string);
+
+    virtual void clear() {
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	clear_table(_counts[i]);
+      }
+      _clear_bigcounts();
+    }
 
     // accessors to get table info
     const HashIntoType n_entries() const { return _tablesizes[0]; }
@@ -96,14 +159,15 @@ namespace khmer {
     }
 
     virtual void count(const char * kmer) {
-      HashIntoType hash = _hash(kmer, _ksize);
+      HashIntoType hash = hash_kmer(kmer);
       count(hash);
     }
 
     virtual void count(HashIntoType khash) {
+      const HashIntoType h = _family.prepare(khash);
       unsigned int n_full = 0;
       for (unsigned int i = 0; i < _n_tables; i++) {
-	const HashIntoType bin = khash % _tablesizes[i];
+	const HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
 
 	if (_counts[i][bin] < MAX_COUNT) {
 	  _counts[i][bin] += 1;
@@ -113,40 +177,77 @@ namespace khmer {
       }
 
       if (n_full == _n_tables && _use_bigcount) {
-	if (_bigcounts[khash] == 0) {
-	  _bigcounts[khash] = MAX_COUNT + 1;
-	} else {
-	  if (_bigcounts[khash] < MAX_BIGCOUNT) {
-	    _bigcounts[khash] += 1;
-	  }
+	_increment_bigcount(khash);
+      }
+    }
+
+    void _increment_bigcount(HashIntoType khash) {
+      BoundedCounterType &bigcount = _bigcount_stripe(khash)[khash];
+      if (bigcount == 0) {
+	bigcount = MAX_COUNT + 1;
+      } else {
+	if (bigcount < MAX_BIGCOUNT) {
+	  bigcount += 1;
 	}
       }
     }
 
+    // CAS-based saturating increments on the counters, with overflow
+    // into _bigcounts under a per-stripe lock.
+    virtual void count_concurrent(const HashIntoType * kmers,
+				  unsigned int n);
+
+    // see Hashtable::count_staged.
+    virtual void count_staged(const HashIntoType * kmers, unsigned int n,
+			      StagingBuffer &buffer);
+
     // get the count for the given k-mer.
     virtual const BoundedCounterType get_count(const char * kmer) const {
-      HashIntoType hash = _hash(kmer, _ksize);
+      HashIntoType hash = hash_kmer(kmer);
       return get_count(hash);
     }
 
     // get the count for the given k-mer hash.
     virtual const BoundedCounterType get_count(HashIntoType khash) const {
+      const HashIntoType h = _family.prepare(khash);
       BoundedCounterType min_count = MAX_COUNT;
       for (unsigned int i = 0; i < _n_tables; i++) {
-	BoundedCounterType the_count = _counts[i][khash % _tablesizes[i]];
+	BoundedCounterType the_count = _counts[i][_family.bin(h, i,
+							      _tablesizes[i])];
 	if (the_count < min_count) {
 	  min_count = the_count;
 	}
       }
       if (min_count == MAX_COUNT && _use_bigcount) {
-	KmerCountMap::const_iterator it = _bigcounts.find(khash);
-	if (it != _bigcounts.end()) {
+	const KmerCountMap &bigcounts = _bigcount_stripe(khash);
+	KmerCountMap::const_iterator it = bigcounts.find(khash);
+	if (it != bigcounts.end()) {
 	  min_count = it->second;
 	}
       }
       return min_count;
     }
 
+    virtual unsigned int count_kmers(const HashIntoType * kmers,
+				     unsigned int n,
+				     HashIntoType lower_bound = 0,
+				     HashIntoType upper_bound = 0) {
+      return _drive_count_kmers(*this, kmers, n, lower_bound, upper_bound);
+    }
+
+    virtual void get_counts(const HashIntoType * kmers, unsigned int n,
+			    BoundedCounterType * out) const {
+      _drive_get_counts(*this, kmers, n, out);
+    }
+
+    // start pulling khash's counters in ahead of a count() or get_count().
+    void _prefetch(HashIntoType khash) const {
+      const HashIntoType h = _family.prepare(khash);
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	__builtin_prefetch(&_counts[i][_family.bin(h, i, _tablesizes[i])]);
+      }
+    }
+
     //
 
     MinMaxTable * fasta_file_to_minmax(const std::string &inputfile,
@@ -244,14 +345,22 @@ namespace khmer {
 
 
   class CountingHashFile {
+  protected:
+    static void _load_sectioned(const std::string &infilename,
+				CountingHash &ht, bool use_mmap);
+    static void _save_sectioned(const std::string &outfilename,
+				const CountingHash &ht, bool compressed);
   public:
-    static void load(const std::string &infilename, CountingHash &ht);
+    // gzipped files are never mapped.
+    static void load(const std::string &infilename, CountingHash &ht,
+		     bool use_mmap=false);
     static void save(const std::string &outfilename, const CountingHash &ht);
   };
 
   class CountingHashFileReader : public CountingHashFile {
   public:
-    CountingHashFileReader(const std::string &infilename, CountingHash &ht);
+    CountingHashFileReader(const std::string &infilename, CountingHash &ht,
+			   bool use_mmap=false);
   };
 
   class CountingHashGzFileReader : public CountingHashFile {
@@ -1,7 +1,10 @@
 #include "hashtable.hh"
 #include "hashbits.hh"
 #include "parsers.hh"
+#include "savedfile.hh"
+#include "traversal.hh"
 #include <iostream>
+#include <string.h>
 #define MAX_KEEPER_SIZE int(1e6)
 
 using namespace std;
@@ -11,54 +14,72 @@ void Hashbits::save(std::string outfilename)
 {
   assert(_counts[0]);
 
-  unsigned int save_ksize = _ksize;
-  unsigned char save_n_tables = _n_tables;
-  unsigned long long save_tablesize;
+  SectionedFileWriter outfile(outfilename, SAVED_HASHBITS);
 
-  ofstream outfile(outfilename.c_str(), ios::binary);
-
-  unsigned char version = SAVED_FORMAT_VERSION;
-  outfile.write((const char *) &version, 1);
-
-  unsigned char ht_type = SAVED_HASHBITS;
-  outfile.write((const char *) &ht_type, 1);
-
-  outfile.write((const char *) &save_ksize, sizeof(save_ksize));
-  outfile.write((const char *) &save_n_tables, sizeof(save_n_tables));
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ksize;
+  params.hash_family = _family.type();
+  params.n_tables = _n_tables;
+  outfile.write_params(params, _tablesizes, _unique_rc);
 
   for (unsigned int i = 0; i < _n_tables; i++) {
-    save_tablesize = _tablesizes[i];
-    unsigned long long tablebytes = save_tablesize / 8 + 1;
+    outfile.write_section(SECTION_TABLE, _counts[i], _tablesizes[i] / 8 + 1);
+  }
 
-    outfile.write((const char *) &save_tablesize, sizeof(save_tablesize));
+  // so that a loaded table knows how full it is.
+  SavedStats stats;
+  stats.occupied_bins = _occupied_bins;
+  stats.n_unique_kmers = _n_unique_kmers;
+  stats.n_overlap_kmers = _n_overlap_kmers;
+  outfile.write_section(SECTION_STATS, &stats, sizeof(stats));
 
-    outfile.write((const char *) _counts[i], tablebytes);
-  }
   outfile.close();
 }
 
 void Hashbits::load(std::string infilename)
 {
-  if (_counts) {
-    for (unsigned int i = 0; i < _n_tables; i++) {
-      delete _counts[i]; _counts[i] = NULL;
-    }
-    delete _counts; _counts = NULL;
+  _load(infilename, false);
+}
+
+void Hashbits::load_mmap(std::string infilename)
+{
+  _load(infilename, true);
+}
+
+void Hashbits::_load(const std::string &infilename, bool use_mmap)
+{
+  if (SectionedFileReader::is_sectioned(infilename)) {
+    _load_sectioned(infilename, use_mmap);
+    return;
   }
-  _tablesizes.clear();
-  
+
+  // the older format (SAVED_FORMAT_VERSION); always read in.
   unsigned int save_ksize = 0;
   unsigned char save_n_tables = 0;
   unsigned long long save_tablesize = 0;
-  unsigned char version, ht_type;
+  unsigned char version = 0, ht_type = 0;
 
   ifstream infile(infilename.c_str(), ios::binary);
-  assert(infile.is_open());
+  if (!infile.is_open()) {
+    throw SavedFileError("can't open " + infilename);
+  }
 
   infile.read((char *) &version, 1);
   infile.read((char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_HASHBITS);
+  if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_HASHBITS) {
+    throw SavedFileError(infilename + " is not a saved Hashbits table");
+  }
+
+  if (_counts) {
+    for (unsigned int i = 0; i < _n_tables; i++) {
+      free_table(_counts[i]); _counts[i] = NULL;
+    }
+    delete[] _counts; _counts = NULL;
+  }
+  _tablesizes.clear();
+
+  _family = HashFamily(HASH_FAMILY_MODULO);
 
   infile.read((char *) &save_ksize, sizeof(save_ksize));
   infile.read((char *) &save_n_tables, sizeof(save_n_tables));
@@ -78,155 +99,186 @@ void Hashbits::load(std::string infilename)
     _tablesizes.push_back(tablesize);
 
     tablebytes = tablesize / 8 + 1;
-    _counts[i] = new Byte[tablebytes];
+    _counts[i] = allocate_table(tablebytes);
 
     unsigned long long loaded = 0;
     while (loaded != tablebytes) {
       infile.read((char *) _counts[i], tablebytes - loaded);
+      if (infile.gcount() == 0) {
+	_n_tables = i + 1;	// (so that the rest aren't freed.)
+	throw SavedFileError(infilename + " is truncated");
+      }
       loaded += infile.gcount();	// do I need to do this loop?
     }
   }
   infile.close();
 }
 
-//////////////////////////////////////////////////////////////////////
-// graph stuff
-
-void Hashbits::calc_connected_graph_size(const HashIntoType kmer_f,
-					 const HashIntoType kmer_r,
-					 unsigned long long& count,
-					 SeenSet& keeper,
-					 const unsigned long long threshold,
-					 bool break_on_circum)
-const
+void Hashbits::_load_sectioned(const std::string &infilename, bool use_mmap)
 {
-  HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-  const BoundedCounterType val = get_count(kmer);
+  SectionedFileReader infile(infilename, SAVED_HASHBITS);
 
-  if (val == 0) {
-    return;
-  }
+  // the old tables stay, if it can't be loaded.
+  SavedParams params;
+  std::vector<HashIntoType> tablesizes;
+  infile.read_params(params, tablesizes, _unique_rc);
 
-  // have we already seen me? don't count; exit.
-  if (set_contains(keeper, kmer)) {
-    return;
+  std::vector<HashIntoType> table_bytes;
+  for (unsigned int i = 0; i < params.n_tables; i++) {
+    table_bytes.push_back(tablesizes[i] / 8 + 1);
   }
 
-  // is this in stop_tags?
-  if (set_contains(stop_tags, kmer)) {
-    return;
+  SavedStats stats;
+  memset(&stats, 0, sizeof(stats));
+  const SavedSection * section = infile.find(SECTION_STATS);
+  if (section) {
+    infile.check_length(*section, sizeof(stats));
+    infile.read_section(*section, &stats);
   }
 
-  // keep track of both seen kmers, and counts.
-  keeper.insert(kmer);
-
-  // is this a high-circumference k-mer? if so, don't count it; get outta here!
-  if (break_on_circum && \
-      kmer_degree(kmer_f, kmer_r) > 4) {
-    return;
+  Byte ** counts = new Byte*[params.n_tables];
+  try {
+    infile.read_tables(table_bytes, counts, use_mmap);
+  } catch (...) {
+    delete[] counts;
+    throw;
   }
 
-  count += 1;
-
-  // are we past the threshold? truncate search.
-  if (threshold && count >= threshold) {
-    return;
+  if (_counts) {
+    for (unsigned int i = 0; i < _n_tables; i++) {
+      free_table(_counts[i]); _counts[i] = NULL;
+    }
+    delete[] _counts; _counts = NULL;
   }
+  _counts = counts;
+  _tablesizes = tablesizes;
 
-  // otherwise, explore in all directions.
-
-  // NEXT.
-
-  HashIntoType f, r;
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-
-  f = next_f(kmer_f, 'A');
-  r = next_r(kmer_r, 'A');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
-
-  f = next_f(kmer_f, 'C');
-  r = next_r(kmer_r, 'C');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+  _family = HashFamily(params.hash_family);
+  _ksize = (WordLength) params.ksize;
+  _n_tables = params.n_tables;
+  _init_bitstuff();
 
-  f = next_f(kmer_f, 'G');
-  r = next_r(kmer_r, 'G');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+  _occupied_bins = stats.occupied_bins;
+  _n_unique_kmers = stats.n_unique_kmers;
+  _n_overlap_kmers = stats.n_overlap_kmers;
+}
 
-  f = next_f(kmer_f, 'T');
-  r = next_r(kmer_r, 'T');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+//////////////////////////////////////////////////////////////////////
+// graph stuff
 
-  // PREVIOUS.
+// counts the k-mers it visits, short of those of high degree if asked;
+// see calc_connected_graph_size.
+class ConnectedSizeVisitor : public TraversalVisitor {
+protected:
+  const Hashbits * _ht;
+  unsigned long long &_count;
+  const unsigned long long _threshold;
+  const bool _break_on_circum;
+public:
+  ConnectedSizeVisitor(const Hashbits * ht, unsigned long long &count,
+		       unsigned long long threshold, bool break_on_circum) :
+    _ht(ht), _count(count), _threshold(threshold),
+    _break_on_circum(break_on_circum) { }
+
+  Action visit(HashIntoType kmer, const TraversalNode &node) {
+    // is this a high-circumference k-mer? if so, don't count it.
+    if (_break_on_circum && _ht->kmer_degree(node.f, node.r) > 4) {
+      return DONT_EXPAND;
+    }
+
+    _count += 1;
+
+    // are we past the threshold? truncate search.
+    if (_threshold && _count >= _threshold) {
+      return STOP;
+    }
+    return EXPAND;
+  }
+};
 
-  
-  r = prev_r(kmer_r, 'A');
-  f = prev_f(kmer_f, 'A');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+void Hashbits::calc_connected_graph_size(const HashIntoType kmer_f,
+					 const HashIntoType kmer_r,
+					 unsigned long long& count,
+					 SeenSet& keeper,
+					 const unsigned long long threshold,
+					 bool break_on_circum)
+const
+{
+  if (get_count(uniqify_rc(kmer_f, kmer_r)) == 0) {
+    return;
+  }
 
-  r = prev_r(kmer_r, 'C');
-  f = prev_f(kmer_f, 'C');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+  GraphTraversal traversal(this);
+  for (SeenSet::const_iterator si = keeper.begin(); si != keeper.end(); si++) {
+    traversal.mark_visited(*si);
+  }
+  traversal.set_limits(&stop_tags, NO_DEPTH_LIMIT, 0);
 
-  r = prev_r(kmer_r, 'G');
-  f = prev_f(kmer_f, 'G');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+  ConnectedSizeVisitor visitor(this, count, threshold, break_on_circum);
+  traversal.traverse(kmer_f, kmer_r, &visitor);
 
-  r = prev_r(kmer_r, 'T');
-  f = prev_f(kmer_f, 'T');
-  calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
+  keeper.insert(traversal.visited().begin(), traversal.visited().end());
 }
 
 void Hashbits::save_tagset(std::string outfilename)
 {
-  ofstream outfile(outfilename.c_str(), ios::binary);
-  const unsigned int tagset_size = all_tags.size();
-  unsigned int save_ksize = _ksize;
-
-  HashIntoType * buf = new HashIntoType[tagset_size];
-
-  unsigned char version = SAVED_FORMAT_VERSION;
-  outfile.write((const char *) &version, 1);
+  const std::vector<HashIntoType> &tags = all_tags.sorted();
 
-  unsigned char ht_type = SAVED_TAGS;
-  outfile.write((const char *) &ht_type, 1);
+  SectionedFileWriter outfile(outfilename, SAVED_TAGS);
 
-  outfile.write((const char *) &save_ksize, sizeof(save_ksize));
-  outfile.write((const char *) &tagset_size, sizeof(tagset_size));
-  outfile.write((const char *) &_tag_density, sizeof(_tag_density));
-
-  unsigned int i = 0;
-  for (SeenSet::iterator pi = all_tags.begin(); pi != all_tags.end();
-	 pi++, i++) {
-    buf[i] = *pi;
-  }
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ksize;
+  params.tag_density = _tag_density;
+  outfile.write_params(params, std::vector<HashIntoType>(), _unique_rc);
 
-  outfile.write((const char *) buf, sizeof(HashIntoType) * tagset_size);
+  outfile.write_section(SECTION_TAGS, tags.empty() ? NULL : &tags[0],
+			sizeof(HashIntoType) * tags.size());
   outfile.close();
-
-  delete buf;
 }
 
 void Hashbits::load_tagset(std::string infilename, bool clear_tags)
 {
-  ifstream infile(infilename.c_str(), ios::binary);
-  assert(infile.is_open());
+  if (SectionedFileReader::is_sectioned(infilename)) {
+    SectionedFileReader infile(infilename, SAVED_TAGS);
 
-  if (clear_tags) {
-    all_tags.clear();
+    // (leaving the tags as they were, if it can't be loaded.)
+    SavedParams params;
+    std::vector<HashIntoType> tablesizes;
+    infile.read_params(params, tablesizes, _unique_rc);
+    if (params.ksize != _ksize) {
+      throw SavedFileError(infilename + " was saved with a different k");
+    }
+
+    _read_tag_section(infile, SECTION_TAGS, all_tags, clear_tags);
+    _tag_density = params.tag_density;
+    return;
+  }
+
+  ifstream infile(infilename.c_str(), ios::binary);
+  if (!infile.is_open()) {
+    throw SavedFileError("can't open " + infilename);
   }
 
-  unsigned char version, ht_type;
+  unsigned char version = 0, ht_type = 0;
   unsigned int save_ksize = 0;
 
   unsigned int tagset_size = 0;
 
   infile.read((char *) &version, 1);
   infile.read((char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_TAGS);
+  if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_TAGS) {
+    throw SavedFileError(infilename + " is not a saved tagset");
+  }
   
   infile.read((char *) &save_ksize, sizeof(save_ksize));
-  assert(save_ksize == _ksize);
+  if (save_ksize != _ksize) {
+    throw SavedFileError(infilename + " was saved with a different k");
+  }
+
+  if (clear_tags) {
+    all_tags.clear();
+  }
 
   infile.read((char *) &tagset_size, sizeof(tagset_size));
   infile.read((char *) &_tag_density, sizeof(_tag_density));
@@ -234,58 +286,75 @@ void Hashbits::load_tagset(std::string infilename, bool clear_tags)
   HashIntoType * buf = new HashIntoType[tagset_size];
 
   infile.read((char *) buf, sizeof(HashIntoType) * tagset_size);
+  if (infile.gcount() != (std::streamsize) (sizeof(HashIntoType) * tagset_size)) {
+    delete[] buf;
+    throw SavedFileError(infilename + " is truncated");
+  }
 
+  all_tags.reserve(all_tags.size() + tagset_size);
   for (unsigned int i = 0; i < tagset_size; i++) {
     all_tags.insert(buf[i]);
   }
 
-  delete buf;
+  delete[] buf;
+}
+
+// add the tags in a SECTION_TAGS or SECTION_STOP_TAGS section to tags,
+// clearing them first if asked; they are left alone if it can't be read.
+void Hashbits::_read_tag_section(SectionedFileReader &infile,
+				 unsigned int type, TagSet &tags,
+				 bool clear_tags)
+{
+  const SavedSection &section = infile.get(type);
+  if (section.length % sizeof(HashIntoType)) {
+    throw SavedFileError(infile.filename() + " has a section of the wrong size");
+  }
+
+  std::vector<HashIntoType> buf(section.length / sizeof(HashIntoType));
+  if (!buf.empty()) {
+    infile.read_section(section, &buf[0]);
+  }
+
+  if (clear_tags) {
+    tags.clear();
+  }
+  tags.reserve(tags.size() + buf.size());
+  for (unsigned long long i = 0; i < buf.size(); i++) {
+    tags.insert(buf[i]);
+  }
 }
 
 unsigned int Hashbits::kmer_degree(HashIntoType kmer_f, HashIntoType kmer_r)
 const
 {
-  unsigned int neighbors = 0;
-
   const unsigned int rc_left_shift = _ksize*2 - 2;
+  const char bases[] = "ACGT";
 
+  // look up all eight neighbors at once.
+  HashIntoType neighbors[8];
+  BoundedCounterType counts[8];
   HashIntoType f, r;
 
-  // NEXT.
-  f = next_f(kmer_f, 'A');
-  r = next_r(kmer_r, 'A');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-	  
-  f = next_f(kmer_f, 'C');
-  r = next_r(kmer_r, 'C');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-
-  f = next_f(kmer_f, 'G');
-  r = next_r(kmer_r, 'G');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-
-  f = next_f(kmer_f, 'T');
-  r = next_r(kmer_r, 'T');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-
-  // PREVIOUS.
-  r = prev_r(kmer_r, 'A');
-  f = prev_f(kmer_f, 'A');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-
-  r = prev_r(kmer_r, 'C');
-  f = prev_f(kmer_f, 'C');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
-    
-  r = prev_r(kmer_r, 'G');
-  f = prev_f(kmer_f, 'G');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
+  for (unsigned int i = 0; i < 4; i++) {
+    // NEXT.
+    f = next_f(kmer_f, bases[i]);
+    r = next_r(kmer_r, bases[i]);
+    neighbors[i] = uniqify_rc(f, r);
+
+    // PREVIOUS.
+    r = prev_r(kmer_r, bases[i]);
+    f = prev_f(kmer_f, bases[i]);
+    neighbors[4 + i] = uniqify_rc(f, r);
+  }
 
-  r = prev_r(kmer_r, 'T');
-  f = prev_f(kmer_f, 'T');
-  if (get_count(uniqify_rc(f, r))) { neighbors++; }
+  get_counts(neighbors, 8, counts);
 
-  return neighbors;
+  unsigned int n_neighbors = 0;
+  for (unsigned int i = 0; i < 8; i++) {
+    if (counts[i]) { n_neighbors++; }
+  }
+
+  return n_neighbors;
 }
 
 
@@ -298,61 +367,89 @@ void Hashbits::consume_fasta_and_tag(const std::string &filename,
 				      unsigned int &total_reads,
 				      unsigned long long &n_consumed,
 				      CallbackFn callback,
-				      void * callback_data)
+				      void * callback_data,
+				      unsigned int n_threads)
 {
   total_reads = 0;
   n_consumed = 0;
 
-  IParser* parser = IParser::get_parser(filename.c_str());
-  Read read;
+  if (n_threads > 1) {
+    std::vector<IParser *> parsers;
+    IParser::get_parsers(filename, n_threads, parsers);
 
-  string seq = "";
+    try {
+      process_batches_threaded(parsers, n_threads, _consume_and_tag_batch,
+			       this, total_reads, n_consumed,
+			       "consume_fasta_and_tag", callback,
+			       callback_data);
+    } catch (...) {
+      delete_parsers(parsers);
+      throw;
+    }
+    delete_parsers(parsers);
+    return;
+  }
+
+  IParser* parser = IParser::get_parser(filename.c_str());
+  ReadBatch batch;
+  KmerExtractor kmers;		// reused from read to read.
 
   //
   // iterate through the FASTA file & consume the reads.
   //
 
-  while(!parser->is_complete())  {
-    read = parser->get_next_read();
-    seq = read.seq;
-
-    // n_consumed += this_n_consumed;
+  while(parser->get_next_batch(batch))  {
+    for (unsigned int i = 0; i < batch.size(); i++) {
+      // process?  (extract also checks the read.)
+      if (kmers.extract(batch.seq(i), batch.seq_len(i), _ksize,
+			_unique_rc)) {
+	_consume_kmers_and_tag(kmers, n_consumed, NULL);
+      }
 
-    if (check_read(seq)) {	// process?
-      consume_sequence_and_tag(seq, n_consumed);
-    }
-	       
-    // reset the sequence info, increment read number
-    total_reads++;
+      // increment read number
+      total_reads++;
 
-    // run callback, if specified
-    if (total_reads % CALLBACK_PERIOD == 0 && callback) {
-      std::cout << "n tags: " << all_tags.size() << "\n";
-      try {
-        callback("consume_fasta_and_tag", callback_data, total_reads,
-		 n_consumed);
-      } catch (...) {
-	delete parser;
-        throw;
+      // run callback, if specified
+      if (total_reads % CALLBACK_PERIOD == 0 && callback) {
+	std::cout << "n tags: " << all_tags.size() << "\n";
+	try {
+	  callback("consume_fasta_and_tag", callback_data, total_reads,
+		   n_consumed);
+	} catch (...) {
+	  delete parser;
+	  throw;
+	}
       }
     }
   }
   delete parser;
 }
 
-void Hashbits::consume_sequence_and_tag(const std::string& seq,
+void Hashbits::consume_sequence_and_tag(const char * seq,
+					unsigned int length,
 					unsigned long long& n_consumed,
 					SeenSet * found_tags)
+{
+  KmerExtractor kmers;
+  kmers.extract(seq, length, _ksize, _unique_rc);
+  _consume_kmers_and_tag(kmers, n_consumed, found_tags);
+}
+
+void Hashbits::_consume_kmers_and_tag(const KmerExtractor &kmers,
+				      unsigned long long& n_consumed,
+				      SeenSet * found_tags)
 {
   bool is_new_kmer;
+  HashIntoType kmer = 0;
 
-  KMerIterator kmers(seq.c_str(), _ksize);
-  HashIntoType kmer;
+  if (!kmers.size()) {
+    return;
+  }
 
   unsigned int since = _tag_density / 2 + 1;
 
-  while(!kmers.done()) {
-    kmer = kmers.next();
+  for (unsigned int i = 0; i < kmers.size(); i++) {
+    kmer = kmers[i];
 
     is_new_kmer = (bool) !get_count(kmer);
     if (is_new_kmer) {
@@ -380,6 +477,204 @@ void Hashbits::consume_sequence_and_tag(const std::string& seq,
   }
 }
 
+//
+// count_concurrent: see hashbits.hh.
+//
+
+void Hashbits::count_concurrent(const HashIntoType * kmers, unsigned int n)
+{
+  HashIntoType n_occupied = 0, n_unique = 0;
+
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int n_new = _set_bits_atomic(kmers[i]);
+    n_occupied += n_new;
+    if (n_new) {
+      n_unique++;
+    }
+  }
+
+  __sync_fetch_and_add(&_occupied_bins, n_occupied);
+  __sync_fetch_and_add(&_n_unique_kmers, n_unique);
+}
+
+//
+// count_staged: stage the bits, then set them a region at a time.
+//     Updates to a byte stay in k-mer order, so which k-mers set a new
+//     bit -- and so the unique k-mer count -- comes out as it would
+//     from count().
+//
+
+void Hashbits::count_staged(const HashIntoType * kmers, unsigned int n,
+			    StagingBuffer &buffer)
+{
+  std::vector<unsigned int> first_region(_n_tables);
+  unsigned int n_regions = 0;
+  for (unsigned int i = 0; i < _n_tables; i++) {
+    first_region[i] = n_regions;
+    n_regions += ((_tablesizes[i] / 8) >> STAGING_REGION_SHIFT) + 1;
+  }
+
+  for (unsigned int start = 0; start < n; start += STAGING_MAX_KMERS) {
+    const unsigned int n_chunk = min(n - start, (unsigned int) STAGING_MAX_KMERS);
+
+    buffer.bins.clear();
+    for (unsigned int k = 0; k < n_chunk; k++) {
+      const HashIntoType h = _family.prepare(kmers[start + k]);
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
+	HashIntoType byte = bin / 8;
+	buffer.add(&_counts[i][byte],
+		   first_region[i] + (byte >> STAGING_REGION_SHIFT),
+		   k, bin % 8);
+      }
+    }
+    buffer.sort(n_regions);
+
+    buffer.kmer_flags.assign(n_chunk, 0);
+    HashIntoType n_occupied = 0, n_unique = 0;
+
+    for (unsigned int j = 0; j < buffer.sorted.size(); j++) {
+      const StagedBin &b = buffer.sorted[j];
+      Byte mask = 1 << (b.kmer_bit & 7);
+      Byte old = __sync_fetch_and_or(b.byte, mask);
+      if (!(old & mask)) {
+	n_occupied++;
+	buffer.kmer_flags[b.kmer_bit >> 3] = 1;
+      }
+    }
+
+    for (unsigned int k = 0; k < n_chunk; k++) {
+      n_unique += buffer.kmer_flags[k];
+    }
+
+    __sync_fetch_and_add(&_occupied_bins, n_occupied);
+    __sync_fetch_and_add(&_n_unique_kmers, n_unique);
+  }
+}
+
+//
+// false_positive_rate: the chance that a k-mer not in the table has all
+//     of its bits set, i.e. the product of each table's fill fraction.
+//
+
+double Hashbits::false_positive_rate() const
+{
+  double rate = 1.0;
+
+  for (unsigned int i = 0; i < _n_tables; i++) {
+    HashIntoType tablebytes = _tablesizes[i] / 8 + 1;
+    HashIntoType n_set = 0;
+
+    for (HashIntoType j = 0; j < tablebytes; j++) {
+      n_set += __builtin_popcount(_counts[i][j]);
+    }
+    rate *= double(n_set) / double(_tablesizes[i]);
+  }
+
+  return rate;
+}
+
+//
+// _tag_kmers: the tagging half of consume_sequence_and_tag, for a read
+//     whose k-mers have already been counted.  is_new[i] says whether
+//     kmers[i] was new to the table.
+//
+
+void Hashbits::_tag_kmers(const HashIntoType * kmers, const char * is_new,
+			  unsigned int n, SeenSet * found_tags)
+{
+  HashIntoType kmer = 0;
+  unsigned int since = _tag_density / 2 + 1;
+
+  for (unsigned int i = 0; i < n; i++) {
+    kmer = kmers[i];
+
+    if (!is_new[i] && set_contains(all_tags, kmer)) {
+      since = 1;
+      if (found_tags) { found_tags->insert(kmer); }
+    } else {
+      since++;
+    }
+
+    if (since >= _tag_density) {
+      all_tags.insert(kmer);
+      if (found_tags) { found_tags->insert(kmer); }
+      since = 1;
+    }
+  }
+
+  if (n && since >= _tag_density/2 - 1) {
+    all_tags.insert(kmer);	// insert the last k-mer, too.
+    if (found_tags) { found_tags->insert(kmer); }
+  }
+}
+
+//
+// _consume_and_tag_batch: the threaded body of consume_fasta_and_tag.
+//     K-mers are counted lock-free; tags for the whole batch are then
+//     placed under _tags_lock.  Where tags land depends on the order in
+//     which batches are processed, but every read still gets a tag at
+//     least every _tag_density k-mers.
+//
+
+void Hashbits::_consume_and_tag_batch(void * data, const ReadBatch &batch,
+				      unsigned long long &n_consumed)
+{
+  Hashbits * ht = (Hashbits *) data;
+
+  // the strand mode is chosen once a batch, not once a k-mer.
+  if (ht->_unique_rc) {
+    _consume_and_tag_batch_as<true>(ht, batch, n_consumed);
+  } else {
+    _consume_and_tag_batch_as<false>(ht, batch, n_consumed);
+  }
+}
+
+template <bool UniqueRC>
+void Hashbits::_consume_and_tag_batch_as(Hashbits * ht,
+					 const ReadBatch &batch,
+					 unsigned long long &n_consumed)
+{
+  KmerExtractor extractor;
+  std::vector<HashIntoType> kmers;
+  std::vector<char> is_new;
+  std::vector<unsigned int> read_starts;
+  HashIntoType n_occupied = 0, n_unique = 0;
+
+  for (unsigned int i = 0; i < batch.size(); i++) {
+    if (!extractor.extract<UniqueRC>(batch.seq(i), batch.seq_len(i),
+				     ht->_ksize)) {
+      continue;
+    }
+
+    read_starts.push_back(kmers.size());
+    for (unsigned int j = 0; j < extractor.size(); j++) {
+      HashIntoType kmer = extractor[j];
+      unsigned int n_new = ht->_set_bits_atomic(kmer);
+
+      kmers.push_back(kmer);
+      is_new.push_back(n_new != 0);
+      n_occupied += n_new;
+      if (n_new) {
+	n_unique++;
+	n_consumed++;
+      }
+    }
+  }
+  read_starts.push_back(kmers.size());
+
+  __sync_fetch_and_add(&ht->_occupied_bins, n_occupied);
+  __sync_fetch_and_add(&ht->_n_unique_kmers, n_unique);
+
+  ScopedLock lock(ht->_tags_lock);
+  for (unsigned int r = 0; r + 1 < read_starts.size(); r++) {
+    unsigned int start = read_starts[r];
+    ht->_tag_kmers(&kmers[start], &is_new[start],
+		   read_starts[r + 1] - start, NULL);
+  }
+}
+
 //
 // consume_fasta_and_tag_with_stoptags: consume a FASTA file of reads,
 //     tagging reads every so often.  Do not insert matches to stoptags,
@@ -416,7 +711,7 @@ void Hashbits::consume_fasta_and_tag_with_stoptags(const std::string &filename,
 
     if (check_read(seq)) {	// process?
       bool is_new_kmer;
-      KMerIterator kmers(seq.c_str(), _ksize);
+      KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
 
       HashIntoType kmer, last_kmer;
       bool is_first_kmer = true;
@@ -504,7 +799,7 @@ void Hashbits::divide_tags_into_subsets(unsigned int subset_size,
 {
   unsigned int i = 0;
 
-  for (SeenSet::const_iterator si = all_tags.begin(); si != all_tags.end();
+  for (TagSet::const_iterator si = all_tags.begin(); si != all_tags.end();
        si++) {
     if (i % subset_size == 0) {
       divvy.insert(*si);
@@ -572,7 +867,7 @@ void Hashbits::consume_partitioned_fasta(const std::string &filename,
       n_consumed += consume_string(seq); // @CTB why are we doing this?
 
       // Next, compute the tag & set the partition, if nonzero
-      HashIntoType kmer = _hash(seq.c_str(), _ksize);
+      HashIntoType kmer = hash_kmer(seq.c_str());
       all_tags.insert(kmer);
       if (p > 0) {
 	partition->set_partition_id(kmer, p);
@@ -619,7 +914,7 @@ void Hashbits::filter_if_present(const std::string infilename,
     seq = read.seq;
 
     if (check_read(seq)) {
-      KMerIterator kmers(seq.c_str(), _ksize);
+      KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
       bool keep = true;
 
       while (!kmers.done()) {
@@ -664,323 +959,106 @@ unsigned int Hashbits::count_kmers_within_radius(HashIntoType kmer_f,
 						 const SeenSet * seen)
 const
 {
-  HashIntoType f, r;
-  NodeQueue node_q;
-  std::queue<unsigned int> breadth_q;
-  unsigned int cur_breadth = 0;
-  unsigned int breadth = 0;
-
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-  unsigned int total = 0;
-
-  SeenSet keeper;		// keep track of traversed kmers
-  if (seen) { keeper = *seen; }
-
-  // start breadth-first search.
-
-  node_q.push(kmer_f);
-  node_q.push(kmer_r);
-  breadth_q.push(0);
-
-  while(!node_q.empty()) {
-    kmer_f = node_q.front();
-    node_q.pop();
-    kmer_r = node_q.front();
-    node_q.pop();
-    breadth = breadth_q.front();
-    breadth_q.pop();
-
-    if (breadth > radius) {
-      break;
-    }
-
-    HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-    if (set_contains(keeper, kmer)) {
-      continue;
-    }
-
-    // keep track of seen kmers
-    keeper.insert(kmer);
-    total++;
-
-    if (max_count && total > max_count) {
-      break;
-    }
-
-    assert(breadth >= cur_breadth); // keep track of watermark, for debugging.
-    if (breadth > cur_breadth) { cur_breadth = breadth; }
-
-    //
-    // Enqueue next set of nodes.
-    //
-
-    // NEXT.
-    f = next_f(kmer_f, 'A');
-    r = next_r(kmer_r, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'C');
-    r = next_r(kmer_r, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'G');
-    r = next_r(kmer_r, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
+  GraphTraversal traversal(this);
+  if (seen) {
+    SeenSet::const_iterator si;
+    for (si = seen->begin(); si != seen->end(); si++) {
+      traversal.mark_visited(*si);
     }
+  }
+  traversal.set_limits(NULL, radius, max_count);
 
-    f = next_f(kmer_f, 'T');
-    r = next_r(kmer_r, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  return traversal.traverse(kmer_f, kmer_r);
+}
 
-    // PREVIOUS.
-    r = prev_r(kmer_r, 'A');
-    f = prev_f(kmer_f, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+// counts up to max_count k-mers, then stops.
+class DepthCountVisitor : public TraversalVisitor {
+protected:
+  const unsigned int _max_count;
+public:
+  unsigned int count;
 
-    r = prev_r(kmer_r, 'C');
-    f = prev_f(kmer_f, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-    
-    r = prev_r(kmer_r, 'G');
-    f = prev_f(kmer_f, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  DepthCountVisitor(unsigned int max_count) : _max_count(max_count), count(0)
+  { }
 
-    r = prev_r(kmer_r, 'T');
-    f = prev_f(kmer_f, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f, r))){
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  Action visit(HashIntoType kmer, const TraversalNode &node) {
+    count++;
+    return count >= _max_count ? STOP : EXPAND;
   }
-
-  return total;
-}
+};
 
 unsigned int Hashbits::count_kmers_within_depth(HashIntoType kmer_f,
 						HashIntoType kmer_r,
 						unsigned int depth,
 						unsigned int max_count,
-						SeenSet * seen)
+						GraphTraversal &seen)
 const
 {
-  HashIntoType f, r;
-  unsigned int count = 1;
-
   if (depth == 0) { return 0; }
 
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-
-  seen->insert(uniqify_rc(kmer_f, kmer_r));
-
-  // NEXT.
-  f = next_f(kmer_f, 'A');
-  r = next_r(kmer_r, 'A');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth - 1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-  }
-
-  f = next_f(kmer_f, 'C');
-  r = next_r(kmer_r, 'C');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
-
-  f = next_f(kmer_f, 'G');
-  r = next_r(kmer_r, 'G');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
-
-  f = next_f(kmer_f, 'T');
-  r = next_r(kmer_r, 'T');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
-
-  // PREVIOUS.
-  r = prev_r(kmer_r, 'A');
-  f = prev_f(kmer_f, 'A');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
-
-  r = prev_r(kmer_r, 'C');
-  f = prev_f(kmer_f, 'C');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
-    
-  r = prev_r(kmer_r, 'G');
-  f = prev_f(kmer_f, 'G');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
+  seen.set_limits(NULL, depth - 1, 0);
 
-  r = prev_r(kmer_r, 'T');
-  f = prev_f(kmer_f, 'T');
-  if (get_count(uniqify_rc(f,r)) && !set_contains(*seen, uniqify_rc(f, r))) {
-    count += count_kmers_within_depth(f, r, depth -1, max_count - count,
-				      seen);
-    if (count >= max_count) { return count; }
-    ;
-  }
+  DepthCountVisitor visitor(max_count);
+  seen.traverse(kmer_f, kmer_r, &visitor);
 
-  return count;
+  return visitor.count;
 }
 
+// stops once max_count k-mers are visited, or max_radius is reached, and
+// remembers how far out that was.
+class VolumeRadiusVisitor : public TraversalVisitor {
+protected:
+  const unsigned int _max_count;
+  const unsigned int _max_radius;
+  unsigned int _total;
+public:
+  unsigned int radius;
+
+  VolumeRadiusVisitor(unsigned int max_count, unsigned int max_radius) :
+    _max_count(max_count), _max_radius(max_radius), _total(0),
+    radius(max_radius) { }
+
+  Action visit(HashIntoType kmer, const TraversalNode &node) {
+    _total++;
+    if (_total >= _max_count || node.depth >= _max_radius) {
+      radius = node.depth;
+      return STOP;
+    }
+    return EXPAND;
+  }
+};
+
 unsigned int Hashbits::find_radius_for_volume(HashIntoType kmer_f,
 					      HashIntoType kmer_r,
 					      unsigned int max_count,
 					      unsigned int max_radius)
 const
 {
-  HashIntoType f, r;
-  NodeQueue node_q;
-  std::queue<unsigned int> breadth_q;
-  unsigned int breadth = 0;
-
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-  unsigned int total = 0;
-
-  SeenSet keeper;		// keep track of traversed kmers
-
-  // start breadth-first search.
-
-  node_q.push(kmer_f);
-  node_q.push(kmer_r);
-  breadth_q.push(0);
-
-  while(!node_q.empty()) {
-    kmer_f = node_q.front();
-    node_q.pop();
-    kmer_r = node_q.front();
-    node_q.pop();
-    breadth = breadth_q.front();
-    breadth_q.pop();
-
-    HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-    if (set_contains(keeper, kmer)) {
-      continue;
-    }
-
-    // keep track of seen kmers
-    keeper.insert(kmer);
-    total++;
-
-    if (total >= max_count || breadth >= max_radius) {
-      break;
-    }
-
-    //
-    // Enqueue next set of nodes.
-    //
-
-    // NEXT.
-    f = next_f(kmer_f, 'A');
-    r = next_r(kmer_r, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'C');
-    r = next_r(kmer_r, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'G');
-    r = next_r(kmer_r, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  GraphTraversal traversal(this);
 
-    f = next_f(kmer_f, 'T');
-    r = next_r(kmer_r, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  // if the whole component is visited first, that's max_radius.
+  VolumeRadiusVisitor visitor(max_count, max_radius);
+  traversal.traverse(kmer_f, kmer_r, &visitor);
 
-    // PREVIOUS.
-    r = prev_r(kmer_r, 'A');
-    f = prev_f(kmer_f, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  return visitor.radius;
+}
 
-    r = prev_r(kmer_r, 'C');
-    f = prev_f(kmer_f, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-    
-    r = prev_r(kmer_r, 'G');
-    f = prev_f(kmer_f, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+// counts the k-mers exactly radius away.
+class OnRadiusVisitor : public TraversalVisitor {
+protected:
+  const unsigned int _radius;
+public:
+  unsigned int count;
 
-    r = prev_r(kmer_r, 'T');
-    f = prev_f(kmer_f, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  OnRadiusVisitor(unsigned int radius) : _radius(radius), count(0) { }
 
-    if (node_q.empty()) {
-      breadth = max_radius;
-      break;
+  Action visit(HashIntoType kmer, const TraversalNode &node) {
+    if (node.depth == _radius) {
+      count++;
     }
+    return EXPAND;
   }
-
-  return breadth;
-}
+};
 
 unsigned int Hashbits::count_kmers_on_radius(HashIntoType kmer_f,
 					     HashIntoType kmer_r,
@@ -988,120 +1066,24 @@ unsigned int Hashbits::count_kmers_on_radius(HashIntoType kmer_f,
 					     unsigned int max_volume)
 const
 {
-  HashIntoType f, r;
-  NodeQueue node_q;
-  std::queue<unsigned int> breadth_q;
-  unsigned int cur_breadth = 0;
-  unsigned int breadth = 0;
-  unsigned int count = 0;
-
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-  unsigned int total = 0;
-
-  SeenSet keeper;		// keep track of traversed kmers
-
-  // start breadth-first search.
-
-  node_q.push(kmer_f);
-  node_q.push(kmer_r);
-  breadth_q.push(0);
-
-  while(!node_q.empty()) {
-    kmer_f = node_q.front();
-    node_q.pop();
-    kmer_r = node_q.front();
-    node_q.pop();
-    breadth = breadth_q.front();
-    breadth_q.pop();
-
-    if (breadth > radius) {
-      break;
-    }
-
-    HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-    if (set_contains(keeper, kmer)) {
-      continue;
-    }
-
-    if (breadth == radius) {
-      count++;
-    }
-
-    // keep track of seen kmers
-    keeper.insert(kmer);
-    total++;
-
-    if (max_volume && total > max_volume) {
-      break;
-    }
-
-    assert(breadth >= cur_breadth); // keep track of watermark, for debugging.
-    if (breadth > cur_breadth) { cur_breadth = breadth; }
-
-    //
-    // Enqueue next set of nodes.
-    //
-
-    // NEXT.
-    f = next_f(kmer_f, 'A');
-    r = next_r(kmer_r, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'C');
-    r = next_r(kmer_r, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'G');
-    r = next_r(kmer_r, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'T');
-    r = next_r(kmer_r, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  GraphTraversal traversal(this);
+  return count_kmers_on_radius(kmer_f, kmer_r, radius, max_volume, traversal);
+}
 
-    // PREVIOUS.
-    r = prev_r(kmer_r, 'A');
-    f = prev_f(kmer_f, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+unsigned int Hashbits::count_kmers_on_radius(HashIntoType kmer_f,
+					     HashIntoType kmer_r,
+					     unsigned int radius,
+					     unsigned int max_volume,
+					     GraphTraversal &traversal)
+const
+{
+  traversal.reset();
+  traversal.set_limits(NULL, radius, max_volume);
 
-    r = prev_r(kmer_r, 'C');
-    f = prev_f(kmer_f, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-    
-    r = prev_r(kmer_r, 'G');
-    f = prev_f(kmer_f, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  OnRadiusVisitor visitor(radius);
+  traversal.traverse(kmer_f, kmer_r, &visitor);
 
-    r = prev_r(kmer_r, 'T');
-    f = prev_f(kmer_f, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-  }
-
-  return count;
+  return visitor.count;
 }
 
 unsigned int Hashbits::trim_on_degree(std::string seq, unsigned int max_degree)
@@ -1113,7 +1095,7 @@ const
   }
 
   HashIntoType kmer_f = 0, kmer_r = 0;
-  KMerIterator kmers(seq.c_str(), _ksize);
+  KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
 
   unsigned int i = _ksize;
   while(!kmers.done()) {
@@ -1139,22 +1121,27 @@ const
   const unsigned int INCR = 2*RADIUS;
   const char * first_kmer = seq.c_str();
 
+  GraphTraversal traversal(this);
+
   HashIntoType kmer_f, kmer_r;
-  _hash(first_kmer, _ksize, kmer_f, kmer_r);
-  if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20) > max_degree) {
+  hash_kmer(first_kmer, kmer_f, kmer_r);
+  if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20, traversal)
+      > max_degree) {
     return _ksize - 1;
   }
 
   for (unsigned int i = INCR; i < seq.length() - _ksize + 1; i += INCR) {
-    _hash(first_kmer + i, _ksize, kmer_f, kmer_r);
-    if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20) > max_degree) {
+    hash_kmer(first_kmer + i, kmer_f, kmer_r);
+    if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20, traversal)
+	> max_degree) {
 
       i -= INCR;
       unsigned int pos = 1;
 
       for (; pos < INCR; pos++) {
-	_hash(first_kmer + i + pos, _ksize, kmer_f, kmer_r);
-	if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20) > max_degree) {
+	hash_kmer(first_kmer + i + pos, kmer_f, kmer_r);
+	if (count_kmers_on_radius(kmer_f, kmer_r, RADIUS, 20, traversal)
+	    > max_degree) {
 	  break;
 	}
       }
@@ -1179,15 +1166,15 @@ unsigned int Hashbits::trim_on_density_explosion(std::string seq,
   SeenSet path;
 
   HashIntoType kmer_f = 0, kmer_r = 0;
-  SeenSet seen;
+  GraphTraversal seen(this);
 
-  KMerIterator kmers(seq.c_str(), _ksize);
+  KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
 
   unsigned int i = _ksize - 2;
   while(!kmers.done()) {
     kmers.next(kmer_f, kmer_r);
     count = count_kmers_within_depth(kmer_f, kmer_r, radius,
-				     max_volume, &seen);
+				     max_volume, seen);
     if (count >= max_volume) {
       return i;
     }
@@ -1201,22 +1188,15 @@ unsigned int Hashbits::trim_on_density_explosion(std::string seq,
 
 unsigned int Hashbits::trim_on_stoptags(std::string seq) const
 {
-  if (!check_read(seq)) {
+  KmerExtractor kmers;
+  if (!kmers.extract(seq, _ksize, _unique_rc)) { // also checks the read.
     return 0;
   }
 
-  SeenSet path;
-  HashIntoType kmer;
-
-  KMerIterator kmers(seq.c_str(), _ksize);
-  
-  unsigned int i = _ksize - 2;
-  while (!kmers.done()) {
-    kmer = kmers.next();
-    if (set_contains(stop_tags, kmer)) {
-      return i;
+  for (unsigned int i = 0; i < kmers.size(); i++) {
+    if (set_contains(stop_tags, kmers[i])) {
+      return _ksize - 2 + i;
     }
-    i++;
   }
 
   return seq.length();
@@ -1231,26 +1211,26 @@ void Hashbits::traverse_from_tags(unsigned int distance,
   unsigned int n = 0;
   unsigned int count;
   unsigned int n_big = 0;
-  SeenSet keeper;
+  GraphTraversal traversal(this);
 
 #if VERBOSE_REPARTITION
   std::cout << all_tags.size() << " tags...\n";
 #endif // 0
-  SeenSet::const_iterator si = all_tags.begin();
+  TagSet::const_iterator si = all_tags.begin();
 
   for (; si != all_tags.end(); si++, i++) {
     n++;
-    count = traverse_from_kmer(*si, distance, keeper);
+    count = traverse_from_kmer(*si, distance, traversal);
 
     if (count >= threshold) {
       n_big++;
-	
-      SeenSet::const_iterator ti;
-      for (ti = keeper.begin(); ti != keeper.end(); ti++) {
-	if (counting.get_count(*ti) > frequency) {
-	  stop_tags.insert(*ti);
+
+      const std::vector<HashIntoType> &keeper = traversal.visited();
+      for (unsigned int j = 0; j < keeper.size(); j++) {
+	if (counting.get_count(keeper[j]) > frequency) {
+	  stop_tags.insert(keeper[j]);
 	} else {
-	  counting.count(*ti);
+	  counting.count(keeper[j]);
 	}
       }
 #if VERBOSE_REPARTITION
@@ -1258,7 +1238,6 @@ void Hashbits::traverse_from_tags(unsigned int distance,
 		<< n_big << " big; " << keeper.size() << "\n";
 #endif // 0
     }
-    keeper.clear();
 
     if (n % 100 == 0) {
 #if VERBOSE_REPARTITION
@@ -1271,134 +1250,17 @@ void Hashbits::traverse_from_tags(unsigned int distance,
 
 unsigned int Hashbits::traverse_from_kmer(HashIntoType start,
 					  unsigned int radius,
-					  SeenSet &keeper)
+					  GraphTraversal &traversal)
 const
 {
   std::string kmer_s = _revhash(start, _ksize);
-  HashIntoType kmer, kmer_f, kmer_r;
-  kmer = _hash(kmer_s.c_str(), _ksize, kmer_f, kmer_r);
-
-  HashIntoType f, r;
-  NodeQueue node_q;
-  std::queue<unsigned int> breadth_q;
-  unsigned int cur_breadth = 0;
-  unsigned int breadth = 0;
-  bool is_first_kmer = true;
-
-  const unsigned int rc_left_shift = _ksize*2 - 2;
-  unsigned int total = 0;
-
-  // start breadth-first search.
-
-  node_q.push(kmer_f);
-  node_q.push(kmer_r);
-  breadth_q.push(0);
-
-  while(!node_q.empty()) {
-    kmer_f = node_q.front();
-    node_q.pop();
-    kmer_r = node_q.front();
-    node_q.pop();
-    breadth = breadth_q.front();
-    breadth_q.pop();
-
-    if (breadth > radius) {
-      break;
-    }
-
-    if (total > MAX_KEEPER_SIZE) {
-      break;
-    }
-
-    HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-    if (set_contains(keeper, kmer)) {
-      continue;
-    }
-
-    if (set_contains(stop_tags, kmer)) {
-      continue;
-    }
-
-    // keep track of seen kmers
-    keeper.insert(kmer);
-    total++;
-
-    if (false && !is_first_kmer && set_contains(all_tags, kmer)) {
-      continue;
-    }
-
-    assert(breadth >= cur_breadth); // keep track of watermark, for debugging.
-    if (breadth > cur_breadth) { cur_breadth = breadth; }
-
-    //
-    // Enqueue next set of nodes.
-    //
-
-    // NEXT.
-    f = next_f(kmer_f, 'A');
-    r = next_r(kmer_r, 'A');
-      
-    // f = ((kmer_f << 2) & bitmask) | twobit_repr('A');
-    r = next_r(kmer_r, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'C');
-    r = next_r(kmer_r, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'G');
-    r = next_r(kmer_r, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'T');
-    r = next_r(kmer_r, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    // PREVIOUS.
-    r = prev_r(kmer_r, 'A');
-    f = prev_f(kmer_f, 'A');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    r = prev_r(kmer_r, 'C');
-    f = prev_f(kmer_f, 'C');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-    
-    r = prev_r(kmer_r, 'G');
-    f = prev_f(kmer_f, 'G');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    r = prev_r(kmer_r, 'T');
-    f = prev_f(kmer_f, 'T');
-    if (get_count(uniqify_rc(f,r)) && !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  HashIntoType kmer_f, kmer_r;
+  hash_kmer(kmer_s.c_str(), kmer_f, kmer_r);
 
-    is_first_kmer = false;
-  }
+  traversal.reset();
+  traversal.set_limits(&stop_tags, radius, MAX_KEEPER_SIZE);
 
-  return total;
+  return traversal.traverse(kmer_f, kmer_r);
 }
 
 void Hashbits::hitraverse_to_stoptags(std::string filename,
@@ -1418,7 +1280,7 @@ void Hashbits::hitraverse_to_stoptags(std::string filename,
     if (check_read(seq)) {
       for (unsigned int i = 0; i < seq.length() - _ksize + 1; i++) {
 	string kmer = seq.substr(i, i + _ksize); // @CTB this wrong!
-	HashIntoType kmer_n = _hash(kmer.c_str(), _ksize);
+	HashIntoType kmer_n = hash_kmer(kmer.c_str());
 	BoundedCounterType n = counting.get_count(kmer_n);
 
 	if (n >= cutoff) {
@@ -1440,65 +1302,76 @@ void Hashbits::hitraverse_to_stoptags(std::string filename,
 
 void Hashbits::load_stop_tags(std::string infilename, bool clear_tags)
 {
-  ifstream infile(infilename.c_str(), ios::binary);
-  assert(infile.is_open());
+  if (SectionedFileReader::is_sectioned(infilename)) {
+    SectionedFileReader infile(infilename, SAVED_STOPTAGS);
 
-  if (clear_tags) {
-    stop_tags.clear();
+    SavedParams params;
+    std::vector<HashIntoType> tablesizes;
+    infile.read_params(params, tablesizes, _unique_rc);
+    if (params.ksize != _ksize) {
+      throw SavedFileError(infilename + " was saved with a different k");
+    }
+
+    _read_tag_section(infile, SECTION_STOP_TAGS, stop_tags, clear_tags);
+    return;
+  }
+
+  ifstream infile(infilename.c_str(), ios::binary);
+  if (!infile.is_open()) {
+    throw SavedFileError("can't open " + infilename);
   }
 
-  unsigned char version, ht_type;
+  unsigned char version = 0, ht_type = 0;
   unsigned int save_ksize = 0;
 
   unsigned int tagset_size = 0;
 
   infile.read((char *) &version, 1);
   infile.read((char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_STOPTAGS);
+  if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_STOPTAGS) {
+    throw SavedFileError(infilename + " is not a saved stoptags file");
+  }
   
   infile.read((char *) &save_ksize, sizeof(save_ksize));
-  assert(save_ksize == _ksize);
+  if (save_ksize != _ksize) {
+    throw SavedFileError(infilename + " was saved with a different k");
+  }
   infile.read((char *) &tagset_size, sizeof(tagset_size));
 
+  if (clear_tags) {
+    stop_tags.clear();
+  }
+
   HashIntoType * buf = new HashIntoType[tagset_size];
 
   infile.read((char *) buf, sizeof(HashIntoType) * tagset_size);
+  if (infile.gcount() != (std::streamsize) (sizeof(HashIntoType) * tagset_size)) {
+    delete[] buf;
+    throw SavedFileError(infilename + " is truncated");
+  }
 
+  stop_tags.reserve(stop_tags.size() + tagset_size);
   for (unsigned int i = 0; i < tagset_size; i++) {
     stop_tags.insert(buf[i]);
   }
 
-  delete buf;
+  delete[] buf;
 }
 
 void Hashbits::save_stop_tags(std::string outfilename)
 {
-  ofstream outfile(outfilename.c_str(), ios::binary);
-  const unsigned int tagset_size = stop_tags.size();
-
-  HashIntoType * buf = new HashIntoType[tagset_size];
-
-  unsigned char version = SAVED_FORMAT_VERSION;
-  outfile.write((const char *) &version, 1);
+  const std::vector<HashIntoType> &tags = stop_tags.sorted();
 
-  unsigned char ht_type = SAVED_STOPTAGS;
-  outfile.write((const char *) &ht_type, 1);
+  SectionedFileWriter outfile(outfilename, SAVED_STOPTAGS);
 
-  unsigned int save_ksize = _ksize;
-  outfile.write((const char *) &save_ksize, sizeof(save_ksize));
-  outfile.write((const char *) &tagset_size, sizeof(tagset_size));
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ksize;
+  outfile.write_params(params, std::vector<HashIntoType>(), _unique_rc);
 
-  unsigned int i = 0;
-  for (SeenSet::iterator pi = stop_tags.begin(); pi != stop_tags.end();
-	 pi++, i++) {
-    buf[i] = *pi;
-  }
-
-  outfile.write((const char *) buf, sizeof(HashIntoType) * tagset_size);
+  outfile.write_section(SECTION_STOP_TAGS, tags.empty() ? NULL : &tags[0],
+			sizeof(HashIntoType) * tags.size());
   outfile.close();
-
-  delete buf;
 }
 
 void Hashbits::print_stop_tags(std::string infilename)
@@ -1506,7 +1379,7 @@ void Hashbits::print_stop_tags(std::string infilename)
   ofstream printfile(infilename.c_str());
 
   unsigned int i = 0;
-  for (SeenSet::iterator pi = stop_tags.begin(); pi != stop_tags.end();
+  for (TagSet::const_iterator pi = stop_tags.begin(); pi != stop_tags.end();
 	 pi++, i++) {
     std::string kmer = _revhash(*pi, _ksize);
     printfile << kmer << "\n";
@@ -1520,7 +1393,7 @@ void Hashbits::print_tagset(std::string infilename)
   ofstream printfile(infilename.c_str());
 
   unsigned int i = 0;
-  for (SeenSet::iterator pi = all_tags.begin(); pi != all_tags.end();
+  for (TagSet::const_iterator pi = all_tags.begin(); pi != all_tags.end();
 	 pi++, i++) {
     std::string kmer = _revhash(*pi, _ksize);
     printfile << kmer << "\n";
@@ -1529,19 +1402,19 @@ void Hashbits::print_tagset(std::string infilename)
   printfile.close();
 }
 
-unsigned int Hashbits::count_and_transfer_to_stoptags(SeenSet &keeper,
-						      unsigned int threshold,
-						      CountingHash &counting)
+unsigned int Hashbits::count_and_transfer_to_stoptags(
+				const std::vector<HashIntoType> &keeper,
+				unsigned int threshold,
+				CountingHash &counting)
 {
   unsigned int n_inserted = 0;
 
-  SeenSet::const_iterator ti;
-  for (ti = keeper.begin(); ti != keeper.end(); ti++) {
-    if (counting.get_count(*ti) >= threshold) {
-      stop_tags.insert(*ti);
+  for (unsigned int i = 0; i < keeper.size(); i++) {
+    if (counting.get_count(keeper[i]) >= threshold) {
+      stop_tags.insert(keeper[i]);
       n_inserted++;
     } else {
-      counting.count(*ti);
+      counting.count(keeper[i]);
     }
   }
 
@@ -1559,7 +1432,7 @@ void Hashbits::traverse_from_reads(std::string filename,
 
   IParser* parser = IParser::get_parser(filename.c_str());
   Read read;
-  SeenSet keeper;
+  GraphTraversal traversal(this);
 
   string seq = "";
 
@@ -1573,20 +1446,18 @@ void Hashbits::traverse_from_reads(std::string filename,
 
     if (check_read(seq)) {	// process?
       const char * last_kmer = seq.c_str() + seq.length() - _ksize;
-      HashIntoType kmer = _hash(last_kmer, _ksize);
+      HashIntoType kmer = hash_kmer(last_kmer);
 
-      unsigned int n = traverse_from_kmer(kmer, radius, keeper);
+      unsigned int n = traverse_from_kmer(kmer, radius, traversal);
 
       if (n >= big_threshold) {
 #if VERBOSE_REPARTITION
 	std::cout << "lump: " << n << "; added: " << total_stop << "\n";
 #endif
-	total_stop += count_and_transfer_to_stoptags(keeper,
+	total_stop += count_and_transfer_to_stoptags(traversal.visited(),
 						     transfer_threshold,
 						     counting);
       }
-
-      keeper.clear();
     }
 	       
     // reset the sequence info, increment read number
@@ -1614,6 +1485,7 @@ void Hashbits::consume_fasta_and_traverse(const std::string &filename,
 
   IParser* parser = IParser::get_parser(filename.c_str());
   Read read;
+  GraphTraversal traversal(this);
 
   string seq = "";
 
@@ -1626,7 +1498,7 @@ void Hashbits::consume_fasta_and_traverse(const std::string &filename,
     seq = read.seq;
 
     if (check_read(seq)) {	// process?
-      KMerIterator kmers(seq.c_str(), _ksize);
+      KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
 
       HashIntoType kmer = 0;
       bool is_first_kmer = true;
@@ -1641,14 +1513,13 @@ void Hashbits::consume_fasta_and_traverse(const std::string &filename,
       }
 
       if (!is_first_kmer) {	// traverse
-	SeenSet keeper;
-
-	unsigned int n = traverse_from_kmer(kmer, radius, keeper);
+	unsigned int n = traverse_from_kmer(kmer, radius, traversal);
 	if (n >= big_threshold) {
 #if VERBOSE_REPARTITION
 	  std::cout << "lmp: " << n << "; added: " << stop_tags.size() << "\n";
 #endif // VERBOSE_REPARTITION
-	  count_and_transfer_to_stoptags(keeper, transfer_threshold, counting);
+	  count_and_transfer_to_stoptags(traversal.visited(),
+					 transfer_threshold, counting);
 	}
       }
     }
@@ -1675,7 +1546,7 @@ const
   SeenSet path;
   HashIntoType kmer;
 
-  KMerIterator kmers(seq.c_str(), _ksize);
+  KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
   
   unsigned int i = 0;
   while(!kmers.done()) {
@@ -1703,7 +1574,7 @@ void Hashbits::extract_unique_paths(std::string seq,
 
   min_length = min_length - _ksize + 1; // adjust for k-mer size.
 
-  KMerIterator kmers(seq.c_str(), _ksize);
+  KMerIterator kmers(seq.c_str(), _ksize, _unique_rc);
   HashIntoType kmer;
 
   std::deque<bool> seen_queue;
@@ -1939,7 +1810,7 @@ unsigned int Hashbits::consume_string_overlap(const std::string &s,
 
   bool bounded = true;
 
-  KMerIterator kmers(sp, _ksize);
+  KMerIterator kmers(sp, _ksize, _unique_rc);
   HashIntoType kmer;
 
   if (lower_bound == upper_bound && upper_bound == 0) {
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include "hashtable.hh"
+#include "tagset.hh"
 #include "subset.hh"
 
 #define next_f(kmer_f, ch) ((((kmer_f) << 2) & bitmask) | (twobit_repr(ch)))
@@ -11,10 +12,16 @@
 #define prev_f(kmer_f, ch) ((kmer_f) >> 2 | twobit_repr(ch) << rc_left_shift)
 #define prev_r(kmer_r, ch) ((((kmer_r) << 2) & bitmask) | (twobit_comp(ch)))
 
-#define set_contains(s, e) ((s).find(e) != (s).end())
-
 namespace khmer {
+  // see also set_contains(const TagSet&, ...).
+  template <typename S, typename E>
+  inline bool set_contains(const S &s, const E &e) {
+    return s.find(e) != s.end();
+  }
+
   class CountingHash;
+  class SectionedFileReader;
+  class GraphTraversal;
 
   class Hashbits : public khmer::Hashtable {
     friend class SubsetPartition;
@@ -26,6 +33,7 @@ namespace khmer {
     HashIntoType _n_unique_kmers;
 	HashIntoType _n_overlap_kmers;
     Byte ** _counts;
+    Mutex _tags_lock;		// guards all_tags during threaded loads.
 
     virtual void _allocate_counters() {
       _n_tables = _tablesizes.size();
@@ -39,8 +47,7 @@ namespace khmer {
 	tablesize = _tablesizes[i];
 	tablebytes = tablesize / 8 + 1;
 
-	_counts[i] = new Byte[tablebytes];
-	memset(_counts[i], 0, tablebytes);
+	_counts[i] = allocate_table(tablebytes);
       }
     }
             
@@ -50,11 +57,65 @@ namespace khmer {
       }
     }
 
+    // atomically set the bits for khash; returns how many of them were
+    // not already set.  Does not touch the occupancy counters.
+    virtual unsigned int _set_bits_atomic(HashIntoType khash) {
+      const HashIntoType h = _family.prepare(khash);
+      unsigned int n_new = 0;
+
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
+	Byte mask = 1 << (bin % 8);
+	Byte old = __sync_fetch_and_or(&_counts[i][bin / 8], mask);
+	if (!(old & mask)) {
+	  n_new++;
+	}
+      }
+      return n_new;
+    }
+
+    void _tag_kmers(const HashIntoType * kmers, const char * is_new,
+		    unsigned int n, SeenSet * found_tags);
+
+    void _consume_kmers_and_tag(const KmerExtractor &kmers,
+				unsigned long long& n_consumed,
+				SeenSet * found_tags);
+
+    static void _consume_and_tag_batch(void * data, const ReadBatch &batch,
+				       unsigned long long &n_consumed);
+    template <bool UniqueRC>
+    static void _consume_and_tag_batch_as(Hashbits * ht,
+					  const ReadBatch &batch,
+					  unsigned long long &n_consumed);
+
+    // for subclasses that lay out their own bits; leaves _counts NULL.
+    Hashbits(WordLength ksize, std::vector<HashIntoType>& tablesizes,
+	     bool allocate) :
+      khmer::Hashtable(ksize), _tablesizes(tablesizes) {
+      _tag_density = DEFAULT_TAG_DENSITY;
+      assert(_tag_density % 2 == 0);
+      partition = new SubsetPartition(this);
+      _occupied_bins = 0;
+      _n_unique_kmers = 0;
+      _n_overlap_kmers = 0;
+      _n_tables = _tablesizes.size();
+      _counts = NULL;
+
+      if (allocate) {
+	_allocate_counters();
+      }
+    }
+
+    void _load(const std::string &infilename, bool use_mmap);
+    void _load_sectioned(const std::string &infilename, bool use_mmap);
+    void _read_tag_section(SectionedFileReader &infile, unsigned int type,
+			   TagSet &tags, bool clear_tags);
+
   public:
     SubsetPartition * partition;
-    SeenSet all_tags;
-    SeenSet stop_tags;
-    SeenSet repart_small_tags;
+    TagSet all_tags;
+    TagSet stop_tags;
+    TagSet repart_small_tags;
 
     void _validate_pmap() {
       if (partition) { partition->_validate_pmap(); }
@@ -75,7 +136,7 @@ namespace khmer {
     ~Hashbits() {
       if (_counts) {
 	for (unsigned int i = 0; i < _n_tables; i++) {
-	  delete _counts[i];
+	  free_table(_counts[i]);
 	  _counts[i] = NULL;
 	}
 	delete _counts;
@@ -93,6 +154,7 @@ namespace khmer {
 
     virtual void save(std::string);
     virtual void load(std::string);
+    virtual void load_mmap(std::string);
     virtual void save_tagset(std::string);
     virtual void load_tagset(std::string, bool clear_tags=true);
 
@@ -116,7 +178,7 @@ namespace khmer {
 				   const unsigned long long threshold=0,
 				   bool break_on_circum=false) const{
       HashIntoType r, f;
-      _hash(kmer, _ksize, f, r);
+      hash_kmer(kmer, f, r);
       calc_connected_graph_size(f, r, count, keeper, threshold, break_on_circum);
     }
 
@@ -135,6 +197,14 @@ namespace khmer {
 
     void divide_tags_into_subsets(unsigned int subset_size, SeenSet& divvy);
 
+    // partition all the tags at once, in n_threads threads, into partition.
+    void parallel_partition(unsigned int n_threads,
+			    bool break_on_stop_tags=false,
+			    bool stop_big_traversals=false) {
+      partition->parallel_partition(n_threads, break_on_stop_tags,
+				    stop_big_traversals);
+    }
+
     void add_kmer_to_tags(HashIntoType kmer) {
       all_tags.insert(kmer);
     }
@@ -145,9 +215,16 @@ namespace khmer {
 			       unsigned int &total_reads,
 			       unsigned long long &n_consumed,
 			       CallbackFn callback = 0,
-			       void * callback_data = 0);
+			       void * callback_data = 0,
+			       unsigned int n_threads = 1);
 
     void consume_sequence_and_tag(const std::string& seq,
+				  unsigned long long& n_consumed,
+				  SeenSet * new_tags = 0) {
+      consume_sequence_and_tag(seq.c_str(), seq.length(), n_consumed,
+			       new_tags);
+    }
+    void consume_sequence_and_tag(const char * seq, unsigned int length,
 				  unsigned long long& n_consumed,
 				  SeenSet * new_tags = 0);
 
@@ -200,7 +277,7 @@ namespace khmer {
     unsigned int kmer_degree(HashIntoType kmer_f, HashIntoType kmer_r) const;
     unsigned int kmer_degree(const char * kmer_s) const {
       HashIntoType kmer_f, kmer_r;
-      _hash(kmer_s, _ksize, kmer_f, kmer_r);
+      hash_kmer(kmer_s, kmer_f, kmer_r);
 
       return kmer_degree(kmer_f, kmer_r);
     }
@@ -208,30 +285,54 @@ namespace khmer {
     // count number of occupied bins
     virtual const HashIntoType n_occupied(HashIntoType start=0,
 				  HashIntoType stop=0) const {
-      // @@ CTB need to be able to *save* this...
       return _occupied_bins/_n_tables;
     }
       
+    // expected false positive rate for a k-mer not in the table, from
+    // how full the tables actually are.
+    virtual double false_positive_rate() const;
+
+    // tags and partitions are kept.
+    virtual void clear() {
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	clear_table(_counts[i]);
+      }
+      _occupied_bins = 0;
+      _n_unique_kmers = 0;
+      _n_overlap_kmers = 0;
+    }
+
     virtual const HashIntoType n_kmers(HashIntoType start=0,
                   HashIntoType stop=0) const {
-      return _n_unique_kmers;	// @@ CTB need to be able to *save* this...
+      return _n_unique_kmers;
     }
 
     virtual const HashIntoType n_overlap_kmers(HashIntoType start=0,
                   HashIntoType stop=0) const {
-      return _n_overlap_kmers;	// @@ CTB need to be able to *save* this...
+      return _n_overlap_kmers;
     }
 
     virtual void count(const char * kmer) {
-      HashIntoType hash = _hash(kmer, _ksize);
+      HashIntoType hash = hash_kmer(kmer);
       count(hash);
     }
 
+    // lock-free: bits are set with an atomic or, and the occupancy
+    // counters are bumped once per call.  Two threads adding the same new
+    // k-mer at once may both count it as unique.
+    virtual void count_concurrent(const HashIntoType * kmers,
+				  unsigned int n);
+
+    // see Hashtable::count_staged.
+    virtual void count_staged(const HashIntoType * kmers, unsigned int n,
+			      StagingBuffer &buffer);
+
     virtual void count(HashIntoType khash) {
+      const HashIntoType h = _family.prepare(khash);
       bool is_new_kmer = false;
 
       for (unsigned int i = 0; i < _n_tables; i++) {
-	HashIntoType bin = khash % _tablesizes[i];
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
 	HashIntoType byte = bin / 8;
 	unsigned char bit = bin % 8;
 	if (!( _counts[i][byte] & (1<<bit))) {
@@ -246,28 +347,20 @@ namespace khmer {
     }
 
 	virtual bool check_overlap(HashIntoType khash, Hashbits &ht2) {
-
-	  for (unsigned int i = 0; i < ht2._n_tables; i++) {
-		HashIntoType bin = khash % ht2._tablesizes[i];
-		HashIntoType byte = bin / 8;
-		unsigned char bit = bin % 8;
-		if (!( ht2._counts[i][byte] & (1<<bit))) {
-		  return false;
-	}
-      }
-	  return true;
+	  return ht2.get_count(khash) != 0;
 	  }
 
     virtual void count_overlap(const char * kmer, Hashbits &ht2) {
-      HashIntoType hash = _hash(kmer, _ksize);
+      HashIntoType hash = hash_kmer(kmer);
       count_overlap(hash,ht2);
     }
 
     virtual void count_overlap(HashIntoType khash, Hashbits &ht2) {
+      const HashIntoType h = _family.prepare(khash);
       bool is_new_kmer = false;
 
       for (unsigned int i = 0; i < _n_tables; i++) {
-	HashIntoType bin = khash % _tablesizes[i];
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
 	HashIntoType byte = bin / 8;
 	unsigned char bit = bin % 8;
 	if (!( _counts[i][byte] & (1<<bit))) {
@@ -286,14 +379,16 @@ namespace khmer {
 
     // get the count for the given k-mer.
     virtual const BoundedCounterType get_count(const char * kmer) const {
-      HashIntoType hash = _hash(kmer, _ksize);
+      HashIntoType hash = hash_kmer(kmer);
       return get_count(hash);
     }
 
     // get the count for the given k-mer hash.
     virtual const BoundedCounterType get_count(HashIntoType khash) const {
+      const HashIntoType h = _family.prepare(khash);
+
       for (unsigned int i = 0; i < _n_tables; i++) {
-	HashIntoType bin = khash % _tablesizes[i];
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
 	HashIntoType byte = bin / 8;
 	unsigned char bit = bin % 8;
       
@@ -304,6 +399,27 @@ namespace khmer {
       return 1;
     }
 
+    virtual unsigned int count_kmers(const HashIntoType * kmers,
+				     unsigned int n,
+				     HashIntoType lower_bound = 0,
+				     HashIntoType upper_bound = 0) {
+      return _drive_count_kmers(*this, kmers, n, lower_bound, upper_bound);
+    }
+
+    virtual void get_counts(const HashIntoType * kmers, unsigned int n,
+			    BoundedCounterType * out) const {
+      _drive_get_counts(*this, kmers, n, out);
+    }
+
+    // start pulling khash's bits in ahead of a count() or get_count().
+    void _prefetch(HashIntoType khash) const {
+      const HashIntoType h = _family.prepare(khash);
+      for (unsigned int i = 0; i < _n_tables; i++) {
+	HashIntoType bin = _family.bin(h, i, _tablesizes[i]);
+	__builtin_prefetch(&_counts[i][bin / 8]);
+      }
+    }
+
     void filter_if_present(const std::string infilename,
 			   const std::string outputfilename,
 			   CallbackFn callback=0,
@@ -314,11 +430,13 @@ namespace khmer {
 					   unsigned int radius,
 					   unsigned int max_count,
 					   const SeenSet * seen=0) const;
+    // k-mers less than depth away that seen hasn't visited yet; seen
+    // then holds them too.
     unsigned int count_kmers_within_depth(HashIntoType kmer_f,
 					  HashIntoType kmer_r,
 					  unsigned int depth,
 					  unsigned int max_count,
-					  SeenSet * seen) const;
+					  GraphTraversal &seen) const;
 
     unsigned int find_radius_for_volume(HashIntoType kmer_f,
 					HashIntoType kmer_r,
@@ -329,6 +447,11 @@ namespace khmer {
 				       HashIntoType kmer_r,
 				       unsigned int radius,
 				       unsigned int max_volume) const;
+    unsigned int count_kmers_on_radius(HashIntoType kmer_f,
+				       HashIntoType kmer_r,
+				       unsigned int radius,
+				       unsigned int max_volume,
+				       GraphTraversal &traversal) const;
 
     unsigned int trim_on_degree(std::string sequence, unsigned int max_degree)
       const;
@@ -345,13 +468,15 @@ namespace khmer {
 			    unsigned int num_high_todo,
 			    CountingHash &counting);
 
+    // the k-mers reached are left in traversal.visited().
     unsigned int traverse_from_kmer(HashIntoType start,
 				    unsigned int radius,
-				    SeenSet &keeper) const;
+				    GraphTraversal &traversal) const;
 
-    unsigned int count_and_transfer_to_stoptags(SeenSet &keeper,
-						unsigned int threshold,
-						CountingHash &counting);
+    unsigned int count_and_transfer_to_stoptags(
+				const std::vector<HashIntoType> &keeper,
+				unsigned int threshold,
+				CountingHash &counting);
 
     void traverse_from_reads(std::string filename,
 			     unsigned int radius,
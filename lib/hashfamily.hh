@@ -0,0 +1,61 @@
+#ifndef HASHFAMILY_HH
+#define HASHFAMILY_HH
+
+#include <assert.h>
+
+// how a k-mer hash is turned into a bin in each table.
+#define HASH_FAMILY_MODULO 0	// khash % tablesize; the original scheme.
+#define HASH_FAMILY_MIX 1	// mixed, then multiply-shift per table.
+
+namespace khmer {
+  // murmur3's 64-bit finalizer; spreads k-mer hashes over all 64 bits.
+  inline HashIntoType mix_hash(HashIntoType h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  //
+  // HashFamily: picks the bins for a k-mer.  Call prepare() once per
+  // k-mer, then bin() for each table.
+  //
+  // HASH_FAMILY_MIX never divides: table i uses the double hash
+  // h + i * h2, scaled into [0, tablesize) by taking the high word of
+  // a 64x64 multiply.  Mixing first also spreads out low-complexity
+  // k-mers, whose raw 2-bit values cluster.
+  //
+
+  class HashFamily {
+  protected:
+    unsigned char _type;
+  public:
+    HashFamily(unsigned char type = HASH_FAMILY_MODULO) : _type(type) {
+      assert(type == HASH_FAMILY_MODULO || type == HASH_FAMILY_MIX);
+    }
+
+    unsigned char type() const { return _type; }
+
+    HashIntoType prepare(HashIntoType khash) const {
+      if (_type == HASH_FAMILY_MODULO) {
+	return khash;
+      }
+      return mix_hash(khash);
+    }
+
+    HashIntoType bin(HashIntoType h, unsigned int i,
+		     HashIntoType tablesize) const {
+      if (_type == HASH_FAMILY_MODULO) {
+	return h % tablesize;
+      }
+
+      HashIntoType h2 = ((h >> 32) | (h << 32)) | 1;
+      HashIntoType g = h + i * h2;
+      return (HashIntoType) (((unsigned __int128) g * tablesize) >> 64);
+    }
+  };
+};
+
+#endif // HASHFAMILY_HH
@@ -9,29 +9,33 @@ using namespace std;
 // check_and_process_read: checks for non-ACGT characters before consuming
 //
 
-unsigned int Hashtable::check_and_process_read(const std::string &read,
-					    bool &is_valid,
-                                            HashIntoType lower_bound,
-                                            HashIntoType upper_bound)
+unsigned int Hashtable::check_and_process_read(const char * read,
+					       unsigned int length,
+					       bool &is_valid,
+					       HashIntoType lower_bound,
+					       HashIntoType upper_bound)
 {
-   is_valid = check_read(read);
+   KmerExtractor kmers;
+
+   // validate & extract the k-mers in one go.
+   is_valid = kmers.extract(read, length, _ksize, _unique_rc);
 
    if (!is_valid) { return 0; }
 
-   return consume_string(read, lower_bound, upper_bound);
+   return _count_kmers(kmers, lower_bound, upper_bound);
 }
 
 //
 // check_read: checks for non-ACGT characters
 //
 
-bool Hashtable::check_read(const std::string &read) const
+bool Hashtable::check_read(const char * read, unsigned int length) const
 {
-  if (read.length() < _ksize) {
+  if (length < _ksize) {
     return false;
   }
 
-  for (unsigned int i = 0; i < read.length(); i++)  {
+  for (unsigned int i = 0; i < length; i++)  {
     if (!is_valid_dna(read[i])) {
       return false;
     }
@@ -40,6 +44,118 @@ bool Hashtable::check_read(const std::string &read) const
   return true;
 }
 
+//
+// _consume_fasta_batch: the threaded body of consume_fasta.  Reads to mask
+//    out are collected and applied after the workers finish; each read's
+//    readmask entry is only looked at by the worker that has that read,
+//    so this is the same as setting them as we go.
+//
+
+namespace khmer {
+  struct _ConsumeFastaState {
+    Hashtable * ht;
+    HashIntoType lower_bound, upper_bound;
+    ReadMaskTable * readmask;
+    bool update_readmask;
+
+    Mutex masklist_lock;
+    std::list<unsigned int> masklist;
+
+    bool staged;
+    Mutex buffers_lock;
+    std::list<StagingBuffer *> buffers;	// not in use; one per thread.
+
+    ~_ConsumeFastaState() {
+      std::list<StagingBuffer *>::iterator it;
+      for (it = buffers.begin(); it != buffers.end(); ++it) {
+	delete *it;
+      }
+    }
+  };
+}
+
+template <bool UniqueRC>
+static void _consume_fasta_batch_as(_ConsumeFastaState * state,
+				    const ReadBatch &batch,
+				    unsigned long long &n_consumed)
+{
+  const WordLength ksize = state->ht->ksize();
+  const bool bounded = !(state->lower_bound == state->upper_bound &&
+			 state->upper_bound == 0);
+
+  KmerExtractor extractor;
+  std::vector<HashIntoType> kmers;
+
+  for (unsigned int i = 0; i < batch.size(); i++) {
+    unsigned int read_num = batch.index(i);
+    if (state->readmask && !state->readmask->get(read_num)) {
+      continue;
+    }
+
+    if (!extractor.extract<UniqueRC>(batch.seq(i), batch.seq_len(i), ksize)) {
+      if (state->update_readmask) {
+	ScopedLock lock(state->masklist_lock);
+	state->masklist.push_back(read_num);
+      }
+      continue;
+    }
+
+    for (unsigned int j = 0; j < extractor.size(); j++) {
+      HashIntoType kmer = extractor[j];
+      if (!bounded ||
+	  (kmer >= state->lower_bound && kmer < state->upper_bound)) {
+	kmers.push_back(kmer);
+      }
+    }
+  }
+
+  if (kmers.empty()) {
+    return;
+  }
+
+  if (state->staged) {
+    // batches are small; save up k-mers so that each region gets a
+    // useful number of updates.  With one worker, there is one buffer,
+    // so the k-mers are still counted in file order.
+    StagingBuffer * buffer;
+    {
+      ScopedLock lock(state->buffers_lock);
+      if (state->buffers.empty()) {
+	buffer = new StagingBuffer;
+      } else {
+	buffer = state->buffers.front();
+	state->buffers.pop_front();
+      }
+    }
+
+    buffer->kmers.insert(buffer->kmers.end(), kmers.begin(), kmers.end());
+    if (buffer->kmers.size() >= STAGING_MAX_KMERS) {
+      state->ht->count_staged(&buffer->kmers[0], buffer->kmers.size(),
+			      *buffer);
+      buffer->kmers.clear();
+    }
+
+    ScopedLock lock(state->buffers_lock);
+    state->buffers.push_back(buffer);
+  } else {
+    state->ht->count_concurrent(&kmers[0], kmers.size());
+  }
+  n_consumed += kmers.size();
+}
+
+static void _consume_fasta_batch(void * data, const ReadBatch &batch,
+				 unsigned long long &n_consumed)
+{
+  _ConsumeFastaState * state = (_ConsumeFastaState *) data;
+
+  // the strand mode is chosen once a batch, not once a k-mer.
+  if (state->ht->unique_rc()) {
+    _consume_fasta_batch_as<true>(state, batch, n_consumed);
+  } else {
+    _consume_fasta_batch_as<false>(state, batch, n_consumed);
+  }
+}
+
 //
 // consume_fasta: consume a FASTA file of reads
 //
@@ -52,17 +168,13 @@ void Hashtable::consume_fasta(const std::string &filename,
 			      ReadMaskTable ** orig_readmask,
 			      bool update_readmask,
 			      CallbackFn callback,
-			      void * callback_data)
+			      void * callback_data,
+			      unsigned int n_threads,
+			      bool staged)
 {
   total_reads = 0;
   n_consumed = 0;
 
-  IParser* parser = IParser::get_parser(filename.c_str());
-  Read read;
-
-  string currName = "";
-  string currSeq = "";
-
   //
   // readmask stuff: were we given one? do we want to update it?
   // 
@@ -78,46 +190,104 @@ void Hashtable::consume_fasta(const std::string &filename,
   // iterate through the FASTA file & consume the reads.
   //
 
-  while(!parser->is_complete())  {
-    read = parser->get_next_read();
-    currSeq = read.seq;
-    currName = read.name; 
-
-    // do we want to process it?
-    if (!readmask || readmask->get(total_reads)) {
-
-      // yep! process.
-      unsigned int this_n_consumed;
-      bool is_valid;
-
-      this_n_consumed = check_and_process_read(currSeq,
-					       is_valid,
-					       lower_bound,
-					       upper_bound);
-
-      // was this an invalid sequence -> mark as bad?
-      if (!is_valid && update_readmask) {
-        if (readmask) {
-	  readmask->set(total_reads, false);
-	} else {
-	  masklist.push_back(total_reads);
-	}
-      } else {		// nope -- count it!
-        n_consumed += this_n_consumed;
+  if (n_threads > 1 || staged) {
+    if (n_threads == 0) {
+      n_threads = 1;
+    }
+
+    // a readmask goes by each read's place in the whole file, so then
+    // the workers must share one parser; otherwise each gets a piece.
+    // (Without orig_readmask, there's nowhere to put a new one.)
+    const bool make_readmask = orig_readmask && update_readmask;
+
+    std::vector<IParser *> parsers;
+    if (readmask || make_readmask) {
+      parsers.push_back(IParser::get_parser(filename.c_str()));
+    } else {
+      IParser::get_parsers(filename, n_threads, parsers);
+    }
+
+    _ConsumeFastaState state;
+    state.ht = this;
+    state.lower_bound = lower_bound;
+    state.upper_bound = upper_bound;
+    state.readmask = readmask;
+    state.update_readmask = make_readmask;
+    state.staged = staged;
+
+    try {
+      process_batches_threaded(parsers, n_threads, _consume_fasta_batch,
+			       &state, total_reads, n_consumed,
+			       "consume_fasta", callback, callback_data);
+    } catch (...) {
+      delete_parsers(parsers);
+      throw;
+    }
+    delete_parsers(parsers);
+
+    // count whatever the workers left behind.
+    list<StagingBuffer *>::iterator bi;
+    for (bi = state.buffers.begin(); bi != state.buffers.end(); ++bi) {
+      StagingBuffer * buffer = *bi;
+      if (!buffer->kmers.empty()) {
+	count_staged(&buffer->kmers[0], buffer->kmers.size(), *buffer);
       }
     }
-	       
-    // reset the sequence info, increment read number
-    total_reads++;
 
-    // run callback, if specified
-    if (total_reads % CALLBACK_PERIOD == 0 && callback) {
-      try {
-        callback("consume_fasta", callback_data, total_reads, n_consumed);
-      } catch (...) {
-        throw;
+    if (readmask) {
+      list<unsigned int>::const_iterator it;
+      for (it = state.masklist.begin(); it != state.masklist.end(); ++it) {
+	readmask->set(*it, false);
+      }
+    } else {
+      masklist.splice(masklist.end(), state.masklist);
+    }
+  } else {
+    IParser* parser = IParser::get_parser(filename.c_str());
+    ReadBatch batch;
+    KmerExtractor kmers;	// reused from read to read.
+
+    while(parser->get_next_batch(batch))  {
+      for (unsigned int i = 0; i < batch.size(); i++) {
+	// do we want to process it?
+	if (!readmask || readmask->get(total_reads)) {
+
+	  // yep! process.  (extract also checks the read.)
+	  unsigned int this_n_consumed = 0;
+	  bool is_valid = kmers.extract(batch.seq(i), batch.seq_len(i),
+					_ksize, _unique_rc);
+
+	  if (is_valid) {
+	    this_n_consumed = _count_kmers(kmers, lower_bound, upper_bound);
+	  }
+
+	  // was this an invalid sequence -> mark as bad?
+	  if (!is_valid && update_readmask) {
+	    if (readmask) {
+	      readmask->set(total_reads, false);
+	    } else {
+	      masklist.push_back(total_reads);
+	    }
+	  } else {		// nope -- count it!
+	    n_consumed += this_n_consumed;
+	  }
+	}
+
+	// increment read number
+	total_reads++;
+
+	// run callback, if specified
+	if (total_reads % CALLBACK_PERIOD == 0 && callback) {
+	  try {
+	    callback("consume_fasta", callback_data, total_reads, n_consumed);
+	  } catch (...) {
+	    delete parser;
+	    throw;
+	  }
+	}
       }
     }
+    delete parser;
   }
 
 
@@ -142,27 +312,43 @@ void Hashtable::consume_fasta(const std::string &filename,
 // consume_string: run through every k-mer in the given string, & hash it.
 //
 
-unsigned int Hashtable::consume_string(const std::string &s,
+unsigned int Hashtable::consume_string(const char * sp,
+				       unsigned int length,
 				       HashIntoType lower_bound,
 				       HashIntoType upper_bound)
 {
-  const char * sp = s.c_str();
-  unsigned int n_consumed = 0;
+  KmerExtractor kmers;
+  kmers.extract(sp, length, _ksize, _unique_rc);
 
-  bool bounded = true;
+  return _count_kmers(kmers, lower_bound, upper_bound);
+}
 
-  KMerIterator kmers(sp, _ksize);
-  HashIntoType kmer;
+unsigned int Hashtable::_count_kmers(const KmerExtractor &kmers,
+				     HashIntoType lower_bound,
+				     HashIntoType upper_bound)
+{
+  return count_kmers(kmers.kmers(), kmers.size(), lower_bound, upper_bound);
+}
 
+//
+// count_kmers, get_counts: the generic versions, one virtual call per
+//    k-mer.  Hashbits & CountingHash override them; see _drive_count_kmers.
+//
+
+unsigned int Hashtable::count_kmers(const HashIntoType * kmers,
+				    unsigned int n,
+				    HashIntoType lower_bound,
+				    HashIntoType upper_bound)
+{
+  bool bounded = true;
   if (lower_bound == upper_bound && upper_bound == 0) {
     bounded = false;
   }
 
-  while(!kmers.done()) {
-    kmer = kmers.next();
-  
-    if (!bounded || (kmer >= lower_bound && kmer < upper_bound)) {
-      count(kmer);
+  unsigned int n_consumed = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    if (!bounded || (kmers[i] >= lower_bound && kmers[i] < upper_bound)) {
+      count(kmers[i]);
       n_consumed++;
     }
   }
@@ -170,3 +356,228 @@ unsigned int Hashtable::consume_string(const std::string &s,
   return n_consumed;
 }
 
+void Hashtable::get_counts(const HashIntoType * kmers, unsigned int n,
+			   BoundedCounterType * out) const
+{
+  for (unsigned int i = 0; i < n; i++) {
+    out[i] = get_count(kmers[i]);
+  }
+}
+
+//
+// StagingBuffer::sort: stable counting sort on the region.
+//
+
+void StagingBuffer::sort(unsigned int n_regions)
+{
+  region_starts.assign(n_regions + 1, 0);
+  for (unsigned int i = 0; i < bins.size(); i++) {
+    region_starts[bins[i].region + 1]++;
+  }
+  for (unsigned int r = 0; r < n_regions; r++) {
+    region_starts[r + 1] += region_starts[r];
+  }
+
+  sorted.resize(bins.size());
+  for (unsigned int i = 0; i < bins.size(); i++) {
+    sorted[region_starts[bins[i].region]++] = bins[i];
+  }
+}
+
+//
+// count_concurrent: the default just serializes callers.
+//
+
+void Hashtable::count_concurrent(const HashIntoType * kmers, unsigned int n)
+{
+  ScopedLock lock(_count_lock);
+
+  for (unsigned int i = 0; i < n; i++) {
+    count(kmers[i]);
+  }
+}
+
+//
+// process_batches_threaded: hand out batches to n_threads workers, each
+//    of which calls 'fn' on its batch.  Given one parser, the workers
+//    share it, taking turns under a lock; given one per thread (see
+//    IParser::get_parsers), each reads its own with no lock at all.  The
+//    calling thread only waits and runs the callback, so callbacks are
+//    never made from a worker.  If the callback throws, or a parser does,
+//    the workers are stopped and joined before the exception is passed
+//    on.
+//
+
+namespace khmer {
+  struct _BatchWorkerState {
+    Mutex parser_lock;		// for a shared parser.
+    bool stop;			// guarded by parser_lock.
+    ParserError * error;	// ditto; what stopped a parser, if anything.
+
+    BatchFn fn;
+    void * fn_data;
+
+    Mutex progress_lock;
+    Condition progress;
+    unsigned int total_reads;
+    unsigned long long n_consumed;
+    unsigned int n_running;
+  };
+
+  struct _BatchWorker {
+    _BatchWorkerState * state;
+    IParser * parser;
+    bool shared;
+  };
+}
+
+// _next_batch: fill 'batch' from the worker's parser; 0 at the end of
+// its input, or once the workers have been stopped.
+
+static unsigned int _next_batch(_BatchWorker * worker, ReadBatch &batch)
+{
+  _BatchWorkerState * state = worker->state;
+  unsigned int n_reads = 0;
+  ParserError * error = NULL;
+
+  state->parser_lock.lock();
+  if (state->stop) {
+    state->parser_lock.unlock();
+    return 0;
+  }
+  if (!worker->shared) {
+    state->parser_lock.unlock();
+  }
+
+  try {
+    n_reads = worker->parser->get_next_batch(batch);
+  } catch (ParserError &e) {
+    error = new ParserError(e);
+  }
+
+  if (!worker->shared) {
+    state->parser_lock.lock();
+  }
+  if (error) {
+    if (state->error) {
+      delete error;		// keep the first.
+    } else {
+      state->error = error;
+    }
+    state->stop = true;
+    n_reads = 0;
+  }
+  state->parser_lock.unlock();
+
+  return n_reads;
+}
+
+static void * _batch_worker(void * arg)
+{
+  _BatchWorker * worker = (_BatchWorker *) arg;
+  _BatchWorkerState * state = worker->state;
+  ReadBatch batch;
+
+  while (1) {
+    unsigned int n_reads = _next_batch(worker, batch);
+    if (n_reads == 0) {
+      break;
+    }
+
+    unsigned long long n_consumed = 0;
+    state->fn(state->fn_data, batch, n_consumed);
+
+    ScopedLock lock(state->progress_lock);
+    state->total_reads += n_reads;
+    state->n_consumed += n_consumed;
+    state->progress.signal();
+  }
+
+  ScopedLock lock(state->progress_lock);
+  state->n_running--;
+  state->progress.signal();
+
+  return NULL;
+}
+
+void khmer::process_batches_threaded(const std::vector<IParser *> &parsers,
+				     unsigned int n_threads,
+				     BatchFn fn,
+				     void * fn_data,
+				     unsigned int &total_reads,
+				     unsigned long long &n_consumed,
+				     const char * callback_name,
+				     CallbackFn callback,
+				     void * callback_data)
+{
+  assert(parsers.size() == 1 || parsers.size() == n_threads);
+
+  _BatchWorkerState state;
+  state.stop = false;
+  state.error = NULL;
+  state.fn = fn;
+  state.fn_data = fn_data;
+  state.total_reads = 0;
+  state.n_consumed = 0;
+  state.n_running = n_threads;
+
+  std::vector<_BatchWorker> workers(n_threads);
+  for (unsigned int i = 0; i < n_threads; i++) {
+    workers[i].state = &state;
+    workers[i].shared = parsers.size() == 1;
+    workers[i].parser = workers[i].shared ? parsers[0] : parsers[i];
+  }
+
+  std::vector<pthread_t> threads(n_threads);
+
+  for (unsigned int i = 0; i < n_threads; i++) {
+    int ret = pthread_create(&threads[i], NULL, _batch_worker, &workers[i]);
+    assert(ret == 0);
+  }
+
+  // wait for the workers, running the callback whenever another
+  // CALLBACK_PERIOD reads have gone by.
+  unsigned int next_callback = CALLBACK_PERIOD;
+
+  state.progress_lock.lock();
+  while (state.n_running) {
+    state.progress.wait(state.progress_lock);
+
+    if (callback && state.total_reads >= next_callback) {
+      unsigned int reads_so_far = state.total_reads;
+      unsigned long long consumed_so_far = state.n_consumed;
+      next_callback = (reads_so_far / CALLBACK_PERIOD + 1) * CALLBACK_PERIOD;
+
+      state.progress_lock.unlock();
+      try {
+	callback(callback_name, callback_data, reads_so_far,
+		 consumed_so_far);
+      } catch (...) {
+	state.parser_lock.lock();
+	state.stop = true;
+	state.parser_lock.unlock();
+
+	for (unsigned int i = 0; i < n_threads; i++) {
+	  pthread_join(threads[i], NULL);
+	}
+	delete state.error;
+	throw;
+      }
+      state.progress_lock.lock();
+    }
+  }
+  state.progress_lock.unlock();
+
+  for (unsigned int i = 0; i < n_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  if (state.error) {
+    ParserError error(*state.error);
+    delete state.error;
+    throw error;
+  }
+
+  total_reads = state.total_reads;
+  n_consumed = state.n_consumed;
+}
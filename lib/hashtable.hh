@@ -14,24 +14,66 @@
 
 #include "khmer.hh"
 #include "storage.hh"
+#include "thread_utils.hh"
+#include "hashfamily.hh"
+#include "alloc.hh"
 
 #define CALLBACK_PERIOD 100000
 
+// staged updates are applied one table region at a time; a region
+// should fit in L2.
+#define STAGING_REGION_SHIFT 18	// 256 KB
+#define STAGING_MAX_KMERS (1 << 19)	// per pass; must fit in 29 bits.
+
+class IParser;
+class ReadBatch;
+
 namespace khmer {
   typedef unsigned int PartitionID;
   typedef std::set<HashIntoType> SeenSet;
   typedef std::set<PartitionID> PartitionSet;
-  typedef std::map<HashIntoType, PartitionID*> PartitionMap;
-  typedef std::map<PartitionID, PartitionID*> PartitionPtrMap;
+  typedef std::map<PartitionID, unsigned int> PartitionIndexMap;
   typedef std::map<PartitionID, SeenSet*> PartitionsToTagsMap;
-  typedef std::set<PartitionID *> PartitionPtrSet;
-  typedef std::map<PartitionID, PartitionPtrSet*> ReversePartitionMap;
   typedef std::queue<HashIntoType> NodeQueue;
-  typedef std::map<PartitionID, PartitionID*> PartitionToPartitionPMap;
   typedef std::map<HashIntoType, unsigned int> TagCountMap;
   typedef std::map<PartitionID, unsigned int> PartitionCountMap;
   typedef std::map<unsigned long long, unsigned long long> PartitionCountDistribution;
 
+  //
+  // StagingBuffer: scratch space for Hashtable::count_staged.  Each
+  // update is a byte of the table (plus a bit, for Hashbits) and the
+  // k-mer it came from; sort() buckets them by region, keeping their
+  // order within a region, so that updates to any one bin are still
+  // applied in read order.  Keep one per thread and reuse it.
+  //
+
+  struct StagedBin {
+    Byte * byte;
+    unsigned int region;
+    unsigned int kmer_bit;	// k-mer index << 3 | bit
+  };
+
+  class StagingBuffer {
+  public:
+    std::vector<HashIntoType> kmers;	// waiting to be counted, for callers.
+    std::vector<StagedBin> bins;
+    std::vector<StagedBin> sorted;
+    std::vector<unsigned int> region_starts;
+    std::vector<Byte> kmer_flags;	// per k-mer, for the table to use.
+
+    void add(Byte * byte, unsigned int region, unsigned int kmer,
+	     unsigned int bit = 0) {
+      StagedBin b;
+      b.byte = byte;
+      b.region = region;
+      b.kmer_bit = (kmer << 3) | bit;
+      bins.push_back(b);
+    }
+
+    // counting sort of 'bins' into 'sorted' by region.
+    void sort(unsigned int n_regions);
+  };
+
   //
   // Sequence iterator class, test.  Not really a C++ iterator yet.
   //
@@ -46,8 +88,10 @@ namespace khmer {
     unsigned int _nbits_sub_1;
     unsigned int index, length;
     bool initialized;
+    const bool _unique_rc;	// the table's strand mode.
   public:
-    KMerIterator(const char * seq, unsigned char k) : _seq(seq), _ksize(k) {
+    KMerIterator(const char * seq, unsigned char k, bool unique_rc) :
+      _seq(seq), _ksize(k), _kmer_f(0), _kmer_r(0), _unique_rc(unique_rc) {
       bitmask = 0;
       for (unsigned int i = 0; i < _ksize; i++) {
 	bitmask = (bitmask << 2) | 3;
@@ -59,16 +103,38 @@ namespace khmer {
       initialized = false;
     }
 
+    // for sequences that are not NUL-terminated, e.g. parser views.
+    KMerIterator(const char * seq, unsigned char k, unsigned int len,
+		 bool unique_rc) :
+      _seq(seq), _ksize(k), _kmer_f(0), _kmer_r(0), _unique_rc(unique_rc) {
+      bitmask = 0;
+      for (unsigned int i = 0; i < _ksize; i++) {
+	bitmask = (bitmask << 2) | 3;
+      }
+      _nbits_sub_1 = (_ksize*2 - 2);
+
+      index = _ksize - 1;
+      length = len;
+      initialized = false;
+    }
+
     HashIntoType first(HashIntoType& f, HashIntoType& r) {
-      HashIntoType x;
-      x = _hash(_seq, _ksize, _kmer_f, _kmer_r);
+      assert(length >= _ksize);
+
+      // same as _hash(), but without relying on NUL termination.
+      _kmer_f = 0;
+      _kmer_r = 0;
+      for (unsigned int i = 0, j = _ksize - 1; i < _ksize; i++, j--) {
+	_kmer_f = (_kmer_f << 2) | twobit_repr(_seq[i]);
+	_kmer_r = (_kmer_r << 2) | twobit_comp(_seq[j]);
+      }
 
       f = _kmer_f;
       r = _kmer_r;
 
       index = _ksize;
 
-      return x;
+      return _uniqify_rc(_kmer_f, _kmer_r, _unique_rc);
     }
 
     HashIntoType next(HashIntoType& f, HashIntoType& r) {
@@ -101,7 +167,7 @@ namespace khmer {
       f = _kmer_f;
       r = _kmer_r;
 
-      return uniqify_rc(_kmer_f, _kmer_r);
+      return _uniqify_rc(_kmer_f, _kmer_r, _unique_rc);
     }
 
     HashIntoType first() { return first(_kmer_f, _kmer_r); }
@@ -116,7 +182,19 @@ namespace khmer {
     HashIntoType bitmask;
     unsigned int _nbits_sub_1;
 
-    Hashtable(WordLength ksize) : _ksize(ksize) {
+    Mutex _count_lock;		// for the default count_concurrent().
+    HashFamily _family;		// how k-mers map to bins.
+    bool _unique_rc;		// the strand mode; see set_unique_rc().
+    unsigned int _traversal_threads; // for big graph searches; 0 for all CPUs.
+
+    // count the extracted k-mers that fall in [lower_bound, upper_bound),
+    // or all of them if both are 0.
+    unsigned int _count_kmers(const KmerExtractor &kmers,
+			      HashIntoType lower_bound,
+			      HashIntoType upper_bound);
+
+    Hashtable(WordLength ksize) : _ksize(ksize), _unique_rc(get_unique_rc()),
+				  _traversal_threads(1) {
       _init_bitstuff();
     }
 
@@ -152,31 +230,116 @@ namespace khmer {
     // accessor to get 'k'
     const WordLength ksize() const { return _ksize; }
 
+    // whether k-mers are stored as the lesser of the two strands; set
+    // from get_unique_rc() when the table is made.
+    bool unique_rc() const { return _unique_rc; }
+
+    // the one of a k-mer's two strands that this table stores.
+    HashIntoType uniqify_rc(HashIntoType f, HashIntoType r) const {
+      return _uniqify_rc(f, r, _unique_rc);
+    }
+
+    // _hash(), in this table's strand mode.
+    HashIntoType hash_kmer(const char * kmer,
+			   HashIntoType &f, HashIntoType &r) const {
+      _hash(kmer, _ksize, f, r);
+      return uniqify_rc(f, r);
+    }
+    HashIntoType hash_kmer(const char * kmer) const {
+      HashIntoType f, r;
+      return hash_kmer(kmer, f, r);
+    }
+
+    // threads that graph searches may use, once they get big enough; 1
+    // by default, since callers such as partitioning already run
+    // several searches at once, or 0 for one per CPU.
+    unsigned int traversal_threads() const { return _traversal_threads; }
+    void set_traversal_threads(unsigned int n) { _traversal_threads = n; }
+
+    // HASH_FAMILY_*; set it before anything is counted.
+    unsigned char hash_family() const { return _family.type(); }
+    void set_hash_family(unsigned char type) { _family = HashFamily(type); }
+
     virtual void count(const char * kmer) = 0;
     virtual void count(HashIntoType khash) = 0;
 
+    // count the k-mers in kmers[0..n) that fall in [lower_bound,
+    // upper_bound), or all of them if both are 0; returns how many were
+    // counted.  Tables override this with _drive_count_kmers, so the
+    // loop calls their own count() directly; a subclass that overrides
+    // count() must override this (and get_counts) as well.
+    virtual unsigned int count_kmers(const HashIntoType * kmers,
+				     unsigned int n,
+				     HashIntoType lower_bound = 0,
+				     HashIntoType upper_bound = 0);
+
+    // count_concurrent, but with the table updates sorted by address
+    // first, so that big tables are written a region at a time instead
+    // of at random.  The result is the same as count_kmers() on the
+    // same k-mers.  The default just calls count_concurrent().
+    virtual void count_staged(const HashIntoType * kmers, unsigned int n,
+			      StagingBuffer &buffer) {
+      count_concurrent(kmers, n);
+    }
+
+    // count a block of k-mers; safe to call from several threads at
+    // once.  The default serializes on a lock around count().
+    virtual void count_concurrent(const HashIntoType * kmers,
+				  unsigned int n);
+
     // get the count for the given k-mer.
     virtual const BoundedCounterType get_count(const char * kmer) const = 0;
     virtual const BoundedCounterType get_count(HashIntoType khash) const = 0;
 
+    // out[i] = get_count(kmers[i]) for i in [0, n); see count_kmers.
+    virtual void get_counts(const HashIntoType * kmers, unsigned int n,
+			    BoundedCounterType * out) const;
+
     virtual void save(std::string) = 0;
     virtual void load(std::string) = 0;
 
+    // like load(), but map the tables from the file instead of reading
+    // them in, where its layout allows; see map_table().
+    virtual void load_mmap(std::string filename) { load(filename); }
+
+    // zero every count, keeping the table's memory; see clear_table().
+    virtual void clear() = 0;
+
     // count every k-mer in the string.
     unsigned int consume_string(const std::string &s,
 				HashIntoType lower_bound = 0,
-				HashIntoType upper_bound = 0);
+				HashIntoType upper_bound = 0) {
+      return consume_string(s.c_str(), s.length(), lower_bound, upper_bound);
+    }
+    // no defaults here, so that consume_string(char*, lb, ub) still
+    // resolves to the std::string version above.
+    unsigned int consume_string(const char * s, unsigned int length,
+				HashIntoType lower_bound,
+				HashIntoType upper_bound);
     
     // checks each read for non-ACGT characters
-    bool check_read(const std::string &read) const;
+    bool check_read(const std::string &read) const {
+      return check_read(read.c_str(), read.length());
+    }
+    bool check_read(const char * read, unsigned int length) const;
 
     // check each read for non-ACGT characters, and then consume it.
     unsigned int check_and_process_read(const std::string &read,
+					bool &is_valid,
+					HashIntoType lower_bound = 0,
+					HashIntoType upper_bound = 0) {
+      return check_and_process_read(read.c_str(), read.length(), is_valid,
+				    lower_bound, upper_bound);
+    }
+    unsigned int check_and_process_read(const char * read,
+					unsigned int length,
 					bool &is_valid,
 					HashIntoType lower_bound = 0,
 					HashIntoType upper_bound = 0);
     
-    // count every k-mer in the FASTA file.
+    // count every k-mer in the FASTA file, using n_threads workers.
+    // 'staged' uses count_staged() for the updates; it's worth it when
+    // the table is much bigger than the cache.
     void consume_fasta(const std::string &filename,
 		       unsigned int &total_reads,
 		       unsigned long long &n_consumed,
@@ -185,9 +348,92 @@ namespace khmer {
 		       ReadMaskTable ** readmask = NULL,
 		       bool update_readmask = true,
 		       CallbackFn callback = NULL,
-		       void * callback_data = NULL);
+		       void * callback_data = NULL,
+		       unsigned int n_threads = 1,
+		       bool staged = false);
   };
 
+  //
+  // Drivers for the per-k-mer loops, instantiated on a concrete table
+  // type.  The qualified TableT:: calls bypass the vtable, so count()
+  // and get_count() are inlined into the loop.
+  //
+  // Each table also has a _prefetch(khash); the drivers run it
+  // PREFETCH_DISTANCE k-mers ahead, so that the cache misses for the
+  // next several k-mers are outstanding while this one is looked up,
+  // instead of being taken one after another.
+  //
+
+#define PREFETCH_DISTANCE 8
+
+  template <class TableT>
+  unsigned int _drive_count_kmers(TableT &ht,
+				  const HashIntoType * kmers,
+				  unsigned int n,
+				  HashIntoType lower_bound,
+				  HashIntoType upper_bound)
+  {
+    for (unsigned int i = 0; i < n && i < PREFETCH_DISTANCE; i++) {
+      ht.TableT::_prefetch(kmers[i]);
+    }
+
+    if (lower_bound == upper_bound && upper_bound == 0) {
+      for (unsigned int i = 0; i < n; i++) {
+	if (i + PREFETCH_DISTANCE < n) {
+	  ht.TableT::_prefetch(kmers[i + PREFETCH_DISTANCE]);
+	}
+	ht.TableT::count(kmers[i]);
+      }
+      return n;
+    }
+
+    unsigned int n_consumed = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      if (i + PREFETCH_DISTANCE < n) {
+	ht.TableT::_prefetch(kmers[i + PREFETCH_DISTANCE]);
+      }
+      if (kmers[i] >= lower_bound && kmers[i] < upper_bound) {
+	ht.TableT::count(kmers[i]);
+	n_consumed++;
+      }
+    }
+    return n_consumed;
+  }
+
+  template <class TableT>
+  void _drive_get_counts(const TableT &ht,
+			 const HashIntoType * kmers,
+			 unsigned int n,
+			 BoundedCounterType * out)
+  {
+    for (unsigned int i = 0; i < n && i < PREFETCH_DISTANCE; i++) {
+      ht.TableT::_prefetch(kmers[i]);
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+      if (i + PREFETCH_DISTANCE < n) {
+	ht.TableT::_prefetch(kmers[i + PREFETCH_DISTANCE]);
+      }
+      out[i] = ht.TableT::get_count(kmers[i]);
+    }
+  }
+
+  // called on a worker thread for each batch; adds to n_consumed.
+  typedef void (*BatchFn)(void * data, const ReadBatch &batch,
+			  unsigned long long &n_consumed);
+
+  // run 'fn' over every batch from 'parsers' -- one shared, or one per
+  // thread -- on n_threads worker threads.
+  void process_batches_threaded(const std::vector<IParser *> &parsers,
+				unsigned int n_threads,
+				BatchFn fn,
+				void * fn_data,
+				unsigned int &total_reads,
+				unsigned long long &n_consumed,
+				const char * callback_name,
+				CallbackFn callback,
+				void * callback_data);
+
 			  
 
 };
@@ -9,11 +9,15 @@
 #define CIRCUM_MAX_VOL 200	// @CTB remove
 
 #define SAVED_FORMAT_VERSION 3
+#define SAVED_FORMAT_VERSION_SECTIONED 6	// see savedfile.hh
+#define SAVED_PAGE_BYTES 4096
 #define SAVED_COUNTING_HT 1
 #define SAVED_HASHBITS 2
 #define SAVED_TAGS 3
 #define SAVED_STOPTAGS 4
 #define SAVED_SUBSET 5
+#define SAVED_BLOCKED_HASHBITS 6
+#define SAVED_BLOCKED_COUNTING_HT 7
 
 #define VERBOSE_REPARTITION 0
 
@@ -7,9 +7,38 @@
 #include "khmer.hh"
 #include "ktable.hh"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 using namespace khmer;
 
+#define X 7				// not ACGT; see ktable.hh.
+
+const unsigned char khmer::_twobit_codes[256] = {
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, 0, X, 2, X, X, X, 3, X, X, X, X, X, X, X, X, // @ABCDEFGHIJKLMNO
+  X, X, X, X, 1, X, X, X, X, X, X, X, X, X, X, X, // PQRSTUVWXYZ
+  X, 0, X, 2, X, X, X, 3, X, X, X, X, X, X, X, X, // `abcdefghijklmno
+  X, X, X, X, 1, X, X, X, X, X, X, X, X, X, X, X, // pqrstuvwxyz
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X
+};
+
+#undef X
+
+bool khmer::_unique_rc = true;
+
 //
 // _hash: hash a k-length DNA sequence into a 64-bit number.
 //
@@ -37,7 +66,7 @@ HashIntoType khmer::_hash(const char * kmer, const WordLength k,
   _h = h;
   _r = r;
 
-  return uniqify_rc(h, r);
+  return _uniqify_rc(h, r, _unique_rc);
 }
 
 // _hash: return the maximum of the forward and reverse hash.
@@ -62,6 +91,110 @@ HashIntoType khmer::_hash_forward(const char * kmer, WordLength k)
   return h;			// return forward only
 }
 
+//
+// _encode_dna: the 2-bit codes for a whole read.
+//
+// With SSE2, 16 bases at a time: upper-case by clearing bit 5, check
+// against A/C/G/T, and get the code from bits 1-2 of the character,
+// which are A=0, C=1, T=2, G=3; swapping 1 and 2 gives khmer's order.
+//
+
+bool khmer::_encode_dna(const char * seq, unsigned int len, Byte * codes)
+{
+  unsigned int i = 0;
+  bool valid = true;
+
+#ifdef __SSE2__
+  const __m128i upper = _mm_set1_epi8((char) 0xDF);
+  const __m128i ch_a = _mm_set1_epi8('A');
+  const __m128i ch_c = _mm_set1_epi8('C');
+  const __m128i ch_g = _mm_set1_epi8('G');
+  const __m128i ch_t = _mm_set1_epi8('T');
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i threes = _mm_set1_epi8(3);
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i u = _mm_and_si128(_mm_loadu_si128((const __m128i *) (seq + i)),
+			      upper);
+
+    __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, ch_a),
+					   _mm_cmpeq_epi8(u, ch_c)),
+			      _mm_or_si128(_mm_cmpeq_epi8(u, ch_g),
+					   _mm_cmpeq_epi8(u, ch_t)));
+    if (_mm_movemask_epi8(ok) != 0xFFFF) {
+      valid = false;
+    }
+
+    // t = bits 1-2 of the character; the shifts are 16-bit, so mask off
+    // whatever comes in from the neighboring byte.
+    __m128i t = _mm_and_si128(_mm_srli_epi16(u, 1), threes);
+    __m128i d = _mm_and_si128(_mm_xor_si128(t, _mm_srli_epi16(t, 1)), ones);
+    __m128i code = _mm_xor_si128(t, _mm_or_si128(d, _mm_add_epi8(d, d)));
+
+    // bad characters get 3, as in the table.
+    code = _mm_or_si128(_mm_and_si128(ok, code), _mm_andnot_si128(ok, threes));
+
+    _mm_storeu_si128((__m128i *) (codes + i), code);
+  }
+#endif // __SSE2__
+
+  for (; i < len; i++) {
+    Byte code = _twobit_codes[(unsigned char) seq[i]];
+    if (code > 3) {
+      valid = false;
+    }
+    codes[i] = code & 3;
+  }
+
+  return valid;
+}
+
+//
+// KmerExtractor::extract: encode, then roll the forward and reverse
+//     complement words along the codes.
+//
+
+template <bool UniqueRC>
+void KmerExtractor::_roll(unsigned int len, WordLength k)
+{
+  const Byte * codes = &_codes[0];
+  HashIntoType * out = &_kmers[0];
+  const HashIntoType bitmask = k < 32 ? (1ULL << (2 * k)) - 1 : ~0ULL;
+  const unsigned int rc_shift = 2 * k - 2;
+
+  HashIntoType f = 0, r = 0;
+  for (unsigned int i = 0; i < (unsigned int) k - 1; i++) {
+    f = (f << 2) | codes[i];
+    r = (r >> 2) | ((HashIntoType) (codes[i] ^ 1) << rc_shift);
+  }
+
+  for (unsigned int i = k - 1; i < len; i++) {
+    f = ((f << 2) | codes[i]) & bitmask;
+    r = (r >> 2) | ((HashIntoType) (codes[i] ^ 1) << rc_shift);
+    *out++ = _uniqify_rc<UniqueRC>(f, r);
+  }
+}
+
+template void KmerExtractor::_roll<true>(unsigned int, WordLength);
+template void KmerExtractor::_roll<false>(unsigned int, WordLength);
+
+bool KmerExtractor::_encode(const char * seq, unsigned int len, WordLength k)
+{
+  assert(k <= sizeof(HashIntoType)*4);
+
+  _kmers.clear();
+  if (len < k) {
+    return false;
+  }
+
+  if (_codes.size() < len) {
+    _codes.resize(len);
+  }
+  _kmers.resize(len - k + 1);
+
+  return _encode_dna(seq, len, &_codes[0]);
+}
+
 //
 // _revhash: given an unsigned int, return the associated k-mer.
 //
@@ -111,7 +244,7 @@ void KTable::consume_string(const std::string &s)
 
   _hash(sp, _ksize, h, r);
   
-  _counts[uniqify_rc(h, r)]++;
+  _counts[_uniqify_rc(h, r, _unique_rc)]++;
 
   for (unsigned int i = _ksize; i < length; i++) {
     // left-shift the previous hash over
@@ -127,7 +260,7 @@ void KTable::consume_string(const std::string &s)
     r = r >> 2;
     r |= (twobit_comp(sp[i]) << (_ksize*2 - 2));
 
-    _counts[uniqify_rc(h, r)]++;
+    _counts[_uniqify_rc(h, r, _unique_rc)]++;
   }
 
 #endif // 0
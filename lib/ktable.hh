@@ -7,32 +7,56 @@
 #include <string.h>
 #include <string>
 #include <assert.h>
+#include <vector>
 
 #include "khmer.hh"
 
+// 2-bit codes by character: A=0, T=1, C=2, G=3 in either case, with
+// the complement being code ^ 1.  Anything else has bit 2 set; its low
+// bits are 3, so it hashes like 'G' as it always has.
+namespace khmer {
+  extern const unsigned char _twobit_codes[256];
+};
+
 // test validity
-#define is_valid_dna(ch) ((toupper(ch)) == 'A' || (toupper(ch)) == 'C' || \
-			  (toupper(ch)) == 'G' || (toupper(ch)) == 'T')
+#define is_valid_dna(ch) (khmer::_twobit_codes[(unsigned char) (ch)] < 4)
 
 // bit representation of A/T/C/G.
-#define twobit_repr(ch) ((toupper(ch)) == 'A' ? 0LL : \
-                         (toupper(ch)) == 'T' ? 1LL : \
-                         (toupper(ch)) == 'C' ? 2LL : 3LL)
+#define twobit_repr(ch) \
+  ((khmer::HashIntoType) (khmer::_twobit_codes[(unsigned char) (ch)] & 3))
 
 #define revtwobit_repr(n) ((n) == 0 ? 'A' : \
                            (n) == 1 ? 'T' : \
                            (n) == 2 ? 'C' : 'G')
 
-#define twobit_comp(ch) ((toupper(ch)) == 'A' ? 1LL : \
-                         (toupper(ch)) == 'T' ? 0LL : \
-                         (toupper(ch)) == 'C' ? 3LL : 2LL)
+#define twobit_comp(ch) (twobit_repr(ch) ^ 1)
 
-// choose wisely between forward and rev comp.
-#if !NO_UNIQUE_RC
-#define uniqify_rc(f, r) ((f) < (r) ? (f) : (r))
-#else
-#define uniqify_rc(f,r)(f)
-#endif
+namespace khmer {
+  // store each k-mer as the lesser of it and its reverse complement
+  // (the default), or as read from the forward strand only.  This used
+  // to be the NO_UNIQUE_RC build flag.  A Hashtable takes the mode that
+  // is set when it is made, and keeps it; saved files record it, and
+  // won't load into a table in the other mode.  KTable and the free
+  // _hash() functions follow the current setting.
+  extern bool _unique_rc;
+  inline void set_unique_rc(bool b) { _unique_rc = b; }
+  inline bool get_unique_rc() { return _unique_rc; }
+
+  // for loops specialized on the strand mode; see KmerExtractor.
+  template <bool UniqueRC>
+  inline HashIntoType _uniqify_rc(HashIntoType f, HashIntoType r) {
+    if (UniqueRC) {
+      return f < r ? f : r;
+    }
+    return f;
+  }
+
+  // choose wisely between forward and rev comp.
+  inline HashIntoType _uniqify_rc(HashIntoType f, HashIntoType r,
+				  bool unique_rc) {
+    return unique_rc ? _uniqify_rc<true>(f, r) : _uniqify_rc<false>(f, r);
+  }
+};
 
 
 namespace khmer {
@@ -44,6 +68,61 @@ namespace khmer {
 
   std::string _revhash(HashIntoType hash, WordLength k);
 
+  // fill codes[0..len) with the 2-bit code of each base; returns false
+  // if any character is not ACGT/acgt.  Vectorized where possible.
+  bool _encode_dna(const char * seq, unsigned int len, Byte * codes);
+
+  //
+  // KmerExtractor: validates a read and computes all of its k-mers in
+  // one pass, into a buffer that is kept between calls.  Use one per
+  // thread; KMerIterator is the one-at-a-time equivalent.
+  //
+
+  class KmerExtractor {
+  protected:
+    std::vector<Byte> _codes;
+    std::vector<HashIntoType> _kmers;
+
+    // fill _codes, and size _kmers; returns whether the read is valid.
+    bool _encode(const char * seq, unsigned int len, WordLength k);
+
+    // the rolling loop, compiled once per strand mode.
+    template <bool UniqueRC>
+    void _roll(unsigned int len, WordLength k);
+  public:
+    // compute the k-mers of seq[0..len), in the strand mode UniqueRC.
+    // Returns false if the read is shorter than k or has non-ACGT
+    // characters, i.e. when Hashtable::check_read would; the k-mers are
+    // filled in either way, hashing bad characters as twobit_repr does.
+    template <bool UniqueRC>
+    bool extract(const char * seq, unsigned int len, WordLength k) {
+      bool valid = _encode(seq, len, k);
+      if (!_kmers.empty()) {
+	_roll<UniqueRC>(len, k);
+      }
+      return valid;
+    }
+
+    // the same, choosing the loop at run time; callers with many reads
+    // should choose once, and call the one above.
+    bool extract(const char * seq, unsigned int len, WordLength k,
+		 bool unique_rc) {
+      if (unique_rc) {
+	return extract<true>(seq, len, k);
+      }
+      return extract<false>(seq, len, k);
+    }
+    bool extract(const std::string &seq, WordLength k, bool unique_rc) {
+      return extract(seq.c_str(), seq.length(), k, unique_rc);
+    }
+
+    unsigned int size() const { return _kmers.size(); }
+    const HashIntoType * kmers() const {
+      return _kmers.empty() ? NULL : &_kmers[0];
+    }
+    HashIntoType operator[](unsigned int i) const { return _kmers[i]; }
+  };
+
   //
   // KTable class: keep track of k-mer prevalences.
   //
@@ -1,5 +1,11 @@
 #include "parsers.hh"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 IParser* IParser::get_parser(const std::string &inputfile)
 {
    std::string filename(inputfile);
@@ -7,404 +13,960 @@ IParser* IParser::get_parser(const std::string &inputfile)
 
    std::string type = filename.substr(found+1);
 
-   if (type == "fq" || type == "fastq") {
-      return new FastqParser(inputfile);
-   } else if (type == "fa" || type == "fasta") {
-      return new FastaParser(inputfile);
-   } else if (type == "gz") {
-      if ((signed int)filename.find("fastq") != -1 || 
-          (signed int)filename.find("fq") != -1) {
-         return new FastqGzParser(inputfile);
+   // BlockParser tells FASTA and FASTQ apart by content.
+   if (type == "gz") {
+      if (BgzfBlockReader::is_bgzf(inputfile)) {
+	 return new BlockParser(new BgzfBlockReader(inputfile));
       }
-      else {
-         return new FastaGzParser(inputfile);
+      return new BlockParser(new GzBlockReader(inputfile));
+   }
+
+   // map regular files; fall back to read() for pipes and the like.
+   MmapFile * file = new MmapFile(inputfile);
+   if (file->is_open()) {
+      return new MmapParser(file, 0, file->size(), true);
+   }
+   delete file;
+
+   return new BlockParser(new FileBlockReader(inputfile));
+}
+
+void IParser::get_parsers(const std::string &inputfile, unsigned int n,
+			  std::vector<IParser *> &parsers)
+{
+   parsers.clear();
+
+   std::string filename(inputfile);
+   std::string type = filename.substr(filename.find_last_of(".") + 1);
+
+   if (n > 1 && type != "gz") {
+      MmapFile * file = new MmapFile(inputfile);
+      if (file->is_open()) {
+	 std::vector<size_t> boundaries;
+	 file->split(n, boundaries);
+
+	 // the first one owns the file.
+	 for (unsigned int i = 0; i < n; i++) {
+	    parsers.push_back(new MmapParser(file, boundaries[i],
+					     boundaries[i + 1], i == 0));
+	 }
+	 return;
       }
-   } else {
-      return new FastaParser(inputfile);
+      delete file;
    }
+
+   parsers.push_back(get_parser(inputfile));
 }
 
-FastaParser::FastaParser(const std::string &inputfile) : 
-                         infile(inputfile.c_str())
+bool IParser::get_next_view(ReadView &view)
 {
-   std::string line, seq;
-   next_name = "";
-   
-   assert(infile.is_open());
+   if (is_complete()) {
+      return false;
+   }
 
-   bool valid_read = 0;
+   _view_read = get_next_read();
 
-   while (!valid_read)  {
-      line = "";
-      seq = "";
-      if (next_name == "")  {
-        getline(infile, current_read.name);
-        assert(current_read.name[0] == '>');
-        current_read.name = current_read.name.substr(1);
-      }
-      else  {
-         current_read.name = next_name;
-         next_name = "";
-      }
-      
-      while(line[0] != '>' && !infile.eof()) {
-         getline(infile, line);
-         if (line[0] != '>') {
-            seq += line;
-         }
-      }
+   view.name = _view_read.name.c_str();
+   view.name_len = _view_read.name.length();
+   view.seq = _view_read.seq.c_str();
+   view.seq_len = _view_read.seq.length();
+   view.quality = NULL;
+   view.quality_len = 0;
 
-      if ((int)seq.find('N') == -1)  {
-         valid_read = 1;
-      }
+   _n_reads++;
+   return true;
+}
 
-      if (line[0] == '>') {
-         next_name = line.substr(1);
-      } else {
-         seq += line;
-      }
+unsigned int IParser::get_next_batch(ReadBatch &batch, unsigned int n)
+{
+   ReadView view;
 
+   batch.clear();
+   while (batch.size() < n && get_next_view(view)) {
+      batch.append(view, _n_reads - 1);
    }
+   return batch.size();
+}
 
-   one_read_left = false;
+FileBlockReader::FileBlockReader(const std::string &inputfile)
+{
+   fd = open(inputfile.c_str(), O_RDONLY);
+   assert(fd >= 0);
+}
 
-   if (infile.eof())
-   {
-      one_read_left = true;
+FileBlockReader::~FileBlockReader()
+{
+   if (fd >= 0) {
+      close(fd);
+      fd = -1;
    }
+}
 
-   current_read.seq = seq;
+size_t FileBlockReader::read_block(char * buf, size_t n)
+{
+   ssize_t n_read;
+
+   do {
+      n_read = read(fd, buf, n);
+   } while (n_read < 0 && errno == EINTR);
+
+   if (n_read < 0) {
+      return 0;
+   }
+   return n_read;
 }
 
-FastaGzParser::FastaGzParser(const std::string &inputfile)
+//
+// GzBlockReader
+//
+
+GzBlockReader::GzBlockReader(const std::string &inputfile)
 {
    infile = gzopen(inputfile.c_str(), "rb");
+   assert(infile != NULL);
+   _start();
+}
+
+GzBlockReader::GzBlockReader(int fd)
+{
+   infile = gzdopen(fd, "rb");
+   assert(infile != NULL);
+   _start();
+}
+
+void GzBlockReader::_start()
+{
+   head = head_offset = tail = n_full = 0;
+   done = failed = stop = false;
+
+   for (unsigned int i = 0; i < GZ_READER_NBUFS; i++) {
+      slots[i] = new char[GZ_READER_BUFSIZE];
+      slot_len[i] = 0;
+   }
 
-   std::string line, seq;
-   int MAXLINE = 1000;
-   char tmp[1000];
-   next_name = "";
+   int ret = pthread_create(&thread, NULL, _thread_main, this);
+   assert(ret == 0);
+}
+
+GzBlockReader::~GzBlockReader()
+{
+   mutex.lock();
+   stop = true;
+   not_full.signal();
+   mutex.unlock();
 
-   bool valid_read = 0;
+   pthread_join(thread, NULL);
+   gzclose(infile);
 
-   while (!valid_read)  {
-      line = "";
-      seq = "";
-      if (next_name == "")  {
-         gzgets(infile, tmp, MAXLINE);
-         tmp[strlen(tmp)-1] = '\0';
-         current_read.name = tmp;
-         //getline(infile, current_read.name);
-         assert(current_read.name[0] == '>');
-         current_read.name = current_read.name.substr(1);
+   for (unsigned int i = 0; i < GZ_READER_NBUFS; i++) {
+      delete[] slots[i];
+      slots[i] = NULL;
+   }
+}
+
+void * GzBlockReader::_thread_main(void * self)
+{
+   ((GzBlockReader *) self)->_produce();
+   return NULL;
+}
+
+// _produce: fill empty slots until EOF.  The slot being filled is not
+// visible to the consumer until n_full is bumped, so gzread runs without
+// the lock held.
+
+void GzBlockReader::_produce()
+{
+   while (1) {
+      mutex.lock();
+      while (n_full == GZ_READER_NBUFS && !stop) {
+	 not_full.wait(mutex);
       }
-      else  {
-         current_read.name = next_name;
-         next_name = "";
+      if (stop) {
+	 mutex.unlock();
+	 return;
       }
+      unsigned int slot = tail;
+      mutex.unlock();
 
-      while(line[0] != '>' && !gzeof(infile)) {
-         gzgets(infile, tmp, MAXLINE);
-         tmp[strlen(tmp)-1] = '\0';
-         line = tmp;
-         //getline(infile, line);
-         if (line[0] != '>') {
-            seq += line;
-         }
-      }
+      int n_read = gzread(infile, slots[slot], GZ_READER_BUFSIZE);
 
-      if ((int)seq.find('N') == -1)  {
-         valid_read = 1;
+      // gzread stops short, without complaint, at a truncated member.
+      int errnum = Z_OK;
+      if (n_read <= 0) {
+	 gzerror(infile, &errnum);
       }
 
-      if (line[0] == '>') {
-         next_name = line.substr(1);
-      } else {
-         seq += line;
+      khmer::ScopedLock lock(mutex);
+      if (n_read <= 0) {
+	 failed = n_read < 0 || (errnum != Z_OK && errnum != Z_STREAM_END);
+	 done = true;
+	 not_empty.signal();
+	 return;
       }
-
+      slot_len[slot] = n_read;
+      tail = (tail + 1) % GZ_READER_NBUFS;
+      n_full++;
+      not_empty.signal();
    }
+}
+
+// read_block: block until at least one slot is full, then copy out as
+// much as is ready.
 
-   one_read_left = false;
+size_t GzBlockReader::read_block(char * buf, size_t n)
+{
+   size_t n_copied = 0;
 
-   if (gzeof(infile))
-   {
-      one_read_left = true;
+   mutex.lock();
+   while (n_full == 0 && !done) {
+      not_empty.wait(mutex);
    }
 
-   current_read.seq = seq;
+   while (n_full > 0 && n_copied < n) {
+      unsigned int slot = head;
+      size_t avail = slot_len[slot] - head_offset;
+      size_t n_take = avail < n - n_copied ? avail : n - n_copied;
+      mutex.unlock();
+
+      memcpy(buf + n_copied, slots[slot] + head_offset, n_take);
+      n_copied += n_take;
+
+      mutex.lock();
+      head_offset += n_take;
+      if (head_offset == slot_len[slot]) {
+	 head = (head + 1) % GZ_READER_NBUFS;
+	 head_offset = 0;
+	 n_full--;
+	 not_full.signal();
+      }
+   }
+   bool at_error = failed && n_full == 0;
+   mutex.unlock();
+
+   if (n_copied == 0 && at_error) {
+      throw ParserError("corrupt or truncated gzip input");
+   }
+   return n_copied;
 }
 
+//
+// BgzfBlockReader
+//
 
-Read FastaParser::get_next_read()
+// read exactly n bytes unless EOF or an error intervenes.
+static size_t _read_fully(int fd, void * buf, size_t n)
 {
-   std::string line = "", seq = "";
-   Read next_read = current_read;
+   size_t n_done = 0;
 
-   if (one_read_left)  {
-      one_read_left = false;
-      return next_read;
+   while (n_done < n) {
+      ssize_t n_read = read(fd, (char *) buf + n_done, n - n_done);
+      if (n_read < 0 && errno == EINTR) {
+	 continue;
+      }
+      if (n_read <= 0) {
+	 break;
+      }
+      n_done += n_read;
    }
+   return n_done;
+}
 
-   bool valid_read = 0;
+// _bgzf_block_size: given a gzip member header of 12 + XLEN bytes, find
+// the 'BC' subfield and return the total member size, or 0 if absent.
 
-   while (!valid_read)  {
-      current_read.name = next_name;
-      next_name = "";
-      current_read.seq = "";
+static size_t _bgzf_block_size(const unsigned char * header, size_t xlen)
+{
+   const unsigned char * p = header + 12;
+   const unsigned char * extra_end = p + xlen;
 
-      getline(infile, line);
+   while (p + 4 <= extra_end) {
+      unsigned int slen = p[2] | (p[3] << 8);
+      if (p[0] == 'B' && p[1] == 'C' && slen == 2 && p + 6 <= extra_end) {
+	 return (p[4] | (p[5] << 8)) + 1;
+      }
+      p += 4 + slen;
+   }
+   return 0;
+}
 
-      while(line[0] != '>' && !infile.eof())
-      {
+bool BgzfBlockReader::is_bgzf(const std::string &inputfile)
+{
+   int fd = open(inputfile.c_str(), O_RDONLY);
+   if (fd < 0) {
+      return false;
+   }
 
-         if (line[0] != '>')  {
-            seq += line;
-         }
-         getline(infile, line);
-      }
+   unsigned char header[12 + 256];
+   bool found = false;
 
-      if (line[0] == '>')  {
-         next_name = line.substr(1);
+   // magic, deflate, FEXTRA set.
+   if (_read_fully(fd, header, 12) == 12 && header[0] == 0x1f &&
+       header[1] == 0x8b && header[2] == 8 && (header[3] & 4)) {
+      size_t xlen = header[10] | (header[11] << 8);
+      if (xlen > 256) {
+	 xlen = 256;
       }
+      found = _read_fully(fd, header + 12, xlen) == xlen &&
+	 _bgzf_block_size(header, xlen) != 0;
+   }
+   close(fd);
 
-      if ((int)seq.find('N') == -1)  {
-         valid_read = 1;
-      }  else if (infile.eof())  {
-         one_read_left = false;
-         break;
-      }
+   return found;
+}
 
-      current_read.seq = seq;
-      seq = "";
+BgzfBlockReader::BgzfBlockReader(const std::string &inputfile,
+				 unsigned int n) :
+   n_threads(n), n_blocks_read(0), next_inflate(0), head(0),
+   head_offset(0), reader_done(false), reader_status(BLOCK_OK), stop(false),
+   read_offset(0), rest_offset(0), rest(NULL)
+{
+   fd = open(inputfile.c_str(), O_RDONLY);
+   assert(fd >= 0);
 
-      if (infile.eof()) {
-         one_read_left = true;
-      }
+   if (n_threads < 1) {
+      n_threads = 1;
+   }
 
+   // enough slots in flight to keep every worker busy while the
+   // consumer drains the oldest ones.
+   n_slots = 4 * n_threads;
+   slots = new Slot[n_slots];
+   for (unsigned int i = 0; i < n_slots; i++) {
+      slots[i].state = SLOT_EMPTY;
+      slots[i].in = new unsigned char[BGZF_MAX_BLOCK_SIZE];
+      slots[i].in_len = 0;
+      slots[i].out = new char[BGZF_MAX_BLOCK_SIZE];
+      slots[i].out_len = 0;
+      slots[i].failed = false;
    }
 
-   return next_read;
+   int ret = pthread_create(&reader_thread, NULL, _reader_main, this);
+   assert(ret == 0);
+
+   worker_threads = new pthread_t[n_threads];
+   for (unsigned int i = 0; i < n_threads; i++) {
+      ret = pthread_create(&worker_threads[i], NULL, _worker_main, this);
+      assert(ret == 0);
+   }
 }
 
-Read FastaGzParser::get_next_read()
+BgzfBlockReader::~BgzfBlockReader()
 {
-   int MAXLINE = 1000;
-   char tmp[MAXLINE];
-   std::string line = "", seq = "";
-   Read next_read = current_read;
+   mutex.lock();
+   stop = true;
+   changed.broadcast();
+   mutex.unlock();
+
+   pthread_join(reader_thread, NULL);
+   for (unsigned int i = 0; i < n_threads; i++) {
+      pthread_join(worker_threads[i], NULL);
+   }
+   delete[] worker_threads;
+   delete rest;
 
-   if (one_read_left)  {
-      one_read_left = false;
-      return next_read;
+   for (unsigned int i = 0; i < n_slots; i++) {
+      delete[] slots[i].in;
+      delete[] slots[i].out;
    }
+   delete[] slots;
+
+   close(fd);
+}
 
-   bool valid_read = 0;
+void * BgzfBlockReader::_reader_main(void * self)
+{
+   ((BgzfBlockReader *) self)->_read_blocks();
+   return NULL;
+}
+
+void * BgzfBlockReader::_worker_main(void * self)
+{
+   ((BgzfBlockReader *) self)->_inflate_blocks();
+   return NULL;
+}
+
+// _read_one_block: read the next whole member into 'slot'.  Anything
+// that starts like a gzip member but isn't a whole BGZF one -- an
+// ordinary member, or a truncated one -- is left for the GzBlockReader,
+// which knows the difference.
+
+BgzfBlockReader::BlockStatus BgzfBlockReader::_read_one_block(Slot &slot)
+{
+   unsigned char * header = slot.in;
+
+   size_t n_read = _read_fully(fd, header, 12);
+   if (n_read == 0) {
+      return BLOCK_EOF;
+   }
+   read_offset += n_read;
 
-   while (!valid_read)  {
-      current_read.name = next_name;
-      next_name = "";
-      current_read.seq = "";
+   if (n_read < 2 || header[0] != 0x1f || header[1] != 0x8b) {
+      return BLOCK_CORRUPT;
+   }
+
+   size_t xlen = 0, block_size = 0;
+   if (n_read == 12 && (header[3] & 4)) {
+      xlen = header[10] | (header[11] << 8);
+      if (12 + xlen <= BGZF_MAX_BLOCK_SIZE) {
+	 n_read = _read_fully(fd, header + 12, xlen);
+	 read_offset += n_read;
+	 if (n_read == xlen) {
+	    block_size = _bgzf_block_size(header, xlen);
+	 }
+      }
+   }
+
+   if (block_size < 12 + xlen || block_size > BGZF_MAX_BLOCK_SIZE) {
+      return BLOCK_NOT_BGZF;
+   }
+
+   size_t n_rest = block_size - 12 - xlen;
+   n_read = _read_fully(fd, header + 12 + xlen, n_rest);
+   read_offset += n_read;
+   if (n_read != n_rest) {
+      return BLOCK_NOT_BGZF;
+   }
+   slot.in_len = block_size;
+
+   return BLOCK_OK;
+}
+
+void BgzfBlockReader::_read_blocks()
+{
+   while (1) {
+      mutex.lock();
+      Slot &slot = slots[n_blocks_read % n_slots];
+      while (slot.state != SLOT_EMPTY && !stop) {
+	 changed.wait(mutex);
+      }
+      if (stop) {
+	 mutex.unlock();
+	 return;
+      }
+      mutex.unlock();
+
+      // the slot is empty, so nobody else touches it until we publish it.
+      off_t block_start = read_offset;
+      BlockStatus status = _read_one_block(slot);
+
+      khmer::ScopedLock lock(mutex);
+      if (status != BLOCK_OK) {
+	 reader_status = status;
+	 rest_offset = block_start;
+	 reader_done = true;
+	 changed.broadcast();
+	 return;
+      }
+      slot.state = SLOT_READ;
+      n_blocks_read++;
+      changed.broadcast();
+   }
+}
 
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      line = tmp;
+void BgzfBlockReader::_inflate_blocks()
+{
+   z_stream strm;
 
-      while(line[0] != '>' && !gzeof(infile))
-      {
-         if (line[0] != '>')  {
-            seq += line;
-         }
-         gzgets(infile, tmp, MAXLINE);
-         tmp[strlen(tmp)-1] = '\0';
-         line = tmp;
+   while (1) {
+      mutex.lock();
+      while (next_inflate == n_blocks_read && !reader_done && !stop) {
+	 changed.wait(mutex);
+      }
+      if (stop || next_inflate == n_blocks_read) {
+	 mutex.unlock();
+	 return;
+      }
+      Slot &slot = slots[next_inflate % n_slots];
+      slot.state = SLOT_INFLATING;
+      next_inflate++;
+      mutex.unlock();
+
+      // each member is a complete gzip stream: windowBits 15 + 16.
+      memset(&strm, 0, sizeof(strm));
+      bool ok = inflateInit2(&strm, 15 + 16) == Z_OK;
+      if (ok) {
+	 strm.next_in = slot.in;
+	 strm.avail_in = slot.in_len;
+	 strm.next_out = (Bytef *) slot.out;
+	 strm.avail_out = BGZF_MAX_BLOCK_SIZE;
+	 ok = inflate(&strm, Z_FINISH) == Z_STREAM_END;
+	 slot.out_len = BGZF_MAX_BLOCK_SIZE - strm.avail_out;
+	 inflateEnd(&strm);
       }
 
-      if (gzeof(infile)) {
-         seq += line;
+      khmer::ScopedLock lock(mutex);
+      slot.failed = !ok;
+      if (!ok) {
+	 slot.out_len = 0;
       }
+      slot.state = SLOT_INFLATED;
+      changed.broadcast();
+   }
+}
 
-      if (line[0] == '>')  {
-         next_name = line.substr(1);
+size_t BgzfBlockReader::read_block(char * buf, size_t n)
+{
+   size_t n_copied = 0;
+
+   khmer::ScopedLock lock(mutex);
+   while (n_copied < n) {
+      Slot &slot = slots[head % n_slots];
+
+      // block only while we have nothing at all to return.
+      while (!(head < n_blocks_read && slot.state == SLOT_INFLATED) &&
+	     !(reader_done && head == n_blocks_read)) {
+	 if (n_copied) {
+	    return n_copied;
+	 }
+	 changed.wait(mutex);
+      }
+      if (head == n_blocks_read) {	// reader_done.
+	 break;
       }
 
-      if ((int)seq.find('N') == -1)  {
-         valid_read = 1;
-      }  else if (gzeof(infile))  {
-         one_read_left = false;
-         break;
+      // hand back what came before a bad block, then complain.
+      if (slot.failed) {
+	 if (n_copied) {
+	    return n_copied;
+	 }
+	 throw ParserError("corrupt BGZF block");
       }
 
-      current_read.seq = seq;
-      seq = "";
+      // an inflated slot belongs to the consumer; copy without the lock.
+      size_t avail = slot.out_len - head_offset;
+      size_t n_take = avail < n - n_copied ? avail : n - n_copied;
+      mutex.unlock();
+      memcpy(buf + n_copied, slot.out + head_offset, n_take);
+      mutex.lock();
+      n_copied += n_take;
+      head_offset += n_take;
+
+      if (head_offset == slot.out_len) {
+	 slot.state = SLOT_EMPTY;
+	 head++;
+	 head_offset = 0;
+	 changed.broadcast();
+      }
+   }
 
-      if (gzeof(infile)) {
-         one_read_left = true;
+   // once the blocks are all handed back, deal with what stopped them.
+   if (n_copied == 0 && head == n_blocks_read && reader_done) {
+      if (reader_status == BLOCK_CORRUPT) {
+	 throw ParserError("corrupt BGZF input: not a gzip member");
       }
 
+      // the reader thread is gone, so fd is ours.
+      if (reader_status == BLOCK_NOT_BGZF) {
+	 if (!rest) {
+	    int rest_fd = dup(fd);
+	    assert(rest_fd >= 0);
+	    lseek(rest_fd, rest_offset, SEEK_SET);
+	    rest = new GzBlockReader(rest_fd);
+	 }
+	 n_copied = rest->read_block(buf, n);
+      }
    }
 
-   return next_read;
+   return n_copied;
 }
 
-FastqParser::FastqParser(const std::string &inputfile) :
-                         infile(inputfile.c_str())
+//
+// BlockParser
+//
+
+BlockParser::BlockParser(IBlockReader * r, size_t size) :
+   reader(r), bufsize(size), at_eof(false), have_pending(false)
 {
-   std::string line_three, quality_scores;
+   buf = new char[bufsize + 1];
+   pos = end = buf;
+   *end = '\0';
+}
 
-   assert(infile.is_open());
+BlockParser::BlockParser(const char * start, const char * stop) :
+   reader(NULL), buf(NULL), bufsize(0), at_eof(true), have_pending(false)
+{
+   // _refill() returns early at EOF, so the buffer is never written.
+   pos = (char *) start;
+   end = (char *) stop;
+}
 
-   bool valid_read = 0;
+BlockParser::~BlockParser()
+{
+   delete reader; reader = NULL;
+   delete[] buf; buf = NULL;
+}
 
-   while (!valid_read && !infile.eof())  {
-      getline(infile, current_read.name);
-      getline(infile, current_read.seq);
-      getline(infile, line_three); 
-      getline(infile, quality_scores);
+// _refill: slide the unparsed data to the front of the buffer and read
+// more behind it, growing the buffer if a single record fills it.  Any
+// outstanding views are invalidated.
 
-      assert(current_read.name[0] == '@');
-      assert(line_three[0] == '+' || line_three[0] == '#');
-      assert(quality_scores.length() == current_read.seq.length());
-   
-      current_read.name = current_read.name.substr(1);
+bool BlockParser::_refill()
+{
+   if (at_eof) {
+      return false;
+   }
+
+   size_t remainder = end - pos;
+
+   if (remainder == bufsize) {
+      char * bigger = new char[2*bufsize + 1];
+      memcpy(bigger, pos, remainder);
+      delete[] buf;
+      buf = bigger;
+      bufsize *= 2;
+   } else if (pos != buf) {
+      memmove(buf, pos, remainder);
+   }
+   pos = buf;
+   end = buf + remainder;
+
+   size_t n_read = reader->read_block(end, bufsize - remainder);
+   if (n_read == 0) {
+      at_eof = true;
+   }
+   end += n_read;
+   *end = '\0';
+
+   return n_read != 0;
+}
+
+static inline unsigned int _strip_cr(const char * start, const char * stop)
+{
+   if (stop > start && *(stop - 1) == '\r') {
+      stop--;
+   }
+   return stop - start;
+}
+
+BlockParser::ParseStatus BlockParser::_parse_fasta(ReadView &view)
+{
+   char * name_end = (char *) memchr(pos, '\n', end - pos);
+   if (!name_end) {
+      if (!at_eof) { return RECORD_INCOMPLETE; }
+      name_end = end;
+   }
+
+   // the record runs until the next line starting with '>'.
+   char * seq_start = name_end < end ? name_end + 1 : end;
+   char * seq_end = NULL;
+   char * p = name_end;
+   bool multiline = false;
+
+   while (p < end) {
+      char * eol = (char *) memchr(p + 1, '\n', end - (p + 1));
+      if (!eol) {
+	 if (!at_eof) { return RECORD_INCOMPLETE; }
+	 seq_end = end;
+	 break;
+      }
+      if (eol + 1 == end) {
+	 if (!at_eof) { return RECORD_INCOMPLETE; }
+	 seq_end = eol;
+	 break;
+      }
+      if (eol[1] == '>') {
+	 seq_end = eol;
+	 break;
+      }
+      multiline = true;
+      p = eol;
+   }
+   if (!seq_end) {
+      seq_end = end;
+   }
+   if (seq_end < seq_start) {
+      seq_end = seq_start;
+   }
+
+   view.name = pos + 1;
+   view.name_len = _strip_cr(pos + 1, name_end);
+   view.quality = NULL;
+   view.quality_len = 0;
 
-      if ((int)current_read.seq.find('N') == -1)  {
-         valid_read = 1;
+   if (!multiline) {
+      view.seq = seq_start;
+      view.seq_len = _strip_cr(seq_start, seq_end);
+   } else {
+      seq_scratch.clear();
+      const char * line = seq_start;
+      while (line < seq_end) {
+	 const char * eol = (const char *) memchr(line, '\n', seq_end - line);
+	 if (!eol) { eol = seq_end; }
+	 seq_scratch.append(line, _strip_cr(line, eol));
+	 line = eol + 1;
       }
+      view.seq = seq_scratch.data();
+      view.seq_len = seq_scratch.length();
    }
+
+   pos = seq_end;
+   return RECORD_OK;
 }
 
-FastqGzParser::FastqGzParser(const std::string &inputfile)
+BlockParser::ParseStatus BlockParser::_parse_fastq(ReadView &view)
 {
-   int MAXLINE = 1000;
-   char tmp[MAXLINE];
-   infile = gzopen(inputfile.c_str(), "rb");
-   std::string line_three, quality_scores;
+   char * eols[4];
+   char * p = pos;
+
+   for (unsigned int i = 0; i < 4; i++) {
+      eols[i] = (char *) memchr(p, '\n', end - p);
+      if (!eols[i]) {
+	 if (!at_eof) { return RECORD_INCOMPLETE; }
+	 if (i < 3) { return RECORD_TRUNCATED; }
+	 eols[i] = end;
+      }
+      p = eols[i] + 1;
+   }
 
-   one_read_left = 0;
+   view.name = pos + 1;
+   view.name_len = _strip_cr(pos + 1, eols[0]);
+   view.seq = eols[0] + 1;
+   view.seq_len = _strip_cr(eols[0] + 1, eols[1]);
+   view.quality = eols[2] + 1;
+   view.quality_len = _strip_cr(eols[2] + 1, eols[3]);
 
-   bool valid_read = 0;
+   assert(*(eols[1] + 1) == '+');
 
-   while (!valid_read && !gzeof(infile))  {
-      //getline(infile, current_read.name);
-      //getline(infile, current_read.seq);
-      //getline(infile, line_three);
-      //getline(infile, quality_scores);
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      current_read.name = tmp;
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      current_read.seq = tmp;
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      line_three = tmp;
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      quality_scores = tmp;
+   pos = eols[3];
+   return RECORD_OK;
+}
 
-      //std::cout << current_read.name[0] << std::endl;
+// _fetch: parse the next record without an 'N' into 'view'.
 
-      assert(current_read.name[0] == '@');
-      assert(line_three[0] == '+');
-      assert(quality_scores.length() == current_read.seq.length());
+bool BlockParser::_fetch(ReadView &view)
+{
+   while (1) {
+      // skip blank lines between records.
+      while (pos < end && (*pos == '\n' || *pos == '\r')) {
+	 pos++;
+      }
+      if (pos == end) {
+	 if (!_refill()) {
+	    return false;
+	 }
+	 continue;
+      }
 
-      current_read.name = current_read.name.substr(1);
+      ParseStatus status;
+      if (*pos == '>') {
+	 status = _parse_fasta(view);
+      } else if (*pos == '@') {
+	 status = _parse_fastq(view);
+      } else {			// not a record start; skip the line.
+	 char * eol = (char *) memchr(pos, '\n', end - pos);
+	 if (eol) {
+	    pos = eol;
+	 } else if (!_refill()) {
+	    pos = end;
+	 }
+	 continue;
+      }
 
-      if ((int)current_read.seq.find('N') == -1)  {
-         valid_read = 1;
+      if (status == RECORD_INCOMPLETE) {
+	 _refill();
+	 continue;
+      } else if (status == RECORD_TRUNCATED) {
+	 pos = end;
+	 return false;
+      }
+
+      if (!memchr(view.seq, 'N', view.seq_len)) {
+	 return true;
       }
    }
 }
 
-Read FastqParser::get_next_read()
+Read BlockParser::get_next_read()
 {
-   Read next_read = current_read;
-   std::string line_three, quality_scores;
+   Read read;
+   ReadView view;
 
-   bool valid_read = 0;
+   if (get_next_view(view)) {
+      read.name.assign(view.name, view.name_len);
+      read.seq.assign(view.seq, view.seq_len);
+   }
+   return read;
+}
 
-   while (!valid_read && !infile.eof())  {
+bool BlockParser::get_next_view(ReadView &view)
+{
+   if (!have_pending) {
+      have_pending = _fetch(pending);
+      if (!have_pending) {
+	 return false;
+      }
+   }
 
-      getline(infile, current_read.name);
+   view = pending;
+   have_pending = false;
+   _n_reads++;
 
-      if (infile.eof())  {
-         return next_read;
-      }
+   return true;
+}
 
-      getline(infile, current_read.seq);
-      getline(infile, line_three);
-      getline(infile, quality_scores);
-   
-      assert(current_read.name[0] == '@');
-      assert(line_three[0] == '+' || line_three[0] == '#');
-      assert(quality_scores.length() == current_read.seq.length());
+// get_next_batch: as IParser's, but calls _fetch directly rather than
+// going through a virtual call per record.
 
-      current_read.name = current_read.name.substr(1);
+unsigned int BlockParser::get_next_batch(ReadBatch &batch, unsigned int n)
+{
+   ReadView view;
 
-      if ((int)current_read.seq.find('N') == -1)  {
-         valid_read = 1;
-      }
+   batch.clear();
+   if (n && have_pending) {
+      batch.append(pending, _n_reads++);
+      have_pending = false;
+   }
+   while (batch.size() < n && _fetch(view)) {
+      batch.append(view, _n_reads++);
    }
+   return batch.size();
+}
 
-   return next_read;
+bool BlockParser::is_complete()
+{
+   if (!have_pending) {
+      have_pending = _fetch(pending);
+   }
+   return !have_pending;
 }
 
-Read FastqGzParser::get_next_read()
+//
+// MmapFile
+//
+
+MmapFile::MmapFile(const std::string &inputfile) :
+   _data(NULL), _size(0), _is_fastq(false)
 {
-   int MAXLINE = 1000;
-   char tmp[MAXLINE];
-   Read next_read = current_read;
-   std::string line_three, quality_scores;
+   struct stat st;
 
-   bool valid_read = 0;
+   fd = open(inputfile.c_str(), O_RDONLY);
+   if (fd < 0) {
+      return;
+   }
+   if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      return;
+   }
 
-   if (gzeof(infile)) {
-      one_read_left = 0;
-      return next_read;
+   void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (p == MAP_FAILED) {
+      return;
    }
+   _data = (char *) p;
+   _size = st.st_size;
 
-   while (!valid_read && !gzeof(infile))  {
+   const char * c = _data;
+   while (c < _data + _size && (*c == '\n' || *c == '\r')) {
+      c++;
+   }
+   _is_fastq = c < _data + _size && *c == '@';
+}
 
-      //getline(infile, current_read.name);
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      current_read.name = tmp;
+MmapFile::~MmapFile()
+{
+   if (_data) {
+      munmap(_data, _size);
+      _data = NULL;
+   }
+   if (fd >= 0) {
+      close(fd);
+      fd = -1;
+   }
+}
 
-      //if (gzeof(infile))  {
-      //   one_read_left = 0;
-      //   return next_read;
-      //}
+// a FASTQ record start is a line beginning with '@' whose second line
+// after it begins with '+', with sequence and quality of equal length.
+// (A quality line may begin with '@', but then the line two below it is
+// a sequence line.)
 
-      //getline(infile, current_read.seq);
-      //getline(infile, line_three);
-      //getline(infile, quality_scores);
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      current_read.seq = tmp;
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      line_three = tmp;
-      gzgets(infile, tmp, MAXLINE);
-      tmp[strlen(tmp)-1] = '\0';
-      quality_scores = tmp;
+static bool _is_fastq_record(const char * p, const char * end)
+{
+   const char * eols[4];
 
-      assert(current_read.name[0] == '@');
-      assert(line_three[0] == '+');
-      assert(quality_scores.length() == current_read.seq.length());
+   for (unsigned int i = 0; i < 4; i++) {
+      eols[i] = (const char *) memchr(p, '\n', end - p);
+      if (!eols[i]) {
+	 if (i < 3) { return false; }
+	 eols[i] = end;
+      }
+      p = eols[i] + 1;
+   }
 
-      current_read.name = current_read.name.substr(1);
+   return *(eols[1] + 1) == '+' &&
+      _strip_cr(eols[0] + 1, eols[1]) == _strip_cr(eols[2] + 1, eols[3]);
+}
 
-      if ((int)current_read.seq.find('N') == -1)  {
-         valid_read = 1;
+size_t MmapFile::next_record_start(size_t offset) const
+{
+   if (offset == 0) {
+      return 0;
+   }
+
+   const char * end = _data + _size;
+   const char * p = _data + offset - 1;
+
+   // always start looking at the beginning of a line.
+   while (p < end) {
+      const char * eol = (const char *) memchr(p, '\n', end - p);
+      if (!eol) {
+	 break;
+      }
+      p = eol + 1;
+      if (p == end) {
+	 break;
+      }
+      if (_is_fastq) {
+	 if (*p == '@' && _is_fastq_record(p, end)) {
+	    return p - _data;
+	 }
+      } else if (*p == '>') {
+	 return p - _data;
       }
+   }
+   return _size;
+}
+
+void MmapFile::split(unsigned int n, std::vector<size_t> &boundaries) const
+{
+   boundaries.clear();
+   boundaries.push_back(0);
+   for (unsigned int i = 1; i < n; i++) {
+      size_t b = next_record_start((size_t) (_size * ((double) i / n)));
+      if (b < boundaries.back()) {
+	 b = boundaries.back();
+      }
+      boundaries.push_back(b);
+   }
+   boundaries.push_back(_size);
+}
+
+//
+// MmapParser
+//
 
-      if (gzeof(infile) && valid_read) {
-         one_read_left = 1;
+MmapParser::MmapParser(MmapFile * f, size_t start, size_t stop, bool owns) :
+   BlockParser(f->data() + start, f->data() + stop), file(f), owns_file(owns)
+{
+   // madvise wants a page-aligned start.
+   size_t pagesize = sysconf(_SC_PAGESIZE);
+   size_t aligned = start - (start % pagesize);
+   char * base = (char *) f->data() + aligned;
+
+   if (stop > aligned) {
+      size_t window = stop - aligned;
+      madvise(base, window, MADV_SEQUENTIAL);
+      if (window > MMAP_WILLNEED_WINDOW) {
+	 window = MMAP_WILLNEED_WINDOW;
       }
+      madvise(base, window, MADV_WILLNEED);
    }
+}
 
-   return next_read;
+MmapParser::~MmapParser()
+{
+   if (owns_file) {
+      delete file;
+   }
+   file = NULL;
 }
 
 
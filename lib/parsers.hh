@@ -3,10 +3,27 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <string.h>
 #include <fstream>
 #include <assert.h>
+#include <sys/types.h>
 #include "zlib-1.2.3/zlib.h"
+#include "thread_utils.hh"
+
+//
+// ParserError: thrown by a parser whose input turns out to be corrupt or
+// truncated, once the records before the damage have all been returned.
+//
+
+class ParserError
+{
+private:
+   std::string _message;
+public:
+   ParserError(const std::string &message) : _message(message) { }
+   const std::string &get_message() const { return _message; }
+};
 
 struct Read
 {
@@ -15,67 +32,350 @@ struct Read
    //std::string quality;
 };
 
+//
+// ReadView: a non-owning view of a single record.  The pointers refer to
+// parser-owned memory and are only valid until the next call into the
+// parser that produced them (including is_complete()).
+//
+
+struct ReadView
+{
+   const char * name;
+   unsigned int name_len;
+   const char * seq;
+   unsigned int seq_len;
+   const char * quality;	// NULL for FASTA records.
+   unsigned int quality_len;
+};
+
+//
+// ReadBatch: a block of records copied into one reusable arena.  Each
+// field is NUL-terminated, so seq() and name() can be handed to code that
+// expects C strings.  clear() keeps the allocations, so a batch reused
+// across calls stops allocating once it has grown to its working size.
+//
+
+#define DEFAULT_READ_BATCH_SIZE 1024
+
+class ReadBatch
+{
+private:
+   struct Record {
+      size_t name, seq, quality;	// offsets into _arena.
+      unsigned int name_len, seq_len, quality_len;
+      bool has_quality;
+      unsigned long long index;
+   };
+
+   std::vector<char> _arena;
+   std::vector<Record> _records;
+
+   size_t _append_field(const char * s, unsigned int len) {
+      size_t offset = _arena.size();
+      _arena.insert(_arena.end(), s, s + len);
+      _arena.push_back('\0');
+      return offset;
+   }
+public:
+   void clear() { _arena.clear(); _records.clear(); }
+   size_t size() const { return _records.size(); }
+   bool empty() const { return _records.empty(); }
+
+   void append(const ReadView &view, unsigned long long index) {
+      Record r;
+      r.name = _append_field(view.name, view.name_len);
+      r.name_len = view.name_len;
+      r.seq = _append_field(view.seq, view.seq_len);
+      r.seq_len = view.seq_len;
+      r.has_quality = view.quality != NULL;
+      r.quality = _append_field(view.quality, view.quality_len);
+      r.quality_len = view.quality_len;
+      r.index = index;
+      _records.push_back(r);
+   }
+
+   const char * name(size_t i) const { return &_arena[_records[i].name]; }
+   unsigned int name_len(size_t i) const { return _records[i].name_len; }
+   const char * seq(size_t i) const { return &_arena[_records[i].seq]; }
+   unsigned int seq_len(size_t i) const { return _records[i].seq_len; }
+   const char * quality(size_t i) const {
+      return _records[i].has_quality ? &_arena[_records[i].quality] : NULL;
+   }
+   unsigned int quality_len(size_t i) const {
+      return _records[i].quality_len;
+   }
+
+   // position of the record in the parser's output, counting from 0.
+   unsigned long long index(size_t i) const { return _records[i].index; }
+};
+
 class IParser
 {
+protected:
+   Read _view_read;
+   unsigned long long _n_reads;	// records returned so far.
 public:
+   IParser() : _n_reads(0) { }
    virtual Read get_next_read() = 0;
    virtual bool is_complete() = 0;
    virtual ~IParser() { }
    static IParser* get_parser(const std::string &inputfile);
+
+   // fill 'parsers' with n parsers over disjoint, record-aligned ranges
+   // of the file, in order, that n threads can read without locking --
+   // or, if the file can't be split (it's compressed, or not a regular
+   // file), with just the one from get_parser().  Their read indexes
+   // each count from 0.  They share the mapping, so delete them all
+   // together, once done with every one.
+   static void get_parsers(const std::string &inputfile, unsigned int n,
+			   std::vector<IParser *> &parsers);
+
+   // zero-copy interface: fills in 'view' and returns true, or returns
+   // false when the input is exhausted.  The default implementation
+   // goes through get_next_read().
+   virtual bool get_next_view(ReadView &view);
+
+   // replace the contents of 'batch' with up to 'n' records; returns the
+   // number read, 0 at end of input.
+   virtual unsigned int get_next_batch(ReadBatch &batch,
+				       unsigned int n = DEFAULT_READ_BATCH_SIZE);
 };
 
+// delete the parsers from get_parsers().
+inline void delete_parsers(std::vector<IParser *> &parsers)
+{
+   for (unsigned int i = 0; i < parsers.size(); i++) {
+      delete parsers[i];
+   }
+   parsers.clear();
+}
+
+//
+// IBlockReader: a source of raw, unparsed bytes for BlockParser.
+//
+
+class IBlockReader
+{
+public:
+   virtual ~IBlockReader() { }
 
-class FastaParser : public IParser
+   // read up to 'n' bytes into 'buf'; returns 0 at end of input.
+   virtual size_t read_block(char * buf, size_t n) = 0;
+};
+
+class FileBlockReader : public IBlockReader
 {
 private:
-   std::ifstream infile;
-   Read current_read;
-   std::string next_name;
-   bool one_read_left;
+   int fd;
 public:
-   FastaParser(const std::string &inputfile);
-   ~FastaParser() { infile.close();  }
-   Read get_next_read();
-   bool is_complete() { return !one_read_left && infile.eof(); } 
+   FileBlockReader(const std::string &inputfile);
+   ~FileBlockReader();
+   size_t read_block(char * buf, size_t n);
 };
 
-class FastaGzParser : public IParser
+//
+// GzBlockReader: inflates a gzip file on a background thread into a small
+// ring of large buffers, so that decompression overlaps with parsing and
+// counting on the consumer side.  (zlib's gzread also passes uncompressed
+// input straight through.)  read_block() throws ParserError once it has
+// handed back everything before a corrupt or truncated member.
+//
+
+#define GZ_READER_NBUFS 4
+#define GZ_READER_BUFSIZE (1024*1024)
+
+class GzBlockReader : public IBlockReader
 {
 private:
    gzFile infile;
-   Read current_read;
-   std::string next_name;
-   bool one_read_left;
+   pthread_t thread;
+
+   khmer::Mutex mutex;
+   khmer::Condition not_empty;	// signalled by the producer.
+   khmer::Condition not_full;	// signalled by the consumer.
+
+   char * slots[GZ_READER_NBUFS];
+   size_t slot_len[GZ_READER_NBUFS];
+   unsigned int head;		// next slot to be consumed...
+   size_t head_offset;		// ...and how much of it has been.
+   unsigned int tail;		// next slot to be filled.
+   unsigned int n_full;
+   bool done;			// producer hit EOF or an error.
+   bool failed;			// ...and it was an error.
+   bool stop;			// consumer is going away.
+
+   void _start();
+   static void * _thread_main(void * self);
+   void _produce();
 public:
-   FastaGzParser(const std::string &inputfile);
-   ~FastaGzParser() { gzclose(infile);  }
-   Read get_next_read();
-   bool is_complete() { return !one_read_left && gzeof(infile); }
+   GzBlockReader(const std::string &inputfile);
+   // read from fd's current position; the reader closes it.
+   GzBlockReader(int fd);
+   ~GzBlockReader();
+   size_t read_block(char * buf, size_t n);
 };
 
-class FastqParser : public IParser
+//
+// BgzfBlockReader: BGZF files are a series of independent gzip members,
+// each at most 64KB and carrying its compressed size in a 'BC' extra
+// subfield.  A reader thread splits the file into members and a pool of
+// worker threads inflates them; read_block() hands the output back in
+// file order.
+//
+// Only the first member is checked before choosing this reader, so the
+// reader thread stops at the first gzip member that isn't a whole BGZF
+// one, and the rest of the file, from there on, goes through a
+// GzBlockReader.  A member that fails to inflate, or anything that isn't
+// gzip at all, makes read_block() throw ParserError when it gets there.
+//
+
+#define BGZF_MAX_BLOCK_SIZE 65536
+#define BGZF_DEFAULT_THREADS 4
+
+class BgzfBlockReader : public IBlockReader
 {
 private:
-   std::ifstream infile;
-   Read current_read;
+   enum SlotState { SLOT_EMPTY, SLOT_READ, SLOT_INFLATING, SLOT_INFLATED };
+
+   struct Slot {
+      SlotState state;
+      unsigned char * in;
+      size_t in_len;
+      char * out;
+      size_t out_len;
+      bool failed;		// didn't inflate.
+   };
+
+   // what _read_one_block found.
+   enum BlockStatus { BLOCK_OK, BLOCK_EOF, BLOCK_NOT_BGZF, BLOCK_CORRUPT };
+
+   int fd;
+   unsigned int n_threads;
+   pthread_t reader_thread;
+   pthread_t * worker_threads;
+
+   khmer::Mutex mutex;
+   khmer::Condition changed;	// broadcast on every slot state change.
+
+   Slot * slots;
+   unsigned int n_slots;
+   unsigned long long n_blocks_read;	// blocks handed out by the reader.
+   unsigned long long next_inflate;	// next block for a worker.
+   unsigned long long head;		// next block for the consumer...
+   size_t head_offset;			// ...and how much of it was used.
+   bool reader_done;
+   BlockStatus reader_status;		// why the reader stopped.
+   bool stop;
+
+   off_t read_offset;		// reader thread's own.
+   off_t rest_offset;		// where the non-BGZF remainder starts.
+   GzBlockReader * rest;	// reading it, once the blocks run out.
+
+   static void * _reader_main(void * self);
+   static void * _worker_main(void * self);
+   void _read_blocks();
+   void _inflate_blocks();
+   BlockStatus _read_one_block(Slot &slot);
+public:
+   BgzfBlockReader(const std::string &inputfile,
+		   unsigned int n_threads = BGZF_DEFAULT_THREADS);
+   ~BgzfBlockReader();
+   size_t read_block(char * buf, size_t n);
+
+   // does the file start with a BGZF member header?
+   static bool is_bgzf(const std::string &inputfile);
+};
+
+//
+// BlockParser: reads FASTA or FASTQ in large blocks and scans record
+// boundaries with memchr.  Single-line sequences are handed back as views
+// directly into the block buffer; multi-line FASTA sequences are joined
+// into a reused scratch buffer.  Records whose sequence contains an 'N'
+// are skipped.
+//
+
+#define BLOCK_PARSER_BUFSIZE (4*1024*1024)
+
+class BlockParser : public IParser
+{
+protected:
+   IBlockReader * reader;
+   char * buf;
+   size_t bufsize;
+   char * pos;			// unparsed data is [pos, end).
+   char * end;
+   bool at_eof;
+
+   ReadView pending;
+   bool have_pending;
+   std::string seq_scratch;
+
+   enum ParseStatus { RECORD_OK, RECORD_INCOMPLETE, RECORD_TRUNCATED };
+
+   bool _refill();
+   ParseStatus _parse_fasta(ReadView &view);
+   ParseStatus _parse_fastq(ReadView &view);
+   bool _fetch(ReadView &view);
+
+   // parse [start, stop) in place, with no reader.  The buffer is never
+   // written to or freed.
+   BlockParser(const char * start, const char * stop);
 public:
-   FastqParser(const std::string &inputfile);
-   ~FastqParser() { infile.close(); }
+   BlockParser(IBlockReader * reader, size_t bufsize = BLOCK_PARSER_BUFSIZE);
+   ~BlockParser();
    Read get_next_read();
-   bool is_complete() { return infile.eof(); }
+   bool get_next_view(ReadView &view);
+   unsigned int get_next_batch(ReadBatch &batch,
+			       unsigned int n = DEFAULT_READ_BATCH_SIZE);
+   bool is_complete();
 };
 
-class FastqGzParser : public IParser
+//
+// MmapFile: a read-only mapping of an uncompressed FASTA/FASTQ file, which
+// can be cut into byte ranges that each start on a record boundary.
+//
+
+#define MMAP_WILLNEED_WINDOW (64*1024*1024)
+
+class MmapFile
 {
 private:
-   gzFile infile;
-   Read current_read;
-   bool one_read_left;
+   int fd;
+   char * _data;
+   size_t _size;
+   bool _is_fastq;
 public:
-   FastqGzParser(const std::string &inputfile);
-   ~FastqGzParser() { gzclose(infile); }
-   Read get_next_read();
-   bool is_complete() { return !one_read_left && gzeof(infile); }
+   MmapFile(const std::string &inputfile);
+   ~MmapFile();
+
+   bool is_open() const { return _data != NULL; }
+   const char * data() const { return _data; }
+   size_t size() const { return _size; }
+
+   // the offset of the first record starting at or after 'offset'.
+   size_t next_record_start(size_t offset) const;
+
+   // fill 'boundaries' with n + 1 offsets; range i is
+   // [boundaries[i], boundaries[i+1]), possibly empty.
+   void split(unsigned int n, std::vector<size_t> &boundaries) const;
 };
 
+//
+// MmapParser: a BlockParser over a byte range of an MmapFile.  Records are
+// returned straight from the mapping.  Parsers over disjoint ranges of
+// one file need no shared state.
+//
+
+class MmapParser : public BlockParser
+{
+private:
+   MmapFile * file;
+   bool owns_file;
+public:
+   MmapParser(MmapFile * file, size_t start, size_t stop,
+	      bool owns_file = false);
+   ~MmapParser();
+};
+
+
 #endif
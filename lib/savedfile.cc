@@ -0,0 +1,590 @@
+#include "khmer.hh"
+#include "savedfile.hh"
+#include "ktable.hh"
+#include "alloc.hh"
+#include "thread_utils.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX_READ_THREADS 8
+#define READ_CHUNK_BYTES (64 * 1024 * 1024)
+#define MAX_SAVED_SECTIONS 65536		// more means a corrupt header.
+
+using namespace std;
+using namespace khmer;
+
+namespace khmer {
+  // the start of the header page.
+  struct _SavedHeader {
+    unsigned char version;
+    unsigned char file_type;
+    unsigned short reserved;
+    unsigned int n_sections;
+    unsigned long long directory_offset;
+    unsigned int directory_crc;
+    unsigned int reserved2;
+  };
+}
+
+// zlib's crc32 takes a 32-bit length.
+static unsigned int _crc(unsigned int crc, const void * data,
+			 unsigned long long n)
+{
+  const Bytef * p = (const Bytef *) data;
+  while (n) {
+    uInt chunk = n > (1U << 30) ? (1U << 30) : (uInt) n;
+    crc = crc32(crc, p, chunk);
+    p += chunk;
+    n -= chunk;
+  }
+  return crc;
+}
+
+//
+// SectionedFileWriter
+//
+
+SectionedFileWriter::SectionedFileWriter(const std::string &filename,
+					 unsigned char file_type,
+					 bool compressed)
+  : _gz(NULL), _file_type(file_type), _in_section(false)
+{
+  if (compressed) {
+    _gz = new ChunkedGzWriter(filename, SAVED_PAGE_BYTES);
+  } else {
+    _outfile.open(filename.c_str(), ios::binary);
+    if (!_outfile.is_open()) {
+      throw SavedFileError("can't open " + filename);
+    }
+  }
+
+  // the header is filled in by close(), once the directory is written.
+  static const char zeros[SAVED_PAGE_BYTES] = { 0 };
+  _write(zeros, SAVED_PAGE_BYTES);
+}
+
+void SectionedFileWriter::_write(const void * data, unsigned long long n)
+{
+  if (_gz) {
+    _gz->write(data, n);
+  } else {
+    _outfile.write((const char *) data, n);
+  }
+}
+
+unsigned long long SectionedFileWriter::_tell()
+{
+  if (_gz) {
+    return _gz->tell();
+  }
+  return _outfile.tellp();
+}
+
+// zero-fill up to the next page boundary.
+void SectionedFileWriter::_pad_to_page()
+{
+  static const char zeros[SAVED_PAGE_BYTES] = { 0 };
+
+  unsigned long long pos = _tell();
+  _write(zeros, _page_align(pos) - pos);
+}
+
+void SectionedFileWriter::begin_section(unsigned int type)
+{
+  assert(!_in_section);
+  _pad_to_page();
+
+  SavedSection section;
+  section.type = type;
+  section.crc = crc32(0L, Z_NULL, 0);
+  section.offset = _tell();
+  section.length = 0;
+
+  _sections.push_back(section);
+  _in_section = true;
+}
+
+void SectionedFileWriter::write(const void * data, unsigned long long n)
+{
+  assert(_in_section);
+  SavedSection &section = _sections.back();
+
+  _write(data, n);
+  section.crc = _crc(section.crc, data, n);
+  section.length += n;
+}
+
+void SectionedFileWriter::end_section()
+{
+  assert(_in_section);
+  _in_section = false;
+}
+
+void SectionedFileWriter::write_params(const SavedParams &params,
+				       const std::vector<HashIntoType> &tablesizes,
+				       bool unique_rc)
+{
+  assert(params.n_tables == tablesizes.size());
+
+  SavedParams save_params = params;
+  save_params.forward_only = unique_rc ? 0 : 1;
+
+  begin_section(SECTION_PARAMS);
+  write(&save_params, sizeof(save_params));
+  for (unsigned int i = 0; i < tablesizes.size(); i++) {
+    unsigned long long save_tablesize = tablesizes[i];
+    write(&save_tablesize, sizeof(save_tablesize));
+  }
+  end_section();
+}
+
+void SectionedFileWriter::close()
+{
+  if (!_outfile.is_open() && !_gz) {
+    return;
+  }
+  assert(!_in_section);
+
+  _pad_to_page();
+
+  _SavedHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = SAVED_FORMAT_VERSION_SECTIONED;
+  header.file_type = _file_type;
+  header.n_sections = _sections.size();
+  header.directory_offset = _tell();
+  header.directory_crc = crc32(0L, Z_NULL, 0);
+
+  if (!_sections.empty()) {
+    header.directory_crc = _crc(header.directory_crc, &_sections[0],
+				_sections.size() * sizeof(SavedSection));
+    _write(&_sections[0], _sections.size() * sizeof(SavedSection));
+  }
+
+  if (_gz) {
+    char head[SAVED_PAGE_BYTES] = { 0 };
+    memcpy(head, &header, sizeof(header));
+
+    _gz->close(head);
+    delete _gz;
+    _gz = NULL;
+    return;
+  }
+
+  _outfile.seekp(0);
+  _outfile.write((const char *) &header, sizeof(header));
+  _outfile.close();
+}
+
+//
+// SectionedFileReader
+//
+
+// gzread, for more than 2 GB at a time.
+static void _gzread_fully(gzFile infile, void * buf, unsigned long long n,
+			  const std::string &filename)
+{
+  char * p = (char *) buf;
+  while (n) {
+    unsigned int chunk = n > (1U << 30) ? (1U << 30) : (unsigned int) n;
+    int got = gzread(infile, p, chunk);
+    if (got <= 0) {
+      throw SavedFileError(filename + " is truncated or corrupt");
+    }
+    p += got;
+    n -= got;
+  }
+}
+
+SectionedFileReader::SectionedFileReader(const std::string &filename,
+					 unsigned char file_type)
+  : _filename(filename), _infile(NULL), _chunked(NULL), _read_pos(0),
+    _direct(false), _fd(-1), _read_left(0)
+{
+  try {
+    _read_directory(file_type);
+  } catch (...) {
+    if (_infile) {
+      gzclose(_infile);
+    }
+    delete _chunked;
+    throw;
+  }
+}
+
+void SectionedFileReader::_read_directory(unsigned char file_type)
+{
+  _SavedHeader header;
+
+  if (ChunkedGzReader::is_chunked(_filename)) {
+    _chunked = new ChunkedGzReader(_filename);
+    _chunked->read(0, &header, sizeof(header));
+  } else {
+    _infile = gzopen(_filename.c_str(), "rb");
+    if (_infile == NULL) {
+      throw SavedFileError("can't open " + _filename);
+    }
+
+    _gzread_fully(_infile, &header, sizeof(header), _filename);
+    _direct = gzdirect(_infile);
+  }
+  if (header.version != SAVED_FORMAT_VERSION_SECTIONED ||
+      header.file_type != file_type) {
+    throw SavedFileError(_filename + " is not the right kind of saved file");
+  }
+  if (header.n_sections > MAX_SAVED_SECTIONS) {
+    throw SavedFileError(_filename + " has a corrupt header");
+  }
+
+  unsigned int crc = crc32(0L, Z_NULL, 0);
+
+  _sections.resize(header.n_sections);
+  if (!_sections.empty()) {
+    const unsigned long long n = _sections.size() * sizeof(SavedSection);
+    if (_chunked) {
+      _chunked->read(header.directory_offset, &_sections[0], n);
+    } else {
+      z_off_t pos = gzseek(_infile, header.directory_offset, SEEK_SET);
+      if (pos != (z_off_t) header.directory_offset) {
+	throw SavedFileError(_filename + " is truncated or corrupt");
+      }
+      _gzread_fully(_infile, &_sections[0], n, _filename);
+    }
+
+    crc = _crc(crc, &_sections[0], _sections.size() * sizeof(SavedSection));
+  }
+  if (crc != header.directory_crc) {
+    throw SavedFileError(_filename + " fails its directory CRC check");
+  }
+
+  // every section lies between the header and the directory.
+  for (unsigned int i = 0; i < _sections.size(); i++) {
+    const SavedSection &section = _sections[i];
+    if (section.offset < SAVED_PAGE_BYTES ||
+	section.offset > header.directory_offset ||
+	section.length > header.directory_offset - section.offset) {
+      throw SavedFileError(_filename + " has a corrupt section directory");
+    }
+  }
+}
+
+SectionedFileReader::~SectionedFileReader()
+{
+  if (_infile) {
+    gzclose(_infile);
+  }
+  delete _chunked;
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+}
+
+bool SectionedFileReader::is_sectioned(const std::string &filename)
+{
+  gzFile infile = gzopen(filename.c_str(), "rb");
+  if (infile == NULL) {
+    return false;
+  }
+
+  unsigned char version = 0;
+  int got = gzread(infile, &version, 1);
+  gzclose(infile);
+
+  return got == 1 && version == SAVED_FORMAT_VERSION_SECTIONED;
+}
+
+const SavedSection * SectionedFileReader::find(unsigned int type,
+					       unsigned int index) const
+{
+  for (unsigned int i = 0; i < _sections.size(); i++) {
+    if (_sections[i].type == type) {
+      if (index == 0) {
+	return &_sections[i];
+      }
+      index--;
+    }
+  }
+  return NULL;
+}
+
+void SectionedFileReader::begin_read(const SavedSection &section)
+{
+  if (_chunked) {
+    _read_pos = section.offset;
+  } else {
+    z_off_t pos = gzseek(_infile, section.offset, SEEK_SET);
+    if (pos != (z_off_t) section.offset) {
+      throw SavedFileError(_filename + " is truncated or corrupt");
+    }
+  }
+
+  _read_left = section.length;
+  _read_crc = crc32(0L, Z_NULL, 0);
+  _expected_crc = section.crc;
+}
+
+unsigned long long SectionedFileReader::read(void * buf, unsigned long long n)
+{
+  if (n > _read_left) {
+    n = _read_left;
+  }
+  if (n == 0) {
+    return 0;
+  }
+
+  if (_chunked) {
+    _chunked->read(_read_pos, buf, n);
+    _read_pos += n;
+  } else {
+    _gzread_fully(_infile, buf, n, _filename);
+  }
+
+  _read_crc = _crc(_read_crc, buf, n);
+  _read_left -= n;
+  if (_read_left == 0 && _read_crc != _expected_crc) {
+    throw SavedFileError(_filename + " fails a CRC check");
+  }
+  return n;
+}
+
+void SectionedFileReader::read_section(const SavedSection &section, void * buf)
+{
+  begin_read(section);
+  read(buf, section.length);
+}
+
+const SavedSection &SectionedFileReader::get(unsigned int type,
+					      unsigned int index) const
+{
+  const SavedSection * section = find(type, index);
+  if (section == NULL) {
+    throw SavedFileError(_filename + " is missing a section");
+  }
+  return *section;
+}
+
+void SectionedFileReader::check_length(const SavedSection &section,
+				       unsigned long long length) const
+{
+  if (section.length != length) {
+    throw SavedFileError(_filename + " has a section of the wrong size");
+  }
+}
+
+void SectionedFileReader::read_params(SavedParams &params,
+				      std::vector<HashIntoType> &tablesizes,
+				      bool unique_rc)
+{
+  const SavedSection &section = get(SECTION_PARAMS);
+  if (section.length < sizeof(params)) {
+    throw SavedFileError(_filename + " has a section of the wrong size");
+  }
+
+  // read it all first, so it is checked before it is believed.
+  std::vector<char> buf(section.length);
+  read_section(section, &buf[0]);
+  memcpy(&params, &buf[0], sizeof(params));
+  check_length(section, sizeof(params) +
+	       (unsigned long long) params.n_tables * sizeof(unsigned long long));
+
+  if ((bool) params.forward_only != !unique_rc) {
+    throw SavedFileError(_filename + (params.forward_only ?
+		" was saved from the forward strand only; "
+		"load it after set_unique_rc(False)" :
+		" was saved from both strands; "
+		"load it without set_unique_rc(False)"));
+  }
+
+  tablesizes.clear();
+  for (unsigned int i = 0; i < params.n_tables; i++) {
+    unsigned long long save_tablesize;
+    memcpy(&save_tablesize, &buf[sizeof(params) + i * sizeof(save_tablesize)],
+	   sizeof(save_tablesize));
+    tablesizes.push_back((HashIntoType) save_tablesize);
+  }
+}
+
+//
+// read_tables: several threads, each taking the next table to pread.
+//
+
+namespace khmer {
+  struct _TableReadState {
+    int fd;
+    std::vector<const SavedSection *> sections;
+    Byte ** tables;
+    unsigned int next;
+
+    Mutex error_lock;
+    bool failed;		// the workers stop at the first failure...
+    std::string error;		// ...and read_tables throws this.
+  };
+}
+
+static void _table_read_failed(_TableReadState * state,
+			       const std::string &error)
+{
+  ScopedLock lock(state->error_lock);
+  if (!state->failed) {
+    state->error = error;
+    state->failed = true;
+  }
+}
+
+static void * _pread_tables(void * arg)
+{
+  _TableReadState * state = (_TableReadState *) arg;
+
+  while (1) {
+    unsigned int i = __sync_fetch_and_add(&state->next, 1);
+    if (i >= state->sections.size() || state->failed) {
+      break;
+    }
+
+    const SavedSection &section = *state->sections[i];
+    Byte * table = state->tables[i];
+    unsigned int crc = crc32(0L, Z_NULL, 0);
+
+    unsigned long long loaded = 0;
+    while (loaded != section.length) {
+      unsigned long long n = section.length - loaded;
+      if (n > READ_CHUNK_BYTES) {
+	n = READ_CHUNK_BYTES;
+      }
+      ssize_t got = pread(state->fd, table + loaded, n,
+			  section.offset + loaded);
+      if (got <= 0) {
+	_table_read_failed(state, " is truncated");
+	return NULL;
+      }
+
+      crc = _crc(crc, table + loaded, got);
+      loaded += got;
+    }
+    if (crc != section.crc) {
+      _table_read_failed(state, " fails a CRC check");
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+void SectionedFileReader::read_tables(const std::vector<HashIntoType> &table_bytes,
+				      Byte ** tables, bool use_mmap)
+{
+  for (unsigned int i = 0; i < table_bytes.size(); i++) {
+    tables[i] = NULL;
+  }
+
+  try {
+    _read_tables(table_bytes, tables, use_mmap);
+  } catch (...) {
+    for (unsigned int i = 0; i < table_bytes.size(); i++) {
+      free_table(tables[i]);
+      tables[i] = NULL;
+    }
+    throw;
+  }
+}
+
+void SectionedFileReader::_read_tables(const std::vector<HashIntoType> &table_bytes,
+				       Byte ** tables, bool use_mmap)
+{
+  std::vector<const SavedSection *> sections;
+  for (unsigned int i = 0; i < table_bytes.size(); i++) {
+    const SavedSection &section = get(SECTION_TABLE, i);
+    check_length(section, table_bytes[i]);
+    sections.push_back(&section);
+  }
+
+  if (_chunked) {
+    vector<ChunkedGzExtent> extents;
+    for (unsigned int i = 0; i < sections.size(); i++) {
+      tables[i] = allocate_table(sections[i]->length);
+
+      ChunkedGzExtent extent;
+      extent.offset = sections[i]->offset;
+      extent.length = sections[i]->length;
+      extent.dest = tables[i];
+      extents.push_back(extent);
+    }
+
+    _chunked->read_parallel(extents);
+    return;
+  }
+
+  if (!_direct) {
+    for (unsigned int i = 0; i < sections.size(); i++) {
+      tables[i] = allocate_table(sections[i]->length);
+      read_section(*sections[i], tables[i]);
+    }
+    return;
+  }
+
+  if (_fd < 0) {
+    _fd = open(_filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+      throw SavedFileError("can't open " + _filename);
+    }
+  }
+
+  if (use_mmap) {
+    // a mapping past the end of the file would fault when it was used.
+    struct stat st;
+    int ret = fstat(_fd, &st);
+    assert(ret == 0);
+
+    for (unsigned int i = 0; i < sections.size(); i++) {
+      if (sections[i]->offset + sections[i]->length >
+	  (unsigned long long) st.st_size) {
+	throw SavedFileError(_filename + " is truncated");
+      }
+      try {
+	tables[i] = map_table(_fd, sections[i]->offset, sections[i]->length);
+      } catch (SavedFileError &e) {
+	throw SavedFileError(_filename + ": " + e.get_message());
+      }
+    }
+    return;
+  }
+
+  _TableReadState state;
+  state.fd = _fd;
+  state.sections = sections;
+  state.tables = tables;
+  state.next = 0;
+  state.failed = false;
+
+  for (unsigned int i = 0; i < sections.size(); i++) {
+    tables[i] = allocate_table(sections[i]->length);
+  }
+
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n_threads = n_cpus > 1 ? n_cpus : 1;
+  if (n_threads > MAX_READ_THREADS) {
+    n_threads = MAX_READ_THREADS;
+  }
+  if (n_threads > table_bytes.size()) {
+    n_threads = table_bytes.size();
+  }
+  if (n_threads <= 1) {
+    _pread_tables(&state);
+  } else {
+    vector<pthread_t> threads(n_threads);
+    for (unsigned int i = 0; i < n_threads; i++) {
+      int ret = pthread_create(&threads[i], NULL, _pread_tables, &state);
+      assert(ret == 0);
+    }
+    for (unsigned int i = 0; i < n_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  if (state.failed) {
+    throw SavedFileError(_filename + state.error);
+  }
+}
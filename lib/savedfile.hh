@@ -0,0 +1,177 @@
+#ifndef SAVEDFILE_HH
+#define SAVEDFILE_HH
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "khmer.hh"
+#include "chunkedgz.hh"
+#include "zlib-1.2.3/zlib.h"
+
+// what each section of a SAVED_FORMAT_VERSION_SECTIONED file holds.
+#define SECTION_PARAMS 1	// a SavedParams, then its n_tables tablesizes.
+#define SECTION_TABLE 2		// one per table, in order.
+#define SECTION_BIGCOUNTS 3	// (HashIntoType, BoundedCounterType) pairs.
+#define SECTION_TAGS 4		// HashIntoTypes.
+#define SECTION_STOP_TAGS 5	// HashIntoTypes.
+#define SECTION_PARTITIONS 6	// (HashIntoType, PartitionID) pairs.
+#define SECTION_STATS 7		// a SavedStats.
+
+namespace khmer {
+  // where the next section (or table) starts in a page-aligned file.
+  inline unsigned long long _page_align(unsigned long long pos) {
+    return (pos + SAVED_PAGE_BYTES - 1) / SAVED_PAGE_BYTES * SAVED_PAGE_BYTES;
+  }
+
+  //
+  // The sectioned format: a header page holding the version and type
+  // bytes (where older files have them) and the location of the section
+  // directory; then the sections, each starting on a SAVED_PAGE_BYTES
+  // boundary so that it can be seeked to, mapped or read on its own;
+  // then the directory itself.  Each section, and the directory, has a
+  // CRC32.  Numbers are native-endian, as in the older formats.
+  //
+  // Readers look sections up by type, and skip any they don't know.
+  // SectionedFileReader throws SavedFileError if a file is the wrong
+  // type, truncated or corrupt, or fails a CRC check.
+  //
+  // A compressed file is the same image, written as chunked gzip (see
+  // chunkedgz.hh): gunzip gives back the uncompressed file.
+  //
+
+  struct SavedSection {
+    unsigned int type;
+    unsigned int crc;
+    unsigned long long offset;
+    unsigned long long length;
+  };
+
+  struct SavedParams {
+    unsigned int ksize;
+    unsigned char hash_family;
+    unsigned char use_bigcount;
+    unsigned short tag_density;
+    unsigned int n_tables;
+    unsigned char forward_only;	// written without set_unique_rc(); 0 in older files.
+    unsigned char reserved[3];
+  };
+
+  struct SavedStats {
+    unsigned long long occupied_bins;
+    unsigned long long n_unique_kmers;
+    unsigned long long n_overlap_kmers;
+  };
+
+  class SectionedFileWriter {
+  protected:
+    std::ofstream _outfile;
+    ChunkedGzWriter * _gz;		// if compressed; else _outfile.
+    unsigned char _file_type;
+    std::vector<SavedSection> _sections;
+    bool _in_section;
+
+    void _write(const void * data, unsigned long long n);
+    unsigned long long _tell();
+    void _pad_to_page();
+  public:
+    SectionedFileWriter(const std::string &filename, unsigned char file_type,
+			bool compressed = false);
+    ~SectionedFileWriter() { close(); }
+
+    // start a section on the next page; write() its contents.
+    void begin_section(unsigned int type);
+    void write(const void * data, unsigned long long n);
+    void end_section();
+
+    void write_section(unsigned int type, const void * data,
+		       unsigned long long n) {
+      begin_section(type);
+      write(data, n);
+      end_section();
+    }
+
+    // params.forward_only is filled in from unique_rc, the strand mode
+    // of the table being saved.
+    void write_params(const SavedParams &params,
+		      const std::vector<HashIntoType> &tablesizes,
+		      bool unique_rc);
+
+    // write the directory, and fill in the header.
+    void close();
+  };
+
+  //
+  // SectionedFileReader: reads through zlib, so a saved file that has
+  // been gzipped can still be loaded, if more slowly: seeking means
+  // decompressing again, and nothing can be mapped or read in parallel.
+  // Chunked gzip files are read through their index instead, and their
+  // tables are inflated in parallel.
+  //
+
+  class SectionedFileReader {
+  protected:
+    std::string _filename;
+    gzFile _infile;
+    ChunkedGzReader * _chunked;	// if chunked gzip; then _infile is NULL.
+    unsigned long long _read_pos;	// in _chunked.
+    bool _direct;		// not compressed.
+    std::vector<SavedSection> _sections;
+    int _fd;			// for read_tables; opened on first use.
+
+    unsigned long long _read_left;
+    unsigned int _read_crc, _expected_crc;
+
+    void _read_directory(unsigned char file_type);
+    void _read_tables(const std::vector<HashIntoType> &table_bytes,
+		      Byte ** tables, bool use_mmap);
+  public:
+    SectionedFileReader(const std::string &filename, unsigned char file_type);
+    ~SectionedFileReader();
+
+    const std::string &filename() const { return _filename; }
+
+    // does this file start with SAVED_FORMAT_VERSION_SECTIONED?
+    static bool is_sectioned(const std::string &filename);
+
+    // the index'th section of this type, or NULL if there isn't one.
+    const SavedSection * find(unsigned int type, unsigned int index = 0) const;
+
+    // the same, but it must be there; and a section that must be length
+    // bytes long.
+    const SavedSection &get(unsigned int type, unsigned int index = 0) const;
+    void check_length(const SavedSection &section,
+		      unsigned long long length) const;
+
+    // read a whole section into buf, checking its CRC.
+    void read_section(const SavedSection &section, void * buf);
+
+    // or a piece at a time: read() returns 0 at the end of the section,
+    // and checks the CRC once it has all been read.
+    void begin_read(const SavedSection &section);
+    unsigned long long read(void * buf, unsigned long long n);
+
+    // the SECTION_PARAMS section; it must be there.  Throws
+    // SavedFileError if the file was written in the other strand mode
+    // from unique_rc, the table's, since its k-mers wouldn't match.
+    void read_params(SavedParams &params,
+		     std::vector<HashIntoType> &tablesizes,
+		     bool unique_rc);
+
+    //
+    // read_tables: the SECTION_TABLE sections, which must be
+    //     table_bytes[i] long, into tables newly allocated with
+    //     allocate_table().  They are read in parallel and checked.
+    //     With use_mmap they are map_table()d instead, and not checked,
+    //     since that would read every page.  Gzipped files are always
+    //     just read; chunked ones are inflated in parallel, and checked
+    //     by the gzip CRCs.  If any of it fails, the tables are freed
+    //     again before SavedFileError is thrown.
+    //
+
+    void read_tables(const std::vector<HashIntoType> &table_bytes,
+		     Byte ** tables, bool use_mmap);
+  };
+};
+
+#endif // SAVEDFILE_HH
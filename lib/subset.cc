@@ -1,11 +1,19 @@
 #include "hashbits.hh"
 #include "subset.hh"
 #include "parsers.hh"
+#include "savedfile.hh"
+#include "traversal.hh"
+
+#include <algorithm>
 
 #define IO_BUF_SIZE 250*1000*1000
+#define MIN_TAG_SLOTS 1024
 
 #define BIG_TRAVERSALS_ARE 200
 
+#define PARTITION_CHUNK_TAGS 1000
+#define PARTITION_CHUNKS_AHEAD 64	// searched, but not yet joined.
+
 // #define VALIDATE_PARTITIONS
 
 using namespace khmer;
@@ -33,29 +41,232 @@ static void print_tag_set(SeenSet& p)
 
 #endif //0
 
-void SubsetPartition::count_partitions(unsigned int& n_partitions,
-				       unsigned int& n_unassigned)
+//
+// PartitionStore
+//
+
+void PartitionStore::clear()
 {
-  n_partitions = 0;
-  n_unassigned = 0;
+  _tags.clear();
+  _left_behind.clear();
+  _links.clear();
+  _roots.clear();
+  _sizes.clear();
+  _slots.assign(MIN_TAG_SLOTS, 0);
+}
 
-  PartitionSet partitions;
+// the slot holding tag, or the empty one where it would go.
+unsigned long long PartitionStore::_slot_for(HashIntoType tag) const
+{
+  const unsigned long long mask = _slots.size() - 1;
+  unsigned long long pos = _mix_tag(tag) & mask;
 
-  //
-  // go through all the tagged kmers and count partitions/orphan.
-  //
+  while (_slots[pos] && _tags[_slots[pos] - 1] != tag) {
+    pos = (pos + 1) & mask;
+  }
+  return pos;
+}
+
+void PartitionStore::_grow_slots()
+{
+  _slots.assign(_slots.size() * 2, 0);
 
-  for (PartitionMap::const_iterator pi = partition_map.begin();
-       pi != partition_map.end(); pi++) {
-    PartitionID * partition_p = pi->second;
-    if (partition_p) {
-      partitions.insert(*partition_p);
+  for (unsigned int i = 0; i < _tags.size(); i++) {
+    if (!_left_behind[i]) {
+      _slots[_slot_for(_tags[i])] = i + 1;
     }
-    else {
-      n_unassigned++;
+  }
+}
+
+unsigned int PartitionStore::_new_index(HashIntoType tag)
+{
+  unsigned int i = _tags.size();
+  assert(i < ROOT_LINK);
+
+  _tags.push_back(tag);
+  _left_behind.push_back(false);
+  _links.push_back(ROOT_LINK);
+
+  return i;
+}
+
+unsigned int PartitionStore::find_tag(HashIntoType tag) const
+{
+  unsigned int slot = _slots[_slot_for(tag)];
+  return slot ? slot - 1 : NO_TAG_INDEX;
+}
+
+unsigned int PartitionStore::add_tag(HashIntoType tag)
+{
+  unsigned long long pos = _slot_for(tag);
+  if (_slots[pos]) {
+    return _slots[pos] - 1;
+  }
+
+  // keep the slots at most 3/4 full.
+  if ((_tags.size() + 1) * 4 > _slots.size() * 3) {
+    _grow_slots();
+    pos = _slot_for(tag);
+  }
+
+  unsigned int i = _new_index(tag);
+  _slots[pos] = i + 1;
+
+  return i;
+}
+
+void PartitionStore::set_partition(unsigned int i, PartitionID p)
+{
+  unsigned int root = find_root(i);
+  assert(p != 0 && p < ROOT_LINK);
+  assert(partition(root) == 0);
+  assert(partition_root(p) == NO_TAG_INDEX);
+
+  if (_roots.size() <= p) {
+    _roots.resize(p + 1, NO_TAG_INDEX);
+    _sizes.resize(p + 1, 0);
+  }
+  _sizes[p] = partition_size(root);
+  _roots[p] = root;
+  _links[root] = ROOT_LINK | p;
+}
+
+unsigned int PartitionStore::join(unsigned int a, unsigned int b)
+{
+  unsigned int root_a = find_root(a);
+  unsigned int root_b = find_root(b);
+  if (root_a == root_b) {
+    return root_a;
+  }
+
+  PartitionID p_a = _links[root_a] & ~ROOT_LINK;
+  PartitionID p_b = _links[root_b] & ~ROOT_LINK;
+  unsigned int size_a = partition_size(root_a);
+  unsigned int size_b = partition_size(root_b);
+  assert(p_a != 0 || p_b != 0);
+
+  if (size_a < size_b) {
+    std::swap(root_a, root_b);
+    std::swap(p_a, p_b);
+  }
+
+  _links[root_b] = root_a;
+
+  // the bigger set keeps its ID, if it has one.
+  if (p_a == 0) {
+    p_a = p_b;
+  } else if (p_b != 0) {
+    _roots[p_b] = NO_TAG_INDEX;
+    _sizes[p_b] = 0;
+  }
+  _links[root_a] = ROOT_LINK | p_a;
+  _roots[p_a] = root_a;
+  _sizes[p_a] = size_a + size_b;
+
+  return root_a;
+}
+
+unsigned int PartitionStore::detach(unsigned int i)
+{
+  const HashIntoType tag = _tags[i];
+  assert(!_left_behind[i]);
+
+  unsigned int root = find_root(i);
+  PartitionID p = _links[root] & ~ROOT_LINK;
+  if (p == 0) {			// alone, and in no partition already.
+    return i;
+  }
+
+  if (root == i && _sizes[p] == 1) { // the only tag; nothing else counts.
+    _roots[p] = NO_TAG_INDEX;
+    _sizes[p] = 0;
+    _links[i] = ROOT_LINK;
+    return i;
+  }
+
+  _sizes[p]--;
+  if (_sizes[p] == 0) {
+    _roots[p] = NO_TAG_INDEX;
+    _links[root] = ROOT_LINK;
+  }
+
+  unsigned long long pos = _slot_for(tag);
+  assert(_slots[pos] == i + 1);
+
+  _left_behind[i] = true;
+  unsigned int j = _new_index(tag);
+  _slots[pos] = j + 1;
+
+  return j;
+}
+
+void PartitionStore::clear_partition(PartitionID p, SeenSet& tags)
+{
+  tags.clear();
+
+  unsigned int root = partition_root(p);
+  if (root == NO_TAG_INDEX) {
+    return;
+  }
+
+  std::vector<unsigned int> members;
+  for (unsigned int i = 0; i < _tags.size(); i++) {
+    if (find_root(i) == root) {
+      members.push_back(i);
+    }
+  }
+
+  // only now that every member has been found can the links go.
+  for (unsigned int j = 0; j < members.size(); j++) {
+    unsigned int i = members[j];
+    if (!_left_behind[i]) {
+      tags.insert(_tags[i]);
+    }
+
+    _links[i] = ROOT_LINK;
+  }
+  _roots[p] = NO_TAG_INDEX;
+  _sizes[p] = 0;
+}
+
+namespace khmer {
+  struct _TagOrder {
+    const std::vector<HashIntoType>& tags;
+
+    bool operator()(unsigned int a, unsigned int b) const {
+      return tags[a] < tags[b];
+    }
+  };
+}
+
+void PartitionStore::sorted_tags(std::vector<unsigned int>& indices) const
+{
+  indices.clear();
+  for (unsigned int i = 0; i < _tags.size(); i++) {
+    if (!_left_behind[i] && partition(i)) {
+      indices.push_back(i);
+    }
+  }
+
+  _TagOrder order = { _tags };
+  std::sort(indices.begin(), indices.end(), order);
+}
+
+//
+// SubsetPartition
+//
+
+void SubsetPartition::count_partitions(unsigned int& n_partitions,
+				       unsigned int& n_unassigned)
+{
+  n_partitions = 0;
+  n_unassigned = 0;		// tags in no partition are not kept.
+
+  for (unsigned int i = 0; i < _store.n_indices(); i++) {
+    if (_store.is_root(i) && _store.partition(i)) {
+      n_partitions++;
     }
   }
-  n_partitions = partitions.size();
 }
 
 
@@ -74,10 +285,8 @@ unsigned int SubsetPartition::output_partitioned_file(const std::string infilena
 
   PartitionSet partitions;
 
-  Read read;
-  string seq;
+  ReadBatch batch;
 
-  std::string first_kmer;
   HashIntoType kmer = 0;
 
   const unsigned int ksize = _ht->ksize();
@@ -87,19 +296,21 @@ unsigned int SubsetPartition::output_partitioned_file(const std::string infilena
   // and output them.
   //
 
-  while(!parser->is_complete()) {
-    read = parser->get_next_read();
-    seq = read.seq;
+  while(parser->get_next_batch(batch)) {
+    for (unsigned int bi = 0; bi < batch.size(); bi++) {
+      const char * seq = batch.seq(bi);
+      const unsigned int seq_len = batch.seq_len(bi);
 
-    if (_ht->check_read(seq)) {
-      const char * kmer_s = seq.c_str();
+      if (!_ht->check_read(seq, seq_len)) {
+	continue;
+      }
 
       bool found_tag = false;
-      for (unsigned int i = 0; i < seq.length() - ksize + 1; i++) {
-	kmer = _hash(kmer_s + i, ksize);
+      for (unsigned int i = 0; i < seq_len - ksize + 1; i++) {
+	kmer = _ht->hash_kmer(seq + i);
 
 	// is this a known tag?
-	if (set_contains(partition_map, kmer)) {
+	if (get_partition_id(kmer)) {
 	  found_tag = true;
 	  break;
 	}
@@ -111,22 +322,16 @@ unsigned int SubsetPartition::output_partitioned_file(const std::string infilena
 
       PartitionID partition_id = 0;
       if (found_tag) {
-	PartitionID * partition_p = partition_map[kmer];
-	if (partition_p == NULL ){
-	  partition_id = 0;
-	  n_singletons++;
-	} else {
-	  partition_id = *partition_p;
-	  partitions.insert(partition_id);
-	}
+	partition_id = get_partition_id(kmer);
+	partitions.insert(partition_id);
       }
 
       if (partition_id > 0 || output_unassigned) {
-	outfile << ">" << read.name << "\t" << partition_id;
+	outfile << ">" << batch.name(bi) << "\t" << partition_id;
 	outfile << "\n" << seq << "\n";
       }
 #ifdef VALIDATE_PARTITIONS
-      std::cout << "checking: " << read.name << "\n";
+      std::cout << "checking: " << batch.name(bi) << "\n";
       assert(is_single_partition(seq));
 #endif // VALIDATE_PARTITIONS
 	       
@@ -197,11 +402,7 @@ unsigned int SubsetPartition::find_unpart(const std::string infilename,
 
       for (SeenSet::iterator si = found_tags.begin(); si != found_tags.end();
 	   si++) {
-	PartitionMap::iterator pi = partition_map.find(*si);
-	PartitionID partition_id = 0;
-	if (pi != partition_map.end() && pi->second != NULL) {
-	  partition_id = *(pi->second);
-	}
+	PartitionID partition_id = get_partition_id(*si);
 	if (partition_id == 0) {
 	  found_zero = true;
 	} else {
@@ -261,16 +462,17 @@ unsigned int SubsetPartition::find_unpart(const std::string infilename,
     std::string kmer_s;
     HashIntoType kmer_f, kmer_r;
     SeenSet tagged_kmers;
+    GraphTraversal traversal(_ht);
     for (SeenSet::iterator si = tags_todo.begin(); si != tags_todo.end(); si++) {
       n += 1;
 
       kmer_s = _revhash(*si, ksize); // @CTB hackity hack hack!
-      kmer = _hash(kmer_s.c_str(), ksize, kmer_f, kmer_r);
+      kmer = _ht->hash_kmer(kmer_s.c_str(), kmer_f, kmer_r);
 
       // find all tagged kmers within range.
       tagged_kmers.clear();
       find_all_tags(kmer_f, kmer_r, tagged_kmers, _ht->all_tags,
-		    true, stop_big_traversals);
+		    true, stop_big_traversals, traversal);
 
       // std::cout << "found " << tagged_kmers.size() << "\n";
 
@@ -295,148 +497,63 @@ unsigned int SubsetPartition::find_unpart(const std::string infilename,
 // find_all_tags: the core of the partitioning code.  finds all tagged k-mers
 //    connected to kmer_f/kmer_r in the graph.
 
+// collects the tags reached, and searches no further past them.
+class TagFindingVisitor : public TraversalVisitor {
+protected:
+  SeenSet &_tagged_kmers;
+  const TagSet &_all_tags;
+  bool _first;
+public:
+  TagFindingVisitor(SeenSet &tagged_kmers, const TagSet &all_tags) :
+    _tagged_kmers(tagged_kmers), _all_tags(all_tags), _first(true) { }
+
+  Action visit(HashIntoType kmer, const TraversalNode &node) {
+    const bool first = _first;
+    _first = false;
+
+    // Is this a kmer-to-tag, and have we put this tag in a partition
+    // already?  Search no further in this direction.  (This is where we
+    // connect partitions.)
+    if (!first && set_contains(_all_tags, kmer)) {
+      _tagged_kmers.insert(kmer);
+      return DONT_EXPAND;
+    }
+    return EXPAND;
+  }
+};
+
 void SubsetPartition::find_all_tags(HashIntoType kmer_f,
 				    HashIntoType kmer_r,
 				    SeenSet& tagged_kmers,
-				    const SeenSet& all_tags,
+				    const TagSet& all_tags,
 				    bool break_on_stop_tags,
 				    bool stop_big_traversals)
 {
-  const HashIntoType bitmask = _ht->bitmask;
-
-  HashIntoType f, r;
-  bool first = true;
-  NodeQueue node_q;
-  std::queue<unsigned int> breadth_q;
-  unsigned int cur_breadth = 0;
-  unsigned int breadth = 0;
-  const unsigned int max_breadth = (2 * _ht->_tag_density) + 1;
-
-  const unsigned int rc_left_shift = _ht->ksize()*2 - 2;
-  unsigned int total = 0;
-
-  SeenSet keeper;		// keep track of traversed kmers
-
-  // start breadth-first search.
-
-  node_q.push(kmer_f);
-  node_q.push(kmer_r);
-  breadth_q.push(0);
-
-  while(!node_q.empty()) {
-    if (stop_big_traversals && keeper.size() > BIG_TRAVERSALS_ARE) {
-      tagged_kmers.clear();
-      break;
-    }
-
-    kmer_f = node_q.front();
-    node_q.pop();
-    kmer_r = node_q.front();
-    node_q.pop();
-    breadth = breadth_q.front();
-    breadth_q.pop();
-
-    HashIntoType kmer = uniqify_rc(kmer_f, kmer_r);
-
-    // Have we already seen this k-mer?  If so, skip.
-    if (set_contains(keeper, kmer)) {
-      continue;
-    }
-
-    // Do we want to traverse through this k-mer?  If not, skip.
-    if (break_on_stop_tags && set_contains(_ht->stop_tags, kmer)) {
-      // @CTB optimize by inserting into keeper set?
-      continue;
-    }
-
-    // keep track of seen kmers
-    keeper.insert(kmer);
-    total++;
-
-    // Is this a kmer-to-tag, and have we put this tag in a partition already?
-    // Search no further in this direction.  (This is where we connect
-    // partitions.)
-    if (!first && set_contains(all_tags, kmer)) {
-      tagged_kmers.insert(kmer);
-      continue;
-    }
-
-    assert(breadth >= cur_breadth); // keep track of watermark, for debugging.
-    if (breadth > cur_breadth) { cur_breadth = breadth; }
-
-    if (breadth >= max_breadth) { continue; } // truncate search @CTB exit?
-
-    //
-    // Enqueue next set of nodes.
-    //
-
-    // NEXT
-    f = next_f(kmer_f, 'A');
-    r = next_r(kmer_r, 'A');
-    if (_ht->get_count(uniqify_rc(f,r)) &&
-	!set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'C');
-    r = next_r(kmer_r, 'C');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'G');
-    r = next_r(kmer_r, 'G');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    f = next_f(kmer_f, 'T');
-    r = next_r(kmer_r, 'T');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-
-    // PREVIOUS.
-    r = prev_r(kmer_r, 'A');
-    f = prev_f(kmer_f, 'A');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  GraphTraversal traversal(_ht);
+  find_all_tags(kmer_f, kmer_r, tagged_kmers, all_tags, break_on_stop_tags,
+		stop_big_traversals, traversal);
+}
 
-    r = prev_r(kmer_r, 'C');
-    f = prev_f(kmer_f, 'C');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
-    
-    r = prev_r(kmer_r, 'G');
-    f = prev_f(kmer_f, 'G');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+void SubsetPartition::find_all_tags(HashIntoType kmer_f,
+				    HashIntoType kmer_r,
+				    SeenSet& tagged_kmers,
+				    const TagSet& all_tags,
+				    bool break_on_stop_tags,
+				    bool stop_big_traversals,
+				    GraphTraversal& traversal)
+{
+  // search no further than the next tag could be, and not at all past
+  // a stop tag, if asked.
+  traversal.reset();
+  traversal.set_limits(break_on_stop_tags ? &_ht->stop_tags : NULL,
+		       (2 * _ht->_tag_density) + 1,
+		       stop_big_traversals ? BIG_TRAVERSALS_ARE : 0);
 
-    r = prev_r(kmer_r, 'T');
-    f = prev_f(kmer_f, 'T');
-    if (_ht->get_count(uniqify_rc(f,r)) && 
-        !set_contains(keeper, uniqify_rc(f,r))) {
-      node_q.push(f); node_q.push(r);
-      breadth_q.push(breadth + 1);
-    }
+  TagFindingVisitor visitor(tagged_kmers, all_tags);
+  traversal.traverse(kmer_f, kmer_r, &visitor);
 
-    first = false;
+  if (traversal.volume_exceeded()) {
+    tagged_kmers.clear();
   }
 }
 
@@ -454,17 +571,18 @@ void SubsetPartition::do_partition(HashIntoType first_kmer,
   std::string kmer_s;
   HashIntoType kmer_f, kmer_r, kmer;
   SeenSet tagged_kmers;
+  GraphTraversal traversal(_ht);
   const unsigned char ksize = _ht->ksize();
 
-  SeenSet::const_iterator si, end;
+  TagSet::const_iterator si, end;
 
   if (first_kmer) {
-    si = _ht->all_tags.find(first_kmer);
+    si = _ht->all_tags.lower_bound(first_kmer);
   } else {
     si = _ht->all_tags.begin();
   }
   if (last_kmer) {
-    end = _ht->all_tags.find(last_kmer);
+    end = _ht->all_tags.lower_bound(last_kmer);
   } else {
     end = _ht->all_tags.end();
   }
@@ -473,12 +591,12 @@ void SubsetPartition::do_partition(HashIntoType first_kmer,
     total_reads++;
 
     kmer_s = _revhash(*si, ksize); // @CTB hackity hack hack!
-    kmer = _hash(kmer_s.c_str(), ksize, kmer_f, kmer_r);
+    kmer = _ht->hash_kmer(kmer_s.c_str(), kmer_f, kmer_r);
 
     // find all tagged kmers within range.
     tagged_kmers.clear();
     find_all_tags(kmer_f, kmer_r, tagged_kmers, _ht->all_tags,
-		  break_on_stop_tags, stop_big_traversals);
+		  break_on_stop_tags, stop_big_traversals, traversal);
 
     // assign the partition ID
     assign_partition_id(kmer, tagged_kmers);
@@ -499,30 +617,205 @@ void SubsetPartition::do_partition(HashIntoType first_kmer,
   }
 }
 
+//
+// parallel_partition: do_partition over all the tags, with n_threads
+//    workers.  The tags are cut into chunks of PARTITION_CHUNK_TAGS, which
+//    workers take in order and search from (the slow part, and read-only);
+//    what each tag reached is then joined into the partitions chunk by
+//    chunk, in tag order, by whichever worker finishes the chunk that is
+//    next.  So the partitions -- and their IDs -- come out exactly as
+//    do_partition's would, however many threads there are.
+//
+
+namespace khmer {
+  // the tags reached from each tag in a chunk.
+  struct _PartitionChunk {
+    std::vector<HashIntoType> found;
+    std::vector<unsigned int> ends;	// of each tag's run in found.
+    bool done;
+  };
+
+  struct _PartitionWorkerState {
+    SubsetPartition * subset;
+    const Hashbits * ht;
+    const std::vector<HashIntoType> * tags;
+    bool break_on_stop_tags;
+    bool stop_big_traversals;
+
+    Mutex lock;
+    Condition progress;
+    unsigned int n_chunks;
+    unsigned int next_chunk;	// the next to search from.
+    unsigned int next_merge;	// the next to join.
+    bool merging;		// is a worker joining chunks?
+    std::vector<_PartitionChunk> chunks;
+  };
+}
+
+static void * _partition_worker(void * arg)
+{
+  _PartitionWorkerState * state = (_PartitionWorkerState *) arg;
+  SubsetPartition * subset = state->subset;
+  const Hashbits * ht = state->ht;
+  const std::vector<HashIntoType> &tags = *state->tags;
+  const unsigned char ksize = ht->ksize();
+
+  GraphTraversal traversal(ht);
+  traversal.n_threads = 1;	// the workers are threads enough.
+  SeenSet tagged_kmers;
+  std::string kmer_s;
+  HashIntoType kmer_f, kmer_r;
+
+  while (1) {
+    // take the next chunk, unless that would get too far ahead of the
+    // joining, and leave too much waiting about.
+    state->lock.lock();
+    while (state->next_chunk < state->n_chunks &&
+	   state->next_chunk - state->next_merge >= PARTITION_CHUNKS_AHEAD) {
+      state->progress.wait(state->lock);
+    }
+    if (state->next_chunk == state->n_chunks) {
+      state->lock.unlock();
+      break;
+    }
+    const unsigned int c = state->next_chunk++;
+    state->lock.unlock();
+
+    _PartitionChunk chunk;
+    const unsigned int start = c * PARTITION_CHUNK_TAGS;
+    const unsigned int end = std::min(start + PARTITION_CHUNK_TAGS,
+				      (unsigned int) tags.size());
+
+    for (unsigned int i = start; i < end; i++) {
+      kmer_s = _revhash(tags[i], ksize);
+      ht->hash_kmer(kmer_s.c_str(), kmer_f, kmer_r);
+
+      tagged_kmers.clear();
+      subset->find_all_tags(kmer_f, kmer_r, tagged_kmers, ht->all_tags,
+			    state->break_on_stop_tags,
+			    state->stop_big_traversals, traversal);
+
+      chunk.found.insert(chunk.found.end(), tagged_kmers.begin(),
+			 tagged_kmers.end());
+      chunk.ends.push_back(chunk.found.size());
+    }
+
+    state->lock.lock();
+    state->chunks[c].found.swap(chunk.found);
+    state->chunks[c].ends.swap(chunk.ends);
+    state->chunks[c].done = true;
+
+    if (state->merging) {
+      state->lock.unlock();
+      continue;
+    }
+
+    // join every chunk that is ready, in order.
+    state->merging = true;
+    while (state->next_merge < state->n_chunks &&
+	   state->chunks[state->next_merge].done) {
+      const unsigned int m = state->next_merge;
+      chunk.found.clear();
+      chunk.ends.clear();
+      chunk.found.swap(state->chunks[m].found);
+      chunk.ends.swap(state->chunks[m].ends);
+      state->lock.unlock();
+
+      unsigned int j = 0;
+      for (unsigned int i = 0; i < chunk.ends.size(); i++) {
+	tagged_kmers.clear();
+	tagged_kmers.insert(chunk.found.begin() + j,
+			    chunk.found.begin() + chunk.ends[i]);
+	j = chunk.ends[i];
+
+	subset->assign_partition_id(tags[m * PARTITION_CHUNK_TAGS + i],
+				    tagged_kmers);
+      }
+
+      state->lock.lock();
+      state->next_merge++;
+      state->progress.broadcast();
+    }
+    state->merging = false;
+    state->lock.unlock();
+  }
+
+  return NULL;
+}
+
+void SubsetPartition::parallel_partition(unsigned int n_threads,
+					 bool break_on_stop_tags,
+					 bool stop_big_traversals)
+{
+  assert(n_threads > 0);
+
+  _PartitionWorkerState state;
+  state.subset = this;
+  state.ht = _ht;
+  // sort the tags now; the workers share them.
+  state.tags = &_ht->all_tags.sorted();
+  state.break_on_stop_tags = break_on_stop_tags;
+  state.stop_big_traversals = stop_big_traversals;
+
+  state.n_chunks = (state.tags->size() + PARTITION_CHUNK_TAGS - 1) /
+    PARTITION_CHUNK_TAGS;
+  state.next_chunk = 0;
+  state.next_merge = 0;
+  state.merging = false;
+  state.chunks.resize(state.n_chunks);
+  for (unsigned int i = 0; i < state.n_chunks; i++) {
+    state.chunks[i].done = false;
+  }
+
+  if (n_threads > state.n_chunks) {
+    n_threads = state.n_chunks;
+  }
+  if (n_threads <= 1) {
+    _partition_worker(&state);
+    return;
+  }
+
+  std::vector<pthread_t> threads(n_threads);
+  for (unsigned int i = 0; i < n_threads; i++) {
+    int ret = pthread_create(&threads[i], NULL, _partition_worker, &state);
+    assert(ret == 0);
+  }
+  for (unsigned int i = 0; i < n_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
 //
 
 void SubsetPartition::set_partition_id(std::string kmer_s, PartitionID p)
 {
   HashIntoType kmer;
   assert(kmer_s.length() >= _ht->ksize());
-  kmer = _hash(kmer_s.c_str(), _ht->ksize());
+  kmer = _ht->hash_kmer(kmer_s.c_str());
 
   set_partition_id(kmer, p);
 }
 
 void SubsetPartition::set_partition_id(HashIntoType kmer, PartitionID p)
 {
-  PartitionPtrSet * s = reverse_pmap[p];
-  PartitionID * pp = NULL;
-  if (s == NULL) {
-    s = new PartitionPtrSet();
-    pp = new unsigned int(p);
-    s->insert(pp);
-    reverse_pmap[p] = s;
+  assert(p != 0);
+
+  // the tag moves to p, leaving any partition it was in.
+  unsigned int i = _store.add_tag(kmer);
+  PartitionID old_p = _store.partition(i);
+  if (old_p == p) {
+    return;
+  }
+  if (old_p) {
+    i = _store.detach(i);
+  }
+
+  unsigned int root = _store.partition_root(p);
+  if (root == NO_TAG_INDEX) {
+    _store.set_partition(i, p);
   } else {
-    pp = *(s->begin());
+    _store.join(root, i);
   }
-  partition_map[kmer] = pp;
 
   if (next_partition_id <= p) {
     next_partition_id = p + 1;
@@ -534,16 +827,15 @@ PartitionID SubsetPartition::assign_partition_id(HashIntoType kmer,
 
 {
   PartitionID return_val = 0; 
-  PartitionID * pp = NULL;
 
   // did we find a tagged kmer?
   if (tagged_kmers.size() >= 1) {
-    pp = _join_partitions_by_tags(tagged_kmers, kmer);
-    return_val = *pp;
+    return_val = _join_partitions_by_tags(tagged_kmers, kmer);
   } else {
-    PartitionMap::iterator pi = partition_map.find(kmer);
-
-    partition_map.erase(kmer);
+    unsigned int i = _store.find_tag(kmer);
+    if (i != NO_TAG_INDEX && _store.partition(i)) {
+      _store.detach(i);
+    }
     return_val = 0;
   }
 
@@ -551,91 +843,50 @@ PartitionID SubsetPartition::assign_partition_id(HashIntoType kmer,
 }
 
 // _join_partitions_by_tags combines the tags in 'tagged_kmers' into a single
-// partition, creating or reassigning partitions as necessary.  Low level
-// function!
+// partition, creating one if none of them are in a partition yet, and then
+// moves 'kmer' into it.  Low level function!
 
-PartitionID * SubsetPartition::_join_partitions_by_tags(
+PartitionID SubsetPartition::_join_partitions_by_tags(
                    const SeenSet& tagged_kmers,
 		   const HashIntoType kmer)
 {
-  SeenSet::const_iterator it = tagged_kmers.begin();
-  unsigned int * this_partition_p = NULL;
+  std::vector<unsigned int> indices;
+  unsigned int root = NO_TAG_INDEX;
 
-  // find first assigned partition ID in tagged set
-  while (it != tagged_kmers.end()) {
-    this_partition_p = partition_map[*it];
-    if (this_partition_p != NULL) {
-      break;
-    }
-    it++;
-  }
-
-  // no partition ID? allocate new!
-  if (this_partition_p == NULL) {
-    this_partition_p = new PartitionID(next_partition_id);
-    next_partition_id++;
-
-    PartitionPtrSet * s = new PartitionPtrSet();
-    s->insert(this_partition_p);
-    reverse_pmap[*this_partition_p] = s;
-  }
-  
-  // reassign all partitions individually.
-  it = tagged_kmers.begin();
+  // find first assigned partition in tagged set
+  SeenSet::const_iterator it = tagged_kmers.begin();
   for (; it != tagged_kmers.end(); ++it) {
-    PartitionMap::iterator pi = partition_map.find(*it);
-
-    if (pi == partition_map.end()) { // no entry? insert.
-      partition_map[*it] = this_partition_p;
-    } else {
-      PartitionID * pp_id = pi->second;
-
-      if (pp_id == NULL) {	// entry is null? set;
-	pi->second = this_partition_p;
-      } else if (*pp_id != *this_partition_p) { // != entry? join partitions.
-	_merge_two_partitions(this_partition_p, pp_id);
-      }
+    unsigned int i = _store.add_tag(*it);
+    if (root == NO_TAG_INDEX && _store.partition(i)) {
+      root = _store.find_root(i);
     }
+    indices.push_back(i);
   }
 
-  assert(this_partition_p != NULL);
-  partition_map[kmer] = this_partition_p;
-
-  return this_partition_p;
-}
-
-// _merge_two_partitions merges the 'merge_pp' partition into the
-// 'the_pp' partition.  It does this by joining the reverse pointer
-// map structures for two partitions and resetting each partition
-// pointer individually.
-
-PartitionID * SubsetPartition::_merge_two_partitions(PartitionID *the_pp,
-						     PartitionID *merge_pp)
-{
-  PartitionPtrSet * s = reverse_pmap[*the_pp];
-  PartitionPtrSet * t = reverse_pmap[*merge_pp];
-
-  // Choose the smaller of two sets to loop over.
-  if (s->size() < t->size()) {
-    PartitionPtrSet * tmp = s;  s = t; t = tmp;
-    PartitionID * tmp2 = the_pp; the_pp = merge_pp; merge_pp = tmp2;
+  // no partition? allocate new!
+  if (root == NO_TAG_INDEX) {
+    root = indices[0];
+    _new_partition(root);
   }
 
-  // Get rid of the reverse pointer for the old partition.
-  reverse_pmap.erase(*merge_pp);
+  for (unsigned int j = 0; j < indices.size(); j++) {
+    root = _store.join(root, indices[j]);
+  }
 
-  // Merge all of the elements in the to-be-replaced PartitionPtrSet
-  // into the merged partition.
-  for (PartitionPtrSet::iterator pi = t->begin(); pi != t->end(); pi++) {
-    PartitionID * iter_pp;
-    iter_pp = *pi;
+  // kmer itself is moved here, not joined, if it's somewhere else.
+  PartitionID p = _store.partition(root);
+  unsigned int i = _store.add_tag(kmer);
+  PartitionID kmer_p = _store.partition(i);
 
-    *iter_pp = *the_pp;	// reset the partition ID to the new one.
-    s->insert(iter_pp);
+  if (kmer_p != p) {
+    if (kmer_p) {
+      i = _store.detach(i);
+    }
+    root = _store.join(root, i);
   }
-  delete t;
 
-  return the_pp;
+  assert(_store.partition(root) == p);
+  return p;
 }
 
 PartitionID SubsetPartition::join_partitions(PartitionID orig, PartitionID join)
@@ -643,17 +894,13 @@ PartitionID SubsetPartition::join_partitions(PartitionID orig, PartitionID join)
   if (orig == join) { return orig; }
   if (orig == 0 || join == 0) { return 0; }
 
-  if (reverse_pmap.find(orig) == reverse_pmap.end() ||
-      reverse_pmap.find(join) == reverse_pmap.end() ||
-      reverse_pmap[orig] == NULL ||
-      reverse_pmap[join] == NULL) {
+  unsigned int orig_root = _store.partition_root(orig);
+  unsigned int join_root = _store.partition_root(join);
+  if (orig_root == NO_TAG_INDEX || join_root == NO_TAG_INDEX) {
     return 0;
   }
 
-  PartitionID * orig_pp = *(reverse_pmap[orig]->begin());
-  PartitionID * join_pp = *(reverse_pmap[join]->begin());
-
-  _merge_two_partitions(orig_pp, join_pp);
+  _store.join(orig_root, join_root);
 
   return orig;
 }
@@ -662,88 +909,69 @@ PartitionID SubsetPartition::get_partition_id(std::string kmer_s)
 {
   HashIntoType kmer;
   assert(kmer_s.length() >= _ht->ksize());
-  kmer = _hash(kmer_s.c_str(), _ht->ksize());
+  kmer = _ht->hash_kmer(kmer_s.c_str());
 
   return get_partition_id(kmer);
 }
 
 PartitionID SubsetPartition::get_partition_id(HashIntoType kmer)
 {
-  if (partition_map.find(kmer) != partition_map.end()) {
-    PartitionID * pp = partition_map[kmer];
-    if (pp == NULL) {
-      return 0;
-    }
-    return *pp;
+  unsigned int i = _store.find_tag(kmer);
+  if (i == NO_TAG_INDEX) {
+    return 0;
   }
-  return 0;
+  return _store.partition(i);
 }
 
 void SubsetPartition::merge(SubsetPartition * other)
 {
   if (this == other) { return; }
 
-  PartitionPtrMap other_to_this;
+  PartitionIndexMap other_to_this;
 
-  PartitionMap::const_iterator pi = other->partition_map.begin();
-  for (; pi != other->partition_map.end(); pi++) {
-    if (pi->second) {
-      _merge_other(pi->first, *(pi->second), other_to_this);
-    }
+  std::vector<unsigned int> indices;
+  other->_store.sorted_tags(indices);
+
+  for (unsigned int j = 0; j < indices.size(); j++) {
+    unsigned int i = indices[j];
+    _merge_other(other->_store.tag(i), other->_store.partition(i),
+		 other_to_this);
   }
 }
 
 // Merge PartitionIDs from another SubsetPartition, based on overlapping
-// tags.  Utility function for merge() and merge_from_disk().
+// tags.  Utility function for merge() and merge_from_disk().  diskp_to_index
+// holds a tag from each other_partition seen so far.
 
 void SubsetPartition::_merge_other(HashIntoType tag,
 				   PartitionID other_partition,
-				   PartitionPtrMap& diskp_to_pp)
+				   PartitionIndexMap& diskp_to_index)
 {
   if (set_contains(_ht->stop_tags, tag)) { // don't merge if it's a stop_tag
     return;
   }
 
-  // OK.  Does our current partitionmap have this?
-  PartitionID * pp_0;
-  pp_0 = partition_map[tag];
-
-  if (pp_0 == NULL) {	// No!  OK, map to new 'un.
-    PartitionID * existing_pp_0 = diskp_to_pp[other_partition];
+  unsigned int i = _store.add_tag(tag);
+  PartitionIndexMap::iterator di = diskp_to_index.find(other_partition);
 
-    if (existing_pp_0) {	// already seen this other_partition
-      partition_map[tag] = existing_pp_0;
+  // OK.  Does our current partitionmap have this?
+  if (_store.partition(i) == 0) {	// No!  OK, map to new 'un.
+    if (di != diskp_to_index.end()) { // already seen this other_partition
+      _store.join(di->second, i);
     }
     else {			// new other_partition! create a new partition.
-      pp_0 = get_new_partition();
-
-      PartitionPtrSet * pp_set = new PartitionPtrSet();
-      pp_set->insert(pp_0);
-      reverse_pmap[*pp_0] = pp_set;
-      partition_map[tag] = pp_0;
-
-      diskp_to_pp[other_partition] = pp_0;
+      _new_partition(i);
+      diskp_to_index[other_partition] = i;
     }
   }
   else {			// yes, we've seen this tag before...
-    PartitionID * existing_pp_0 = diskp_to_pp[other_partition];
-
-    if (existing_pp_0) {	// mapping exists.  copacetic?
-      if (*pp_0 == *existing_pp_0) {
-	;			// yep! nothing to do, yay!
-      } else {
-	// remapping must be done... we need to merge!
-	// the two partitions to merge are *pp_0 and *existing_pp_0.
-	// we also need to reset existing_pp_0 in diskp_to_pp to pp_0.
-
-	pp_0 = _merge_two_partitions(pp_0, existing_pp_0);
-	diskp_to_pp[other_partition] = pp_0;
-      }
+    if (di != diskp_to_index.end()) { // mapping exists; join, if need be.
+      _store.join(i, di->second);
     }
     else {
       // no, does not exist in our mapping yet.  but that's ok,
       // we can fix that.
-      diskp_to_pp[other_partition] = pp_0;
+      diskp_to_index[other_partition] = i;
     }
   }
 }
@@ -752,19 +980,45 @@ void SubsetPartition::_merge_other(HashIntoType tag,
 
 void SubsetPartition::merge_from_disk(string other_filename)
 {
-  ifstream infile(other_filename.c_str(), ios::binary);
-  assert(infile.is_open());
+  ifstream infile;
+  SectionedFileReader * sectioned = NULL;
+
+  if (SectionedFileReader::is_sectioned(other_filename)) {
+    sectioned = new SectionedFileReader(other_filename, SAVED_SUBSET);
+
+    try {
+      SavedParams params;
+      std::vector<HashIntoType> tablesizes;
+      sectioned->read_params(params, tablesizes, _ht->unique_rc());
+      if (params.ksize != _ht->ksize()) {
+	throw SavedFileError(other_filename + " was saved with a different k");
+      }
 
-  unsigned int save_ksize = 0;
-  unsigned char version, ht_type;
+      sectioned->begin_read(sectioned->get(SECTION_PARTITIONS));
+    } catch (...) {
+      delete sectioned;
+      throw;
+    }
+  } else {
+    infile.open(other_filename.c_str(), ios::binary);
+    if (!infile.is_open()) {
+      throw SavedFileError("can't open " + other_filename);
+    }
 
-  infile.read((char *) &version, 1);
-  infile.read((char *) &ht_type, 1);
-  assert(version == SAVED_FORMAT_VERSION);
-  assert(ht_type == SAVED_SUBSET);
+    unsigned int save_ksize = 0;
+    unsigned char version = 0, ht_type = 0;
 
-  infile.read((char *) &save_ksize, sizeof(save_ksize));
-  assert(save_ksize == _ht->ksize());
+    infile.read((char *) &version, 1);
+    infile.read((char *) &ht_type, 1);
+    if (version != SAVED_FORMAT_VERSION || ht_type != SAVED_SUBSET) {
+      throw SavedFileError(other_filename + " is not a saved partition map");
+    }
+
+    infile.read((char *) &save_ksize, sizeof(save_ksize));
+    if (save_ksize != _ht->ksize()) {
+      throw SavedFileError(other_filename + " was saved with a different k");
+    }
+  }
 
   char * buf = NULL;
   buf = new char[IO_BUF_SIZE];
@@ -773,65 +1027,77 @@ void SubsetPartition::merge_from_disk(string other_filename)
   unsigned int loaded = 0;
   unsigned int remainder;
 
-  assert(infile.is_open());
-
-  PartitionPtrMap diskp_to_pp;
+  PartitionIndexMap diskp_to_index;
 
   HashIntoType * kmer_p = NULL;
   PartitionID * diskp = NULL;
 
   //
   // Run through the entire partitionmap file, figuring out what partition IDs
-  // are present.
+  // are present.  (A sectioned file's CRC is only checked at the end, so
+  // a corrupt one may already be partly merged when it is caught.)
   //
 
   remainder = 0;
   unsigned int iteration = 0;
-  while (!infile.eof()) {
-    unsigned int i;
+  try {
+    while (1) {
+      unsigned int i;
 
-    infile.read(buf + remainder, IO_BUF_SIZE - remainder);
-    n_bytes = infile.gcount() + remainder;
-    remainder = n_bytes % (sizeof(PartitionID) + sizeof(HashIntoType));
-    n_bytes -= remainder;
+      if (sectioned) {
+	n_bytes = sectioned->read(buf + remainder, IO_BUF_SIZE - remainder);
+      } else {
+	infile.read(buf + remainder, IO_BUF_SIZE - remainder);
+	n_bytes = infile.gcount();
+      }
+      if (n_bytes == 0) {
+	break;
+      }
+      n_bytes += remainder;
+      remainder = n_bytes % (sizeof(PartitionID) + sizeof(HashIntoType));
+      n_bytes -= remainder;
 
-    iteration++;
+      iteration++;
 
-    for (i = 0; i < n_bytes;) {
-      kmer_p = (HashIntoType *) (buf + i);
-      i += sizeof(HashIntoType);
-      diskp = (PartitionID *) (buf + i);
-      i += sizeof(PartitionID);
+      for (i = 0; i < n_bytes;) {
+	kmer_p = (HashIntoType *) (buf + i);
+	i += sizeof(HashIntoType);
+	diskp = (PartitionID *) (buf + i);
+	i += sizeof(PartitionID);
 
-      assert(*diskp != 0);		// sanity check.
+	if (*diskp == 0) {		// sanity check.
+	  throw SavedFileError(other_filename + " is corrupt");
+	}
 
-      _merge_other(*kmer_p, *diskp, diskp_to_pp);
+	_merge_other(*kmer_p, *diskp, diskp_to_index);
 
-      loaded++;
+	loaded++;
+      }
+      assert(i == n_bytes);
+      memcpy(buf, buf + n_bytes, remainder);
     }
-    assert(i == n_bytes);
-    memcpy(buf, buf + n_bytes, remainder);
-
-    // _merge_from_disk_consolidate(diskp_to_pp);
+  } catch (...) {
+    delete[] buf;
+    delete sectioned;
+    throw;
   }
 
-  delete buf;
+  delete[] buf;
+  delete sectioned;
 }
 
 // Save a partition map to disk.
 
 void SubsetPartition::save_partitionmap(string pmap_filename)
 {
-  ofstream outfile(pmap_filename.c_str(), ios::binary);
-
-  unsigned char version = SAVED_FORMAT_VERSION;
-  outfile.write((const char *) &version, 1);
+  SectionedFileWriter outfile(pmap_filename, SAVED_SUBSET);
 
-  unsigned char ht_type = SAVED_SUBSET;
-  outfile.write((const char *) &ht_type, 1);
+  SavedParams params;
+  memset(&params, 0, sizeof(params));
+  params.ksize = _ht->ksize();
+  outfile.write_params(params, std::vector<HashIntoType>(), _ht->unique_rc());
 
-  unsigned int save_ksize = _ht->ksize();
-  outfile.write((const char *) &save_ksize, sizeof(save_ksize));
+  outfile.begin_section(SECTION_PARTITIONS);
 
   ///
 
@@ -842,37 +1108,35 @@ void SubsetPartition::save_partitionmap(string pmap_filename)
   HashIntoType * kmer_p = NULL;
   PartitionID * pp;
 
-  // For each tag in the partition map, save the tag and the associated
-  // partition ID.
+  // For each tag in a partition, save the tag and the associated
+  // partition ID, in tag order as before.
 
-  PartitionMap::const_iterator pi = partition_map.begin();
-  for (; pi != partition_map.end(); pi++) {
-    PartitionID p_id;
+  std::vector<unsigned int> indices;
+  _store.sorted_tags(indices);
 
-    HashIntoType kmer = pi->first;
-    if (pi->second != NULL) {	// if a partition ID has been assigned... save.
-      p_id = *(pi->second);
+  for (unsigned int j = 0; j < indices.size(); j++) {
+    unsigned int i = indices[j];
 
-      // each record consists of one tag followed by one PartitionID.
-      kmer_p = (HashIntoType *) (buf + n_bytes);
-      *kmer_p = kmer;
-      n_bytes += sizeof(HashIntoType);
+    // each record consists of one tag followed by one PartitionID.
+    kmer_p = (HashIntoType *) (buf + n_bytes);
+    *kmer_p = _store.tag(i);
+    n_bytes += sizeof(HashIntoType);
 
-      pp = (PartitionID *) (buf + n_bytes);
-      *pp = p_id;
-      n_bytes += sizeof(PartitionID);
+    pp = (PartitionID *) (buf + n_bytes);
+    *pp = _store.partition(i);
+    n_bytes += sizeof(PartitionID);
 
-      // flush to disk
-      if (n_bytes >= IO_BUF_SIZE - sizeof(HashIntoType) - sizeof(PartitionID)) {
-	outfile.write(buf, n_bytes);
-	n_bytes = 0;
-      }
+    // flush to disk
+    if (n_bytes >= IO_BUF_SIZE - sizeof(HashIntoType) - sizeof(PartitionID)) {
+      outfile.write(buf, n_bytes);
+      n_bytes = 0;
     }
   }
   // save remainder.
   if (n_bytes) {
     outfile.write(buf, n_bytes);
   }
+  outfile.end_section();
   outfile.close();
 
   delete buf;
@@ -889,30 +1153,27 @@ void SubsetPartition::load_partitionmap(string infilename)
 
 void SubsetPartition::_validate_pmap()
 {
-  for (PartitionMap::const_iterator pi = partition_map.begin();
-       pi != partition_map.end(); pi++) {
-    //HashIntoType kmer = (*pi).first;
-    PartitionID * pp_id = (*pi).second;
-
-    if (pp_id != NULL) {
-      assert(*pp_id >= 1);
-      assert(*pp_id < next_partition_id);
-    }
-  }
-
-  for (ReversePartitionMap::const_iterator ri = reverse_pmap.begin();
-       ri != reverse_pmap.end(); ri++) {
-    PartitionID p = (*ri).first;
-    PartitionPtrSet *s = (*ri).second;
+  std::vector<unsigned int> sizes(_store.n_indices(), 0);
 
-    assert(s != NULL);
+  for (unsigned int i = 0; i < _store.n_indices(); i++) {
+    unsigned int root = _store.find_root(i);
+    if (!_store.left_behind(i)) {
+      sizes[root]++;
+      assert(_store.find_tag(_store.tag(i)) == i);
+    }
 
-    for (PartitionPtrSet::const_iterator si = s->begin(); si != s->end();
-	 si++) {
-      PartitionID * pp;
-      pp = *si;
+    if (_store.is_root(i)) {
+      PartitionID p = _store.partition(i);
+      if (p != 0) {
+	assert(p < next_partition_id);
+	assert(_store.partition_root(p) == i);
+      }
+    }
+  }
 
-      assert (p == *pp);
+  for (unsigned int i = 0; i < _store.n_indices(); i++) {
+    if (_store.is_root(i)) {
+      assert(sizes[i] == _store.partition_size(i));
     }
   }
 }
@@ -921,17 +1182,7 @@ void SubsetPartition::_validate_pmap()
 
 void SubsetPartition::_clear_all_partitions()
 {
-  for (ReversePartitionMap::iterator ri = reverse_pmap.begin();
-       ri != reverse_pmap.end(); ri++) {
-    PartitionPtrSet * s = (*ri).second;
-
-    for (PartitionPtrSet::iterator pi = s->begin(); pi != s->end(); pi++) {
-      PartitionID * pp = (*pi);
-      delete pp;
-    }
-    delete s;
-  }
-  partition_map.clear();
+  _store.clear();
   next_partition_id = 1;
 }
 
@@ -945,17 +1196,15 @@ bool SubsetPartition::is_single_partition(std::string seq)
   HashIntoType kmer;
 
   PartitionSet partitions;
-  PartitionID *pp;
+  PartitionID p;
 
-  KMerIterator kmers(seq.c_str(), _ht->ksize());
+  KMerIterator kmers(seq.c_str(), _ht->ksize(), _ht->unique_rc());
   while (!kmers.done()) {
     kmer = kmers.next();
 
-    if (partition_map.find(kmer) != partition_map.end()) {
-      pp = partition_map[kmer];
-      if (pp) {
-	partitions.insert(*pp);
-      }
+    p = get_partition_id(kmer);
+    if (p) {
+      partitions.insert(p);
     }
   }
 
@@ -969,11 +1218,11 @@ void SubsetPartition::join_partitions_by_path(std::string seq)
   SeenSet tagged_kmers;
   HashIntoType kmer;
 
-  KMerIterator kmers(seq.c_str(), _ht->ksize());
+  KMerIterator kmers(seq.c_str(), _ht->ksize(), _ht->unique_rc());
 
   while(!kmers.done()) {
     kmer = kmers.next();
-    if (_ht->all_tags.find(kmer) != _ht->all_tags.end()) {
+    if (set_contains(_ht->all_tags, kmer)) {
       tagged_kmers.insert(kmer);
     }
   }
@@ -986,22 +1235,13 @@ void SubsetPartition::partition_size_distribution(PartitionCountDistribution &d,
 						  unsigned int& n_unassigned)
 const
 {
-  PartitionCountMap cm;
-  n_unassigned = 0;
+  n_unassigned = 0;		// tags in no partition are not kept.
 
-  for (PartitionMap::const_iterator pi = partition_map.begin();
-       pi != partition_map.end(); pi++) {
-    if (pi->second) {
-      cm[*(pi->second)]++;
-    } else {
-      n_unassigned++;
+  for (unsigned int i = 0; i < _store.n_indices(); i++) {
+    if (_store.is_root(i) && _store.partition(i)) {
+      d[_store.partition_size(i)]++;
     }
   }
-
-  for (PartitionCountMap::const_iterator cmi = cm.begin(); cmi != cm.end();
-       cmi++) {
-    d[cmi->second]++;
-  }
 }
 
 unsigned int SubsetPartition::repartition_largest_partition(unsigned int distance,
@@ -1009,7 +1249,6 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
 						    unsigned int frequency,
 						    CountingHash &counting)
 {
-  PartitionCountMap cm;
   unsigned int n_unassigned = 0;
   PartitionID biggest_p = 0;
   unsigned int next_largest = 0;
@@ -1018,23 +1257,9 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
   std::cout << "calculating partition size distribution.\n";
 #endif // 0
 
-  // first, count the number of members in each partition.
-  for (PartitionMap::const_iterator pi = partition_map.begin();
-       pi != partition_map.end(); pi++) {
-    if (pi->second) {
-      cm[*(pi->second)]++;
-    } else {
-      n_unassigned++;
-    }
-  }
-
-  // then, build the distribution.
+  // partition sizes are kept at the roots.
   PartitionCountDistribution d;
-
-  for (PartitionCountMap::const_iterator cmi = cm.begin(); cmi != cm.end();
-       cmi++) {
-    d[cmi->second]++;
-  }
+  partition_size_distribution(d, n_unassigned);
 
   // find biggest.
   PartitionCountDistribution::const_iterator di = d.end();
@@ -1042,10 +1267,11 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
 
   assert(d.size());
 
-  for (PartitionCountMap::const_iterator cmi = cm.begin(); cmi != cm.end();
-       cmi++) {
-    if (cmi->second == di->first) {
-      biggest_p = cmi->first;	// find PID of largest partition
+  // the highest PID of those that size, as before.
+  for (unsigned int i = 0; i < _store.n_indices(); i++) {
+    PartitionID p = _store.is_root(i) ? _store.partition(i) : 0;
+    if (p && _store.partition_size(i) == di->first && p > biggest_p) {
+      biggest_p = p;		// find PID of largest partition
     }
   }
   assert(biggest_p != 0);
@@ -1080,7 +1306,7 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
   unsigned int n = 0;
   unsigned int count;
   unsigned int n_big = 0;
-  SeenSet keeper;
+  GraphTraversal traversal(_ht);
 
   SeenSet::const_iterator si = bigtags.begin();
 
@@ -1093,17 +1319,17 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
     }
 #endif //0
 
-    count = _ht->traverse_from_kmer(*si, distance, keeper);
+    count = _ht->traverse_from_kmer(*si, distance, traversal);
 
     if (count >= threshold) {
       n_big++;
-	
-      SeenSet::const_iterator ti;
-      for (ti = keeper.begin(); ti != keeper.end(); ti++) {
-	if (counting.get_count(*ti) > frequency) {
-	  _ht->stop_tags.insert(*ti);
+
+      const std::vector<HashIntoType> &keeper = traversal.visited();
+      for (unsigned int j = 0; j < keeper.size(); j++) {
+	if (counting.get_count(keeper[j]) > frequency) {
+	  _ht->stop_tags.insert(keeper[j]);
 	} else {
-	  counting.count(*ti);
+	  counting.count(keeper[j]);
 	}
       }
 #if VERBOSE_REPARTITION
@@ -1117,7 +1343,6 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
       _ht->repart_small_tags.insert(*si);
 #endif //0
     }
-    keeper.clear();
 
     if (n % 1000 == 0) {
 #if VERBOSE_REPARTITION
@@ -1142,6 +1367,7 @@ unsigned int SubsetPartition::repartition_largest_partition(unsigned int distanc
 void SubsetPartition::repartition_a_partition(const SeenSet& partition_tags)
 {
   SeenSet tagged_kmers;
+  GraphTraversal traversal(_ht);
   std::string kmer_s;
   HashIntoType kmer_f, kmer_r, kmer;
   unsigned int ksize = _ht->ksize();
@@ -1157,10 +1383,11 @@ void SubsetPartition::repartition_a_partition(const SeenSet& partition_tags)
     }
 
     kmer_s = _revhash(*si, ksize); // @CTB hackity hack hack!
-    kmer = _hash(kmer_s.c_str(), ksize, kmer_f, kmer_r);
+    kmer = _ht->hash_kmer(kmer_s.c_str(), kmer_f, kmer_r);
 
     tagged_kmers.clear();
-    find_all_tags(kmer_f, kmer_r, tagged_kmers, _ht->all_tags, true, false);
+    find_all_tags(kmer_f, kmer_r, tagged_kmers, _ht->all_tags, true, false,
+		  traversal);
 
     // only join things already in bigtags.
     for (SeenSet::iterator ssi = tagged_kmers.begin();
@@ -1181,26 +1408,5 @@ void SubsetPartition::repartition_a_partition(const SeenSet& partition_tags)
 void SubsetPartition::_clear_partition(PartitionID the_partition,
 				       SeenSet& partition_tags)
 {
-  partition_tags.clear();
-
-  for (PartitionMap::iterator pi = partition_map.begin();
-       pi != partition_map.end(); pi++) {
-    if (pi->second && *(pi->second) == the_partition) {
-      partition_tags.insert(pi->first);
-    }
-  }
-
-  for (SeenSet::const_iterator si = partition_tags.begin();
-       si != partition_tags.end(); si++) {
-    partition_map.erase(*si);
-  }
-
-  // clear out the reverse partition mapping, too.
-  PartitionPtrSet * ps = reverse_pmap[the_partition];
-  for (PartitionPtrSet::iterator psi = ps->begin(); psi != ps->end(); psi++) {
-    delete *psi;
-  }
-  delete ps;
-
-  reverse_pmap.erase(the_partition);
+  _store.clear_partition(the_partition, partition_tags);
 }
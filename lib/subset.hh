@@ -2,25 +2,133 @@
 #define SUBSET_HH
 
 #include "hashtable.hh"
+#include "tagset.hh"
+
+#define NO_TAG_INDEX ((unsigned int) -1)
+#define ROOT_LINK 0x80000000U	// a root's link: this, and its partition.
 
 namespace khmer {
   class CountingHash;
   class Hashbits;
+  class GraphTraversal;
+
+  //
+  // PartitionStore: which partition each tag is in, as a disjoint-set
+  // forest over dense tag indices, with path halving and union by size.
+  // Each index has one link: its parent's index, or, at a root,
+  // ROOT_LINK with the set's partition ID (0 if it isn't in one; then
+  // the tag is alone in its set).  Sizes are kept by partition ID.
+  //
+  // Tags are found by open addressing into the index.  A tag can't be
+  // taken out of the middle of a set, so detach() leaves its old index
+  // behind, still linking the rest of the set, and gives it a new one.
+  //
+  // That is 12 bytes per index (the tag and its link), and 5 to 11 for
+  // its slot, the slots being 3/8 to 3/4 full: 17 to 23 bytes per tag,
+  // plus 8 for each partition ID handed out.  The tag and link are all
+  // a tag needs, so any way of finding it costs more than that; and
+  // the roots and sizes kept by ID, not in the root's link, are what
+  // let set_partition_id() (once a read, on loading) find a partition,
+  // and tell an emptied partition from one that is still there.
+  //
+
+  class PartitionStore {
+  protected:
+    std::vector<HashIntoType> _tags;	// by index.
+    std::vector<bool> _left_behind;	// by detach(); its tag has moved on.
+    mutable std::vector<unsigned int> _links;	// by index.
+    std::vector<unsigned int> _roots;	// by PartitionID.
+    std::vector<unsigned int> _sizes;	// tags in the set; by PartitionID.
+    std::vector<unsigned int> _slots;	// index + 1, or 0 if empty.
+
+    unsigned long long _slot_for(HashIntoType tag) const;
+    unsigned int _new_index(HashIntoType tag);
+    void _grow_slots();
+  public:
+    PartitionStore() { clear(); }
+
+    void clear();
+
+    // all indices, including those left behind by detach().
+    unsigned int n_indices() const { return _tags.size(); }
+
+    HashIntoType tag(unsigned int i) const { return _tags[i]; }
+
+    // left behind by detach(), and holding no tag; any tag can be
+    // stored, NO_TAG included.
+    bool left_behind(unsigned int i) const { return _left_behind[i]; }
+
+    // the tag's index, or NO_TAG_INDEX.
+    unsigned int find_tag(HashIntoType tag) const;
+
+    // the tag's index, adding it (in no partition) if need be.
+    unsigned int add_tag(HashIntoType tag);
+
+    bool is_root(unsigned int i) const { return _links[i] & ROOT_LINK; }
+
+    unsigned int find_root(unsigned int i) const {
+      while (!is_root(i)) {
+	unsigned int parent = _links[i];
+	if (!is_root(parent)) {
+	  _links[i] = _links[parent];
+	}
+	i = _links[i];
+      }
+      return i;
+    }
+
+    PartitionID partition(unsigned int i) const {
+      return _links[find_root(i)] & ~ROOT_LINK;
+    }
+
+    // tags in the partition; O(1), given its root.
+    unsigned int partition_size(unsigned int root) const {
+      PartitionID p = _links[root] & ~ROOT_LINK;
+      if (p == 0) {
+	return _left_behind[root] ? 0 : 1;
+      }
+      return _sizes[p];
+    }
+
+    // the root of partition p, or NO_TAG_INDEX.
+    unsigned int partition_root(PartitionID p) const {
+      return p < _roots.size() ? _roots[p] : NO_TAG_INDEX;
+    }
+
+    // put i, which must be in no partition, into a new partition p.
+    void set_partition(unsigned int i, PartitionID p);
+
+    // join two sets, at least one of them in a partition; returns the
+    // new root.  The bigger set keeps its partition ID (the first, if
+    // they're the same size).
+    unsigned int join(unsigned int a, unsigned int b);
+
+    // take i's tag out of its partition; returns its new index.
+    unsigned int detach(unsigned int i);
+
+    // dissolve partition p, leaving its tags in none; tags gets them.
+    void clear_partition(PartitionID p, SeenSet& tags);
+
+    // the indices of tags that are in a partition, sorted by tag.
+    void sorted_tags(std::vector<unsigned int>& indices) const;
+  };
 
   class SubsetPartition {
     friend class Hashbits;
   protected:
     unsigned int next_partition_id;
     Hashbits * _ht;
-    PartitionMap partition_map;
-    ReversePartitionMap reverse_pmap;
+    PartitionStore _store;
 
     void _clear_all_partitions();
 
-    PartitionID * _merge_two_partitions(PartitionID *orig_pp,
-					PartitionID *new_pp);
-    PartitionID * _join_partitions_by_tags(const SeenSet& tagged_kmers,
-					   const HashIntoType kmer);
+    PartitionID _new_partition(unsigned int i) {
+      _store.set_partition(i, next_partition_id);
+      return next_partition_id++;
+    }
+
+    PartitionID _join_partitions_by_tags(const SeenSet& tagged_kmers,
+					 const HashIntoType kmer);
 
   public:
     SubsetPartition(Hashbits * ht) : next_partition_id(2), _ht(ht) {
@@ -37,15 +145,8 @@ namespace khmer {
     PartitionID get_partition_id(std::string kmer_s);
     PartitionID get_partition_id(HashIntoType kmer);
 
-    PartitionID * get_new_partition() {
-      PartitionID* pp = new PartitionID(next_partition_id);
-      next_partition_id++;
-      return pp;
-    }
-
     void merge(SubsetPartition *);
     void merge_from_disk(std::string);
-    void _merge_from_disk_consolidate(PartitionPtrMap&);
 
     void save_partitionmap(std::string outfile);
     void load_partitionmap(std::string infile);
@@ -53,9 +154,15 @@ namespace khmer {
 
     void find_all_tags(HashIntoType kmer_f, HashIntoType kmer_r,
 		       SeenSet& tagged_kmers,
-		       const SeenSet& all_tags,
+		       const TagSet& all_tags,
 		       bool break_on_stop_tags=false,
 		       bool stop_big_traversals=false);
+    void find_all_tags(HashIntoType kmer_f, HashIntoType kmer_r,
+		       SeenSet& tagged_kmers,
+		       const TagSet& all_tags,
+		       bool break_on_stop_tags,
+		       bool stop_big_traversals,
+		       GraphTraversal& traversal);
 
     void do_partition(HashIntoType first_kmer,
 		      HashIntoType last_kmer,
@@ -64,6 +171,12 @@ namespace khmer {
 		      CallbackFn callback=0,
 		      void * callback_data=0);
 
+    // do_partition over all the tags, searching from them in n_threads
+    // threads; the result is the same however many there are.
+    void parallel_partition(unsigned int n_threads,
+			    bool break_on_stop_tags=false,
+			    bool stop_big_traversals=false);
+
     void count_partitions(unsigned int& n_partitions,
 			  unsigned int& n_unassigned);
 
@@ -94,7 +207,7 @@ namespace khmer {
 
     void _merge_other(HashIntoType tag,
 		      PartitionID other_partition,
-		      PartitionPtrMap& diskp_to_pp);
+		      PartitionIndexMap& diskp_to_index);
   };
 }
 
@@ -0,0 +1,113 @@
+#include "tagset.hh"
+
+#include <algorithm>
+
+#define MIN_TAG_SLOTS 1024
+
+using namespace std;
+using namespace khmer;
+
+void TagSet::clear()
+{
+  _slots.assign(MIN_TAG_SLOTS, NO_TAG);
+  _size = 0;
+  _has_no_tag = false;
+
+  std::vector<HashIntoType>().swap(_sorted);
+  _n_sorted = 0;
+  _sorted_made = false;
+}
+
+void TagSet::_rehash(unsigned long long n_slots)
+{
+  std::vector<HashIntoType> old_slots(n_slots, NO_TAG);
+  _slots.swap(old_slots);
+
+  for (unsigned long long i = 0; i < old_slots.size(); i++) {
+    if (old_slots[i] != NO_TAG) {
+      _slots[_slot_for(old_slots[i])] = old_slots[i];
+    }
+  }
+}
+
+void TagSet::reserve(unsigned long long n)
+{
+  unsigned long long n_slots = _slots.size();
+  while (n * 4 > n_slots * 3) {
+    n_slots *= 2;
+  }
+
+  if (n_slots != _slots.size()) {
+    _rehash(n_slots);
+  }
+}
+
+bool TagSet::insert(HashIntoType tag)
+{
+  if (tag == NO_TAG) {
+    if (_has_no_tag) {
+      return false;
+    }
+    _has_no_tag = true;
+  } else {
+    unsigned long long pos = _slot_for(tag);
+    if (_slots[pos] == tag) {
+      return false;
+    }
+
+    if ((_size + 1) * 4 > _slots.size() * 3) {
+      _rehash(_slots.size() * 2);
+      pos = _slot_for(tag);
+    }
+    _slots[pos] = tag;
+  }
+
+  _size++;
+  if (_sorted_made) {
+    _sorted.push_back(tag);
+  }
+
+  return true;
+}
+
+const std::vector<HashIntoType>& TagSet::sorted() const
+{
+  if (!_sorted_made) {
+    _sorted.reserve(_size);
+    for (unsigned long long i = 0; i < _slots.size(); i++) {
+      if (_slots[i] != NO_TAG) {
+	_sorted.push_back(_slots[i]);
+      }
+    }
+    if (_has_no_tag) {
+      _sorted.push_back(NO_TAG);
+    }
+    _sorted_made = true;
+  }
+
+  // sort only what was added since last time, and merge it in.
+  if (_n_sorted < _sorted.size()) {
+    std::vector<HashIntoType>::iterator middle = _sorted.begin() + _n_sorted;
+    std::sort(middle, _sorted.end());
+    std::inplace_merge(_sorted.begin(), middle, _sorted.end());
+    _n_sorted = _sorted.size();
+  }
+
+  return _sorted;
+}
+
+TagSet::const_iterator TagSet::lower_bound(HashIntoType tag) const
+{
+  const std::vector<HashIntoType>& tags = sorted();
+  return std::lower_bound(tags.begin(), tags.end(), tag);
+}
+
+void TagSet::swap(TagSet &other)
+{
+  _slots.swap(other._slots);
+  std::swap(_size, other._size);
+  std::swap(_has_no_tag, other._has_no_tag);
+  _sorted.swap(other._sorted);
+  std::swap(_n_sorted, other._n_sorted);
+  std::swap(_sorted_made, other._sorted_made);
+}
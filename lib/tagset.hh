@@ -0,0 +1,97 @@
+#ifndef TAGSET_HH
+#define TAGSET_HH
+
+#include <vector>
+
+#include "khmer.hh"
+
+#define NO_TAG ((HashIntoType) -1)	// never a canonical k-mer.
+
+namespace khmer {
+  // tags are k-mers, not hashes; mix the bits before using them as one.
+  inline unsigned long long _mix_tag(HashIntoType tag) {
+    tag ^= tag >> 33;
+    tag *= 0xff51afd7ed558ccdULL;
+    tag ^= tag >> 33;
+    return tag;
+  }
+
+  //
+  // TagSet: a set of tags, by open addressing with linear probing into
+  // a power-of-two table that is kept at most 3/4 full.  That is 11-21
+  // bytes a tag, where a SeenSet takes about 48, and a lookup is one
+  // or two cache misses instead of a walk down a tree.  Empty slots
+  // hold NO_TAG, so that tag, should it ever turn up, is kept apart.
+  //
+  // Iteration is in sorted order, as with a SeenSet, over a sorted copy
+  // of the tags, which is another 8 bytes a tag: 19-29 in all, once it
+  // has been made.  It is made on first use, and then kept: tags added
+  // later are put at its end, and on next use only they are sorted, and
+  // merged in.  Bringing it up to date is not thread-safe, so threads
+  // that share a TagSet should have it done (with sorted()) before they
+  // start.  clear() frees it.
+  //
+
+  class TagSet {
+  protected:
+    std::vector<HashIntoType> _slots;
+    unsigned long long _size;
+    bool _has_no_tag;
+
+    // all the tags once made, the first _n_sorted of them in order.
+    mutable std::vector<HashIntoType> _sorted;
+    mutable unsigned long long _n_sorted;
+    mutable bool _sorted_made;
+
+    // the slot holding tag, or the empty one where it would go.
+    unsigned long long _slot_for(HashIntoType tag) const {
+      const unsigned long long mask = _slots.size() - 1;
+      unsigned long long pos = _mix_tag(tag) & mask;
+
+      while (_slots[pos] != tag && _slots[pos] != NO_TAG) {
+	pos = (pos + 1) & mask;
+      }
+      return pos;
+    }
+
+    void _rehash(unsigned long long n_slots);
+  public:
+    typedef std::vector<HashIntoType>::const_iterator const_iterator;
+
+    TagSet() { clear(); }
+
+    unsigned long long size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    void clear();
+
+    // make room for n tags in all.
+    void reserve(unsigned long long n);
+
+    // true if the tag is new.
+    bool insert(HashIntoType tag);
+
+    bool contains(HashIntoType tag) const {
+      if (tag == NO_TAG) {
+	return _has_no_tag;
+      }
+      return _slots[_slot_for(tag)] == tag;
+    }
+
+    const std::vector<HashIntoType>& sorted() const;
+
+    const_iterator begin() const { return sorted().begin(); }
+    const_iterator end() const { return sorted().end(); }
+
+    // the first tag that is not less than this one.
+    const_iterator lower_bound(HashIntoType tag) const;
+
+    void swap(TagSet &other);
+  };
+
+  inline bool set_contains(const TagSet &s, HashIntoType tag) {
+    return s.contains(tag);
+  }
+};
+
+#endif // TAGSET_HH
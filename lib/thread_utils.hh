@@ -0,0 +1,56 @@
+#ifndef THREAD_UTILS_HH
+#define THREAD_UTILS_HH
+
+#include <pthread.h>
+#include <assert.h>
+
+//
+// Thin wrappers around pthread mutexes and condition variables.
+//
+
+namespace khmer {
+  class Mutex {
+    friend class Condition;
+  protected:
+    pthread_mutex_t _mutex;
+  public:
+    Mutex() { pthread_mutex_init(&_mutex, NULL); }
+    ~Mutex() { pthread_mutex_destroy(&_mutex); }
+
+    void lock() { pthread_mutex_lock(&_mutex); }
+    void unlock() { pthread_mutex_unlock(&_mutex); }
+  private:
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+  };
+
+  // holds a Mutex for the lifetime of the object.
+  class ScopedLock {
+  protected:
+    Mutex& _mutex;
+  public:
+    ScopedLock(Mutex& m) : _mutex(m) { _mutex.lock(); }
+    ~ScopedLock() { _mutex.unlock(); }
+  private:
+    ScopedLock(const ScopedLock&);
+    ScopedLock& operator=(const ScopedLock&);
+  };
+
+  class Condition {
+  protected:
+    pthread_cond_t _cond;
+  public:
+    Condition() { pthread_cond_init(&_cond, NULL); }
+    ~Condition() { pthread_cond_destroy(&_cond); }
+
+    // the caller must hold 'm'.
+    void wait(Mutex& m) { pthread_cond_wait(&_cond, &m._mutex); }
+    void signal() { pthread_cond_signal(&_cond); }
+    void broadcast() { pthread_cond_broadcast(&_cond); }
+  private:
+    Condition(const Condition&);
+    Condition& operator=(const Condition&);
+  };
+}
+
+#endif // THREAD_UTILS_HH
@@ -0,0 +1,361 @@
+#include "traversal.hh"
+#include "hashbits.hh"
+
+#include <algorithm>
+#include <unistd.h>
+
+#define MIN_VISITED_SLOTS 1024
+#define MIN_FRONTIER_COMPACT 4096	// nodes taken before it's worth it.
+#define MIN_PARALLEL_LEVEL 4096		// nodes, for threads to be worth it.
+#define MAX_TRAVERSAL_THREADS 16
+
+using namespace std;
+using namespace khmer;
+
+static unsigned int _n_cpus()
+{
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n = n_cpus > 1 ? n_cpus : 1;
+  return n > MAX_TRAVERSAL_THREADS ? MAX_TRAVERSAL_THREADS : n;
+}
+
+GraphTraversal::GraphTraversal(const Hashtable * ht) :
+  _ht(ht), _slots(MIN_VISITED_SLOTS, NO_TAG), _visited_no_tag(false),
+  _head(0), _n_visited(0), _volume_exceeded(false),
+  _n_levels(0), _n_busy(0), _stopping(false), stop_tags(NULL),
+  max_depth(NO_DEPTH_LIMIT), max_volume(0)
+{
+  const unsigned int ksize = ht->ksize();
+
+  n_threads = ht->traversal_threads();
+  if (n_threads == 0) {
+    n_threads = _n_cpus();
+  }
+
+  _bitmask = 0;
+  for (unsigned int i = 0; i < ksize; i++) {
+    _bitmask = (_bitmask << 2) | 3;
+  }
+  _rc_left_shift = ksize*2 - 2;
+}
+
+void GraphTraversal::reset()
+{
+  // if there are few of them, empty just the runs of slots they're in;
+  // emptying only their own slots would cut the runs short, hiding the
+  // k-mers further along.
+  if (_visited.size() * 8 < _slots.size()) {
+    const unsigned long long mask = _slots.size() - 1;
+
+    for (unsigned long long i = 0; i < _visited.size(); i++) {
+      if (_visited[i] == NO_TAG) {
+	continue;
+      }
+      unsigned long long pos = _mix_tag(_visited[i]) & mask;
+      while (_slots[pos] != NO_TAG) {
+	_slots[pos] = NO_TAG;
+	pos = (pos + 1) & mask;
+      }
+    }
+  } else {
+    std::fill(_slots.begin(), _slots.end(), NO_TAG);
+  }
+  _visited_no_tag = false;
+  _visited.clear();
+
+  _frontier.clear();
+  _head = 0;
+  _n_visited = 0;
+  _volume_exceeded = false;
+}
+
+void GraphTraversal::_grow_slots()
+{
+  std::vector<HashIntoType> old_slots(_slots.size() * 2, NO_TAG);
+  _slots.swap(old_slots);
+
+  for (unsigned long long i = 0; i < old_slots.size(); i++) {
+    if (old_slots[i] != NO_TAG) {
+      _slots[_slot_for(old_slots[i])] = old_slots[i];
+    }
+  }
+}
+
+bool GraphTraversal::mark_visited(HashIntoType kmer)
+{
+  // all ones, which a forward-strand k = 32 k-mer can be.
+  if (kmer == NO_TAG) {
+    if (_visited_no_tag) {
+      return false;
+    }
+    _visited_no_tag = true;
+    _visited.push_back(kmer);
+    return true;
+  }
+
+  unsigned long long pos = _slot_for(kmer);
+  if (_slots[pos] == kmer) {
+    return false;
+  }
+
+  if ((_visited.size() + 1) * 4 > _slots.size() * 3) {
+    _grow_slots();
+    pos = _slot_for(kmer);
+  }
+  _slots[pos] = kmer;
+  _visited.push_back(kmer);
+
+  return true;
+}
+
+void GraphTraversal::_neighbors(const TraversalNode &node,
+				TraversalNode neighbors[8],
+				HashIntoType kmers[8]) const
+{
+  const HashIntoType bitmask = _bitmask;
+  const unsigned int rc_left_shift = _rc_left_shift;
+  const char bases[] = "ACGT";
+
+  // next, then previous.
+  for (unsigned int i = 0; i < 4; i++) {
+    neighbors[i].f = next_f(node.f, bases[i]);
+    neighbors[i].r = next_r(node.r, bases[i]);
+
+    neighbors[4 + i].r = prev_r(node.r, bases[i]);
+    neighbors[4 + i].f = prev_f(node.f, bases[i]);
+  }
+  for (unsigned int i = 0; i < 8; i++) {
+    neighbors[i].depth = node.depth + 1;
+    kmers[i] = _ht->uniqify_rc(neighbors[i].f, neighbors[i].r);
+  }
+}
+
+unsigned char GraphTraversal::_present(const HashIntoType kmers[8]) const
+{
+  // look up all eight at once.
+  BoundedCounterType counts[8];
+  _ht->get_counts(kmers, 8, counts);
+
+  unsigned char present = 0;
+  for (unsigned int i = 0; i < 8; i++) {
+    if (counts[i]) {
+      present |= 1 << i;
+    }
+  }
+  return present;
+}
+
+void GraphTraversal::_push_neighbors(const TraversalNode &node,
+				     unsigned long long i)
+{
+  TraversalNode neighbors[8];
+  HashIntoType kmers[8];
+  _neighbors(node, neighbors, kmers);
+
+  const unsigned char present =
+    _level_found ? _found[i - _level_start] : _present(kmers);
+
+  for (unsigned int j = 0; j < 8; j++) {
+    if ((present & (1 << j)) && !is_visited(kmers[j])) {
+      _frontier.push_back(neighbors[j]);
+    }
+  }
+}
+
+//
+// _find_level: look up the neighbors of every node in the level -- the
+//    Bloom lookups are nearly all of the work in a big one -- in
+//    n_threads threads, each taking a run of nodes.  The visited set is
+//    only read, so the level can then be walked in order as usual, and
+//    it all comes out the same as it would in one thread.
+//
+
+void GraphTraversal::_find_share(unsigned int share)
+{
+  const unsigned long long n = _level_end - _level_start;
+  const unsigned long long start = _level_start + n * share / n_threads;
+  const unsigned long long end = _level_start + n * (share + 1) / n_threads;
+
+  TraversalNode neighbors[8];
+  HashIntoType kmers[8];
+
+  for (unsigned long long i = start; i < end; i++) {
+    const TraversalNode &node = _frontier[i];
+    const HashIntoType kmer = _ht->uniqify_rc(node.f, node.r);
+    unsigned char &present = _found[i - _level_start];
+
+    // skip what won't be expanded.
+    if (node.depth >= max_depth || is_visited(kmer) ||
+	(stop_tags && set_contains(*stop_tags, kmer))) {
+      present = 0;
+      continue;
+    }
+
+    _neighbors(node, neighbors, kmers);
+    present = _present(kmers);
+  }
+}
+
+namespace khmer {
+  struct _PoolWorkerArg {
+    GraphTraversal * traversal;
+    unsigned int share;
+  };
+}
+
+void * GraphTraversal::_pool_worker(void * arg)
+{
+  _PoolWorkerArg * worker = (_PoolWorkerArg *) arg;
+  GraphTraversal * t = worker->traversal;
+  const unsigned int share = worker->share;
+  delete worker;
+
+  unsigned long long n_levels = 0;
+
+  t->_pool_lock.lock();
+  while (1) {
+    while (!t->_stopping && t->_n_levels == n_levels) {
+      t->_level_ready.wait(t->_pool_lock);
+    }
+    if (t->_stopping) {
+      break;
+    }
+    n_levels = t->_n_levels;
+
+    t->_pool_lock.unlock();
+    t->_find_share(share);
+    t->_pool_lock.lock();
+
+    if (--t->_n_busy == 0) {
+      t->_level_done.signal();
+    }
+  }
+  t->_pool_lock.unlock();
+
+  return NULL;
+}
+
+void GraphTraversal::_start_workers()
+{
+  for (unsigned int i = 1; i < n_threads; i++) {
+    _PoolWorkerArg * worker = new _PoolWorkerArg;
+    worker->traversal = this;
+    worker->share = i;
+
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, _pool_worker, worker);
+    assert(ret == 0);
+    _workers.push_back(thread);
+  }
+}
+
+void GraphTraversal::_stop_workers()
+{
+  if (_workers.empty()) {
+    return;
+  }
+
+  {
+    ScopedLock lock(_pool_lock);
+    _stopping = true;
+    _level_ready.broadcast();
+  }
+  for (unsigned int i = 0; i < _workers.size(); i++) {
+    pthread_join(_workers[i], NULL);
+  }
+  _workers.clear();
+  _stopping = false;
+}
+
+void GraphTraversal::_find_level()
+{
+  _found.resize(_level_end - _level_start);
+
+  if (_workers.empty()) {
+    _start_workers();
+  }
+
+  {
+    ScopedLock lock(_pool_lock);
+    _n_busy = _workers.size();
+    _n_levels++;
+    _level_ready.broadcast();
+  }
+
+  _find_share(0);
+
+  ScopedLock lock(_pool_lock);
+  while (_n_busy) {
+    _level_done.wait(_pool_lock);
+  }
+}
+
+unsigned long long GraphTraversal::traverse(HashIntoType kmer_f,
+					    HashIntoType kmer_r,
+					    TraversalVisitor * visitor)
+{
+  _frontier.clear();
+  _head = 0;
+  _level_start = _level_end = 0;
+  _level_found = false;
+  _n_visited = 0;
+  _volume_exceeded = false;
+
+  TraversalNode start = { kmer_f, kmer_r, 0 };
+  _frontier.push_back(start);
+
+  while (_head < _frontier.size()) {
+    if (max_volume && _n_visited > max_volume) {
+      _volume_exceeded = true;
+      break;
+    }
+
+    // a new level: everything queued now is one deeper than the last.
+    if (_head == _level_end) {
+      // drop the nodes already taken, rather than growing without end.
+      if (_head >= MIN_FRONTIER_COMPACT && _head * 2 >= _frontier.size()) {
+	_frontier.erase(_frontier.begin(), _frontier.begin() + _head);
+	_head = 0;
+      }
+
+      _level_start = _head;
+      _level_end = _frontier.size();
+      _level_found = n_threads > 1 &&
+	_level_end - _level_start >= MIN_PARALLEL_LEVEL;
+      if (_level_found) {
+	_find_level();
+      }
+    }
+
+    const unsigned long long i = _head++;
+    const TraversalNode node = _frontier[i];
+    const HashIntoType kmer = _ht->uniqify_rc(node.f, node.r);
+
+    if (stop_tags && set_contains(*stop_tags, kmer)) {
+      continue;
+    }
+    if (!mark_visited(kmer)) {
+      continue;
+    }
+    _n_visited++;
+
+    if (visitor) {
+      TraversalVisitor::Action action = visitor->visit(kmer, node);
+      if (action == TraversalVisitor::STOP) {
+	break;
+      }
+      if (action == TraversalVisitor::DONT_EXPAND) {
+	continue;
+      }
+    }
+
+    if (node.depth >= max_depth) {
+      continue;
+    }
+
+    _push_neighbors(node, i);
+  }
+
+  _stop_workers();
+  return _n_visited;
+}
@@ -0,0 +1,161 @@
+#ifndef TRAVERSAL_HH
+#define TRAVERSAL_HH
+
+#include <vector>
+
+#include "khmer.hh"
+#include "tagset.hh"
+#include "thread_utils.hh"
+
+#define NO_DEPTH_LIMIT ((unsigned int) -1)
+
+namespace khmer {
+  class Hashtable;
+
+  // a k-mer waiting on the frontier, and how far it is from the start.
+  struct TraversalNode {
+    HashIntoType f, r;
+    unsigned int depth;
+  };
+
+  // what a traversal does with each k-mer it reaches; see traverse().
+  class TraversalVisitor {
+  public:
+    enum Action {
+      EXPAND,			// go on to its neighbors.
+      DONT_EXPAND,		// search no further in this direction.
+      STOP			// end the traversal here.
+    };
+
+    virtual ~TraversalVisitor() { }
+
+    virtual Action visit(HashIntoType kmer, const TraversalNode &node) = 0;
+  };
+
+  //
+  // GraphTraversal: breadth-first search over the k-mers present in a
+  // hashtable, with everything a search needs -- the set of visited
+  // k-mers, open addressed like a TagSet, and the frontier, one array
+  // of {f, r, depth} records -- kept from one search to the next, so a
+  // thread that holds on to one allocates nothing once it has grown.
+  //
+  // The visited set lasts until reset(), so searches can be chained,
+  // each one steering around what the ones before it saw.
+  //
+  // Once a level of the search gets big, its neighbors are looked up in
+  // n_threads threads (set from the hashtable's traversal_threads(),
+  // which is 1 unless changed), with the same result as in one.  The
+  // threads are started on the first such level, and kept until the
+  // search ends.
+  //
+  // Not thread-safe; use one per thread.
+  //
+
+  class GraphTraversal {
+  protected:
+    const Hashtable * _ht;
+    HashIntoType _bitmask;
+    unsigned int _rc_left_shift;
+
+    std::vector<HashIntoType> _slots;	// NO_TAG if empty.
+    bool _visited_no_tag;		// so that k-mer is kept apart.
+    std::vector<HashIntoType> _visited;	// in the order they were visited.
+
+    std::vector<TraversalNode> _frontier;
+    unsigned long long _head;		// the next node to take.
+
+    // the level being taken, and, if it was big enough to look up in
+    // parallel, which neighbors each of its nodes has; see _find_level.
+    unsigned long long _level_start;
+    unsigned long long _level_end;
+    bool _level_found;
+    std::vector<unsigned char> _found;
+
+    unsigned long long _n_visited;	// by the last traverse().
+    bool _volume_exceeded;
+
+    // the slot holding kmer, or the empty one where it would go.
+    unsigned long long _slot_for(HashIntoType kmer) const {
+      const unsigned long long mask = _slots.size() - 1;
+      unsigned long long pos = _mix_tag(kmer) & mask;
+
+      while (_slots[pos] != kmer && _slots[pos] != NO_TAG) {
+	pos = (pos + 1) & mask;
+      }
+      return pos;
+    }
+
+    void _grow_slots();
+
+    void _neighbors(const TraversalNode &node, TraversalNode neighbors[8],
+		    HashIntoType kmers[8]) const;
+    // which of the eight are in the hashtable, as bits.
+    unsigned char _present(const HashIntoType kmers[8]) const;
+    // queue the unvisited neighbors of node, the i'th in the frontier.
+    void _push_neighbors(const TraversalNode &node, unsigned long long i);
+
+    // the workers, n_threads - 1 of them; this thread is the other.
+    std::vector<pthread_t> _workers;
+    Mutex _pool_lock;
+    Condition _level_ready;		// or time to stop.
+    Condition _level_done;
+    unsigned long long _n_levels;	// handed to the workers so far.
+    unsigned int _n_busy;		// workers still on this level.
+    bool _stopping;
+
+    void _find_level();
+    // look up the neighbors of share i of the level's nodes.
+    void _find_share(unsigned int i);
+    void _start_workers();
+    void _stop_workers();
+    static void * _pool_worker(void * arg);
+  public:
+    // stop conditions, kept until changed.
+    const TagSet * stop_tags;		// never entered; or NULL.
+    unsigned int max_depth;		// visited, but not expanded, this deep.
+    unsigned long long max_volume;	// stop once more are visited; 0 for no limit.
+
+    // threads for looking up a big level's neighbors; see _find_level.
+    unsigned int n_threads;
+
+    GraphTraversal(const Hashtable * ht);
+    ~GraphTraversal() { _stop_workers(); }
+
+    // forget every visited k-mer; keeps the memory.
+    void reset();
+
+    void set_limits(const TagSet * stops, unsigned int depth,
+		    unsigned long long volume) {
+      stop_tags = stops;
+      max_depth = depth;
+      max_volume = volume;
+    }
+
+    bool is_visited(HashIntoType kmer) const {
+      if (kmer == NO_TAG) {
+	return _visited_no_tag;
+      }
+      return _slots[_slot_for(kmer)] == kmer;
+    }
+
+    // mark kmer as visited; true if it wasn't already.
+    bool mark_visited(HashIntoType kmer);
+
+    // search outward from kmer_f/kmer_r, passing each newly visited
+    // k-mer to the visitor (if any).  Neighbors are queued only if they
+    // are present in the hashtable; the start k-mer is taken regardless.
+    // Returns the number of k-mers visited.
+    unsigned long long traverse(HashIntoType kmer_f, HashIntoType kmer_r,
+				TraversalVisitor * visitor = 0);
+
+    unsigned long long n_visited() const { return _n_visited; }
+
+    // did the last traverse() stop because it passed max_volume?
+    bool volume_exceeded() const { return _volume_exceeded; }
+
+    // everything visited since reset(), in order.
+    const std::vector<HashIntoType>& visited() const { return _visited; }
+  };
+};
+
+#endif // TRAVERSAL_HH
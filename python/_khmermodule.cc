@@ -10,7 +10,10 @@
 #include "hashtable.hh"
 #include "hashbits.hh"
 #include "counting.hh"
+#include "blocked.hh"
 #include "storage.hh"
+#include "parsers.hh"
+#include "savedfile.hh"
 
 //
 // Function necessary for Python loading:
@@ -33,6 +36,21 @@ public:
   _khmer_signal(std::string message) : _khmer_exception(message) { };
 };
 
+// report a ParserError, from a corrupt or truncated input file, as an
+// IOError.
+
+static PyObject * _parser_error(const ParserError &e)
+{
+  PyErr_SetString(PyExc_IOError, e.get_message().c_str());
+  return NULL;
+}
+
+static PyObject * _saved_file_error(const khmer::SavedFileError &e)
+{
+  PyErr_SetString(PyExc_IOError, e.get_message().c_str());
+  return NULL;
+}
+
 class _pre_partition_info {
 public:
   khmer::HashIntoType kmer;
@@ -679,6 +697,21 @@ static PyObject * hash_n_occupied(PyObject * self, PyObject * args)
   return PyInt_FromLong(n);
 }
 
+static PyObject * hash_clear(PyObject * self, PyObject * args)
+{
+  khmer_KCountingHashObject * me = (khmer_KCountingHashObject *) self;
+  khmer::CountingHash * counting = me->counting;
+
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  counting->clear();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
 static PyObject * hash_n_entries(PyObject * self, PyObject * args)
 {
   khmer_KCountingHashObject * me = (khmer_KCountingHashObject *) self;
@@ -725,7 +758,11 @@ static PyObject * hash_output_fasta_kmer_pos_freq(PyObject * self, PyObject *arg
     return NULL;
   }
 
-  counting->output_fasta_kmer_pos_freq(infile, outfile);
+  try {
+    counting->output_fasta_kmer_pos_freq(infile, outfile);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 
   return PyInt_FromLong(0);
 }
@@ -761,6 +798,8 @@ static PyObject * hash_fasta_file_to_minmax(PyObject * self, PyObject *args)
 					  _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
   
   khmer_MinMaxObject * minmax_obj = (khmer_MinMaxObject *) \
@@ -809,6 +848,8 @@ static PyObject * hash_filter_fasta_file_limit_n(PyObject * self, PyObject *args
                                                 _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   khmer_ReadMaskObject * readmask_obj = (khmer_ReadMaskObject *) \
@@ -952,6 +993,8 @@ static PyObject * hash_filter_fasta_file_run(PyObject * self, PyObject *args)
 						_report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   khmer_ReadMaskObject * readmask_obj = (khmer_ReadMaskObject *) \
@@ -972,13 +1015,22 @@ static PyObject * hash_consume_fasta(PyObject * self, PyObject * args)
   PyObject * update_readmask_bool = NULL;
   khmer::HashIntoType lower_bound = 0, upper_bound = 0;
   PyObject * callback_obj = NULL;
+  int n_threads = 1;
+  PyObject * staged_bool = NULL;
 
-  if (!PyArg_ParseTuple(args, "s|iiOOO", &filename, &lower_bound, &upper_bound,
-			&readmask_obj, &update_readmask_bool,
-			&callback_obj)) {
+  if (!PyArg_ParseTuple(args, "s|iiOOOiO", &filename, &lower_bound,
+			&upper_bound, &readmask_obj, &update_readmask_bool,
+			&callback_obj, &n_threads, &staged_bool)) {
+    return NULL;
+  }
+
+  if (n_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "n_threads must be at least 1");
     return NULL;
   }
 
+  bool staged = staged_bool != NULL && PyObject_IsTrue(staged_bool);
+
   // set C++ parameters accordingly
   bool update_readmask = false;
   khmer::ReadMaskTable * readmask = NULL;
@@ -1006,9 +1058,12 @@ static PyObject * hash_consume_fasta(PyObject * self, PyObject * args)
   try {
     counting->consume_fasta(filename, total_reads, n_consumed,
 			     lower_bound, upper_bound, &readmask,
-			     update_readmask, _report_fn, callback_obj);
+			     update_readmask, _report_fn, callback_obj,
+			     n_threads, staged);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   // error checking -- this should still be null!
@@ -1044,6 +1099,8 @@ static PyObject * hash_consume_fasta_build_readmask(PyObject * self, PyObject *
 			     _report_fn, callback_obj);
   } catch  (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   if (!readmask) {
@@ -1199,7 +1256,11 @@ static PyObject * hash_get_kmer_abund_mean(PyObject * self, PyObject * args)
   unsigned long long total = 0;
   unsigned long long count = 0;
   float mean = 0.0;
-  counting->get_kmer_abund_mean(filename, total, count, mean);
+  try {
+    counting->get_kmer_abund_mean(filename, total, count, mean);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 
   return Py_BuildValue("LLf", total, count, mean);
 }
@@ -1217,7 +1278,11 @@ static PyObject * hash_get_kmer_abund_abs_deviation(PyObject * self, PyObject *
   }
 
   float abs_dev = 0.0;
-  counting->get_kmer_abund_abs_deviation(filename, mean, abs_dev);
+  try {
+    counting->get_kmer_abund_abs_deviation(filename, mean, abs_dev);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 
   return Py_BuildValue("f", abs_dev);
 }
@@ -1337,8 +1402,12 @@ static PyObject * hash_abundance_distribution(PyObject * self, PyObject * args)
 
 
   khmer::HashIntoType * dist;
-  dist = counting->abundance_distribution(filename, hashbits,
-					  _report_fn, callback_obj);
+  try {
+    dist = counting->abundance_distribution(filename, hashbits,
+					    _report_fn, callback_obj);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
   
   PyObject * x = PyList_New(MAX_BIGCOUNT + 1);
   for (int i = 0; i < MAX_BIGCOUNT + 1; i++) {
@@ -1378,9 +1447,13 @@ static PyObject * hash_fasta_count_kmers_by_position(PyObject * self, PyObject *
     
 
   unsigned long long * counts;
-  counts = counting->fasta_count_kmers_by_position(inputfile, max_read_len,
-						    readmask, limit_by,
-						    _report_fn, callback_obj);
+  try {
+    counts = counting->fasta_count_kmers_by_position(inputfile, max_read_len,
+						      readmask, limit_by,
+						      _report_fn, callback_obj);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 					 
   PyObject * x = PyList_New(max_read_len);
   for (int i = 0; i < max_read_len; i++) {
@@ -1418,9 +1491,13 @@ static PyObject * hash_fasta_dump_kmers_by_abundance(PyObject * self, PyObject *
   }
     
 
-  counting->fasta_dump_kmers_by_abundance(inputfile,
-					   readmask, limit_by,
-					   _report_fn, callback_obj);
+  try {
+    counting->fasta_dump_kmers_by_abundance(inputfile,
+					     readmask, limit_by,
+					     _report_fn, callback_obj);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 					 
 
   Py_INCREF(Py_None);
@@ -1469,7 +1546,32 @@ static PyObject * hash_load(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  counting->load(filename);
+  try {
+    counting->load(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * hash_load_mmap(PyObject * self, PyObject * args)
+{
+  khmer_KCountingHashObject * me = (khmer_KCountingHashObject *) self;
+  khmer::CountingHash * counting = me->counting;
+
+  char * filename = NULL;
+
+  if (!PyArg_ParseTuple(args, "s", &filename)) {
+    return NULL;
+  }
+
+  try {
+    counting->load_mmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -1486,7 +1588,11 @@ static PyObject * hash_save(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  counting->save(filename);
+  try {
+    counting->save(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -1506,6 +1612,18 @@ static PyObject * hash_get_ksize(PyObject * self, PyObject * args)
   return PyInt_FromLong(k);
 }
 
+static PyObject * hash_get_hash_family(PyObject * self, PyObject * args)
+{
+  khmer_KCountingHashObject * me = (khmer_KCountingHashObject *) self;
+  khmer::CountingHash * counting = me->counting;
+
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  return PyInt_FromLong(counting->hash_family());
+}
+
 static PyObject * hash_get_hashsizes(PyObject * self, PyObject * args)
 {
   khmer_KCountingHashObject * me = (khmer_KCountingHashObject *) self;
@@ -1531,10 +1649,12 @@ static PyObject * hash_collect_high_abundance_kmers(PyObject * self,
 
 static PyMethodDef khmer_counting_methods[] = {
   { "ksize", hash_get_ksize, METH_VARARGS, "" },
+  { "hash_family", hash_get_hash_family, METH_VARARGS, "" },
   { "hashsizes", hash_get_hashsizes, METH_VARARGS, "" },
   { "set_use_bigcount", hash_set_use_bigcount, METH_VARARGS, "" },
   { "get_use_bigcount", hash_get_use_bigcount, METH_VARARGS, "" },
   { "n_occupied", hash_n_occupied, METH_VARARGS, "Count the number of occupied bins" },
+  { "clear", hash_clear, METH_VARARGS, "Zero all counts, keeping the table's memory" },
   { "n_entries", hash_n_entries, METH_VARARGS, "" },
   { "count", hash_count, METH_VARARGS, "Count the given kmer" },
   { "consume", hash_consume, METH_VARARGS, "Count all k-mers in the given string" },
@@ -1559,6 +1679,7 @@ static PyMethodDef khmer_counting_methods[] = {
   { "fasta_dump_kmers_by_abundance", hash_fasta_dump_kmers_by_abundance, METH_VARARGS, "" },
   { "load", hash_load, METH_VARARGS, "" },
   { "save", hash_save, METH_VARARGS, "" },
+  { "load_mmap", hash_load_mmap, METH_VARARGS, "Load, mapping the tables from the file" },
   { "get_kmer_abund_abs_deviation", hash_get_kmer_abund_abs_deviation, METH_VARARGS, "" },
   { "get_kmer_abund_mean", hash_get_kmer_abund_mean, METH_VARARGS, "" },
   { "collect_high_abundance_kmers", hash_collect_high_abundance_kmers,
@@ -1628,8 +1749,14 @@ static PyObject* _new_counting_hash(PyObject * self, PyObject * args)
 {
   unsigned int k = 0;
   PyObject* sizes_list_o = NULL;
+  int hash_family = HASH_FAMILY_MODULO;
 
-  if (!PyArg_ParseTuple(args, "IO", &k, &sizes_list_o)) {
+  if (!PyArg_ParseTuple(args, "IO|i", &k, &sizes_list_o, &hash_family)) {
+    return NULL;
+  }
+
+  if (hash_family != HASH_FAMILY_MODULO && hash_family != HASH_FAMILY_MIX) {
+    PyErr_SetString(PyExc_ValueError, "unknown hash family");
     return NULL;
   }
 
@@ -1643,6 +1770,38 @@ static PyObject* _new_counting_hash(PyObject * self, PyObject * args)
     PyObject_New(khmer_KCountingHashObject, &khmer_KCountingHashType);
 
   kcounting_obj->counting = new khmer::CountingHash(k, sizes);
+  kcounting_obj->counting->set_hash_family(hash_family);
+
+  return (PyObject *) kcounting_obj;
+}
+
+static PyObject* _new_blocked_counting_hash(PyObject * self, PyObject * args)
+{
+  unsigned int k = 0;
+  PyObject* sizes_list_o = NULL;
+
+  if (!PyArg_ParseTuple(args, "IO", &k, &sizes_list_o)) {
+    return NULL;
+  }
+
+  std::vector<khmer::HashIntoType> sizes;
+  for (int i = 0; i < PyObject_Length(sizes_list_o); i++) {
+    PyObject * size_o = PyList_GET_ITEM(sizes_list_o, i);
+    sizes.push_back(PyLong_AsLongLong(size_o));
+  }
+
+  // each table is a counter in every block.
+  if (sizes.empty() || sizes.size() > BLOCKED_BLOCK_BYTES) {
+    PyErr_Format(PyExc_ValueError,
+		 "a blocked counting hash takes 1 to %d tables",
+		 BLOCKED_BLOCK_BYTES);
+    return NULL;
+  }
+
+  khmer_KCountingHashObject * kcounting_obj = (khmer_KCountingHashObject *) \
+    PyObject_New(khmer_KCountingHashObject, &khmer_KCountingHashType);
+
+  kcounting_obj->counting = new khmer::BlockedCountingHash(k, sizes);
 
   return (PyObject *) kcounting_obj;
 }
@@ -1720,6 +1879,8 @@ static PyObject * hashbits_count_overlap(PyObject * self, PyObject * args)
 			     update_readmask, _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   // error checking -- this should still be null!
@@ -1758,6 +1919,33 @@ static PyObject * hashbits_n_occupied(PyObject * self, PyObject * args)
   return PyInt_FromLong(n);
 }
 
+static PyObject * hashbits_clear(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  hashbits->clear();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * hashbits_false_positive_rate(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  return PyFloat_FromDouble(hashbits->false_positive_rate());
+}
+
 static PyObject * hashbits_n_tags(PyObject * self, PyObject * args)
 {
   khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
@@ -1866,7 +2054,11 @@ static PyObject * hashbits_load_stop_tags(PyObject * self, PyObject * args)
   if (clear_tags_o && !PyObject_IsTrue(clear_tags_o)) {
     clear_tags = false;
   }
-  hashbits->load_stop_tags(filename, clear_tags);
+  try {
+    hashbits->load_stop_tags(filename, clear_tags);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
   
   Py_INCREF(Py_None);
   return Py_None;
@@ -1883,7 +2075,11 @@ static PyObject * hashbits_save_stop_tags(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->save_stop_tags(filename);
+  try {
+    hashbits->save_stop_tags(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
   
   Py_INCREF(Py_None);
   return Py_None;
@@ -1951,7 +2147,11 @@ static PyObject * hashbits_hitraverse_to_stoptags(PyObject * self, PyObject * ar
 
   khmer::CountingHash * counting = ((khmer_KCountingHashObject *) counting_o)->counting;
 
-  hashbits->hitraverse_to_stoptags(filename, *counting, cutoff);
+  try {
+    hashbits->hitraverse_to_stoptags(filename, *counting, cutoff);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
   
   Py_INCREF(Py_None);
   return Py_None;
@@ -2175,6 +2375,43 @@ static PyObject * hashbits_do_subset_partition(PyObject * self, PyObject * args)
   return PyCObject_FromVoidPtr(subset_p, free_subset_partition_info);
 }
 
+static PyObject * hashbits_parallel_partition(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  unsigned int n_threads = 1;
+  PyObject * break_on_stop_tags_o = NULL;
+  PyObject * stop_big_traversals_o = NULL;
+
+  if (!PyArg_ParseTuple(args, "|IOO", &n_threads, &break_on_stop_tags_o,
+			&stop_big_traversals_o)) {
+    return NULL;
+  }
+
+  if (n_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "n_threads must be at least 1");
+    return NULL;
+  }
+
+  bool break_on_stop_tags = false;
+  if (break_on_stop_tags_o && PyObject_IsTrue(break_on_stop_tags_o)) {
+    break_on_stop_tags = true;
+  }
+  bool stop_big_traversals = false;
+  if (stop_big_traversals_o && PyObject_IsTrue(stop_big_traversals_o)) {
+    stop_big_traversals = true;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  hashbits->parallel_partition(n_threads, break_on_stop_tags,
+			       stop_big_traversals);
+  Py_END_ALLOW_THREADS
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
 static PyObject * hashbits_join_partitions_by_path(PyObject * self, PyObject *args)
 {
   khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
@@ -2224,7 +2461,11 @@ static PyObject * hashbits_merge_from_disk(PyObject * self, PyObject *args)
     return NULL;
   }
 
-  hashbits->partition->merge_from_disk(filename);
+  try {
+    hashbits->partition->merge_from_disk(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2240,13 +2481,22 @@ static PyObject * hashbits_consume_fasta(PyObject * self, PyObject * args)
   PyObject * update_readmask_bool = NULL;
   khmer::HashIntoType lower_bound = 0, upper_bound = 0;
   PyObject * callback_obj = NULL;
+  int n_threads = 1;
+  PyObject * staged_bool = NULL;
 
-  if (!PyArg_ParseTuple(args, "s|iiOOO", &filename, &lower_bound, &upper_bound,
-			&readmask_obj, &update_readmask_bool,
-			&callback_obj)) {
+  if (!PyArg_ParseTuple(args, "s|iiOOOiO", &filename, &lower_bound,
+			&upper_bound, &readmask_obj, &update_readmask_bool,
+			&callback_obj, &n_threads, &staged_bool)) {
     return NULL;
   }
 
+  if (n_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "n_threads must be at least 1");
+    return NULL;
+  }
+
+  bool staged = staged_bool != NULL && PyObject_IsTrue(staged_bool);
+
   bool update_readmask = false;
   khmer::ReadMaskTable * readmask = NULL;
 
@@ -2275,9 +2525,12 @@ static PyObject * hashbits_consume_fasta(PyObject * self, PyObject * args)
   try {
     hashbits->consume_fasta(filename, total_reads, n_consumed,
 			     lower_bound, upper_bound, &readmask,
-			     update_readmask, _report_fn, callback_obj);
+			     update_readmask, _report_fn, callback_obj,
+			     n_threads, staged);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   // error checking -- this should still be null!
@@ -2305,8 +2558,12 @@ static PyObject * hashbits_traverse_from_reads(PyObject * self, PyObject * args)
 
   khmer::CountingHash * counting = ((khmer_KCountingHashObject *) counting_o)->counting;
 
-  hashbits->traverse_from_reads(filename, radius, big_threshold,
-				transfer_threshold, *counting);
+  try {
+    hashbits->traverse_from_reads(filename, radius, big_threshold,
+				  transfer_threshold, *counting);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
       
 
   Py_INCREF(Py_None);
@@ -2330,8 +2587,12 @@ static PyObject * hashbits_consume_fasta_and_traverse(PyObject * self, PyObject
 
   khmer::CountingHash * counting = ((khmer_KCountingHashObject *) counting_o)->counting;
 
-  hashbits->consume_fasta_and_traverse(filename, radius, big_threshold,
-				       transfer_threshold, *counting);
+  try {
+    hashbits->consume_fasta_and_traverse(filename, radius, big_threshold,
+					 transfer_threshold, *counting);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
       
 
   Py_INCREF(Py_None);
@@ -2350,8 +2611,15 @@ static PyObject * hashbits_consume_fasta_and_tag(PyObject * self, PyObject * arg
 
   char * filename;
   PyObject * callback_obj = NULL;
+  int n_threads = 1;
 
-  if (!PyArg_ParseTuple(args, "s|O", &filename, &callback_obj)) {
+  if (!PyArg_ParseTuple(args, "s|Oi", &filename, &callback_obj,
+			&n_threads)) {
+    return NULL;
+  }
+
+  if (n_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "n_threads must be at least 1");
     return NULL;
   }
 
@@ -2362,9 +2630,11 @@ static PyObject * hashbits_consume_fasta_and_tag(PyObject * self, PyObject * arg
 
   try {
     hashbits->consume_fasta_and_tag(filename, total_reads, n_consumed,
-				     _report_fn, callback_obj);
+				     _report_fn, callback_obj, n_threads);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return Py_BuildValue("iL", total_reads, n_consumed);
@@ -2393,6 +2663,8 @@ static PyObject * hashbits_consume_fasta_and_tag_with_stoptags(PyObject * self,
 						  _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return Py_BuildValue("iL", total_reads, n_consumed);
@@ -2420,6 +2692,8 @@ static PyObject * hashbits_consume_partitioned_fasta(PyObject * self, PyObject *
 					 _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return Py_BuildValue("iL", total_reads, n_consumed);
@@ -2451,7 +2725,7 @@ static PyObject * hashbits_find_all_tags(PyObject * self, PyObject *args)
   Py_BEGIN_ALLOW_THREADS
 
     khmer::HashIntoType kmer, kmer_f, kmer_r;
-    kmer = khmer::_hash(kmer_s, hashbits->ksize(), kmer_f, kmer_r);
+    kmer = hashbits->hash_kmer(kmer_s, kmer_f, kmer_r);
 
     ppi = new _pre_partition_info(kmer);
     hashbits->partition->find_all_tags(kmer_f, kmer_r, ppi->tagged_kmers,
@@ -2497,7 +2771,7 @@ static PyObject * hashbits_add_tag(PyObject * self, PyObject *args)
     return NULL;
   }
 
-  khmer::HashIntoType kmer = khmer::_hash(kmer_s, hashbits->ksize());
+  khmer::HashIntoType kmer = hashbits->hash_kmer(kmer_s);
   hashbits->add_tag(kmer);
 
   Py_INCREF(Py_None);
@@ -2514,7 +2788,7 @@ static PyObject * hashbits_add_stop_tag(PyObject * self, PyObject *args)
     return NULL;
   }
 
-  khmer::HashIntoType kmer = khmer::_hash(kmer_s, hashbits->ksize());
+  khmer::HashIntoType kmer = hashbits->hash_kmer(kmer_s);
   hashbits->add_stop_tag(kmer);
 
   Py_INCREF(Py_None);
@@ -2531,7 +2805,7 @@ static PyObject * hashbits_get_stop_tags(PyObject * self, PyObject * args)
   }
 
   khmer::WordLength k = hashbits->ksize();
-  khmer::SeenSet::const_iterator si;
+  khmer::TagSet::const_iterator si;
 
   PyObject * x = PyList_New(hashbits->stop_tags.size());
   unsigned long long i = 0;
@@ -2555,7 +2829,7 @@ static PyObject * hashbits_get_tagset(PyObject * self, PyObject * args)
   }
 
   khmer::WordLength k = hashbits->ksize();
-  khmer::SeenSet::const_iterator si;
+  khmer::TagSet::const_iterator si;
 
   PyObject * x = PyList_New(hashbits->all_tags.size());
   unsigned long long i = 0;
@@ -2600,6 +2874,8 @@ static PyObject * hashbits_output_partitions(PyObject * self, PyObject * args)
 						     callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return PyInt_FromLong(n_partitions);
@@ -2631,6 +2907,8 @@ static PyObject * hashbits_find_unpart(PyObject * self, PyObject * args)
 					 _report_fn,callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return PyInt_FromLong(n_singletons);
@@ -2656,6 +2934,8 @@ static PyObject * hashbits_filter_if_present(PyObject * self, PyObject * args)
     hashbits->filter_if_present(filename, output, _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
   
   Py_INCREF(Py_None);
@@ -2673,7 +2953,11 @@ static PyObject * hashbits_save_partitionmap(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->partition->save_partitionmap(filename);
+  try {
+    hashbits->partition->save_partitionmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2690,7 +2974,11 @@ static PyObject * hashbits_load_partitionmap(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->partition->load_partitionmap(filename);
+  try {
+    hashbits->partition->load_partitionmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2784,7 +3072,32 @@ static PyObject * hashbits_load(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->load(filename);
+  try {
+    hashbits->load(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * hashbits_load_mmap(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  char * filename = NULL;
+
+  if (!PyArg_ParseTuple(args, "s", &filename)) {
+    return NULL;
+  }
+
+  try {
+    hashbits->load_mmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2801,7 +3114,11 @@ static PyObject * hashbits_save(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->save(filename);
+  try {
+    hashbits->save(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2823,7 +3140,11 @@ static PyObject * hashbits_load_tagset(PyObject * self, PyObject * args)
   if (clear_tags_o && !PyObject_IsTrue(clear_tags_o)) {
     clear_tags = false;
   }
-  hashbits->load_tagset(filename, clear_tags);
+  try {
+    hashbits->load_tagset(filename, clear_tags);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2840,7 +3161,11 @@ static PyObject * hashbits_save_tagset(PyObject * self, PyObject * args)
     return NULL;
   }
 
-  hashbits->save_tagset(filename);
+  try {
+    hashbits->save_tagset(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -2860,7 +3185,11 @@ static PyObject * hashbits_save_subset_partitionmap(PyObject * self, PyObject *
 
   Py_BEGIN_ALLOW_THREADS
 
-  subset_p->save_partitionmap(filename);
+  try {
+    subset_p->save_partitionmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    return _saved_file_error(e);
+  }
 
   Py_END_ALLOW_THREADS
 
@@ -2882,12 +3211,24 @@ static PyObject * hashbits_load_subset_partitionmap(PyObject * self, PyObject *
   khmer::SubsetPartition * subset_p;
   subset_p = new khmer::SubsetPartition(hashbits);
 
+  std::string error;
+
   Py_BEGIN_ALLOW_THREADS
 
-  subset_p->load_partitionmap(filename);
+  try {
+    subset_p->load_partitionmap(filename);
+  } catch (khmer::SavedFileError &e) {
+    error = e.get_message();
+  }
 
   Py_END_ALLOW_THREADS
 
+  if (!error.empty()) {
+    delete subset_p;
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return NULL;
+  }
+
   return PyCObject_FromVoidPtr(subset_p, free_subset_partition_info);
 }
 
@@ -2907,6 +3248,22 @@ static PyObject * hashbits__set_tag_density(PyObject * self, PyObject * args)
   return Py_None;
 }
 
+static PyObject * hashbits_set_traversal_threads(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  unsigned int n;
+  if (!PyArg_ParseTuple(args, "I", &n)) {
+    return NULL;
+  }
+
+  hashbits->set_traversal_threads(n);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
 static PyObject * hashbits__get_tag_density(PyObject * self, PyObject * args)
 {
   khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
@@ -2962,12 +3319,23 @@ static PyObject * hashbits_merge2_from_disk(PyObject * self, PyObject * args)
   khmer::SubsetPartition * subset1_p;
   subset1_p = (khmer::SubsetPartition *) PyCObject_AsVoidPtr(subset1_obj);
 
+  std::string error;
+
   Py_BEGIN_ALLOW_THREADS
 
+  try {
     subset1_p->merge_from_disk(filename);
+  } catch (khmer::SavedFileError &e) {
+    error = e.get_message();
+  }
 
   Py_END_ALLOW_THREADS
 
+  if (!error.empty()) {
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return NULL;
+  }
+
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -3105,7 +3473,7 @@ static PyObject * hashbits_count_kmers_within_radius(PyObject * self, PyObject *
   Py_BEGIN_ALLOW_THREADS
 
   khmer::HashIntoType kmer_f, kmer_r;
-  khmer::_hash(kmer, hashbits->ksize(), kmer_f, kmer_r);
+  hashbits->hash_kmer(kmer, kmer_f, kmer_r);
   n = hashbits->count_kmers_within_radius(kmer_f, kmer_r, radius,
 						       max_count);
 
@@ -3132,7 +3500,7 @@ static PyObject * hashbits_count_kmers_on_radius(PyObject * self, PyObject * arg
   Py_BEGIN_ALLOW_THREADS
 
   khmer::HashIntoType kmer_f, kmer_r;
-  khmer::_hash(kmer, hashbits->ksize(), kmer_f, kmer_r);
+  hashbits->hash_kmer(kmer, kmer_f, kmer_r);
   n = hashbits->count_kmers_on_radius(kmer_f, kmer_r, radius, max_volume);
 
   Py_END_ALLOW_THREADS
@@ -3185,7 +3553,7 @@ static PyObject * hashbits_find_radius_for_volume(PyObject * self, PyObject * ar
   Py_BEGIN_ALLOW_THREADS
 
   khmer::HashIntoType kmer_f, kmer_r;
-  khmer::_hash(kmer, hashbits->ksize(), kmer_f, kmer_r);
+  hashbits->hash_kmer(kmer, kmer_f, kmer_r);
   n = hashbits->find_radius_for_volume(kmer_f, kmer_r, max_count,
 						    max_radius);
 
@@ -3208,6 +3576,18 @@ static PyObject * hashbits_get_ksize(PyObject * self, PyObject * args)
   return PyInt_FromLong(k);
 }
 
+static PyObject * hashbits_get_hash_family(PyObject * self, PyObject * args)
+{
+  khmer_KHashbitsObject * me = (khmer_KHashbitsObject *) self;
+  khmer::Hashbits * hashbits = me->hashbits;
+
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  return PyInt_FromLong(hashbits->hash_family());
+}
+
 
 static PyObject * hashbits_get_hashsizes(PyObject * self, PyObject * args)
 {
@@ -3254,9 +3634,12 @@ static PyObject * hashbits_extract_unique_paths(PyObject * self, PyObject * args
 static PyMethodDef khmer_hashbits_methods[] = {
   { "extract_unique_paths", hashbits_extract_unique_paths, METH_VARARGS, "" },
   { "ksize", hashbits_get_ksize, METH_VARARGS, "" },
+  { "hash_family", hashbits_get_hash_family, METH_VARARGS, "" },
   { "hashsizes", hashbits_get_hashsizes, METH_VARARGS, "" },
   { "n_occupied", hashbits_n_occupied, METH_VARARGS, "Count the number of occupied bins" },
+  { "clear", hashbits_clear, METH_VARARGS, "Zero all bits, keeping the table's memory; tags are kept" },
   { "n_unique_kmers", hashbits_n_unique_kmers,  METH_VARARGS, "Count the number of unique kmers" },
+  { "false_positive_rate", hashbits_false_positive_rate, METH_VARARGS, "Estimate the false positive rate from the table fill" },
   { "count", hashbits_count, METH_VARARGS, "Count the given kmer" },
   { "count_overlap", hashbits_count_overlap,METH_VARARGS,"Count overlap kmers in two datasets" },
   { "consume", hashbits_consume, METH_VARARGS, "Count all k-mers in the given string" },
@@ -3273,6 +3656,7 @@ static PyMethodDef khmer_hashbits_methods[] = {
   { "identify_stoptags_by_position", hashbits_identify_stoptags_by_position, METH_VARARGS, "" },
   { "trim_on_density_explosion", hashbits_trim_on_density_explosion, METH_VARARGS, "" },
   { "do_subset_partition", hashbits_do_subset_partition, METH_VARARGS, "" },
+  { "parallel_partition", hashbits_parallel_partition, METH_VARARGS, "" },
   { "find_all_tags", hashbits_find_all_tags, METH_VARARGS, "" },
   { "assign_partition_id", hashbits_assign_partition_id, METH_VARARGS, "" },
   { "output_partitions", hashbits_output_partitions, METH_VARARGS, "" },
@@ -3284,6 +3668,7 @@ static PyMethodDef khmer_hashbits_methods[] = {
   { "get_tagset", hashbits_get_tagset, METH_VARARGS, "" },
   { "load", hashbits_load, METH_VARARGS, "" },
   { "save", hashbits_save, METH_VARARGS, "" },
+  { "load_mmap", hashbits_load_mmap, METH_VARARGS, "Load, mapping the tables from the file" },
   { "load_tagset", hashbits_load_tagset, METH_VARARGS, "" },
   { "save_tagset", hashbits_save_tagset, METH_VARARGS, "" },
   { "n_tags", hashbits_n_tags, METH_VARARGS, "" },
@@ -3292,6 +3677,7 @@ static PyMethodDef khmer_hashbits_methods[] = {
   { "save_partitionmap", hashbits_save_partitionmap, METH_VARARGS, "" },
   { "_validate_partitionmap", hashbits__validate_partitionmap, METH_VARARGS, "" },
   { "_get_tag_density", hashbits__get_tag_density, METH_VARARGS, "" },
+  { "set_traversal_threads", hashbits_set_traversal_threads, METH_VARARGS, "" },
   { "_set_tag_density", hashbits__set_tag_density, METH_VARARGS, "" },
   { "consume_fasta", hashbits_consume_fasta, METH_VARARGS, "Count all k-mers in a given file" },
   { "consume_fasta_and_tag", hashbits_consume_fasta_and_tag, METH_VARARGS, "Count all k-mers in a given file" },
@@ -3338,8 +3724,14 @@ static PyObject* _new_hashbits(PyObject * self, PyObject * args)
 {
   unsigned int k = 0;
   PyObject* sizes_list_o = NULL;
+  int hash_family = HASH_FAMILY_MODULO;
 
-  if (!PyArg_ParseTuple(args, "IO", &k, &sizes_list_o)) {
+  if (!PyArg_ParseTuple(args, "IO|i", &k, &sizes_list_o, &hash_family)) {
+    return NULL;
+  }
+
+  if (hash_family != HASH_FAMILY_MODULO && hash_family != HASH_FAMILY_MIX) {
+    PyErr_SetString(PyExc_ValueError, "unknown hash family");
     return NULL;
   }
 
@@ -3353,6 +3745,42 @@ static PyObject* _new_hashbits(PyObject * self, PyObject * args)
     PyObject_New(khmer_KHashbitsObject, &khmer_KHashbitsType);
 
   khashbits_obj->hashbits = new khmer::Hashbits(k, sizes);
+  khashbits_obj->hashbits->set_hash_family(hash_family);
+
+  return (PyObject *) khashbits_obj;
+}
+
+//
+// new_blocked_hashbits
+//
+
+static PyObject* _new_blocked_hashbits(PyObject * self, PyObject * args)
+{
+  unsigned int k = 0;
+  PyObject* sizes_list_o = NULL;
+
+  if (!PyArg_ParseTuple(args, "IO", &k, &sizes_list_o)) {
+    return NULL;
+  }
+
+  std::vector<khmer::HashIntoType> sizes;
+  for (int i = 0; i < PyObject_Length(sizes_list_o); i++) {
+    PyObject * size_o = PyList_GET_ITEM(sizes_list_o, i);
+    sizes.push_back(PyLong_AsLongLong(size_o));
+  }
+
+  // each table is a bit in every block.
+  if (sizes.empty() || sizes.size() > BLOCKED_BLOCK_BITS) {
+    PyErr_Format(PyExc_ValueError,
+		 "a blocked hashbits table takes 1 to %d tables",
+		 BLOCKED_BLOCK_BITS);
+    return NULL;
+  }
+
+  khmer_KHashbitsObject * khashbits_obj = (khmer_KHashbitsObject *) \
+    PyObject_New(khmer_KHashbitsObject, &khmer_KHashbitsType);
+
+  khashbits_obj->hashbits = new khmer::BlockedHashbits(k, sizes);
 
   return (PyObject *) khashbits_obj;
 }
@@ -3370,8 +3798,12 @@ static PyObject * hash_collect_high_abundance_kmers(PyObject * self, PyObject *
   }
 
   khmer::SeenSet found_kmers;
-  counting->collect_high_abundance_kmers(filename, lower_count, upper_count,
-					 found_kmers);
+  try {
+    counting->collect_high_abundance_kmers(filename, lower_count, upper_count,
+					   found_kmers);
+  } catch (ParserError &e) {
+    return _parser_error(e);
+  }
 
   // create a new hashbits object...
   std::vector<khmer::HashIntoType> sizes;
@@ -3382,7 +3814,12 @@ static PyObject * hash_collect_high_abundance_kmers(PyObject * self, PyObject *
 
   // ...and set the collected kmers as the stoptags.
   khashbits_obj->hashbits = new khmer::Hashbits(counting->ksize(), sizes);
-  khashbits_obj->hashbits->stop_tags.swap(found_kmers);
+  khmer::TagSet &stop_tags = khashbits_obj->hashbits->stop_tags;
+  stop_tags.reserve(found_kmers.size());
+  for (khmer::SeenSet::const_iterator si = found_kmers.begin();
+       si != found_kmers.end(); ++si) {
+    stop_tags.insert(*si);
+  }
 
   return (PyObject *) khashbits_obj;
 }
@@ -3579,6 +4016,8 @@ static PyObject * readmask_filter_fasta_file(PyObject * self, PyObject *args)
 					 _report_fn, callback_obj);
   } catch (_khmer_signal &e) {
     return NULL;
+  } catch (ParserError &e) {
+    return _parser_error(e);
   }
 
   return PyInt_FromLong(n_kept);
@@ -3915,6 +4354,58 @@ static PyObject * reverse_hash(PyObject * self, PyObject * args)
   return PyString_FromString(khmer::_revhash(val, ksize).c_str());
 }
 
+static PyObject * set_unique_rc(PyObject * self, PyObject * args)
+{
+  PyObject * o;
+
+  if (!PyArg_ParseTuple(args, "O", &o)) {
+    return NULL;
+  }
+
+  khmer::set_unique_rc(PyObject_IsTrue(o));
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * get_unique_rc(PyObject * self, PyObject * args)
+{
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  return PyBool_FromLong(khmer::get_unique_rc());
+}
+
+static PyObject * set_alloc_policy(PyObject * self, PyObject * args)
+{
+  unsigned int policy;
+
+  if (!PyArg_ParseTuple(args, "I", &policy)) {
+    return NULL;
+  }
+
+  if (policy & ~(ALLOC_HUGEPAGES | ALLOC_HUGETLB | ALLOC_NUMA_INTERLEAVE |
+		 ALLOC_NUMA_FIRST_TOUCH)) {
+    PyErr_SetString(PyExc_ValueError, "unknown allocation policy flag");
+    return NULL;
+  }
+
+  khmer::set_alloc_policy(policy);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * get_alloc_policy(PyObject * self, PyObject * args)
+{
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  return PyInt_FromLong(khmer::get_alloc_policy());
+}
+
 static PyObject * set_reporting_callback(PyObject * self, PyObject * args)
 {
   PyObject * o;
@@ -3931,6 +4422,106 @@ static PyObject * set_reporting_callback(PyObject * self, PyObject * args)
   return Py_None;
 }
 
+//
+// read_batches: every record in a file, as get_next_batch() hands them
+//    back -- a list of batches, each a list of (index, name, sequence,
+//    quality) tuples, with quality None for FASTA.  One ReadBatch is
+//    reused throughout, as in the loaders.  Mostly for testing.
+//
+
+static PyObject * _batch_records(const ReadBatch &batch)
+{
+  PyObject * records = PyList_New(batch.size());
+  for (unsigned int i = 0; i < batch.size(); i++) {
+    PyList_SET_ITEM(records, i,
+		    Py_BuildValue("Ks#s#z#", batch.index(i),
+				  batch.name(i), (int) batch.name_len(i),
+				  batch.seq(i), (int) batch.seq_len(i),
+				  batch.quality(i), (int) batch.quality_len(i)));
+  }
+  return records;
+}
+
+static PyObject * read_batches(PyObject * self, PyObject * args)
+{
+  char * filename;
+  int batch_size = DEFAULT_READ_BATCH_SIZE;
+
+  if (!PyArg_ParseTuple(args, "s|i", &filename, &batch_size)) {
+    return NULL;
+  }
+
+  if (batch_size < 1) {
+    PyErr_SetString(PyExc_ValueError, "batch_size must be at least 1");
+    return NULL;
+  }
+
+  IParser * parser = IParser::get_parser(filename);
+  ReadBatch batch;
+  PyObject * batches = PyList_New(0);
+
+  try {
+    while (parser->get_next_batch(batch, batch_size)) {
+      PyObject * records = _batch_records(batch);
+      PyList_Append(batches, records);
+      Py_DECREF(records);
+    }
+  } catch (ParserError &e) {
+    delete parser;
+    Py_DECREF(batches);
+    return _parser_error(e);
+  }
+  delete parser;
+
+  return batches;
+}
+
+//
+// read_split: the records of each of the parsers get_parsers() gives for
+//    n threads, as a list of lists of read_batches() tuples.
+//
+
+static PyObject * read_split(PyObject * self, PyObject * args)
+{
+  char * filename;
+  int n = 1;
+
+  if (!PyArg_ParseTuple(args, "si", &filename, &n)) {
+    return NULL;
+  }
+
+  if (n < 1) {
+    PyErr_SetString(PyExc_ValueError, "n must be at least 1");
+    return NULL;
+  }
+
+  std::vector<IParser *> parsers;
+  IParser::get_parsers(filename, n, parsers);
+  ReadBatch batch;
+  PyObject * pieces = PyList_New(parsers.size());
+
+  try {
+    for (unsigned int i = 0; i < parsers.size(); i++) {
+      PyObject * piece = PyList_New(0);
+      PyList_SET_ITEM(pieces, i, piece);
+
+      while (parsers[i]->get_next_batch(batch)) {
+	PyObject * records = _batch_records(batch);
+	Py_ssize_t end = PyList_GET_SIZE(piece);
+	PyList_SetSlice(piece, end, end, records);
+	Py_DECREF(records);
+      }
+    }
+  } catch (ParserError &e) {
+    delete_parsers(parsers);
+    Py_DECREF(pieces);
+    return _parser_error(e);
+  }
+  delete_parsers(parsers);
+
+  return pieces;
+}
+
 //
 // Module machinery.
 //
@@ -3939,14 +4530,22 @@ static PyMethodDef KhmerMethods[] = {
   { "new_ktable", new_ktable, METH_VARARGS, "Create an empty ktable" },
   { "new_hashtable", new_hashtable, METH_VARARGS, "Create an empty single-table counting hash" },
   { "_new_counting_hash", _new_counting_hash, METH_VARARGS, "Create an empty counting hash" },
+  { "_new_blocked_counting_hash", _new_blocked_counting_hash, METH_VARARGS, "Create an empty cache-blocked counting hash" },
   { "_new_hashbits", _new_hashbits, METH_VARARGS, "Create an empty hashbits table" },
+  { "_new_blocked_hashbits", _new_blocked_hashbits, METH_VARARGS, "Create an empty cache-blocked hashbits table" },
   { "new_readmask", new_readmask, METH_VARARGS, "Create a new read mask table" },
   { "new_minmax", new_minmax, METH_VARARGS, "Create a new min/max value table" },
   { "consume_genome", consume_genome, METH_VARARGS, "Create a new ktable from a genome" },
   { "forward_hash", forward_hash, METH_VARARGS, "", },
   { "forward_hash_no_rc", forward_hash_no_rc, METH_VARARGS, "", },
   { "reverse_hash", reverse_hash, METH_VARARGS, "", },
+  { "set_unique_rc", set_unique_rc, METH_VARARGS, "Store k-mers as min(forward, revcomp) (True, the default) or forward-only, in tables made from now on" },
+  { "get_unique_rc", get_unique_rc, METH_VARARGS, "" },
+  { "set_alloc_policy", set_alloc_policy, METH_VARARGS, "Set how tables created from now on are allocated (ALLOC_* flags)" },
+  { "get_alloc_policy", get_alloc_policy, METH_VARARGS, "" },
   { "set_reporting_callback", set_reporting_callback, METH_VARARGS, "" },
+  { "read_batches", read_batches, METH_VARARGS, "Read a FASTA/FASTQ file as lists of (index, name, sequence, quality) records" },
+  { "read_split", read_split, METH_VARARGS, "Read a FASTA/FASTQ file as split for n threads, one list of records per piece" },
   { NULL, NULL, 0, NULL }
 };
 
@@ -4,36 +4,94 @@ import _khmer
 from _khmer import new_ktable
 from _khmer import new_hashtable
 from _khmer import _new_counting_hash
+from _khmer import _new_blocked_counting_hash
 from _khmer import _new_hashbits
+from _khmer import _new_blocked_hashbits
 from _khmer import new_readmask
 from _khmer import new_minmax
 from _khmer import consume_genome
 from _khmer import forward_hash, forward_hash_no_rc, reverse_hash
+from _khmer import set_unique_rc, get_unique_rc
+from _khmer import set_alloc_policy, get_alloc_policy
 from _khmer import set_reporting_callback
+from _khmer import read_batches, read_split
 
 from filter_utils import filter_fasta_file_any, filter_fasta_file_all, filter_fasta_file_limit_n
 
 ###
 
-def new_hashbits(k, starting_size, n_tables=2):
+# how k-mers are mapped to table bins; see lib/hashfamily.hh.
+HASH_FAMILY_MODULO = 0
+HASH_FAMILY_MIX = 1
+
+HASH_FAMILIES = { 'modulo' : HASH_FAMILY_MODULO,
+                  'mix' : HASH_FAMILY_MIX }
+
+# table allocation policy flags, for set_alloc_policy; see lib/alloc.hh.
+ALLOC_HUGEPAGES = 1
+ALLOC_HUGETLB = 2
+ALLOC_NUMA_INTERLEAVE = 4
+ALLOC_NUMA_FIRST_TOUCH = 8
+
+def new_hashbits(k, starting_size, n_tables=2,
+                 hash_family=HASH_FAMILY_MODULO):
     primes = get_n_primes_above_x(n_tables, starting_size)
     
-    return _new_hashbits(k, primes)
+    return _new_hashbits(k, primes, hash_family)
+
+def new_blocked_hashbits(k, starting_size, n_tables=2):
+    primes = get_n_primes_above_x(n_tables, starting_size)
+
+    return _new_blocked_hashbits(k, primes)
 
-def new_counting_hash(k, starting_size, n_tables=2):
+def new_counting_hash(k, starting_size, n_tables=2,
+                      hash_family=HASH_FAMILY_MODULO):
     primes = get_n_primes_above_x(n_tables, starting_size)
     
-    return _new_counting_hash(k, primes)
+    return _new_counting_hash(k, primes, hash_family)
+
+def new_blocked_counting_hash(k, starting_size, n_tables=2):
+    primes = get_n_primes_above_x(n_tables, starting_size)
 
-def load_hashbits(filename):
-    ht = _new_hashbits(1, [1])
-    ht.load(filename)
+    return _new_blocked_counting_hash(k, primes)
+
+_SAVED_BLOCKED_HASHBITS = 6
+_SAVED_BLOCKED_COUNTING_HT = 7
+
+def _saved_table_type(filename):
+    # the second byte of the file says which layout it was saved from.
+    if filename.endswith('.gz'):
+        import gzip
+        header = gzip.open(filename, 'rb').read(2)
+    else:
+        header = open(filename, 'rb').read(2)
+    if len(header) == 2:
+        return ord(header[1])
+    return None
+
+# with mmap=True, tables saved with save() are mapped from the
+# file rather than read in, so processes loading the same file share it.
+def load_hashbits(filename, mmap=False):
+    if _saved_table_type(filename) == _SAVED_BLOCKED_HASHBITS:
+        ht = _new_blocked_hashbits(1, [1])
+    else:
+        ht = _new_hashbits(1, [1])
+    if mmap:
+        ht.load_mmap(filename)
+    else:
+        ht.load(filename)
 
     return ht
 
-def load_counting_hash(filename):
-    ht = _new_counting_hash(1, [1])
-    ht.load(filename)
+def load_counting_hash(filename, mmap=False):
+    if _saved_table_type(filename) == _SAVED_BLOCKED_COUNTING_HT:
+        ht = _new_blocked_counting_hash(1, [1])
+    else:
+        ht = _new_counting_hash(1, [1])
+    if mmap:
+        ht.load_mmap(filename)
+    else:
+        ht.load(filename)
     
     return ht
 
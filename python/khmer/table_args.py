@@ -0,0 +1,19 @@
+# command-line options shared by the counting and hashbits scripts; see
+# counting_args and hashbits_args.
+
+# for scripts that load reads with consume_fasta and friends.
+def add_threads_args(parser):
+    parser.add_argument('--threads', '-T', type=int, dest='n_threads',
+                        default=1,
+                        help='number of threads to use when loading reads')
+
+# for scripts that build a new table of their own.
+def add_table_type_args(parser):
+    parser.add_argument('--hash-family', dest='hash_family',
+                        default='modulo', choices=['modulo', 'mix'],
+                        help='how k-mers are mapped to table bins; '
+                        '\'mix\' avoids a division per table')
+    parser.add_argument('--blocked', dest='blocked', default=False,
+                        action='store_true',
+                        help='keep each k-mer\'s bins in one cache line; '
+                        'faster, with slightly more collisions')
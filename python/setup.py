@@ -3,15 +3,22 @@ from distutils.core import setup, Extension
 # the c++ extension module (needs to be linked in with ktable.o ...)
 extension_mod = Extension("khmer._khmermodule",
                           ["_khmermodule.cc"],
-                          extra_compile_args=['-g'],
+                          extra_compile_args=['-g', '-pthread'],
+                          extra_link_args=['-pthread'],
                           include_dirs=['../lib',],
                           library_dirs=['../lib',],
                           extra_objects=['../lib/ktable.o',
+                                         '../lib/alloc.o',
+                                         '../lib/chunkedgz.o',
+                                         '../lib/savedfile.o',
+                                         '../lib/tagset.o',
+                                         '../lib/traversal.o',
                                          '../lib/hashtable.o',
                                          '../lib/parsers.o',
                                          '../lib/hashbits.o',
                                          '../lib/counting.o',
                                          '../lib/subset.o',
+                                         '../lib/blocked.o',
                                          '../lib/zlib-1.2.3/adler32.o',
                                          '../lib/zlib-1.2.3/compress.o',
                                          '../lib/zlib-1.2.3/crc32.o',
@@ -25,16 +32,31 @@ extension_mod = Extension("khmer._khmermodule",
                                          '../lib/zlib-1.2.3/uncompr.o',
                                          '../lib/zlib-1.2.3/zutil.o',],
                           depends=['../lib/storage.hh',
+                                   '../lib/parsers.hh',
+                                   '../lib/thread_utils.hh',
+                                   '../lib/hashfamily.hh',
+                                   '../lib/alloc.hh',
+                                   '../lib/chunkedgz.hh',
+                                   '../lib/savedfile.hh',
+                                   '../lib/tagset.hh',
+                                   '../lib/traversal.hh',
                                    '../lib/khmer.hh',
                                    '../lib/ktable.hh',
                                    '../lib/hashtable.hh',
                                    '../lib/counting.hh',
+                                   '../lib/blocked.hh',
+                                   '../lib/alloc.o',
+                                   '../lib/chunkedgz.o',
+                                   '../lib/savedfile.o',
+                                   '../lib/tagset.o',
+                                   '../lib/traversal.o',
                                    '../lib/hashtable.o',
                                    '../lib/ktable.o',
                                    '../lib/parsers.o',
                                    '../lib/hashbits.o',
                                    '../lib/counting.o',
                                    '../lib/subset.o',
+                                   '../lib/blocked.o',
                                    '../lib/zlib-1.2.3/adler32.o',
                                    '../lib/zlib-1.2.3/compress.o',
                                    '../lib/zlib-1.2.3/crc32.o',
@@ -16,9 +16,12 @@ import os.path
 import sys, screed
 import khmer
 from khmer.hashbits_args import build_construct_args, DEFAULT_MIN_HASHSIZE
+from khmer.table_args import add_threads_args, add_table_type_args
 
 def main():
     parser = build_construct_args()
+    add_threads_args(parser)
+    add_table_type_args(parser)
     parser.add_argument('--no-build-tagset', '-n', default=False,
                         action='store_true', dest='no_build_tagset',
                         help='Do NOT construct tagset while loading sequences')
@@ -26,6 +29,7 @@ def main():
     parser.add_argument('input_filenames', nargs='+')
 
     args = parser.parse_args()
+    hash_family = khmer.HASH_FAMILIES[args.hash_family]
 
     if not args.quiet:
         if args.min_hashsize == DEFAULT_MIN_HASHSIZE:
@@ -35,6 +39,9 @@ def main():
         print>>sys.stderr, ' - kmer size =    %d \t\t(-k)' % args.ksize
         print>>sys.stderr, ' - n hashes =     %d \t\t(-N)' % args.n_hashes
         print>>sys.stderr, ' - min hashsize = %-5.2g \t(-x)' % args.min_hashsize
+        print>>sys.stderr, ' - n threads =    %d \t\t(-T)' % args.n_threads
+        if args.blocked:
+            print>>sys.stderr, ' - blocked layout \t\t(--blocked)'
         print>>sys.stderr, ''
         print>>sys.stderr, 'Estimated memory usage is %.2g bytes (n_hashes x min_hashsize / 8)' % (args.n_hashes * args.min_hashsize / 8.)
         print>>sys.stderr, '-'*8
@@ -56,14 +63,17 @@ def main():
     ###
     
     print 'making hashtable'
-    ht = khmer.new_hashbits(K, HT_SIZE, N_HT)
+    if args.blocked:
+        ht = khmer.new_blocked_hashbits(K, HT_SIZE, N_HT)
+    else:
+        ht = khmer.new_hashbits(K, HT_SIZE, N_HT, hash_family)
 
     for n, filename in enumerate(filenames):
        print 'consuming input', filename
        if args.no_build_tagset:
-           ht.consume_fasta(filename)
+           ht.consume_fasta(filename, 0, 0, None, False, None, args.n_threads)
        else:
-           ht.consume_fasta_and_tag(filename)
+           ht.consume_fasta_and_tag(filename, None, args.n_threads)
 
     print 'saving hashtable in', base + '.ht'
     ht.save(base + '.ht')
@@ -76,6 +86,9 @@ def main():
     info_fp.write('%d unique k-mers' % ht.n_unique_kmers())
 
     fp_rate = khmer.calc_expected_collisions(ht)
+    if args.blocked:
+        print 'fp rate of the classic layout would be about %1.3f' % fp_rate
+        fp_rate = ht.false_positive_rate()
     print 'fp rate estimated to be %1.3f' % fp_rate
     if fp_rate > 0.15:          # 0.18 is ACTUAL MAX. Do not change.
         print >>sys.stderr, "**"
@@ -12,15 +12,19 @@ Use '-h' for parameter help.
 import sys, screed
 import khmer
 from khmer.counting_args import build_construct_args, DEFAULT_MIN_HASHSIZE
+from khmer.table_args import add_threads_args, add_table_type_args
 
 ###
 
 def main():
     parser = build_construct_args()
+    add_threads_args(parser)
+    add_table_type_args(parser)
     parser.add_argument('output_filename')
     parser.add_argument('input_filenames', nargs='+')
 
     args = parser.parse_args()
+    hash_family = khmer.HASH_FAMILIES[args.hash_family]
 
     if not args.quiet:
         if args.min_hashsize == DEFAULT_MIN_HASHSIZE:
@@ -30,6 +34,9 @@ def main():
         print>>sys.stderr, ' - kmer size =    %d \t\t(-k)' % args.ksize
         print>>sys.stderr, ' - n hashes =     %d \t\t(-N)' % args.n_hashes
         print>>sys.stderr, ' - min hashsize = %-5.2g \t(-x)' % args.min_hashsize
+        print>>sys.stderr, ' - n threads =    %d \t\t(-T)' % args.n_threads
+        if args.blocked:
+            print>>sys.stderr, ' - blocked layout \t\t(--blocked)'
         print>>sys.stderr, ''
         print>>sys.stderr, 'Estimated memory usage is %.2g bytes (n_hashes x min_hashsize)' % (args.n_hashes * args.min_hashsize)
         print>>sys.stderr, '-'*8
@@ -48,12 +55,15 @@ def main():
     ###
     
     print 'making hashtable'
-    ht = khmer.new_counting_hash(K, HT_SIZE, N_HT)
+    if args.blocked:
+        ht = khmer.new_blocked_counting_hash(K, HT_SIZE, N_HT)
+    else:
+        ht = khmer.new_counting_hash(K, HT_SIZE, N_HT, hash_family)
     ht.set_use_bigcount(True)
 
     for n, filename in enumerate(filenames):
        print 'consuming input', filename
-       ht.consume_fasta(filename)
+       ht.consume_fasta(filename, 0, 0, None, False, None, args.n_threads)
 
        if n > 0 and n % 10 == 0:
            print 'mid-save', base
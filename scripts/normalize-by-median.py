@@ -12,6 +12,7 @@ import sys, screed, os
 import khmer
 from itertools import izip
 from khmer.counting_args import build_construct_args, DEFAULT_MIN_HASHSIZE
+from khmer.table_args import add_table_type_args
 import argparse
 
 DEFAULT_DESIRED_COVERAGE=5
@@ -30,6 +31,7 @@ def validpair(r0, r1):
 
 def main():
     parser = build_construct_args()
+    add_table_type_args(parser)
     parser.add_argument('-C', '--cutoff', type=int, dest='cutoff',
                         default=DEFAULT_DESIRED_COVERAGE)
     parser.add_argument('-p', '--paired', action='store_true')
@@ -41,6 +43,7 @@ def main():
     parser.add_argument('input_filenames', nargs='+')
 
     args = parser.parse_args()
+    hash_family = khmer.HASH_FAMILIES[args.hash_family]
 
     if not args.quiet:
         if args.min_hashsize == DEFAULT_MIN_HASHSIZE:
@@ -51,6 +54,8 @@ def main():
         print>>sys.stderr, ' - n hashes =     %d \t\t(-N)' % args.n_hashes
         print>>sys.stderr, ' - min hashsize = %-5.2g \t(-x)' % args.min_hashsize
         print>>sys.stderr, ' - paired =	      %s \t\t(-p)' % args.paired
+        if args.blocked:
+            print>>sys.stderr, ' - blocked layout \t\t(--blocked)'
         print>>sys.stderr, ''
         print>>sys.stderr, 'Estimated memory usage is %.2g bytes (n_hashes x min_hashsize)' % (args.n_hashes * args.min_hashsize)
         print>>sys.stderr, '-'*8
@@ -72,7 +77,10 @@ def main():
         ht = khmer.load_counting_hash(args.loadhash)
     else:
         print 'making hashtable'
-        ht = khmer.new_counting_hash(K, HT_SIZE, N_HT)
+        if args.blocked:
+            ht = khmer.new_blocked_counting_hash(K, HT_SIZE, N_HT)
+        else:
+            ht = khmer.new_counting_hash(K, HT_SIZE, N_HT, hash_family)
 
     total = 0
     discarded = 0
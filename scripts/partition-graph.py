@@ -4,7 +4,9 @@ Partition a graph.
 
 % python scripts/partition-graph.py <base>
 
-This will output many <base>.subset.N.pmap files.
+This will output many <base>.subset.N.pmap files.  With --no-subsets, it
+partitions everything at once instead, and outputs <base>.pmap.merged
+(so merge-partitions.py isn't needed).
 
 Use '-h' for parameter help.
 """
@@ -75,6 +77,9 @@ def main():
     parser.add_argument('--threads', '-T', dest='n_threads',
                         default=DEFAULT_N_THREADS,
                         help='Number of simultaneous threads to execute')
+    parser.add_argument('--no-subsets', dest='no_subsets',
+                        action='store_true', default=False,
+                        help='Partition in one pass; save <base>.pmap.merged')
 
     args = parser.parse_args()
     basename = args.basename
@@ -109,6 +114,16 @@ def main():
     # now, partition!
     #
 
+    if args.no_subsets:
+        n_threads = int(args.n_threads)
+        print 'partitioning all tags in %d threads' % n_threads
+        ht.parallel_partition(n_threads, True, stop_big_traversals)
+
+        output_file = basename + '.pmap.merged'
+        print 'saving merged to', output_file
+        ht.save_partitionmap(output_file)
+        return
+
     # divide the tags up into subsets
     divvy = ht.divide_tags_into_subsets(int(args.subset_size))
     n_subsets = len(divvy)
@@ -1,7 +1,9 @@
 import os
 import gzip
+import string
 
 import khmer
+import screed
 import khmer_tst_utils as utils
 
 MAX_COUNT=255
@@ -497,3 +499,744 @@ def test_collect_high_abundance_kmers():
 
     kh = khmer.new_counting_hash(18, 1e6, 4)
     hb = kh.collect_high_abundance_kmers(seqpath, 2, 4)
+
+def test_consume_fasta_multiline():
+    seqpath = utils.get_temp_filename('multiline.fa')
+    fp = open(seqpath, 'w')
+    fp.write('>read1 desc\nGGTTGACGG\nGGCTCAGGG\n\n>read2\nACGTACGTACGTACGTACGT\n')
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 2, n_reads
+    assert n_consumed == 1 + 3, n_consumed
+    assert kh.get('GGTTGACGGGGCTCAGGG') == 1
+
+def test_consume_fastq_crlf():
+    seqpath = utils.get_temp_filename('crlf.fq')
+    fp = open(seqpath, 'wb')
+    fp.write('@read1\r\nGGTTGACGGGGCTCAGGG\r\n+\r\n##################\r\n')
+    fp.write('@read2\r\nGGTTGACGGGGCTCAGGG\r\n+read2\r\n@#################\r\n')
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 2, n_reads
+    assert kh.get('GGTTGACGGGGCTCAGGG') == 2
+
+def test_consume_fasta_long_read():
+    # longer than the old fixed-size line buffer.
+    seq = 'ACGGTCATTGCA' * 20000
+    seqpath = utils.get_temp_filename('long.fa')
+    fp = open(seqpath, 'w')
+    fp.write('>long\n%s\n>short\n%s\n' % (seq, seq[:20]))
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 2, n_reads
+    assert n_consumed == len(seq) - 18 + 1 + 3, n_consumed
+
+def test_consume_fasta_gz_long_read():
+    # spans several decompression buffers, and is longer than the old
+    # fixed-size gzgets line.
+    seq = 'ACGGTCATTGCA' * 200000
+    seqpath = utils.get_temp_filename('long.fq.gz')
+    fp = gzip.open(seqpath, 'wb')
+    fp.write('@long\n%s\n+\n%s\n' % (seq, '#' * len(seq)))
+    fp.write('@short\n%s\n+\n%s\n' % (seq[:20], '#' * 20))
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 2, n_reads
+    assert n_consumed == len(seq) - 18 + 1 + 3, n_consumed
+
+def test_consume_fasta_gz_named_fa():
+    # record type is detected from content, not the filename.
+    seqpath = utils.get_temp_filename('reads.fa.gz')
+    fp = gzip.open(seqpath, 'wb')
+    fp.write('@read1\nGGTTGACGGGGCTCAGGG\n+\n##################\n')
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 1, n_reads
+    assert kh.get('GGTTGACGGGGCTCAGGG') == 1
+
+def _write_bgzf(filename, data, blocksize=60000):
+    # minimal BGZF writer: one gzip member per block, plus the empty
+    # end-of-file member.
+    import struct
+    import zlib
+
+    fp = open(filename, 'wb')
+    chunks = [ data[i:i + blocksize] for i in range(0, len(data), blocksize) ]
+    for chunk in chunks + ['']:
+        c = zlib.compressobj(6, zlib.DEFLATED, -15)
+        cdata = c.compress(chunk) + c.flush()
+        bsize = 18 + len(cdata) + 8
+        fp.write(struct.pack('<BBBBIBBHBBHH', 0x1f, 0x8b, 8, 4, 0, 0, 0xff,
+                             6, ord('B'), ord('C'), 2, bsize - 1))
+        fp.write(cdata)
+        fp.write(struct.pack('<II', zlib.crc32(chunk) & 0xffffffff,
+                             len(chunk)))
+    fp.close()
+
+def test_consume_fasta_bgzf():
+    seq = 'ACGGTCATTGCA' * 10
+    records = [ '>read%d\n%s\n' % (i, seq) for i in range(5000) ]
+    seqpath = utils.get_temp_filename('reads.fa.gz')
+    _write_bgzf(seqpath, ''.join(records))
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 5000, n_reads
+    assert n_consumed == 5000 * (len(seq) - 18 + 1), n_consumed
+
+def test_consume_fasta_bgzf_then_gzip():
+    # a BGZF file with an ordinary gzip member appended still reads in
+    # full, as it does with zcat.
+    seq = 'ACGGTCATTGCA' * 10
+    records = [ '>read%d\n%s\n' % (i, seq) for i in range(5000) ]
+    seqpath = utils.get_temp_filename('reads.fa.gz')
+    _write_bgzf(seqpath, ''.join(records[:2500]))
+
+    outfp = open(seqpath, 'ab')
+    fp = gzip.GzipFile(fileobj=outfp, mode='wb')
+    fp.write(''.join(records[2500:]))
+    fp.close()
+    outfp.close()
+
+    kh = khmer.new_counting_hash(18, 1e6, 4)
+    n_reads, n_consumed = kh.consume_fasta(seqpath)
+
+    assert n_reads == 5000, n_reads
+    assert n_consumed == 5000 * (len(seq) - 18 + 1), n_consumed
+
+def _damage(filename, truncate=False):
+    data = open(filename, 'rb').read()
+    middle = len(data) / 2
+    if truncate:
+        data = data[:middle]
+    else:
+        data = data[:middle] + 'XXXXXXXX' + data[middle + 8:]
+    open(filename, 'wb').write(data)
+
+def test_consume_fasta_damaged_gz():
+    seq = 'ACGGTCATTGCA' * 10
+    data = ''.join([ '>read%d\n%s\n' % (i, seq) for i in range(5000) ])
+
+    for bgzf in (True, False):
+        for truncate in (True, False):
+            seqpath = utils.get_temp_filename('damaged.fa.gz')
+            if bgzf:
+                _write_bgzf(seqpath, data)
+            else:
+                fp = gzip.open(seqpath, 'wb')
+                fp.write(data)
+                fp.close()
+            _damage(seqpath, truncate)
+
+            for n_threads in (1, 4):
+                kh = khmer.new_counting_hash(18, 1e6, 4)
+                try:
+                    kh.consume_fasta(seqpath, 0, 0, None, False, None,
+                                     n_threads)
+                    assert 0, (bgzf, truncate, n_threads)
+                except IOError:
+                    pass
+
+def test_consume_fasta_threaded():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh1 = khmer.new_counting_hash(12, 1e5, 4)
+    n_reads1, n_consumed1 = kh1.consume_fasta(seqpath)
+
+    kh4 = khmer.new_counting_hash(12, 1e5, 4)
+    n_reads4, n_consumed4 = kh4.consume_fasta(seqpath, 0, 0, None, False,
+                                              None, 4)
+
+    assert n_reads1 == n_reads4 == 25000, (n_reads1, n_reads4)
+    assert n_consumed1 == n_consumed4, (n_consumed1, n_consumed4)
+
+    for n, record in enumerate(screed.open(seqpath)):
+        if n >= 100:
+            break
+        for i in range(len(record.sequence) - 12 + 1):
+            kmer = record.sequence[i:i + 12]
+            assert kh1.get(kmer) == kh4.get(kmer), kmer
+
+def test_consume_fasta_bad_threads():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh = khmer.new_counting_hash(12, 1e5, 4)
+    for n_threads in (0, -1):
+        try:
+            kh.consume_fasta(seqpath, 0, 0, None, False, None, n_threads)
+            assert 0, "should fail"
+        except ValueError:
+            pass
+
+def test_consume_fasta_threaded_readmask():
+    # sequence #4 (index 3) is too short, and should get masked out.
+    seqpath = utils.get_test_data('simple_2.fa')
+
+    readmask = khmer.new_readmask(4)
+    kh = khmer.new_counting_hash(10, 4**10, 1)
+    n_reads, n_consumed = kh.consume_fasta(seqpath, 0, 0, readmask, True,
+                                           None, 4)
+
+    assert n_reads == 4, n_reads
+    assert n_consumed == 63, n_consumed
+    assert readmask.get(0)
+    assert readmask.get(1)
+    assert readmask.get(2)
+    assert not readmask.get(3)
+
+def test_consume_fasta_threaded_bigcount():
+    seqpath = utils.get_temp_filename('repeats.fa')
+    fp = open(seqpath, 'w')
+    for i in range(3000):
+        fp.write('>read%d\nGGTTGACGGGGCTCAGGGGGTTGACG\n' % i)
+    fp.close()
+
+    kh = khmer.new_counting_hash(18, 1e5, 4)
+    kh.set_use_bigcount(True)
+    n_reads, n_consumed = kh.consume_fasta(seqpath, 0, 0, None, False,
+                                           None, 4)
+
+    assert n_reads == 3000, n_reads
+    assert kh.get('GGTTGACGGGGCTCAGGG') == 3000, kh.get('GGTTGACGGGGCTCAGGG')
+    assert kh.get('GTTGACGGGGCTCAGGGG') == 3000
+
+    # and without bigcount, the counters saturate.
+    kh = khmer.new_counting_hash(18, 1e5, 4)
+    kh.consume_fasta(seqpath, 0, 0, None, False, None, 4)
+    assert kh.get('GGTTGACGGGGCTCAGGG') == MAX_COUNT
+
+def test_blocked_counts():
+    # count-min never undercounts, and is exact when the table is sparse.
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh1 = khmer.new_counting_hash(12, 1e7, 4)
+    kh1.consume_fasta(seqpath)
+
+    kh2 = khmer.new_blocked_counting_hash(12, 1e7, 4)
+    kh2.consume_fasta(seqpath)
+
+    assert kh2.hashsizes() == kh1.hashsizes()
+
+    n_same = 0
+    n_total = 0
+    for n, record in enumerate(screed.open(seqpath)):
+        if n >= 100:
+            break
+        for i in range(len(record.sequence) - 12 + 1):
+            kmer = record.sequence[i:i + 12]
+            assert kh2.get(kmer) >= 1
+            n_total += 1
+            if kh2.get(kmer) == kh1.get(kmer):
+                n_same += 1
+        assert kh2.get_median_count(record.sequence)[0] >= 1
+
+    assert n_same > n_total * 0.99, (n_same, n_total)
+
+def test_blocked_n_tables():
+    # a block has 64 counters, one for each table.
+    kh = khmer.new_blocked_counting_hash(12, 1e3, 64)
+    assert len(kh.hashsizes()) == 64
+
+    for n_tables in (0, 65):
+        try:
+            khmer.new_blocked_counting_hash(12, 1e3, n_tables)
+            assert 0, "should fail"
+        except ValueError:
+            pass
+
+def test_blocked_threaded():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh1 = khmer.new_blocked_counting_hash(12, 1e5, 4)
+    kh1.consume_fasta(seqpath)
+
+    kh4 = khmer.new_blocked_counting_hash(12, 1e5, 4)
+    kh4.consume_fasta(seqpath, 0, 0, None, False, None, 4)
+
+    assert kh1.n_occupied() == kh4.n_occupied()
+
+    for n, record in enumerate(screed.open(seqpath)):
+        if n >= 100:
+            break
+        for i in range(len(record.sequence) - 12 + 1):
+            kmer = record.sequence[i:i + 12]
+            assert kh1.get(kmer) == kh4.get(kmer), kmer
+
+def test_blocked_bigcount_save_load():
+    for suffix in ('.kh', '.kh.gz'):
+        savepath = utils.get_temp_filename('blockedsave' + suffix)
+
+        kh = khmer.new_blocked_counting_hash(12, 1e5, 4)
+        kh.set_use_bigcount(True)
+        for i in range(500):
+            kh.count('GGTTGACGGGGC')
+        kh.consume(DNA)
+        kh.save(savepath)
+
+        for mmap in (False, True):
+            kh2 = khmer.load_counting_hash(savepath, mmap)
+            assert kh2.get_use_bigcount()
+            assert kh2.hashsizes() == kh.hashsizes()
+            assert kh2.get('GGTTGACGGGGC') == 500
+            assert kh2.get(DNA[:12]) == kh.get(DNA[:12])
+            assert kh2.n_occupied() == kh.n_occupied()
+
+        # the .gz save is chunked, as for classic tables.
+        if suffix.endswith('.gz'):
+            data = open(savepath, 'rb').read()
+            assert data[12:14] == 'KC'
+
+        # and classic tables still load as classic tables.
+        kh3 = khmer.new_counting_hash(12, 1e5, 4)
+        kh3.consume(DNA)
+        kh3.save(savepath)
+
+        kh4 = khmer.load_counting_hash(savepath)
+        assert kh4.n_occupied() == kh3.n_occupied()
+        assert kh4.get(DNA[:12]) == 1
+
+def test_hash_family_mix_save_load():
+    for suffix in ('.kh', '.kh.gz'):
+        savepath = utils.get_temp_filename('mixsave' + suffix)
+
+        kh = khmer.new_counting_hash(12, 1e5, 4, khmer.HASH_FAMILY_MIX)
+        kh.set_use_bigcount(True)
+        for i in range(500):
+            kh.count('GGTTGACGGGGC')
+        kh.consume(DNA)
+        assert kh.get('GGTTGACGGGGC') == 500
+        kh.save(savepath)
+
+        kh2 = khmer.load_counting_hash(savepath)
+        assert kh2.hash_family() == khmer.HASH_FAMILY_MIX
+        assert kh2.get('GGTTGACGGGGC') == 500
+        assert kh2.get(DNA[:12]) == kh.get(DNA[:12])
+
+def test_hash_family_mix_threaded():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh1 = khmer.new_counting_hash(12, 1e5, 4, khmer.HASH_FAMILY_MIX)
+    kh1.consume_fasta(seqpath)
+
+    kh4 = khmer.new_counting_hash(12, 1e5, 4, khmer.HASH_FAMILY_MIX)
+    kh4.consume_fasta(seqpath, 0, 0, None, False, None, 4)
+
+    for n, record in enumerate(screed.open(seqpath)):
+        if n >= 100:
+            break
+        for i in range(len(record.sequence) - 12 + 1):
+            kmer = record.sequence[i:i + 12]
+            assert kh1.get(kmer) == kh4.get(kmer), kmer
+
+def test_kmers_lowercase():
+    # the one-pass k-mer extraction handles lower case like upper case,
+    # including across its 16-base blocks.
+    seq = DNA * 2
+    kh = khmer.new_counting_hash(20, 1e6, 4)
+    kh.consume(seq.lower())
+
+    for i in range(len(seq) - 20 + 1):
+        assert kh.get(seq[i:i + 20]) >= 1, i
+
+    assert kh.get_median_count(seq) == kh.get_median_count(seq.lower())
+    assert kh.trim_on_abundance(seq.lower(), 1) == (seq.lower(), len(seq))
+
+def test_kmers_bad_chars():
+    # reads with non-ACGT characters are not valid, but are still hashed
+    # (as 'G') where nothing checks them.
+    seq = DNA[:40] + 'N' + DNA[41:]
+    kh = khmer.new_counting_hash(20, 1e6, 4)
+    kh.consume(seq)
+
+    g_seq = DNA[:40] + 'G' + DNA[41:]
+    assert kh.get(g_seq[30:50]) == 1
+    assert kh.get_median_count(seq) == kh.get_median_count(g_seq)
+
+    trim_seq, trim_at = kh.trim_on_abundance(seq, 1)
+    assert trim_at == 0, trim_at
+
+def test_unique_rc_off():
+    # forward-strand only: a k-mer and its reverse complement are distinct.
+    rc = DNA[::-1].translate(string.maketrans('ACGT', 'TGCA'))
+
+    khmer.set_unique_rc(False)
+    try:
+        assert not khmer.get_unique_rc()
+        kh_f = khmer.new_counting_hash(20, 1e6, 4)
+    finally:
+        khmer.set_unique_rc(True)
+
+    # a table keeps the mode it was made in, alongside one in the other.
+    kh = khmer.new_counting_hash(20, 1e6, 4)
+    kh.consume(DNA)
+    kh_f.consume(DNA)
+
+    assert kh_f.get(DNA[:20]) == 1
+    assert kh_f.get(rc[-20:]) == 0
+    assert kh_f.get_median_count(DNA)[0] == 1
+    assert kh_f.get_median_count(rc)[0] == 0
+
+    assert kh.get(rc[-20:]) == 1
+    assert kh.get_median_count(rc)[0] == 1
+
+    # and the threaded path, which picks its loop once a batch.
+    fapath = utils.get_temp_filename('dna.fa')
+    open(fapath, 'w').write('>dna\n%s\n' % DNA)
+    kh_f.consume_fasta(fapath, 0, 0, None, False, None, 2)
+    kh.consume_fasta(fapath, 0, 0, None, False, None, 2)
+    assert kh_f.get(DNA[:20]) == 2
+    assert kh_f.get(rc[-20:]) == 0
+    assert kh.get(rc[-20:]) == 2
+
+def test_unique_rc_off_save_load():
+    # a table remembers which strand mode it was saved in, and won't load
+    # in the other.
+    savepath = utils.get_temp_filename('forward.kh')
+
+    khmer.set_unique_rc(False)
+    try:
+        kh = khmer.new_counting_hash(20, 1e6, 4)
+        kh.consume(DNA)
+        kh.save(savepath)
+
+        kh = khmer.new_counting_hash(20, 1, 1)
+        kh.load(savepath)
+        assert kh.get(DNA[:20]) == 1
+    finally:
+        khmer.set_unique_rc(True)
+
+    kh = khmer.new_counting_hash(20, 1e6, 4)
+    kh.consume(DNA)
+    for load in (kh.load, kh.load_mmap):
+        try:
+            load(savepath)
+            assert 0, "should fail"
+        except IOError, e:
+            assert 'forward strand' in str(e), str(e)
+
+    # and the table it had is still there.
+    assert kh.get(DNA[:20]) == 1
+
+    savepath2 = utils.get_temp_filename('both.kh')
+    kh.save(savepath2)
+
+    khmer.set_unique_rc(False)
+    try:
+        kh_f = khmer.new_counting_hash(20, 1, 1)
+    finally:
+        khmer.set_unique_rc(True)
+    try:
+        kh_f.load(savepath2)
+        assert 0, "should fail"
+    except IOError, e:
+        assert 'both strands' in str(e), str(e)
+
+    # changing the mode later doesn't change a table's own.
+    khmer.set_unique_rc(False)
+    try:
+        kh.load(savepath2)
+        assert kh.get(DNA[:20]) == 1
+    finally:
+        khmer.set_unique_rc(True)
+
+def test_read_stats_match_get():
+    # the per-read statistics look k-mers up in bulk; check them against
+    # one-at-a-time lookups, on both layouts.
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    for new_hash in (khmer.new_counting_hash,
+                     khmer.new_blocked_counting_hash):
+        kh = new_hash(12, 1e4, 4)
+        kh.consume_fasta(seqpath)
+
+        for n, record in enumerate(screed.open(seqpath)):
+            if n >= 50:
+                break
+            seq = record.sequence
+            counts = [ kh.get(seq[i:i + 12]) for i in range(len(seq) - 12 + 1) ]
+
+            assert kh.get_min_count(seq) == min(counts)
+            assert kh.get_max_count(seq) == max(counts)
+            assert kh.get_median_count(seq)[0] == \
+                   sorted(counts)[len(counts) / 2]
+
+            threshold = sorted(counts)[len(counts) / 4]
+            trim_at = kh.trim_on_abundance(seq, threshold)[1]
+            if counts[0] < threshold:
+                assert trim_at == 0
+            elif min(counts) >= threshold:
+                assert trim_at == len(seq)
+            else:
+                first_bad = [ c < threshold for c in counts ].index(True)
+                assert trim_at == first_bad + 12 - 1
+
+def test_consume_fasta_staged():
+    # staged loading makes exactly the same table, bigcounts included.
+    seqpath = utils.get_test_data('test-reads.fa')
+    path1 = utils.get_temp_filename('unstaged.kh')
+    path2 = utils.get_temp_filename('staged.kh')
+
+    kh1 = khmer.new_counting_hash(12, 1e3, 4)
+    kh1.set_use_bigcount(True)
+    kh1.consume_fasta(seqpath)
+    kh1.save(path1)
+
+    kh2 = khmer.new_counting_hash(12, 1e3, 4)
+    kh2.set_use_bigcount(True)
+    kh2.consume_fasta(seqpath, 0, 0, None, False, None, 1, True)
+    kh2.save(path2)
+
+    assert kh1.get('GGTTGACGGGGCTCAGGG'[:12]) > MAX_COUNT
+    assert open(path1, 'rb').read() == open(path2, 'rb').read()
+
+def test_consume_fasta_staged_threaded():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh1 = khmer.new_counting_hash(12, 1e5, 4)
+    kh1.consume_fasta(seqpath)
+
+    kh4 = khmer.new_counting_hash(12, 1e5, 4)
+    kh4.consume_fasta(seqpath, 0, 0, None, False, None, 4, True)
+
+    assert kh1.n_occupied() == kh4.n_occupied()
+
+    for n, record in enumerate(screed.open(seqpath)):
+        if n >= 100:
+            break
+        for i in range(len(record.sequence) - 12 + 1):
+            kmer = record.sequence[i:i + 12]
+            assert kh1.get(kmer) == kh4.get(kmer), kmer
+
+def test_alloc_policy():
+    # every policy falls back gracefully, and makes a working table.
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    kh = khmer.new_counting_hash(12, 1e5, 4)
+    kh.consume_fasta(seqpath)
+
+    for policy in (khmer.ALLOC_HUGEPAGES, khmer.ALLOC_HUGETLB,
+                   khmer.ALLOC_NUMA_INTERLEAVE,
+                   khmer.ALLOC_HUGEPAGES | khmer.ALLOC_NUMA_FIRST_TOUCH):
+        khmer.set_alloc_policy(policy)
+        try:
+            assert khmer.get_alloc_policy() == policy
+            kh2 = khmer.new_counting_hash(12, 1e5, 4)
+            ht2 = khmer.new_blocked_hashbits(12, 1e5, 4)
+        finally:
+            khmer.set_alloc_policy(0)
+
+        kh2.consume_fasta(seqpath)
+        ht2.consume_fasta(seqpath)
+        assert kh2.n_occupied() == kh.n_occupied()
+        assert ht2.get('GGTTGACGGGGC')
+        del kh2, ht2
+
+def test_alloc_policy_bad():
+    try:
+        khmer.set_alloc_policy(1024)
+        assert 0, "should fail"
+    except ValueError:
+        pass
+    assert khmer.get_alloc_policy() == 0
+
+def test_clear():
+    seqpath = utils.get_test_data('test-reads.fa')
+
+    for policy in (0, khmer.ALLOC_HUGEPAGES, khmer.ALLOC_NUMA_FIRST_TOUCH):
+        khmer.set_alloc_policy(policy)
+        try:
+            kh = khmer.new_counting_hash(12, 1e5, 4)
+            bh = khmer.new_blocked_counting_hash(12, 1e5, 4)
+        finally:
+            khmer.set_alloc_policy(0)
+
+        for ht in (kh, bh):
+            ht.set_use_bigcount(True)
+            ht.consume_fasta(seqpath)
+            n_occupied = ht.n_occupied()
+            count = ht.get('GGTTGACGGGGC')
+            assert n_occupied and count
+
+            ht.clear()
+            assert ht.n_occupied() == 0
+            assert ht.get('GGTTGACGGGGC') == 0
+
+            ht.consume_fasta(seqpath)
+            assert ht.n_occupied() == n_occupied
+            assert ht.get('GGTTGACGGGGC') == count
+
+def _read_sections(filename):
+    import struct
+
+    data = open(filename, 'rb').read()
+    n_sections, directory_offset = struct.unpack('=IQ', data[4:16])
+
+    sections = []
+    for i in range(n_sections):
+        start = directory_offset + i * 24
+        type, crc, offset, length = struct.unpack('=IIQQ',
+                                                  data[start:start + 24])
+        sections.append((type, data[offset:offset + length]))
+    return sections
+
+def _write_v3_counting(sectioned, filename, ksize):
+    # the same tables and bigcounts, in the version 3 layout.
+    import struct
+
+    sections = _read_sections(sectioned)
+    tables = [ body for (type, body) in sections if type == 2 ]
+    bigcounts = [ body for (type, body) in sections if type == 3 ][0]
+
+    fp = open(filename, 'wb')
+    fp.write(struct.pack('=BBBIB', 3, 1, 1, ksize, len(tables)))
+    for table in tables:
+        fp.write(struct.pack('=Q', len(table)))
+        fp.write(table)
+    fp.write(struct.pack('=Q', len(bigcounts) // 10))
+    fp.write(bigcounts)
+    fp.close()
+
+def test_save_load_mmap():
+    seqpath = utils.get_test_data('test-reads.fa')
+    savepath = utils.get_temp_filename('mapped.kh')
+    oldpath = utils.get_temp_filename('v3.kh')
+
+    kh = khmer.new_counting_hash(12, 1e5, 4)
+    kh.set_use_bigcount(True)
+    kh.consume_fasta(seqpath)
+    for i in range(300):
+        kh.count('AAAAAAAAAAAA')
+    assert kh.get('AAAAAAAAAAAA') > 255
+    kh.save(savepath)
+
+    _write_v3_counting(savepath, oldpath, 12)
+
+    # the sectioned format: the parameters, then the first table, each
+    # on its own page.
+    data = open(savepath, 'rb').read()
+    assert ord(data[0]) == 6
+    assert data[8192:8192 + 100] == open(oldpath, 'rb').read()[16:116]
+
+    seq = open(seqpath).read().split('\n')[1]
+    for loaded in (khmer.load_counting_hash(savepath),
+                   khmer.load_counting_hash(savepath, mmap=True),
+                   khmer.load_counting_hash(oldpath),
+                   khmer.load_counting_hash(oldpath, mmap=True)):
+        assert loaded.get_use_bigcount()
+        assert loaded.get('AAAAAAAAAAAA') == kh.get('AAAAAAAAAAAA')
+        assert loaded.n_occupied() == kh.n_occupied()
+        assert loaded.get_median_count(seq) == kh.get_median_count(seq)
+
+    # writes stay in this process; the file is untouched.
+    mapped = khmer.load_counting_hash(savepath, mmap=True)
+    count = mapped.get('GGTTGACGGGGC')
+    mapped.count('GGTTGACGGGGC')
+    assert mapped.get('GGTTGACGGGGC') == count + 1
+    mapped.clear()
+    assert mapped.n_occupied() == 0
+    assert open(savepath, 'rb').read() == data
+
+def test_save_load_chunked_gz():
+    seqpath = utils.get_test_data('test-reads.fa')
+    savepath = utils.get_temp_filename('chunked.kh')
+    gzpath = utils.get_temp_filename('chunked.kh.gz')
+
+    # 2 x 10m bins is several chunks.
+    kh = khmer.new_counting_hash(12, 1e7, 2)
+    kh.set_use_bigcount(True)
+    kh.consume_fasta(seqpath)
+    for i in range(300):
+        kh.count('AAAAAAAAAAAA')
+    kh.save(savepath)
+    kh.save(gzpath)
+
+    # each member says how big it is ("KC"), and it is still gzip: it
+    # unpacks to the uncompressed save.
+    data = open(gzpath, 'rb').read()
+    assert data[:2] == '\x1f\x8b'
+    assert data[12:14] == 'KC'
+    assert gzip.open(gzpath, 'rb').read() == open(savepath, 'rb').read()
+    assert len(data) < os.path.getsize(savepath) / 4
+
+    seq = open(seqpath).read().split('\n')[1]
+    loaded = khmer.load_counting_hash(gzpath)
+    assert loaded.get_use_bigcount()
+    assert loaded.get('AAAAAAAAAAAA') == kh.get('AAAAAAAAAAAA')
+    assert loaded.n_occupied() == kh.n_occupied()
+    assert loaded.get_median_count(seq) == kh.get_median_count(seq)
+
+def _io_fails(call, path, message):
+    try:
+        call(path)
+        assert 0, "should fail"
+    except IOError, e:
+        assert message in str(e), str(e)
+
+def test_load_corrupt():
+    # damaged files raise IOError, and leave the table that was there.
+    seqpath = utils.get_test_data('test-reads.fa')
+    savepath = utils.get_temp_filename('saved.kh')
+    badpath = utils.get_temp_filename('bad.kh')
+
+    kh = khmer.new_counting_hash(12, 1e5, 2)
+    kh.consume_fasta(seqpath)
+    kh.save(savepath)
+    data = open(savepath, 'rb').read()
+
+    # a byte of the first table, which starts on the third page.
+    bad = data[:8192 + 10] + chr(ord(data[8192 + 10]) ^ 0xff) + \
+        data[8192 + 11:]
+    open(badpath, 'wb').write(bad)
+    _io_fails(khmer.load_counting_hash, badpath, 'CRC')
+
+    kh2 = khmer.new_counting_hash(12, 1e5, 2)
+    kh2.count('AAAAAAAAAAAA')
+    _io_fails(kh2.load, badpath, 'CRC')
+    assert kh2.get('AAAAAAAAAAAA') == 1
+    assert kh2.n_occupied() == 1
+
+    # cut short, for both ways of loading.
+    open(badpath, 'wb').write(data[:len(data) / 2])
+    _io_fails(kh2.load, badpath, badpath)
+    _io_fails(kh2.load_mmap, badpath, badpath)
+    assert kh2.get('AAAAAAAAAAAA') == 1
+
+    # the wrong kind of file.
+    _io_fails(kh2.load, utils.get_test_data('test-reads.fa'), 'test-reads')
+
+    # a corrupt chunk of a compressed save.
+    gzpath = utils.get_temp_filename('saved.kh.gz')
+    kh.save(gzpath)
+    data = open(gzpath, 'rb').read()
+    middle = len(data) / 2
+    open(gzpath, 'wb').write(data[:middle] + chr(ord(data[middle]) ^ 0xff) +
+                             data[middle + 1:])
+    _io_fails(khmer.load_counting_hash, gzpath, gzpath)
+
+def test_save_fails():
+    # a file that can't be written raises IOError, compressed or not.
+    badpath = os.path.join(utils.get_temp_filename('nodir'), 'saved.kh')
+
+    kh = khmer.new_counting_hash(12, 1e3, 2)
+    _io_fails(kh.save, badpath, "can't open")
+    _io_fails(kh.save, badpath + '.gz', "can't open")
+
+    ht = khmer.new_hashbits(12, 1e3, 2)
+    _io_fails(ht.save, badpath, "can't open")
+    _io_fails(ht.save_tagset, badpath, "can't open")
@@ -173,6 +173,60 @@ class Test_InexactGraphFu(object):
         x = ht.calc_connected_graph_size(word)
         assert x == 2
 
+    def test_long_path(self):
+        # far longer than the stack would allow, when this recursed.
+        import random
+        r = random.Random(1)
+        seq = "".join([ r.choice("ACGT") for i in range(200000) ])
+
+        ht = khmer.new_hashbits(31, 1e7, 4)
+        ht.consume(seq)
+
+        x = ht.calc_connected_graph_size(seq[:31], 150000)
+        assert x == 150000, x
+
+        x = ht.calc_connected_graph_size(seq[100000:100031])
+        assert x >= len(seq) - 31 + 1, x
+
+    def test_threaded_traversal(self):
+        # dense enough that the searches fan out, and go parallel.
+        import random
+        r = random.Random(2)
+        seq = "".join([ r.choice("ACGT") for i in range(200000) ])
+
+        ht = khmer.new_hashbits(10, 4**10 + 1, 1)
+        ht.consume(seq)
+
+        results = []
+        for n_threads in (1, 4):
+            ht.set_traversal_threads(n_threads)
+            results.append((ht.calc_connected_graph_size(seq[:10]),
+                            ht.calc_connected_graph_size(seq[:10], 20000),
+                            ht.count_kmers_within_radius(seq[:10], 20, 30000),
+                            ht.find_radius_for_volume(seq[:10], 20000, 100),
+                            ht.count_kmers_on_radius(seq[:10], 5, 0)))
+
+        assert results[0][0] > 100000, results
+        assert results[0] == results[1], results
+
+    def test_all_ones_kmer(self):
+        # forward-strand only, 'G'*32 hashes to all ones.
+        khmer.set_unique_rc(False)
+        try:
+            ht = khmer.new_hashbits(32, 4**8+1, 4)
+            ht.consume('G' * 33)
+            x = ht.calc_connected_graph_size('G' * 32)
+            assert x == 1, x
+
+            ht.consume('G' * 32 + 'A')
+            ht.consume('C' + 'G' * 31)
+            x = ht.calc_connected_graph_size('G' * 32)
+            assert x == 3, x
+            x = ht.calc_connected_graph_size('G' * 31 + 'A')
+            assert x == 3, x
+        finally:
+            khmer.set_unique_rc(True)
+
 ###
 
 class Test_Partitioning(object):
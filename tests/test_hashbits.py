@@ -73,6 +73,207 @@ def test_bloom_c_1():
    assert ht3.n_occupied() == 3882
    assert ht3.n_unique_kmers() == 3960
 
+def test_bloom_c_threaded():
+   ### concurrent loading sets the same bits as serial loading
+   filename = utils.get_test_data('test-reads.fa')
+
+   K = 20 # size of kmer
+   HT_SIZE= 100000 # size of hashtable
+   N_HT = 3 # number of hashtables
+
+   ht1 = khmer.new_hashbits(K, HT_SIZE, N_HT)
+   ht1.consume_fasta(filename)
+
+   ht4 = khmer.new_hashbits(K, HT_SIZE, N_HT)
+   ht4.consume_fasta(filename, 0, 0, None, False, None, 4)
+
+   assert ht1.n_occupied() == ht4.n_occupied()
+
+   for n, record in enumerate(fasta_iter(open(filename))):
+      if n >= 100:
+         break
+      sequence = record['sequence']
+      for i in range(0, len(sequence) + 1 - K):
+         assert ht4.get(sequence[i:i + K])
+
+def test_bloom_c_bad_threads():
+   filename = utils.get_test_data('test-reads.fa')
+
+   ht = khmer.new_hashbits(20, 100000, 3)
+   for n_threads in (0, -1):
+      try:
+         ht.consume_fasta(filename, 0, 0, None, False, None, n_threads)
+         assert 0, "should fail"
+      except ValueError:
+         pass
+
+def test_blocked_n_tables():
+   ### a block has 512 bits, one for each table
+   for n_tables in (0, 513):
+      try:
+         khmer.new_blocked_hashbits(20, 1e3, n_tables)
+         assert 0, "should fail"
+      except ValueError:
+         pass
+
+def test_blocked_bloom():
+   ### the blocked layout holds every k-mer the classic one does
+   filename = utils.get_test_data('test-reads.fa')
+
+   K = 20 # size of kmer
+   HT_SIZE= 3000000 # size of hashtable
+   N_HT = 3 # number of hashtables
+
+   ht1 = khmer.new_hashbits(K, HT_SIZE, N_HT)
+   ht1.consume_fasta(filename)
+
+   ht2 = khmer.new_blocked_hashbits(K, HT_SIZE, N_HT)
+   ht2.consume_fasta(filename)
+
+   assert ht2.hashsizes() == ht1.hashsizes()
+   n_unique = ht1.n_unique_kmers()
+   assert abs(ht2.n_unique_kmers() - n_unique) < n_unique / 100
+
+   # the blocked layout pays a little in fp rate for its locality.
+   fp1 = ht1.false_positive_rate()
+   fp2 = ht2.false_positive_rate()
+   assert abs(fp1 - khmer.calc_expected_collisions(ht1)) < 0.001
+   assert fp1 < fp2 < 0.1, (fp1, fp2)
+
+   for n, record in enumerate(fasta_iter(open(filename))):
+      if n >= 100:
+         break
+      sequence = record['sequence']
+      for i in range(0, len(sequence) + 1 - K):
+         assert ht2.get(sequence[i:i + K])
+
+def test_bloom_c_staged():
+   ### staged loading sets the same bits, & finds the same unique k-mers
+   filename = utils.get_test_data('test-reads.fa')
+
+   ht1 = khmer.new_hashbits(20, 100000, 3)
+   ht1.consume_fasta(filename)
+
+   ht2 = khmer.new_hashbits(20, 100000, 3)
+   ht2.consume_fasta(filename, 0, 0, None, False, None, 1, True)
+
+   assert ht1.n_occupied() == ht2.n_occupied()
+   assert ht1.n_unique_kmers() == ht2.n_unique_kmers()
+
+   path1 = utils.get_temp_filename('unstaged.ht')
+   path2 = utils.get_temp_filename('staged.ht')
+   ht1.save(path1)
+   ht2.save(path2)
+   assert open(path1, 'rb').read() == open(path2, 'rb').read()
+
+def test_clear():
+   filename = utils.get_test_data('test-reads.fa')
+
+   for ht in (khmer.new_hashbits(20, 100000, 3),
+              khmer.new_blocked_hashbits(20, 100000, 3)):
+      ht.consume_fasta(filename)
+      n_occupied = ht.n_occupied()
+      n_unique = ht.n_unique_kmers()
+      assert n_occupied
+
+      ht.clear()
+      assert ht.n_occupied() == 0
+      assert ht.n_unique_kmers() == 0
+      assert ht.false_positive_rate() == 0
+
+      ht.consume_fasta(filename)
+      assert ht.n_occupied() == n_occupied
+      assert ht.n_unique_kmers() == n_unique
+
+def test_save_load_mmap():
+   filename = utils.get_test_data('test-reads.fa')
+   savepath = utils.get_temp_filename('mapped.ht')
+
+   ht = khmer.new_hashbits(20, 100000, 3, khmer.HASH_FAMILY_MIX)
+   ht.consume_fasta(filename)
+   ht.save(savepath)
+   data = open(savepath, 'rb').read()
+   assert ord(data[0]) == 6
+
+   seq = open(filename).read().split('\n')[1]
+   ht2 = khmer.load_hashbits(savepath, mmap=True)
+   assert ht2.hash_family() == khmer.HASH_FAMILY_MIX
+   assert ht2.n_occupied() == ht.n_occupied()
+   assert ht2.n_unique_kmers() == ht.n_unique_kmers()
+   for i in range(0, len(seq) + 1 - 20):
+      assert ht2.get(seq[i:i + 20])
+
+   ht2.clear()
+   assert ht2.n_occupied() == 0
+   assert open(savepath, 'rb').read() == data
+
+def test_blocked_bloom_threaded():
+   filename = utils.get_test_data('test-reads.fa')
+
+   ht1 = khmer.new_blocked_hashbits(20, 100000, 3)
+   ht1.consume_fasta(filename)
+
+   ht4 = khmer.new_blocked_hashbits(20, 100000, 3)
+   ht4.consume_fasta_and_tag(filename, None, 4)
+
+   assert ht1.n_occupied() == ht4.n_occupied()
+
+def test_consume_fasta_and_tag_bad_threads():
+   filename = utils.get_test_data('test-reads.fa')
+
+   ht = khmer.new_hashbits(20, 100000, 3)
+   for n_threads in (0, -1):
+      try:
+         ht.consume_fasta_and_tag(filename, None, n_threads)
+         assert 0, "should fail"
+      except ValueError:
+         pass
+
+def test_blocked_save_load():
+   inpath = utils.get_test_data('random-20-a.fa')
+   savepath = utils.get_temp_filename('tempblockedsave0.ht')
+
+   ht = khmer.new_blocked_hashbits(20, 1e5, 4)
+   ht.consume_fasta(inpath)
+   ht.save(savepath)
+
+   data = open(savepath, 'rb').read()
+   assert ord(data[0]) == 6                       # the sectioned format.
+
+   record = iter(fasta_iter(open(inpath))).next()
+   seq = record['sequence']
+   for mmap in (False, True):
+      ht2 = khmer.load_hashbits(savepath, mmap)
+
+      assert ht2.ksize() == 20
+      assert ht2.hashsizes() == ht.hashsizes()
+      assert ht2.false_positive_rate() == ht.false_positive_rate()
+      assert ht2.n_occupied() == ht.n_occupied()
+      assert ht2.n_unique_kmers() == ht.n_unique_kmers()
+
+      for i in range(0, len(seq) + 1 - 20):
+         assert ht2.get(seq[i:i + 20])
+
+   # it remembers which strand mode it was saved in.
+   khmer.set_unique_rc(False)
+   try:
+      try:
+         khmer.load_hashbits(savepath)
+         assert 0, "should fail"
+      except IOError, e:
+         assert 'both strands' in str(e), str(e)
+   finally:
+      khmer.set_unique_rc(True)
+
+   # a classic table should not be mistaken for a blocked one.
+   ht3 = khmer.new_hashbits(20, 1e5, 4)
+   ht3.consume(seq)
+   ht3.save(savepath)
+
+   ht4 = khmer.load_hashbits(savepath)
+   assert ht4.n_occupied() == ht3.n_occupied()    # saved with the table
+   assert ht4.get(seq[:20])
+
 def test_n_occupied_2(): # simple one
    K=4
    HT_SIZE = 10 # use 11
@@ -248,13 +449,12 @@ def test_save_load_tagset():
    ht.load_tagset(outfile)              # implicitly => clear_tags=True
    ht.save_tagset(outfile)
 
-   # if tags have been cleared, then the new tagfile will be larger (30 bytes);
-   # else smaller (22 bytes).
+   # if tags have been cleared, then the new tagfile will have one tag;
+   # else two.
 
-   fp = open(outfile, 'rb')
-   data = fp.read()
-   fp.close()
-   assert len(data) == 22, len(data)
+   ht2 = khmer.new_hashbits(32, 1, 1)
+   ht2.load_tagset(outfile)
+   assert len(ht2.get_tagset()) == 1, ht2.get_tagset()
    
 def test_save_load_tagset_noclear():
    ht = khmer.new_hashbits(32, 1, 1)
@@ -269,13 +469,80 @@ def test_save_load_tagset_noclear():
    ht.load_tagset(outfile, False)       # set clear_tags => False; zero tags
    ht.save_tagset(outfile)
 
-   # if tags have been cleared, then the new tagfile will be large (30 bytes);
-   # else small (22 bytes).
+   # if tags have been cleared, then the new tagfile will have one tag;
+   # else two.
 
-   fp = open(outfile, 'rb')
-   data = fp.read()
-   fp.close()
-   assert len(data) == 30, len(data)
+   ht2 = khmer.new_hashbits(32, 1, 1)
+   ht2.load_tagset(outfile)
+   assert len(ht2.get_tagset()) == 2, ht2.get_tagset()
+
+def test_load_tagset_other_strand_mode():
+   outfile = utils.get_temp_filename('tagset')
+
+   khmer.set_unique_rc(False)
+   try:
+      ht_f = khmer.new_hashbits(32, 1, 1)
+   finally:
+      khmer.set_unique_rc(True)
+   ht_f.add_tag('A'*32)
+   ht_f.save_tagset(outfile)
+
+   ht = khmer.new_hashbits(32, 1, 1)
+   ht.add_tag('A'*32)
+   ht.add_tag('G'*32)
+   try:
+      ht.load_tagset(outfile)
+      assert 0, "should fail"
+   except IOError:
+      pass
+
+   # nothing was cleared.
+   assert len(ht.get_tagset()) == 2, ht.get_tagset()
+
+def test_save_load_tagset_many():
+   import itertools
+
+   ht = khmer.new_hashbits(12, 1, 1)
+
+   # enough tags for the set to grow a few times; no two of these are
+   # reverse complements.
+   kmers = [ 'AAAAA' + ''.join(x) + 'C' for x in
+             itertools.product('ACGT', repeat=6) ]
+   for kmer in kmers:
+      ht.add_tag(kmer)
+      ht.add_tag(kmer)
+   assert ht.n_tags() == len(kmers)
+
+   tags = ht.get_tagset()
+   assert len(set(tags)) == len(kmers)
+
+   outfile = utils.get_temp_filename('tagset')
+   ht.save_tagset(outfile)
+
+   ht2 = khmer.new_hashbits(12, 1, 1)
+   ht2.load_tagset(outfile)
+   assert ht2.get_tagset() == tags        # in the same (sorted) order.
+
+def test_tagset_add_after_iterating():
+   import itertools
+
+   kmers = [ 'AAAAA' + ''.join(x) + 'C' for x in
+             itertools.product('ACGT', repeat=6) ]
+
+   ht = khmer.new_hashbits(12, 1, 1)
+   for kmer in kmers:
+      ht.add_tag(kmer)
+   tags = ht.get_tagset()
+
+   # iterate over half, add the rest, and iterate again.
+   ht2 = khmer.new_hashbits(12, 1, 1)
+   for kmer in kmers[::2]:
+      ht2.add_tag(kmer)
+   assert len(ht2.get_tagset()) == len(kmers[::2])
+
+   for kmer in kmers[1::2]:
+      ht2.add_tag(kmer)
+   assert ht2.get_tagset() == tags        # in the same (sorted) order.
 
 def test_stop_traverse():
    filename = utils.get_test_data('random-20-a.fa')
@@ -479,3 +746,78 @@ def test_find_unpart_fail():
    ht.find_unpart(filename2, True, False)
    n, _ = ht.count_partitions()
    assert n == 49, n                    # only 49 sequences worth of tags
+
+def test_hash_family_mix():
+   inpath = utils.get_test_data('random-20-a.fa')
+   savepath = utils.get_temp_filename('tempmixsave0.ht')
+
+   ht = khmer.new_hashbits(20, 1e5, 4, khmer.HASH_FAMILY_MIX)
+   assert ht.hash_family() == khmer.HASH_FAMILY_MIX
+   ht.consume_fasta(inpath)
+
+   record = iter(fasta_iter(open(inpath))).next()
+   seq = record['sequence']
+   for i in range(0, len(seq) + 1 - 20):
+      assert ht.get(seq[i:i + 20])
+
+   # the family is saved with the table...
+   ht.save(savepath)
+
+   ht2 = khmer.load_hashbits(savepath)
+   assert ht2.hash_family() == khmer.HASH_FAMILY_MIX
+   for i in range(0, len(seq) + 1 - 20):
+      assert ht2.get(seq[i:i + 20])
+
+   # ...and so is the default.
+   ht3 = khmer.new_hashbits(20, 1e5, 4)
+   assert ht3.hash_family() == khmer.HASH_FAMILY_MODULO
+   ht3.save(savepath)
+   ht4 = khmer.load_hashbits(savepath)
+   assert ht4.hash_family() == khmer.HASH_FAMILY_MODULO
+
+def _write_v3_hashbits(filename, ksize, tablesizes, kmer_hash):
+   # a version 3 file, as older versions saved them, with one k-mer set.
+   import struct
+
+   fp = open(filename, 'wb')
+   fp.write(struct.pack('=BBIB', 3, 2, ksize, len(tablesizes)))
+   for size in tablesizes:
+      table = bytearray(size / 8 + 1)
+      bin = kmer_hash % size
+      table[bin / 8] |= 1 << (bin % 8)
+      fp.write(struct.pack('=Q', size))
+      fp.write(str(table))
+   fp.close()
+
+def test_load_v3():
+   savepath = utils.get_temp_filename('v3.ht')
+   kmer = 'ATGGCTGACGTTAGCTCGGA'
+   _write_v3_hashbits(savepath, 20, [ 99991, 99989 ], khmer.forward_hash(kmer, 20))
+
+   for mmap in (False, True):
+      ht = khmer.load_hashbits(savepath, mmap)
+      assert ht.ksize() == 20
+      assert ht.get(kmer)
+      assert not ht.get('A' * 20)
+
+def test_save_load_stats():
+   filename = utils.get_test_data('test-reads.fa')
+   savepath = utils.get_temp_filename('stats.ht')
+   
+   ht = khmer.new_hashbits(20, 100000, 3)
+   ht.consume_fasta(filename)
+   assert ht.n_occupied() and ht.n_unique_kmers()
+   ht.save(savepath)
+
+   # no need to recount; the occupancy comes with the table.
+   ht2 = khmer.load_hashbits(savepath)
+   assert ht2.n_occupied() == ht.n_occupied()
+   assert ht2.n_unique_kmers() == ht.n_unique_kmers()
+   assert ht2.false_positive_rate() == ht.false_positive_rate()
+
+def test_hash_family_bad():
+   try:
+      khmer.new_hashbits(20, 1e5, 4, 17)
+      assert 0, "should fail"
+   except ValueError:
+      pass
@@ -0,0 +1,187 @@
+import os
+import gzip
+
+import khmer
+import khmer_tst_utils as utils
+
+def teardown():
+    utils.cleanup()
+
+def _write(filename, data):
+    if filename.endswith('.gz'):
+        fp = gzip.open(filename, 'wb')
+    else:
+        fp = open(filename, 'wb')
+    fp.write(data)
+    fp.close()
+
+def _flatten(batches):
+    records = []
+    for batch in batches:
+        records.extend(batch)
+    return records
+
+def test_read_batches_fasta():
+    filename = utils.get_temp_filename('reads.fa')
+    _write(filename, '>a\nACGT\n>b desc\nGGCC\nTTAA\n>c\nCCCC\n>d\nT\n>e\nAA\n')
+
+    batches = khmer.read_batches(filename, 2)
+    assert [ len(b) for b in batches ] == [2, 2, 1], batches
+
+    records = _flatten(batches)
+    assert records == [(0, 'a', 'ACGT', None),
+                       (1, 'b desc', 'GGCCTTAA', None),
+                       (2, 'c', 'CCCC', None),
+                       (3, 'd', 'T', None),
+                       (4, 'e', 'AA', None)], records
+
+def test_read_batches_fastq():
+    filename = utils.get_temp_filename('reads.fq')
+    _write(filename, '@a\nACGT\n+\nIIII\n@b\nGG\n+b\n@#\n@c\nTTT\n+\n!!!\n')
+
+    records = _flatten(khmer.read_batches(filename, 2))
+    assert records == [(0, 'a', 'ACGT', 'IIII'),
+                       (1, 'b', 'GG', '@#'),
+                       (2, 'c', 'TTT', '!!!')], records
+
+def test_read_batches_skip_n():
+    # records with an N are skipped, and not counted in the index.
+    filename = utils.get_temp_filename('reads.fa')
+    _write(filename, '>a\nACGT\n>b\nANGT\n>c\nCCCC\n')
+
+    records = _flatten(khmer.read_batches(filename, 1))
+    assert records == [(0, 'a', 'ACGT', None),
+                       (1, 'c', 'CCCC', None)], records
+
+def test_read_batches_reuse():
+    # long records, then short ones, in the same reused batch: nothing
+    # from the earlier batches may show through.
+    data = []
+    expected = []
+    for i in range(100):
+        seq = 'ACGT' * (100 - i)
+        qual = chr(ord('!') + i % 40) * len(seq)
+        data.append('@r%d\n%s\n+\n%s\n' % (i, seq, qual))
+        expected.append((i, 'r%d' % i, seq, qual))
+
+    for name in ('reads.fq', 'reads.fq.gz'):
+        filename = utils.get_temp_filename(name)
+        _write(filename, ''.join(data))
+
+        for batch_size in (1, 3, 7, 100, 1000):
+            batches = khmer.read_batches(filename, batch_size)
+            assert max([ len(b) for b in batches ]) == min(batch_size, 100)
+            assert _flatten(batches) == expected, (name, batch_size)
+
+def test_read_batches_many_blocks():
+    # more than one parser buffer's worth of input.
+    seq = 'ACGGTCATTGCA' * 25
+    data = ''.join([ '>read%d\n%s\n' % (i, seq) for i in range(30000) ])
+
+    filename = utils.get_temp_filename('reads.fa.gz')
+    _write(filename, data)
+
+    batches = khmer.read_batches(filename)
+    assert [ len(b) for b in batches[:-1] ] == [1024] * (len(batches) - 1)
+
+    records = _flatten(batches)
+    assert len(records) == 30000, len(records)
+    for i, (index, name, sequence, quality) in enumerate(records):
+        assert index == i
+        assert name == 'read%d' % i
+        assert sequence == seq
+        assert quality is None
+
+def test_read_batches_bad_size():
+    filename = utils.get_temp_filename('reads.fa')
+    _write(filename, '>a\nACGT\n')
+
+    try:
+        khmer.read_batches(filename, 0)
+        assert 0, "should fail"
+    except ValueError:
+        pass
+
+def _strip_index(records):
+    return [ (name, seq, quality) for (index, name, seq, quality) in records ]
+
+FASTA_DATA = ('>a\nACGTACGT\nAC\n>b\nGG\n>c long name\nACGTTGCA\nTTGG\nCC\n'
+              '>d\nA\n>e\nACGGTCATTGCAACGGTCATTGCA\n')
+
+# quality lines starting with '@' and '+', which look like record starts.
+FASTQ_DATA = ('@a\nACGT\n+\n@@@@\n@b\nGGCCA\n+b\n+@+@+\n@c\nAC\n+\n@A\n'
+              '@d\nACGTACGT\n+\nIIIIIIII\n@e\nT\n+\n@\n@f\nAA\n+\n!!\n')
+
+def test_read_batches_mmap_matches_stream():
+    # the mapped parser and the streaming one see the same records, with
+    # or without a final newline, and with DOS line endings.
+    for data, n_records in ((FASTA_DATA, 5), (FASTQ_DATA, 6),
+                            (FASTA_DATA[:-1], 5), (FASTQ_DATA[:-1], 6),
+                            (FASTA_DATA.replace('\n', '\r\n'), 5),
+                            (FASTQ_DATA.replace('\n', '\r\n'), 6)):
+        plain = utils.get_temp_filename('reads.fq')
+        _write(plain, data)
+        compressed = utils.get_temp_filename('reads.fq.gz')
+        _write(compressed, data)
+
+        a = _flatten(khmer.read_batches(plain))
+        b = _flatten(khmer.read_batches(compressed))
+        assert len(a) == n_records, a
+        assert a == b, (data, a, b)
+
+def _check_split(filename):
+    whole = _flatten(khmer.read_batches(filename))
+    size = os.path.getsize(filename)
+
+    # enough different n to cut at every offset in the file.
+    for n in range(1, size + 2):
+        pieces = khmer.read_split(filename, n)
+        assert len(pieces) == n, (n, len(pieces))
+
+        joined = []
+        for piece in pieces:
+            assert [ r[0] for r in piece ] == range(len(piece)), (n, piece)
+            joined.extend(_strip_index(piece))
+
+        assert joined == _strip_index(whole), (n, joined)
+
+def test_read_split_fasta():
+    filename = utils.get_temp_filename('reads.fa')
+    _write(filename, FASTA_DATA)
+    _check_split(filename)
+
+def test_read_split_fastq():
+    filename = utils.get_temp_filename('reads.fq')
+    _write(filename, FASTQ_DATA)
+    _check_split(filename)
+
+    records = _flatten(khmer.read_batches(filename))
+    assert [ r[3] for r in records ] == ['@@@@', '+@+@+', '@A', 'IIIIIIII',
+                                         '@', '!!'], records
+
+def test_read_split_compressed():
+    # can't be split, so there's just the one piece.
+    filename = utils.get_temp_filename('reads.fq.gz')
+    _write(filename, FASTQ_DATA)
+
+    pieces = khmer.read_split(filename, 4)
+    assert len(pieces) == 1
+    assert pieces[0] == _flatten(khmer.read_batches(filename))
+
+def test_consume_fasta_split():
+    # the threaded loader reads a piece per thread.
+    filename = utils.get_temp_filename('reads.fq')
+    _write(filename, FASTQ_DATA * 500)
+
+    kh1 = khmer.new_counting_hash(4, 4**4, 1)
+    n_reads1, n_consumed1 = kh1.consume_fasta(filename)
+
+    kh4 = khmer.new_counting_hash(4, 4**4, 1)
+    n_reads4, n_consumed4 = kh4.consume_fasta(filename, 0, 0, None, False,
+                                              None, 4)
+
+    assert n_reads1 == n_reads4 == 3000, (n_reads1, n_reads4)
+    assert n_consumed1 == n_consumed4, (n_consumed1, n_consumed4)
+    for i in range(4**4):
+        kmer = khmer.reverse_hash(i, 4)
+        assert kh1.get(kmer) == kh4.get(kmer), kmer
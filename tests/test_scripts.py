@@ -1,4 +1,4 @@
-import sys, os, shutil
+import sys, os, shutil, glob
 from cStringIO import StringIO
 import traceback
 
@@ -97,6 +97,19 @@ def test_load_into_counting():
     assert status == 0
     assert os.path.exists(outfile)
 
+def test_load_into_counting_threaded():
+    script = scriptpath('load-into-counting.py')
+    args = ['-x', '1e7', '-N', '2', '-k', '20', '-T', '4']
+    
+    outfile = utils.get_temp_filename('out.kh')
+    infile = utils.get_test_data('test-abund-read-2.fa')
+
+    args.extend([outfile, infile])
+
+    (status, out, err) = runscript(script, args)
+    assert status == 0
+    assert os.path.exists(outfile)
+
 def test_load_into_counting_fail():
     script = scriptpath('load-into-counting.py')
     args = ['-x', '1e2', '-N', '2', '-k', '20'] # use small HT
@@ -217,6 +230,26 @@ def test_normalize_by_median():
     assert len(seqs) == 1, seqs
     assert seqs[0].startswith('GGTTGACGGGGCTCAGGGGG'), seqs
 
+def test_normalize_by_median_blocked():
+    CUTOFF='1'
+
+    infile = utils.get_temp_filename('test.fa')
+    in_dir = os.path.dirname(infile)
+
+    shutil.copyfile(utils.get_test_data('test-abund-read-2.fa'), infile)
+
+    script = scriptpath('normalize-by-median.py')
+    args = ['-C', CUTOFF, '-k', '17', '--blocked', infile]
+    (status, out, err) = runscript(script, args, in_dir)
+    assert status == 0
+
+    outfile = infile + '.keep'
+    assert os.path.exists(outfile), outfile
+
+    seqs = [ r.sequence for r in screed.open(outfile) ]
+    assert len(seqs) == 1, seqs
+    assert seqs[0].startswith('GGTTGACGGGGCTCAGGGGG'), seqs
+
 def test_normalize_by_median_2():
     CUTOFF='2'
 
@@ -339,6 +372,45 @@ def test_load_graph():
     x = ht.subset_count_partitions(subset)
     assert x == (1, 0), x
 
+def test_load_graph_threaded():
+    script = scriptpath('load-graph.py')
+    args = ['-x', '1e7', '-N', '2', '-k', '20', '-T', '4']
+
+    outfile = utils.get_temp_filename('out')
+    infile = utils.get_test_data('random-20-a.fa')
+
+    args.extend([outfile, infile])
+
+    (status, out, err) = runscript(script, args)
+    assert status == 0
+
+    ht = khmer.load_hashbits(outfile + '.ht')
+    ht.load_tagset(outfile + '.tagset')
+
+    subset = ht.do_subset_partition(0, 0)
+    x = ht.subset_count_partitions(subset)
+    assert x == (1, 0), x
+
+def test_load_graph_blocked():
+    script = scriptpath('load-graph.py')
+    args = ['-x', '1e7', '-N', '2', '-k', '20', '--blocked']
+
+    outfile = utils.get_temp_filename('out')
+    infile = utils.get_test_data('random-20-a.fa')
+
+    args.extend([outfile, infile])
+
+    (status, out, err) = runscript(script, args)
+    assert status == 0
+    assert 'classic layout' in out
+
+    ht = khmer.load_hashbits(outfile + '.ht')
+    ht.load_tagset(outfile + '.tagset')
+
+    subset = ht.do_subset_partition(0, 0)
+    x = ht.subset_count_partitions(subset)
+    assert x == (1, 0), x
+
 def test_load_graph_fail():
     script = scriptpath('load-graph.py')
     args = ['-x', '1e3', '-N', '2', '-k', '20'] # use small HT
@@ -489,6 +561,25 @@ def test_partition_graph_1():
     x = ht.count_partitions()
     assert x == (1, 0)          # should be exactly one partition.
 
+def test_partition_graph_no_subsets():
+    graphbase = _make_graph(utils.get_test_data('random-20-a.fa'))
+
+    script = scriptpath('partition-graph.py')
+    args = ['--no-subsets', '-T', '2', graphbase]
+
+    (status, out, err) = runscript(script, args)
+    assert status == 0
+
+    final_pmap_file = graphbase + '.pmap.merged'
+    assert os.path.exists(final_pmap_file)
+    assert not glob.glob(graphbase + '.subset.*.pmap')
+
+    ht = khmer.load_hashbits(graphbase + '.ht')
+    ht.load_partitionmap(final_pmap_file)
+
+    x = ht.count_partitions()
+    assert x == (1, 0)          # should be exactly one partition.
+
 def test_partition_graph_nojoin_k21():
     # test with K=21
     graphbase = _make_graph(utils.get_test_data('random-20-a.fa'), K=21)
@@ -371,3 +371,104 @@ def test_small_real_partitions():
     assert set(parts) != set(['0'])
 
 test_small_real_partitions.runme = True
+
+def test_partition_ids_move_and_join():
+    ht = khmer.new_hashbits(10, 1, 1)
+    ht.set_partition_id('TTAGGACTGC', 2)
+    ht.set_partition_id('TGCGTTTCAA', 2)
+    ht.set_partition_id('ATACTGTAAA', 3)
+    assert ht.count_partitions() == (2, 0)
+    assert ht.get_partition_id('CCCCCCCCCC') == 0
+
+    # moving a tag leaves the rest of its partition behind.
+    ht.set_partition_id('TTAGGACTGC', 3)
+    assert ht.get_partition_id('TTAGGACTGC') == 3
+    assert ht.get_partition_id('TGCGTTTCAA') == 2
+    ht._validate_partitionmap()
+
+    # the bigger partition keeps its ID.
+    ht.join_partitions(2, 3)
+    assert ht.get_partition_id('TGCGTTTCAA') == 3
+    assert ht.get_partition_id('ATACTGTAAA') == 3
+    assert ht.count_partitions() == (1, 0)
+
+    savepath = utils.get_temp_filename('joined.pmap')
+    ht.save_partitionmap(savepath)
+
+    ht2 = khmer.new_hashbits(10, 1, 1)
+    ht2.load_partitionmap(savepath)
+    assert ht2.count_partitions() == (1, 0)
+    p = ht2.get_partition_id('TTAGGACTGC')
+    assert p != 0
+    assert ht2.get_partition_id('TGCGTTTCAA') == p
+
+def test_partition_ids_many_tags():
+    import itertools
+
+    ht = khmer.new_hashbits(10, 1, 1)
+    # no two of these are reverse complements.
+    kmers = [ ''.join(x) for x in itertools.product('ACGT', repeat=5) ]
+    kmers = [ 'AAAA' + k + 'C' for k in kmers ]
+
+    for n, kmer in enumerate(kmers):
+        ht.set_partition_id(kmer, n % 7 + 2)
+    ht._validate_partitionmap()
+
+    for n, kmer in enumerate(kmers):
+        assert ht.get_partition_id(kmer) == n % 7 + 2
+    assert ht.count_partitions() == (7, 0)
+
+def test_partition_ids_all_ones_tag():
+    # forward-strand only, 'G'*32 hashes to all ones; it is a tag like
+    # any other, through moves, rehashing and saving.
+    import itertools
+
+    kmers = [ ''.join(x) for x in itertools.product('ACT', repeat=7) ]
+    kmers = [ 'A' * 25 + k for k in kmers ]
+    ones = 'G' * 32
+
+    khmer.set_unique_rc(False)
+    try:
+        ht = khmer.new_hashbits(32, 1, 1)
+        ht.set_partition_id(ones, 2)
+        ht.set_partition_id(kmers[0], 2)
+        ht.set_partition_id(ones, 3)        # left behind in 2.
+
+        for n, kmer in enumerate(kmers):
+            ht.set_partition_id(kmer, n % 5 + 2)
+        ht._validate_partitionmap()
+        assert ht.get_partition_id(ones) == 3
+
+        savepath = utils.get_temp_filename('ones.pmap')
+        ht.save_partitionmap(savepath)
+
+        ht2 = khmer.new_hashbits(32, 1, 1)
+        ht2.load_partitionmap(savepath)
+        ht2._validate_partitionmap()
+        assert ht2.count_partitions() == ht.count_partitions()
+        assert ht2.get_partition_id(ones) == ht2.get_partition_id(kmers[1])
+    finally:
+        khmer.set_unique_rc(True)
+
+def test_parallel_partition():
+    filename = utils.get_test_data('test-reads.fa')
+
+    def partition(n_threads):
+        ht = khmer.new_hashbits(20, 1e7, 4)
+        ht.consume_fasta_and_tag(filename)
+        if n_threads:
+            ht.parallel_partition(n_threads, True)
+        else:
+            subset = ht.do_subset_partition(0, 0, True)
+            ht.merge_subset(subset)
+
+        savepath = utils.get_temp_filename('%d.pmap' % n_threads)
+        ht.save_partitionmap(savepath)
+        return ht.count_partitions(), open(savepath, 'rb').read()
+
+    counts, pmap = partition(1)
+    assert counts == partition(0)[0], counts
+
+    # the same partitions, and partition IDs, whatever the thread count.
+    for n_threads in (2, 5):
+        assert partition(n_threads) == (counts, pmap), n_threads